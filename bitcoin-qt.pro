@@ -158,6 +158,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/sync.h \
     src/util.h \
     src/hash.h \
+    src/muhash.h \
     src/uint256.h \
     src/serialize.h \
     src/main.h \
@@ -165,6 +166,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/key.h \
     src/db.h \
     src/walletdb.h \
+    src/coinselection.h \
+    src/walletlog.h \
     src/script.h \
     src/init.h \
     src/bloom.h \
@@ -222,6 +225,13 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/macnotificationhandler.h \
     src/qt/splashscreen.h \
     src/mimblewimble.h \
+    src/mimblewimble_crypto.h \
+    src/mimblewimble_coins.h \
+    src/mimblewimble_pool.h \
+    src/mimblewimble_mmr.h \
+    src/mimblewimble_sync.h \
+    src/mimblewimble_verify.h \
+    src/mimblewimble_keychain.h \
     src/mimblewimble_wallet.h \
     src/mimblewimble_init.h \
     src/qt/mimblewimbledialog.h
@@ -244,6 +254,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/sync.cpp \
     src/util.cpp \
     src/hash.cpp \
+    src/muhash.cpp \
     src/netbase.cpp \
     src/key.cpp \
     src/script.cpp \
@@ -255,6 +266,8 @@ SOURCES += src/qt/bitcoin.cpp \
     src/addrman.cpp \
     src/db.cpp \
     src/walletdb.cpp \
+    src/coinselection.cpp \
+    src/walletlog.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
     src/qt/transactionrecord.cpp \
@@ -297,9 +310,15 @@ SOURCES += src/qt/bitcoin.cpp \
     src/txdb.cpp \
     src/qt/splashscreen.cpp \
     src/mimblewimble.cpp \
+    src/mimblewimble_crypto.cpp \
+    src/mimblewimble_coins.cpp \
+    src/mimblewimble_pool.cpp \
+    src/mimblewimble_mmr.cpp \
+    src/mimblewimble_sync.cpp \
+    src/mimblewimble_verify.cpp \
+    src/mimblewimble_keychain.cpp \
     src/mimblewimble_wallet.cpp \
     src/mimblewimble_init.cpp \
-    src/test_mimblewimble.cpp \
     src/rpcmimblewimble.cpp \
     src/qt/mimblewimbledialog.cpp
 
@@ -0,0 +1,41 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BENCH_H
+#define BITCOIN_BENCH_H
+
+#include "util.h"
+
+#include <stdexcept>
+
+/** Benchmarks run by bench_duckbucks.
+ *
+ * A benchmark is a function that times its own work and prints what it
+ * measured. Unlike the unit tests nothing is asserted about the timings;
+ * BENCH_REQUIRE only stops a benchmark whose work went wrong, so its numbers
+ * are not reported as if it had succeeded.
+ */
+typedef void (*BenchFunction)();
+
+class CBenchRegister
+{
+public:
+    CBenchRegister(const char* pszName, BenchFunction func);
+};
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static CBenchRegister bench_register_##name(#name, name); \
+    static void name()
+
+#define BENCH_REQUIRE(expr) \
+    if (!(expr)) \
+        throw std::runtime_error(strprintf("%s:%d: %s", __FILE__, __LINE__, #expr))
+
+/** Per second rate of nCount operations that took nMicros */
+inline double BenchRate(int64 nCount, int64 nMicros)
+{
+    return nCount * 1000000.0 / std::max(nMicros, (int64)1);
+}
+
+#endif
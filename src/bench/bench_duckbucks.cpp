@@ -0,0 +1,100 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+
+#include "db.h"
+#include "txdb.h"
+#include "main.h"
+#include "wallet.h"
+#include "mimblewimble_verify.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+extern void noui_connect();
+
+static map<string, BenchFunction>& Benchmarks()
+{
+    static map<string, BenchFunction> mapBenchmarks;
+    return mapBenchmarks;
+}
+
+CBenchRegister::CBenchRegister(const char* pszName, BenchFunction func)
+{
+    Benchmarks()[pszName] = func;
+}
+
+// usage: bench_duckbucks [pattern]
+// Runs the benchmarks whose names match the wildcard pattern, all by default.
+// Unlike test_duckbucks the database environment is on disk, so the wallet
+// benchmarks include the cost of making writes durable.
+int main(int argc, char* argv[])
+{
+    string strPattern = argc > 1 ? argv[1] : "*";
+
+    fPrintToDebugger = true;
+    noui_connect();
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_duckbucks_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    if (!bitdb.Open(pathTemp))
+    {
+        fprintf(stderr, "bench_duckbucks: cannot open the database environment in %s\n", pathTemp.string().c_str());
+        return 1;
+    }
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+    InitBlockIndex();
+    bool fFirstRun;
+    pwalletMain = new CWallet("wallet.dat");
+    pwalletMain->LoadWallet(fFirstRun);
+    RegisterWallet(pwalletMain);
+    boost::thread_group threadGroup;
+    nScriptCheckThreads = std::max(std::min((int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS), 1);
+    for (int i=0; i < nScriptCheckThreads-1; i++) {
+        threadGroup.create_thread(&ThreadScriptCheck);
+        threadGroup.create_thread(&ThreadMWCheck);
+    }
+
+    int nFailed = 0;
+    BOOST_FOREACH(const PAIRTYPE(string, BenchFunction)& item, Benchmarks())
+    {
+        if (!WildcardMatch(item.first, strPattern))
+            continue;
+        printf("%s\n", item.first.c_str());
+        try {
+            item.second();
+        } catch (std::exception& e) {
+            printf("  FAILED: %s\n", e.what());
+            nFailed++;
+        }
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    UnregisterWallet(pwalletMain);
+    delete pwalletMain;
+    pwalletMain = NULL;
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    bitdb.Flush(true);
+    boost::filesystem::remove_all(pathTemp);
+    return nFailed ? 1 : 0;
+}
+
+void Shutdown(void* parg)
+{
+  exit(0);
+}
+
+void StartShutdown()
+{
+  exit(0);
+}
@@ -0,0 +1,119 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+
+#include "coinselection.h"
+#include "main.h"
+#include "wallet.h"
+
+using namespace std;
+
+// drops the selected outputs from the simulated wallet
+static void SpendSelected(vector<COutput>& vCoins, const set<pair<const CWalletTx*,unsigned int> >& setCoins)
+{
+    for (unsigned int j = 0; j < vCoins.size(); )
+    {
+        if (setCoins.count(make_pair(vCoins[j].tx, (unsigned int)vCoins[j].i)))
+        {
+            delete vCoins[j].tx;
+            vCoins[j] = vCoins.back();
+            vCoins.pop_back();
+        }
+        else
+            j++;
+    }
+}
+
+// Replays the payment trace of coin_selection_simulation in coinselection_tests
+// and reports selection latency, fees and the growth of the UTXO set. The
+// trace comes from the deterministic insecure_rand, so runs can be compared
+// with each other.
+BENCHMARK(coin_selection)
+{
+    CWallet wallet;
+    vector<COutput> vCoins;
+    seed_insecure_rand(true);
+    vector<int64> vTrace;
+    vector<char> vfDeposit;
+    for (int i = 0; i < 1000; i++)
+    {
+        vTrace.push_back((1 + insecure_rand() % 2000) * (COIN / 1000));
+        vfDeposit.push_back(insecure_rand() % 3 == 0);
+    }
+
+    int64 nFeeRate = max(nTransactionFee, CTransaction::nMinTxFee);
+    int64 nCostOfChange = nFeeRate * (COIN_SELECTION_INPUT_SIZE + COIN_SELECTION_OUTPUT_SIZE) / 1000;
+    unsigned int nLockTime = 0;
+
+    for (int i = 0; i < 700; i++)
+    {
+        bool fDeposit = vCoins.size() < 10 || vfDeposit[i];
+        int64 nAmount = vTrace[i];
+        if (!fDeposit)
+        {
+            int64 nTarget = nAmount + CTransaction::nMinTxFee;
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            int64 nValueIn = 0;
+            bool fUsedBnB;
+            if (!wallet.SelectCoinsByTier(nTarget, vCoins, setCoins, nValueIn, &fUsedBnB))
+                continue;
+            SpendSelected(vCoins, setCoins);
+            nAmount = nValueIn - nTarget;
+            if (nAmount == 0 || (fUsedBnB && nAmount <= nCostOfChange))
+                continue;
+        }
+
+        // a deposit, or the change of a payment
+        CTransaction tx;
+        tx.nLockTime = nLockTime++;
+        tx.vout.push_back(CTxOut(nAmount, CScript()));
+        vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6*24));
+    }
+
+    // the rest of the trace is payments only, timed
+    int nPayments = 0, nChangeless = 0, nFailed = 0;
+    int64 nFees = 0, nMicros = 0, nMaxMicros = 0;
+    unsigned int nStartSize = vCoins.size();
+    for (int i = 0; i < 300; i++)
+    {
+        int64 nTarget = vTrace[700 + i] + CTransaction::nMinTxFee;
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        int64 nValueIn = 0;
+        bool fUsedBnB;
+
+        int64 nStart = GetTimeMicros();
+        bool fSelected = wallet.SelectCoinsByTier(nTarget, vCoins, setCoins, nValueIn, &fUsedBnB);
+        int64 nElapsed = GetTimeMicros() - nStart;
+        nMicros += nElapsed;
+        nMaxMicros = max(nMaxMicros, nElapsed);
+        if (!fSelected)
+        {
+            nFailed++;
+            continue;
+        }
+        nPayments++;
+        nFees += CTransaction::nMinTxFee;
+        SpendSelected(vCoins, setCoins);
+
+        int64 nChange = nValueIn - nTarget;
+        if (nChange == 0 || (fUsedBnB && nChange <= nCostOfChange))
+        {
+            nChangeless++;
+            nFees += nChange;
+            continue;
+        }
+        CTransaction tx;
+        tx.nLockTime = nLockTime++;
+        tx.vout.push_back(CTxOut(nChange, CScript()));
+        vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6*24));
+    }
+
+    printf("  %d payments (%d changeless, %d failed), fees %s, %"PRI64d" us average / %"PRI64d" us max, UTXO set %u -> %u\n",
+           nPayments, nChangeless, nFailed, FormatMoney(nFees).c_str(),
+           nPayments + nFailed ? nMicros / (nPayments + nFailed) : 0, nMaxMicros,
+           nStartSize, (unsigned int)vCoins.size());
+
+    BOOST_FOREACH(COutput& output, vCoins)
+        delete output.tx;
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+
+#include "crypter.h"
+
+using namespace std;
+
+// the cost of unlocking with each derivation, at its default strength
+BENCHMARK(crypter_kdf)
+{
+    SecureString strPassphrase("duckbucks");
+    CMasterKey kMasterKey;
+    kMasterKey.vchSalt.assign(WALLET_CRYPTO_SALT_SIZE, 1);
+    CCrypter crypter;
+
+    int64 nStart = GetTimeMicros();
+    BENCH_REQUIRE(crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    int64 nSHA512Micros = GetTimeMicros() - nStart;
+
+    kMasterKey.SetScrypt(WALLET_CRYPTO_SCRYPT_LOGN, WALLET_CRYPTO_SCRYPT_R, WALLET_CRYPTO_SCRYPT_P);
+    nStart = GetTimeMicros();
+    BENCH_REQUIRE(crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    int64 nScryptMicros = GetTimeMicros() - nStart;
+
+    printf("  sha512 x%u %"PRI64d"us, scrypt 2^%u %"PRI64d"us\n",
+           CMasterKey().nDeriveIterations, nSHA512Micros, WALLET_CRYPTO_SCRYPT_LOGN, nScryptMicros);
+}
@@ -0,0 +1,329 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+
+#include "mimblewimble.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_keychain.h"
+#include "mimblewimble_mmr.h"
+#include "mimblewimble_pool.h"
+#include "mimblewimble_sync.h"
+#include "mimblewimble_verify.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace mw;
+
+// a signed transaction spending nValue in two outputs and the fee
+static Transaction MWSignedTx(int64 nValue, int64 nFee)
+{
+    vector<Output> vInputs, vOutputs;
+    BlindingFactor blindIn = BlindingFactor::Random(), excess;
+    vInputs.push_back(createOutput(nValue, blindIn));
+    for (unsigned int i = 0; i < 2; i++) {
+        BlindingFactor blind = BlindingFactor::Random();
+        vOutputs.push_back(createOutput(i ? nValue - nFee - nValue / 3 : nValue / 3, blind));
+        excess += blind;
+    }
+    Transaction tx = Transaction::BuildTransaction(vInputs, vOutputs, nFee, 0);
+    tx.offset = BlindingFactor::Random();
+    excess -= blindIn;
+    excess -= tx.offset;
+    BENCH_REQUIRE(tx.kernels[0].Sign(excess));
+    tx.MarkDirty();
+    return tx;
+}
+
+// an output with a distinct commitment; the coins views and the pool do not
+// look at the proof
+static Output MWTestOutput(unsigned int n)
+{
+    unsigned char p[PEDERSEN_COMMITMENT_SIZE] = {0x02};
+    memcpy(p + 1, &n, sizeof(n));
+    return Output(Commitment(p), RangeProof());
+}
+
+// proofs verified one at a time and in batches of growing size
+BENCHMARK(mw_bulletproof)
+{
+    static const unsigned int nDistinct = 16;
+    vector<vector<unsigned char> > vCommits, vProofs;
+    for (unsigned int i = 0; i < nDistinct; i++)
+    {
+        unsigned char blind[BLINDING_FACTOR_SIZE], commit[PEDERSEN_COMMITMENT_SIZE];
+        RandomBlindingFactor(blind);
+        uint64 nValue = (uint64)i * 100000000 + i;
+        BENCH_REQUIRE(PedersenCommit(commit, nValue, blind));
+        vector<unsigned char> vchProof(BULLETPROOF_SIZE);
+        BENCH_REQUIRE(BulletproofProve(&vchProof[0], nValue, blind));
+        vCommits.push_back(vector<unsigned char>(commit, commit + sizeof(commit)));
+        vProofs.push_back(vchProof);
+    }
+
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < 64; i++)
+        BENCH_REQUIRE(BulletproofVerify(&vCommits[i % nDistinct][0], &vProofs[i % nDistinct][0]));
+    printf("  single: %.0f proofs/s\n", BenchRate(64, GetTimeMicros() - nStart));
+
+    CBulletproofBatch batch;
+    unsigned int vnBatch[] = { 64, 256, 1024 };
+    for (unsigned int n = 0; n < sizeof(vnBatch) / sizeof(vnBatch[0]); n++)
+    {
+        batch.clear();
+        for (unsigned int i = 0; i < vnBatch[n]; i++)
+            batch.Add(&vCommits[i % nDistinct][0], &vProofs[i % nDistinct][0]);
+        nStart = GetTimeMicros();
+        BENCH_REQUIRE(batch.Verify());
+        printf("  batch of %u: %.0f proofs/s\n", vnBatch[n], BenchRate(vnBatch[n], GetTimeMicros() - nStart));
+    }
+}
+
+BENCHMARK(mw_kernel_signature)
+{
+    vector<Kernel> vKernels(200);
+    for (unsigned int i = 0; i < vKernels.size(); i++) {
+        vKernels[i].nFee = i;
+        BENCH_REQUIRE(vKernels[i].Sign(BlindingFactor::Random()));
+    }
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        BENCH_REQUIRE(vKernels[i].Verify());
+    int64 nSingle = GetTimeMicros() - nStart;
+    CSchnorrBatch batch;
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        BENCH_REQUIRE(vKernels[i].Verify(&batch));
+    BENCH_REQUIRE(batch.Verify());
+    int64 nBatch = GetTimeMicros() - nStart;
+    printf("  %.0f/s one by one, %.0f/s batched\n", BenchRate(vKernels.size(), nSingle), BenchRate(vKernels.size(), nBatch));
+}
+
+// a two-output transaction, deserialized, hashed and verified repeatedly
+BENCHMARK(mw_transaction)
+{
+    Transaction tx = MWSignedTx(10 * COIN, COIN / 100);
+    static const unsigned int nTx = 256;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    for (unsigned int i = 0; i < nTx; i++)
+        ss << tx;
+    vector<Transaction> vtx(nTx);
+
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nTx; i++)
+        ss >> vtx[i];
+    printf("  deserialize: %.0f tx/s\n", BenchRate(nTx, GetTimeMicros() - nStart));
+
+    // the first GetHash() serializes, later ones return the cached hash
+    for (int nPass = 0; nPass < 2; nPass++)
+    {
+        nStart = GetTimeMicros();
+        for (unsigned int i = 0; i < nTx; i++)
+            vtx[i].GetHash();
+        printf("  hash (%s): %.0f tx/s\n", nPass ? "cached" : "computed", BenchRate(nTx, GetTimeMicros() - nStart));
+    }
+
+    // all range proofs of the transactions in one batch
+    CBulletproofBatch batch;
+    batch.reserve(nTx * tx.vout.size());
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nTx; i++)
+        BENCH_REQUIRE(vtx[i].Verify(&batch));
+    BENCH_REQUIRE(batch.Verify());
+    printf("  verify: %.0f tx/s\n", BenchRate(nTx, GetTimeMicros() - nStart));
+}
+
+// input checks against a warm cache
+BENCHMARK(mw_coins_lookup)
+{
+    CMWCoinsViewDB db(1 << 20, true);
+    CMWCoinsViewCache cache(db);
+    for (unsigned int i = 0; i < 10000; i++)
+        BENCH_REQUIRE(cache.AddCoin(MWTestOutput(100 + i), 3));
+    int64 nStart = GetTimeMicros();
+    unsigned int nFound = 0;
+    for (unsigned int n = 0; n < 10; n++)
+        for (unsigned int i = 0; i < 10000; i++)
+            nFound += cache.HaveCoin(MWTestOutput(100 + i).commitment);
+    int64 nTime = GetTimeMicros() - nStart;
+    BENCH_REQUIRE(nFound == 100000);
+    printf("  %.0f cached HaveCoin lookups/s\n", BenchRate(100000, nTime));
+}
+
+// a chain of 10000 pool transactions, each spending the change of the one before
+BENCHMARK(mw_pool)
+{
+    const unsigned int nTx = 10000;
+    vector<Transaction> vtx;
+    vtx.reserve(nTx + 1);
+    for (unsigned int i = 0; i <= nTx; i++)
+    {
+        Transaction tx;
+        tx.vin.push_back(Input(MWTestOutput(100 + i).commitment));
+        tx.vout.push_back(MWTestOutput(101 + i));
+        tx.vout.push_back(MWTestOutput(100000 + i));
+        Kernel kernel;
+        kernel.nFee = 1 + i;
+        tx.kernels.push_back(kernel);
+        tx.offset = BlindingFactor::Random();
+        vtx.push_back(tx);
+    }
+
+    CMWTxPool pool;
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nTx; i++)
+        pool.addUnchecked(vtx[i].GetHash(), vtx[i]);
+    int64 nAdd = GetTimeMicros() - nStart;
+    Transaction agg;
+    nStart = GetTimeMicros();
+    pool.GetAggregate(agg);
+    int64 nAggregate = GetTimeMicros() - nStart;
+    BENCH_REQUIRE(agg.kernels.size() == nTx);
+
+    // adding one more only touches that one
+    nStart = GetTimeMicros();
+    pool.addUnchecked(vtx[nTx].GetHash(), vtx[nTx]);
+    int64 nAddOne = GetTimeMicros() - nStart;
+    printf("  add %.1f us/tx, %"PRI64d" us for one more; aggregate of %u txs in %.2f ms\n",
+           (double)nAdd / nTx, nAddOne, nTx, nAggregate / 1000.0);
+}
+
+// kernel appends, a flush per 10000 as if per block
+BENCHMARK(mw_mmr)
+{
+    boost::filesystem::path pathMMR = GetDataDir() / "mmrbench";
+    boost::filesystem::remove_all(pathMMR);
+    {
+        const unsigned int nAppends = 200000;
+        unsigned char kernel[CMWAccumulators::KERNEL_SIZE] = {0};
+        CMMR mmrKernels(pathMMR, sizeof(kernel), false);
+        int64 nStart = GetTimeMicros();
+        for (unsigned int i = 0; i < nAppends; i++) {
+            memcpy(kernel, &i, sizeof(i));
+            mmrKernels.Append(kernel);
+            if (i % 10000 == 9999)
+                BENCH_REQUIRE(mmrKernels.Flush());
+        }
+        printf("  %.0f appends/s\n", BenchRate(nAppends, GetTimeMicros() - nStart));
+    }
+    boost::filesystem::remove_all(pathMMR);
+}
+
+// writing a state archive and loading it into an empty state
+BENCHMARK(mw_state_archive)
+{
+    boost::filesystem::path pathBench = GetDataDir() / "mwstatebench";
+    boost::filesystem::remove_all(pathBench);
+    {
+        // unspent outputs that balance against the kernels: the blinding
+        // factor of the last output makes up the difference
+        CMWAccumulators acc(pathBench / "src");
+        CMWCoinsViewDB db(1 << 20, true);
+        CMWCoinsViewCache view(db);
+        BlindingFactor blindLeft;
+        for (unsigned int i = 0; i < 100; i++) {
+            BlindingFactor blind = BlindingFactor::Random();
+            Kernel kernel;
+            kernel.nFee = i;
+            BENCH_REQUIRE(kernel.Sign(blind));
+            acc.AppendKernel(kernel);
+            blindLeft += blind;
+        }
+        acc.offset = BlindingFactor::Random();
+        blindLeft += acc.offset;
+        const unsigned int nOutputs = 400;
+        for (unsigned int i = 0; i < nOutputs; i++) {
+            BlindingFactor blind = BlindingFactor::Random();
+            if (i == nOutputs - 1)
+                blind = blindLeft;
+            else
+                blindLeft -= blind;
+            Output output = createOutput((i + 1) * COIN, blind);
+            acc.AppendOutput(output);
+            BENCH_REQUIRE(view.AddCoin(output, 5));
+            acc.nSupply += (i + 1) * COIN;
+        }
+        BENCH_REQUIRE(acc.Flush());
+
+        CMWStateHeader header;
+        int64 nStart = GetTimeMicros();
+        BENCH_REQUIRE(WriteMWStateArchive(pathBench / "archive", acc, view, 7, 1234, header, 64, 5));
+        int64 nWrite = GetTimeMicros() - nStart;
+
+        CMWAccumulators accNew(pathBench / "new");
+        CMWCoinsViewDB dbNew(1 << 20, true);
+        CMWCoinsViewCache viewNew(dbNew);
+        nStart = GetTimeMicros();
+        BENCH_REQUIRE(LoadMWStateArchive(pathBench / "archive", header, acc.nSupply, accNew, viewNew));
+        int64 nLoad = GetTimeMicros() - nStart;
+
+        uint64 nBytes = 0;
+        for (unsigned int i = 0; i < header.vChunkHashes.size(); i++)
+            nBytes += boost::filesystem::file_size(pathBench / "archive" / strprintf("chunk%05u.dat", i));
+        printf("  %u kernels and %u outputs: %"PRI64u" bytes, written in %.1f ms, loaded in %.1f ms\n",
+               (unsigned int)header.nKernels, (unsigned int)header.nUnspent, nBytes, nWrite / 1000.0, nLoad / 1000.0);
+    }
+    boost::filesystem::remove_all(pathBench);
+}
+
+// pool transactions, aggregated the way a block carries them
+BENCHMARK(mw_verify_engine)
+{
+    const unsigned int nTx = 48;
+    CMWTxPool pool;
+    mwverifycache.clear();
+    vector<Transaction> vtx;
+    for (unsigned int i = 0; i < nTx; i++)
+        vtx.push_back(MWSignedTx((i + 1) * COIN, 1000 + i));
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nTx; i++)
+        BENCH_REQUIRE(pool.accept(vtx[i], NULL));
+    int64 nAccept = GetTimeMicros() - nStart;
+    Transaction agg;
+    pool.GetAggregate(agg);
+
+    // the pool checked every kernel and output: only the sum is left
+    nStart = GetTimeMicros();
+    BENCH_REQUIRE(VerifyMWTransaction(agg));
+    int64 nCached = GetTimeMicros() - nStart;
+    mwverifycache.clear();
+    nStart = GetTimeMicros();
+    BENCH_REQUIRE(VerifyMWTransaction(agg));
+    int64 nParallel = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    BENCH_REQUIRE(agg.Verify());
+    int64 nSerial = GetTimeMicros() - nStart;
+    printf("  %u transactions accepted in %.1f ms; as a block %.1f ms in one thread, "
+           "%.1f ms on the check queue, %.2f ms with the pool's checks cached\n",
+           nTx, nAccept / 1000.0, nSerial / 1000.0, nParallel / 1000.0, nCached / 1000.0);
+    mwverifycache.clear();
+}
+
+// an output set where every third output is ours, scanned with more threads
+BENCHMARK(mw_keychain_scan)
+{
+    unsigned char seed1[32], seed2[32];
+    memset(seed1, 3, sizeof(seed1));
+    memset(seed2, 4, sizeof(seed2));
+    CMWKeyChain keychain(seed1, sizeof(seed1)), other(seed2, sizeof(seed2));
+
+    CMWCoinsViewDB db(1 << 20, true);
+    const unsigned int nOutputs = 600;
+    {
+        CMWCoinsViewCache cache(db);
+        for (unsigned int i = 0; i < nOutputs; i++)
+            BENCH_REQUIRE(cache.AddCoin((i % 3 == 0 ? keychain : other).CreateOutput((i + 1) * COIN, i), i + 1));
+        cache.SetBestBlock(1);
+        BENCH_REQUIRE(cache.Flush());
+    }
+
+    for (unsigned int nThreads = 1; nThreads <= 4; nThreads *= 2) {
+        vector<CMWWalletOutput> vFound;
+        int64 nStart = GetTimeMicros();
+        BENCH_REQUIRE(ScanMWCoins(db, keychain, nThreads, vFound));
+        int64 nTime = GetTimeMicros() - nStart;
+        BENCH_REQUIRE(vFound.size() == nOutputs / 3);
+        printf("  %u outputs with %u threads in %.2f ms\n", nOutputs, nThreads, nTime / 1000.0);
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+
+#include "base58.h"
+#include "init.h"
+#include "walletdb.h"
+#include "walletlog.h"
+
+using namespace std;
+
+// Makes the writes so far durable: the log-structured backend syncs every
+// commit itself, Berkeley DB writes without syncing and needs its log flushed
+static void MakeDurable(bool fLog)
+{
+    if (!fLog)
+        BENCH_REQUIRE(bitdb.dbenv.log_flush(NULL) == 0);
+}
+
+// The wallet write paths on both backends, on disk and durable in both:
+// keypool refills are single writes, transaction storage is batched in a
+// transaction.
+BENCHMARK(wallet_backend)
+{
+    const char* pszBackends[] = { "bdb", "log" };
+    for (unsigned int n = 0; n < 2; n++)
+    {
+        mapArgs["-walletbackend"] = pszBackends[n];
+        string strFile = strprintf("bench_wallet_%s.dat", pszBackends[n]);
+        {
+            CWalletDB walletdb(strFile, "cr+");
+
+            CPubKey pubkey = pwalletMain->GenerateNewKey();
+            int64 nStart = GetTimeMicros();
+            for (int64 i = 0; i < 200; i++)
+            {
+                BENCH_REQUIRE(walletdb.WritePool(i, CKeyPool(pubkey)));
+                MakeDurable(n == 1);
+            }
+            int64 nPoolMicros = GetTimeMicros() - nStart;
+
+            nStart = GetTimeMicros();
+            BENCH_REQUIRE(walletdb.TxnBegin());
+            for (unsigned int i = 0; i < 1000; i++)
+            {
+                CTransaction tx;
+                tx.nLockTime = i;
+                tx.vout.push_back(CTxOut(i * CENT, CScript() << OP_TRUE));
+                CWalletTx wtx(pwalletMain, tx);
+                BENCH_REQUIRE(walletdb.WriteTx(tx.GetHash(), wtx));
+            }
+            BENCH_REQUIRE(walletdb.TxnCommit());
+            MakeDurable(n == 1);
+            int64 nTxMicros = GetTimeMicros() - nStart;
+
+            BENCH_REQUIRE(CWalletLog::IsLogFile(GetDataDir() / strFile) == (n == 1));
+            printf("  %s: %.0f keypool writes/s, %.0f transactions/s\n", pszBackends[n],
+                   BenchRate(200, nPoolMicros), BenchRate(1000, nTxMicros));
+        }
+        bitdb.RemoveDb(strFile);
+        boost::filesystem::remove(GetDataDir() / strFile);
+    }
+    mapArgs.erase("-walletbackend");
+}
+
+// Loads a wallet of 1000 keys and 2000 transactions with one decode worker
+// and with several
+BENCHMARK(wallet_load)
+{
+    string strFile = "bench_walletload.dat";
+    {
+        CWalletDB walletdb(strFile, "cr+");
+        BENCH_REQUIRE(walletdb.WriteVersion(CLIENT_VERSION));
+        vector<CPubKey> vPubKeys;
+        for (int i = 0; i < 1000; i++)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            vPubKeys.push_back(key.GetPubKey());
+            BENCH_REQUIRE(walletdb.WriteKey(vPubKeys.back(), key.GetPrivKey()));
+            BENCH_REQUIRE(walletdb.WriteName(CBitcoinAddress(vPubKeys.back().GetID()).ToString(), strprintf("key%d", i)));
+        }
+        for (int i = 0; i < 2000; i++)
+        {
+            CTransaction tx;
+            tx.vin.push_back(CTxIn(COutPoint(uint256(i + 1), 0)));
+            tx.vout.push_back(CTxOut(CENT, CScript() << vPubKeys[i % 1000] << OP_CHECKSIG));
+            CWalletTx wtx(NULL, tx);
+            wtx.nOrderPos = i;
+            BENCH_REQUIRE(walletdb.WriteTx(tx.GetHash(), wtx));
+        }
+        BENCH_REQUIRE(walletdb.WriteOrderPosNext(2000));
+    }
+
+    const char* pszThreads[] = { "1", "4" };
+    for (unsigned int n = 0; n < 2; n++)
+    {
+        mapArgs["-walletloadthreads"] = pszThreads[n];
+        CWallet walletLoad(strFile);
+        bool fFirstRun;
+        int64 nStart = GetTimeMicros();
+        BENCH_REQUIRE(walletLoad.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        printf("  %s threads: %"PRI64d"us\n", pszThreads[n], GetTimeMicros() - nStart);
+        BENCH_REQUIRE(walletLoad.mapWallet.size() == 2000);
+    }
+    mapArgs.erase("-walletloadthreads");
+    bitdb.RemoveDb(strFile);
+}
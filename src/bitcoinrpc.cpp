@@ -254,6 +254,9 @@ static const CRPCCommand vRPCCommands[] =
     { "listsinceblock",         &listsinceblock,         false,     false,      true },
     { "dumpprivkey",            &dumpprivkey,            true,      false,      true },
     { "importprivkey",          &importprivkey,          false,     false,      true },
+    { "sethdseed",              &sethdseed,              false,     false,      true },
+    { "getrescaninfo",          &getrescaninfo,          true,      true,       true },
+    { "abortrescan",            &abortrescan,            true,      true,       true },
     { "listunspent",            &listunspent,            false,     false,      true },
     { "getrawtransaction",      &getrawtransaction,      false,     false,      false },
     { "createrawtransaction",   &createrawtransaction,   false,     false,      false },
@@ -262,10 +265,21 @@ static const CRPCCommand vRPCCommands[] =
     { "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
     { "getnormalizedtxid",      &getnormalizedtxid,      true,      true,       false },
     { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "dumptxoutset",           &dumptxoutset,           true,      false,      false },
+    { "loadtxoutset",           &loadtxoutset,           false,     false,      false },
+    { "getaddresshistory",      &getaddresshistory,      true,      false,      false },
+    { "getaddressutxos",        &getaddressutxos,        true,      false,      false },
     { "gettxout",               &gettxout,               true,      false,      false },
     { "lockunspent",            &lockunspent,            false,     false,      true },
     { "listlockunspent",        &listlockunspent,        false,     false,      true },
     { "verifychain",            &verifychain,            true,      false,      false },
+    { "getmwbalance",           &getmwbalance,           false,     false,      true },
+    { "createmwoutput",         &createmwoutput,         false,     false,      true },
+    { "createmwtransaction",    &createmwtransaction,    false,     false,      true },
+    { "scanmwoutputs",          &scanmwoutputs,          false,     true,       true },
+    { "getmwmmrinfo",           &getmwmmrinfo,           true,      false,      false },
+    { "getmwmmrproof",          &getmwmmrproof,          true,      false,      false },
+    { "writemwstate",           &writemwstate,           false,     false,      false },
 };
 
 CRPCTable::CRPCTable()
@@ -1190,13 +1204,21 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "signrawtransaction"     && n > 1) ConvertTo<Array>(params[1], true);
     if (strMethod == "signrawtransaction"     && n > 2) ConvertTo<Array>(params[2], true);
     if (strMethod == "sendrawtransaction"     && n > 1) ConvertTo<bool>(params[1], true);
+    if (strMethod == "gettxoutsetinfo"        && n > 0) ConvertTo<boost::int64_t>(params[0]);
+    if (strMethod == "getaddresshistory"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddresshistory"      && n > 2) ConvertTo<boost::int64_t>(params[2]);
     if (strMethod == "gettxout"               && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "gettxout"               && n > 2) ConvertTo<bool>(params[2]);
     if (strMethod == "lockunspent"            && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "lockunspent"            && n > 1) ConvertTo<Array>(params[1]);
     if (strMethod == "importprivkey"          && n > 2) ConvertTo<bool>(params[2]);
+    if (strMethod == "sethdseed"              && n > 1) ConvertTo<bool>(params[1]);
     if (strMethod == "verifychain"            && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "verifychain"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "createmwoutput"         && n > 0) ConvertTo<double>(params[0]);
+    if (strMethod == "createmwtransaction"    && n > 0) ConvertTo<double>(params[0]);
+    if (strMethod == "scanmwoutputs"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
+    if (strMethod == "getmwmmrproof"          && n > 1) ConvertTo<boost::int64_t>(params[1]);
 
     return params;
 }
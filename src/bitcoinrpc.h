@@ -142,6 +142,9 @@ extern json_spirit::Value addnode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value sethdseed(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrescaninfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value abortrescan(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getgenerate(const json_spirit::Array& params, bool fHelp); // in rpcmining.cpp
 extern json_spirit::Value setgenerate(const json_spirit::Array& params, bool fHelp);
@@ -204,7 +207,19 @@ extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool f
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value dumptxoutset(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value loadtxoutset(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
 
+extern json_spirit::Value getmwbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value createmwoutput(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value createmwtransaction(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value scanmwoutputs(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getmwmmrinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getmwmmrproof(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value writemwstate(const json_spirit::Array& params, bool fHelp);
+
 #endif
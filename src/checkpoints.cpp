@@ -62,6 +62,63 @@ namespace Checkpoints
             return data;
     }
 
+    // UTXO set snapshots that loadtxoutset accepts: height -> (block hash,
+    // digest of the unspent outputs as reported by gettxoutsetinfo's "muhash").
+    // Add an entry with
+    //   (height, std::make_pair(uint256("0x<block hash>"), uint256("0x<muhash>")))
+    // after dumping a snapshot at a checkpointed height and checking it on
+    // independently synced nodes. On testnet, -checkpoints=0 accepts any
+    // snapshot, so loading one can be tried before its entry is added.
+    typedef std::map<int, std::pair<uint256, uint256> > MapSnapshots;
+    static MapSnapshots mapSnapshots;
+    static MapSnapshots mapSnapshotsTestnet;
+
+    bool CheckSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashCoins)
+    {
+        if (fTestNet && !GetBoolArg("-checkpoints", true))
+            return true;
+
+        const MapSnapshots& snapshots = fTestNet ? mapSnapshotsTestnet : mapSnapshots;
+
+        MapSnapshots::const_iterator i = snapshots.find(nHeight);
+        if (i == snapshots.end()) return false;
+        return hashBlock == i->second.first && hashCoins == i->second.second;
+    }
+
+    // Mimblewimble state archives that -mwfastsync accepts: height -> block hash,
+    // kernel and output MMR roots as reported by getmwmmrinfo, and the value held
+    // by the unspent outputs. Add an entry after writing the archive with
+    // writemwstate at a checkpointed height and checking it on independently
+    // synced nodes. On testnet, -checkpoints=0 accepts any state at a block of
+    // the best chain, with the supply its archive claims, so fast sync can be
+    // tried before an entry is added.
+    struct CMWStateCheckpoint {
+        uint256 hashBlock;
+        uint256 hashKernelRoot;
+        uint256 hashOutputRoot;
+        int64 nSupply;
+    };
+    typedef std::map<int, CMWStateCheckpoint> MapMWStates;
+    static MapMWStates mapMWStates;
+    static MapMWStates mapMWStatesTestnet;
+
+    bool CheckMWState(int nHeight, const uint256& hashBlock, const uint256& hashKernelRoot,
+                      const uint256& hashOutputRoot, int64& nSupply)
+    {
+        if (fTestNet && !GetBoolArg("-checkpoints", true))
+            return true;
+
+        const MapMWStates& states = fTestNet ? mapMWStatesTestnet : mapMWStates;
+
+        MapMWStates::const_iterator i = states.find(nHeight);
+        if (i == states.end()) return false;
+        if (hashBlock != i->second.hashBlock || hashKernelRoot != i->second.hashKernelRoot ||
+            hashOutputRoot != i->second.hashOutputRoot)
+            return false;
+        nSupply = i->second.nSupply;
+        return true;
+    }
+
     bool CheckBlock(int nHeight, const uint256& hash)
     {
         if (!GetBoolArg("-checkpoints", true))
@@ -6,7 +6,8 @@
 
 #include <map>
 
-class uint256;
+#include "uint256.h"
+
 class CBlockIndex;
 
 /** Block-chain checkpoints are compiled-in sanity checks.
@@ -24,6 +25,15 @@ namespace Checkpoints
     CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex);
 
     double GuessVerificationProgress(CBlockIndex *pindex);
+
+    // Returns true if the UTXO set snapshot at nHeight is a known, trusted one
+    bool CheckSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashCoins);
+
+    // Returns true if the Mimblewimble state at nHeight is a known, trusted one,
+    // and sets nSupply to the value held by its unspent outputs. On testnet with
+    // -checkpoints=0 every state is accepted and nSupply is left as it is.
+    bool CheckMWState(int nHeight, const uint256& hashBlock, const uint256& hashKernelRoot,
+                      const uint256& hashOutputRoot, int64& nSupply);
 }
 
 #endif
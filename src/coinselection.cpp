@@ -0,0 +1,89 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+
+#include <limits>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+bool SelectCoinsBnB(const vector<CSelectionCandidate>& vCandidates, int64 nTarget, int64 nCostOfChange,
+                    vector<char>& vfSelected, int64& nValueRet, int nMaxTries, int64 nMaxMillis)
+{
+    vfSelected.assign(vCandidates.size(), false);
+    nValueRet = 0;
+    if (nTarget <= 0)
+        return false;
+
+    // value still available at or after the current depth
+    int64 nRemaining = 0;
+    BOOST_FOREACH(const CSelectionCandidate& candidate, vCandidates)
+        nRemaining += candidate.nValue;
+    if (nRemaining < nTarget)
+        return false;
+
+    vector<char> vfCurrent(vCandidates.size(), false);
+    int64 nCurrent = 0;
+    int64 nBestExcess = std::numeric_limits<int64>::max();
+    unsigned int nDepth = 0;
+    int64 nStart = GetTimeMillis();
+
+    for (int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        if ((nTries & 1023) == 1023 && GetTimeMillis() - nStart > nMaxMillis)
+            break;
+
+        bool fBacktrack = false;
+        if (nCurrent + nRemaining < nTarget ||
+            nCurrent > nTarget + nCostOfChange ||
+            nCurrent - nTarget >= nBestExcess)
+        {
+            // cannot reach the target, overshoots the window, or is no better than what we have
+            fBacktrack = true;
+        }
+        else if (nCurrent >= nTarget)
+        {
+            nBestExcess = nCurrent - nTarget;
+            vfSelected = vfCurrent;
+            nValueRet = nCurrent;
+            if (nBestExcess == 0)
+                break;
+            // adding more can only increase the excess
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            // walk back past omitted outputs to the last included one, and omit it instead
+            while (nDepth > 0 && !vfCurrent[nDepth - 1])
+            {
+                nDepth--;
+                nRemaining += vCandidates[nDepth].nValue;
+            }
+            if (nDepth == 0)
+                break; // the whole tree has been searched
+            vfCurrent[nDepth - 1] = false;
+            nCurrent -= vCandidates[nDepth - 1].nValue;
+        }
+        else
+        {
+            const CSelectionCandidate& candidate = vCandidates[nDepth];
+            nRemaining -= candidate.nValue;
+            // including an output equal to an omitted predecessor only repeats subsets already tried
+            if (nDepth > 0 && !vfCurrent[nDepth - 1] &&
+                candidate.nValue == vCandidates[nDepth - 1].nValue)
+                vfCurrent[nDepth] = false;
+            else
+            {
+                vfCurrent[nDepth] = true;
+                nCurrent += candidate.nValue;
+            }
+            nDepth++;
+        }
+    }
+
+    return nBestExcess != std::numeric_limits<int64>::max();
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_COINSELECTION_H
+#define BITCOIN_COINSELECTION_H
+
+#include "util.h"
+
+#include <utility>
+#include <vector>
+
+class CWalletTx;
+
+// approximate serialized sizes used to price inputs and change outputs
+static const unsigned int COIN_SELECTION_INPUT_SIZE = 148;
+static const unsigned int COIN_SELECTION_OUTPUT_SIZE = 34;
+
+// budget for one branch-and-bound search
+static const int BNB_MAX_TRIES = 100000;
+static const int64 BNB_MAX_MILLIS = 250;
+
+/** A spendable output as seen by coin selection */
+class CSelectionCandidate
+{
+public:
+    std::pair<const CWalletTx*, unsigned int> coin;
+    int64 nValue;
+    // nValue minus the fee for spending it as an input
+    int64 nEffectiveValue;
+    // first confirmation tier this output is eligible in (0 = most confirmed)
+    int nTier;
+
+    CSelectionCandidate(const CWalletTx* pcoin, unsigned int n, int64 nValueIn, int64 nInputFee, int nTierIn)
+    {
+        coin = std::make_pair(pcoin, n);
+        nValue = nValueIn;
+        nEffectiveValue = nValueIn - nInputFee;
+        nTier = nTierIn;
+    }
+
+    friend bool operator<(const CSelectionCandidate& a, const CSelectionCandidate& b)
+    {
+        // descending effective value, so the search tries large outputs first
+        return a.nEffectiveValue > b.nEffectiveValue;
+    }
+};
+
+/** Depth-first branch-and-bound search for a changeless selection.
+ *
+ * vCandidates must be sorted (see operator< above). Looks for a subset whose
+ * value lies in [nTarget, nTarget + nCostOfChange], i.e. where creating a
+ * change output would cost more than it is worth, and returns the one with
+ * the smallest excess. Branches that already overshoot the window or cannot
+ * reach the target any more are cut, as are branches that would repeat an
+ * omitted output of equal value. The search stops after nMaxTries steps or
+ * nMaxMillis milliseconds and then returns the best selection found so far.
+ */
+bool SelectCoinsBnB(const std::vector<CSelectionCandidate>& vCandidates, int64 nTarget, int64 nCostOfChange,
+                    std::vector<char>& vfSelected, int64& nValueRet,
+                    int nMaxTries = BNB_MAX_TRIES, int64 nMaxMillis = BNB_MAX_MILLIS);
+
+#endif // BITCOIN_COINSELECTION_H
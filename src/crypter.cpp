@@ -12,15 +12,38 @@
 
 #include "crypter.h"
 
-bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod)
+bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+                                    const std::vector<unsigned char>& vchOtherDerivationParameters)
 {
     if (nRounds < 1 || chSalt.size() != WALLET_CRYPTO_SALT_SIZE)
         return false;
 
     int i = 0;
-    if (nDerivationMethod == 0)
+    if (nDerivationMethod == WALLET_CRYPTO_DERIVE_SHA512)
         i = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), &chSalt[0],
                           (unsigned char *)&strKeyData[0], strKeyData.size(), nRounds, chKey, chIV);
+    else if (nDerivationMethod == WALLET_CRYPTO_DERIVE_SCRYPT)
+    {
+        if (vchOtherDerivationParameters.size() != 3)
+            return false;
+        unsigned int nLogN = vchOtherDerivationParameters[0];
+        uint64_t nR = vchOtherDerivationParameters[1], nP = vchOtherDerivationParameters[2];
+        if (nLogN < 1 || nLogN > WALLET_CRYPTO_SCRYPT_MAX_LOGN || nR < 1 || nP < 1)
+            return false;
+
+        // the key, then the IV, as EVP_BytesToKey lays them out for AES-256-CBC
+        unsigned char buf[WALLET_CRYPTO_KEY_SIZE + AES_BLOCK_SIZE];
+        uint64_t nMaxMem = 128 * nR * (((uint64_t)1 << nLogN) + nP + 2) + (1 << 20);
+        if (EVP_PBE_scrypt(strKeyData.data(), strKeyData.size(), &chSalt[0], chSalt.size(),
+                           (uint64_t)1 << nLogN, nR, nP, nMaxMem, buf, sizeof(buf)) == 1)
+        {
+            memcpy(chKey, buf, WALLET_CRYPTO_KEY_SIZE);
+            memset(chIV, 0, sizeof(chIV));
+            memcpy(chIV, buf + WALLET_CRYPTO_KEY_SIZE, AES_BLOCK_SIZE);
+            i = WALLET_CRYPTO_KEY_SIZE;
+        }
+        OPENSSL_cleanse(buf, sizeof(buf));
+    }
 
     if (i != (int)WALLET_CRYPTO_KEY_SIZE)
     {
@@ -15,6 +15,19 @@
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
 
+enum
+{
+    WALLET_CRYPTO_DERIVE_SHA512 = 0,
+    WALLET_CRYPTO_DERIVE_SCRYPT = 1
+};
+
+// default scrypt cost for new master keys: 2^15 * 128 * 8 bytes = 32 MiB
+const unsigned int WALLET_CRYPTO_SCRYPT_LOGN = 15;
+const unsigned int WALLET_CRYPTO_SCRYPT_R = 8;
+const unsigned int WALLET_CRYPTO_SCRYPT_P = 1;
+// largest log2 N accepted from a wallet file (128 MiB at r = 8 per unit of p)
+const unsigned int WALLET_CRYPTO_SCRYPT_MAX_LOGN = 20;
+
 /*
 Private key encryption is done based on a CMasterKey,
 which holds a salt and random encryption key.
@@ -23,7 +36,9 @@ CMasterKeys are encrypted using AES-256-CBC using a key
 derived using derivation method nDerivationMethod
 (0 == EVP_sha512()) and derivation iterations nDeriveIterations.
 vchOtherDerivationParameters is provided for alternative algorithms
-which may require more parameters (such as scrypt).
+which may require more parameters: for scrypt (1), the memory-hard
+method, they are log2 of the cost N, the block size r and the
+parallelism p, one byte each, and nDeriveIterations is unused.
 
 Wallet Private Keys are then encrypted using AES-256-CBC
 with the double-sha256 of the public key as the IV, and the
@@ -57,9 +72,19 @@ public:
         // 25000 rounds is just under 0.1 seconds on a 1.86 GHz Pentium M
         // ie slightly lower than the lowest hardware we need bother supporting
         nDeriveIterations = 25000;
-        nDerivationMethod = 0;
+        nDerivationMethod = WALLET_CRYPTO_DERIVE_SHA512;
         vchOtherDerivationParameters = std::vector<unsigned char>(0);
     }
+
+    void SetScrypt(unsigned int nLogN, unsigned int nR, unsigned int nP)
+    {
+        nDerivationMethod = WALLET_CRYPTO_DERIVE_SCRYPT;
+        nDeriveIterations = 1;
+        vchOtherDerivationParameters.resize(3);
+        vchOtherDerivationParameters[0] = nLogN;
+        vchOtherDerivationParameters[1] = nR;
+        vchOtherDerivationParameters[2] = nP;
+    }
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
@@ -73,7 +98,12 @@ private:
     bool fKeySet;
 
 public:
-    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod);
+    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+                              const std::vector<unsigned char>& vchOtherDerivationParameters = std::vector<unsigned char>());
+    bool SetKeyFromPassphrase(const SecureString &strKeyData, const CMasterKey& kMasterKey)
+    {
+        return SetKeyFromPassphrase(strKeyData, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod, kMasterKey.vchOtherDerivationParameters);
+    }
     bool Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned char> &vchCiphertext);
     bool Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingMaterial& vchPlaintext);
     bool SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigned char>& chNewIV);
@@ -101,6 +101,19 @@ bool CDBEnv::Open(const boost::filesystem::path& pathIn)
     return true;
 }
 
+bool CDBEnv::UseLog(const std::string& strFile, bool fCreate)
+{
+    if (mapLogDb.count(strFile))
+        return true;
+    map<string, Db*>::iterator mi = mapDb.find(strFile);
+    if (mi != mapDb.end() && (*mi).second != NULL)
+        return false;
+    filesystem::path pathFile = GetDataDir() / strFile;
+    if (filesystem::exists(pathFile))
+        return CWalletLog::IsLogFile(pathFile);
+    return fCreate && GetArg("-walletbackend", "bdb") == "log";
+}
+
 void CDBEnv::MakeMock()
 {
     if (fDbEnvInit)
@@ -207,6 +220,9 @@ bool CDBEnv::Salvage(std::string strFile, bool fAggressive,
 
 void CDBEnv::CheckpointLSN(std::string strFile)
 {
+    // log-structured files are always self-contained
+    if (!fDbEnvInit || CWalletLog::IsLogFile(GetDataDir() / strFile))
+        return;
     dbenv.txn_checkpoint(0, 0, 0);
     if (fMockDb)
         return;
@@ -214,8 +230,7 @@ void CDBEnv::CheckpointLSN(std::string strFile)
 }
 
 
-CDB::CDB(const char *pszFile, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+CDB::CDB(const char *pszFile, const char* pszMode) : pstorage(NULL)
 {
     int ret;
     if (pszFile == NULL)
@@ -229,12 +244,44 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
     {
         LOCK(bitdb.cs_db);
+        if (bitdb.UseLog(pszFile, fCreate))
+        {
+            strFile = pszFile;
+            ++bitdb.mapFileUseCount[strFile];
+            CWalletLog* plog = bitdb.mapLogDb[strFile];
+            if (plog == NULL)
+            {
+                plog = new CWalletLog();
+                if (!plog->Open(GetDataDir() / strFile, fCreate))
+                {
+                    delete plog;
+                    bitdb.mapLogDb.erase(strFile);
+                    --bitdb.mapFileUseCount[strFile];
+                    strFile = "";
+                    throw runtime_error(strprintf("CDB() : can't open wallet log %s", pszFile));
+                }
+                bitdb.mapLogDb[strFile] = plog;
+                pstorage = new CWalletLogStorage(plog);
+
+                if (fCreate && !Exists(string("version")))
+                {
+                    bool fTmp = fReadOnly;
+                    fReadOnly = false;
+                    WriteVersion(CLIENT_VERSION);
+                    fReadOnly = fTmp;
+                }
+            }
+            if (!pstorage)
+                pstorage = new CWalletLogStorage(plog);
+            return;
+        }
+
         if (!bitdb.Open(GetDataDir()))
             throw runtime_error("env open failed");
 
         strFile = pszFile;
         ++bitdb.mapFileUseCount[strFile];
-        pdb = bitdb.mapDb[strFile];
+        Db* pdb = bitdb.mapDb[strFile];
         if (pdb == NULL)
         {
             pdb = new Db(&bitdb.dbenv, 0);
@@ -263,6 +310,7 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
                 strFile = "";
                 throw runtime_error(strprintf("CDB() : can't open database file %s, error %d", pszFile, ret));
             }
+            pstorage = new CBDBStorage(pdb);
 
             if (fCreate && !Exists(string("version")))
             {
@@ -274,32 +322,27 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
             bitdb.mapDb[strFile] = pdb;
         }
+        if (!pstorage)
+            pstorage = new CBDBStorage(pdb);
     }
 }
 
 void CDB::Flush()
 {
-    if (activeTxn)
-        return;
-
-    // Flush database activity from memory pool to disk log
-    unsigned int nMinutes = 0;
-    if (fReadOnly)
-        nMinutes = 1;
-
-    bitdb.dbenv.txn_checkpoint(nMinutes ? GetArg("-dblogsize", 100)*1024 : 0, nMinutes, 0);
+    if (pstorage)
+        pstorage->Flush(fReadOnly);
 }
 
 void CDB::Close()
 {
-    if (!pdb)
+    if (!pstorage)
         return;
-    if (activeTxn)
-        activeTxn->abort();
-    activeTxn = NULL;
-    pdb = NULL;
+    // an uncommitted transaction is aborted
+    pstorage->TxnAbort();
 
     Flush();
+    delete pstorage;
+    pstorage = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -311,6 +354,13 @@ void CDBEnv::CloseDb(const string& strFile)
 {
     {
         LOCK(cs_db);
+        map<string, CWalletLog*>::iterator mi = mapLogDb.find(strFile);
+        if (mi != mapLogDb.end())
+        {
+            delete (*mi).second;
+            mapLogDb.erase(mi);
+            return;
+        }
         if (mapDb[strFile] != NULL)
         {
             // Close the database handle
@@ -322,6 +372,307 @@ void CDBEnv::CloseDb(const string& strFile)
     }
 }
 
+/** Cursor of a CBDBStorage */
+class CBDBCursor : public CDBCursor
+{
+private:
+    Dbc* pdbc;
+
+public:
+    explicit CBDBCursor(Dbc* pdbcIn) : pdbc(pdbcIn) {}
+    ~CBDBCursor() { pdbc->close(); }
+
+    int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+    {
+        // Read at cursor
+        Dbt datKey;
+        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+        {
+            datKey.set_data(&ssKey[0]);
+            datKey.set_size(ssKey.size());
+        }
+        Dbt datValue;
+        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+        {
+            datValue.set_data(&ssValue[0]);
+            datValue.set_size(ssValue.size());
+        }
+        datKey.set_flags(DB_DBT_MALLOC);
+        datValue.set_flags(DB_DBT_MALLOC);
+        int ret = pdbc->get(&datKey, &datValue, fFlags);
+        if (ret != 0)
+            return ret;
+        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+            return 99999;
+
+        // Convert to streams
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write((char*)datKey.get_data(), datKey.get_size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+        // Clear and free memory
+        memset(datKey.get_data(), 0, datKey.get_size());
+        memset(datValue.get_data(), 0, datValue.get_size());
+        free(datKey.get_data());
+        free(datValue.get_data());
+        return 0;
+    }
+};
+
+bool CBDBStorage::Read(CDataStream& ssKey, CDataStream& ssValue)
+{
+    Dbt datKey(&ssKey[0], ssKey.size());
+
+    // Read
+    Dbt datValue;
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+    memset(datKey.get_data(), 0, datKey.get_size());
+    if (datValue.get_data() == NULL)
+        return false;
+
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datValue.get_data());
+    return (ret == 0);
+}
+
+bool CBDBStorage::Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite)
+{
+    Dbt datKey(&ssKey[0], ssKey.size());
+    Dbt datValue(&ssValue[0], ssValue.size());
+
+    // Write
+    int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+
+    // Clear memory in case it was a private key
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    return (ret == 0);
+}
+
+bool CBDBStorage::Erase(CDataStream& ssKey)
+{
+    Dbt datKey(&ssKey[0], ssKey.size());
+
+    // Erase
+    int ret = pdb->del(activeTxn, &datKey, 0);
+
+    // Clear memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    return (ret == 0 || ret == DB_NOTFOUND);
+}
+
+bool CBDBStorage::Exists(CDataStream& ssKey)
+{
+    Dbt datKey(&ssKey[0], ssKey.size());
+
+    // Exists
+    int ret = pdb->exists(activeTxn, &datKey, 0);
+
+    // Clear memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    return (ret == 0);
+}
+
+CDBCursor* CBDBStorage::GetCursor()
+{
+    Dbc* pcursor = NULL;
+    int ret = pdb->cursor(NULL, &pcursor, 0);
+    if (ret != 0)
+        return NULL;
+    return new CBDBCursor(pcursor);
+}
+
+bool CBDBStorage::TxnBegin()
+{
+    if (activeTxn)
+        return false;
+    DbTxn* ptxn = bitdb.TxnBegin();
+    if (!ptxn)
+        return false;
+    activeTxn = ptxn;
+    return true;
+}
+
+bool CBDBStorage::TxnCommit()
+{
+    if (!activeTxn)
+        return false;
+    int ret = activeTxn->commit(0);
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CBDBStorage::TxnAbort()
+{
+    if (!activeTxn)
+        return false;
+    int ret = activeTxn->abort();
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+void CBDBStorage::Flush(bool fReadOnly)
+{
+    if (activeTxn)
+        return;
+
+    // Flush database activity from memory pool to disk log
+    unsigned int nMinutes = 0;
+    if (fReadOnly)
+        nMinutes = 1;
+
+    bitdb.dbenv.txn_checkpoint(nMinutes ? GetArg("-dblogsize", 100)*1024 : 0, nMinutes, 0);
+}
+
+
+/** Cursor of a CWalletLogStorage */
+class CWalletLogCursor : public CDBCursor
+{
+private:
+    CWalletLog* plog;
+    // the last key returned
+    vector<unsigned char> vchKey;
+    bool fStarted;
+
+public:
+    explicit CWalletLogCursor(CWalletLog* plogIn) : plog(plogIn), fStarted(false) {}
+
+    int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+    {
+        bool fInclusive;
+        if (fFlags == DB_SET_RANGE)
+        {
+            vchKey.assign(ssKey.begin(), ssKey.end());
+            fInclusive = true;
+        }
+        else if (fFlags == DB_NEXT)
+            fInclusive = !fStarted;
+        else
+            return WALLETLOG_CURSOR_UNSUPPORTED;
+
+        vector<unsigned char> vchNext;
+        CSerializeData vchValue;
+        if (!plog->Seek(vchKey, fInclusive, vchNext, vchValue))
+            return DB_NOTFOUND;
+        vchKey = vchNext;
+        fStarted = true;
+
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write((char*)&vchKey[0], vchKey.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write(vchValue.empty() ? NULL : &vchValue[0], vchValue.size());
+        return 0;
+    }
+};
+
+bool CWalletLogStorage::Read(CDataStream& ssKey, CDataStream& ssValue)
+{
+    vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    CSerializeData vchValue;
+    if (pbatchTxn)
+    {
+        // see our own uncommitted changes, as a Berkeley DB transaction would
+        int nOp = pbatchTxn->Find(vchKey, vchValue);
+        if (nOp == CWalletLogBatch::OP_ERASE)
+            return false;
+        if (nOp == CWalletLogBatch::OP_WRITE)
+        {
+            ssValue.write(vchValue.empty() ? NULL : &vchValue[0], vchValue.size());
+            return true;
+        }
+    }
+    if (!plog->Read(vchKey, vchValue))
+        return false;
+    ssValue.write(vchValue.empty() ? NULL : &vchValue[0], vchValue.size());
+    return true;
+}
+
+bool CWalletLogStorage::Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && Exists(ssKey))
+        return false;
+    CWalletLogBatch batch;
+    CWalletLogBatch& target = pbatchTxn ? *pbatchTxn : batch;
+    target.Write(&ssKey[0], &ssKey[0] + ssKey.size(), &ssValue[0], &ssValue[0] + ssValue.size());
+    if (pbatchTxn)
+        return true;
+    return plog->Commit(batch, true);
+}
+
+bool CWalletLogStorage::Erase(CDataStream& ssKey)
+{
+    // like DB_NOTFOUND, erasing a missing key is not an error
+    CWalletLogBatch batch;
+    CWalletLogBatch& target = pbatchTxn ? *pbatchTxn : batch;
+    target.Erase(&ssKey[0], &ssKey[0] + ssKey.size());
+    if (pbatchTxn)
+        return true;
+    return plog->Commit(batch, true);
+}
+
+bool CWalletLogStorage::Exists(CDataStream& ssKey)
+{
+    vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    if (pbatchTxn)
+    {
+        CSerializeData vchValue;
+        int nOp = pbatchTxn->Find(vchKey, vchValue);
+        if (nOp != 0)
+            return nOp == CWalletLogBatch::OP_WRITE;
+    }
+    return plog->Exists(vchKey);
+}
+
+CDBCursor* CWalletLogStorage::GetCursor()
+{
+    // Cursors walk the committed records only; every caller reads outside of
+    // a transaction.
+    return new CWalletLogCursor(plog);
+}
+
+bool CWalletLogStorage::TxnBegin()
+{
+    if (pbatchTxn)
+        return false;
+    pbatchTxn = new CWalletLogBatch();
+    return true;
+}
+
+bool CWalletLogStorage::TxnCommit()
+{
+    if (!pbatchTxn)
+        return false;
+    bool fCommitted = plog->Commit(*pbatchTxn, true);
+    delete pbatchTxn;
+    pbatchTxn = NULL;
+    return fCommitted;
+}
+
+bool CWalletLogStorage::TxnAbort()
+{
+    if (!pbatchTxn)
+        return false;
+    delete pbatchTxn;
+    pbatchTxn = NULL;
+    return true;
+}
+
+void CWalletLogStorage::Flush(bool fReadOnly)
+{
+    if (pbatchTxn)
+        return;
+    plog->Sync();
+}
+
 bool CDBEnv::RemoveDb(const string& strFile)
 {
     this->CloseDb(strFile);
@@ -344,6 +695,9 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                 bitdb.CheckpointLSN(strFile);
                 bitdb.mapFileUseCount.erase(strFile);
 
+                if (bitdb.UseLog(strFile, false))
+                    return RewriteLog(strFile, pszSkip);
+
                 bool fSuccess = true;
                 printf("Rewriting %s...\n", strFile.c_str());
                 string strFileRes = strFile + ".rewrite";
@@ -363,7 +717,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
@@ -372,12 +726,12 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                             int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND)
                             {
-                                pcursor->close();
+                                delete pcursor;
                                 break;
                             }
                             else if (ret != 0)
                             {
-                                pcursor->close();
+                                delete pcursor;
                                 fSuccess = false;
                                 break;
                             }
@@ -424,6 +778,197 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::RewriteLog(const string& strFile, const char* pszSkip)
+{
+    // A log rewrite is a compaction; skipped records are erased first.
+    printf("Rewriting %s...\n", strFile.c_str());
+    CDB db(strFile.c_str(), "r+");
+    CWalletLogBatch batch;
+    CDBCursor* pcursor = db.GetCursor();
+    if (!pcursor)
+        return false;
+    while (true)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+        if (ret == DB_NOTFOUND)
+            break;
+        if (ret != 0)
+        {
+            delete pcursor;
+            return error("CDB::RewriteLog() : error scanning %s", strFile.c_str());
+        }
+        if (pszSkip &&
+            strncmp(&ssKey[0], pszSkip, std::min(ssKey.size(), strlen(pszSkip))) == 0)
+            batch.Erase(&ssKey[0], &ssKey[0] + ssKey.size());
+    }
+    delete pcursor;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << string("version");
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << CLIENT_VERSION;
+    batch.Write(&ssKey[0], &ssKey[0] + ssKey.size(), &ssValue[0], &ssValue[0] + ssValue.size());
+
+    CWalletLog* plog = bitdb.mapLogDb[strFile];
+    bool fSuccess = plog->Commit(batch, true) && plog->Compact();
+    if (!fSuccess)
+        printf("Rewriting of %s FAILED!\n", strFile.c_str());
+    return fSuccess;
+}
+
+// A mock environment (unit tests) keeps Berkeley DB files in memory, as
+// databases named after the file
+static bool MockDbExists(const string& strFile)
+{
+    Db db(&bitdb.dbenv, 0);
+    db.get_mpf()->set_flags(DB_MPOOL_NOFILE, 1);
+    int ret = db.open(NULL, NULL, strFile.c_str(), DB_BTREE, DB_RDONLY, 0);
+    db.close(0);
+    return ret == 0;
+}
+
+bool CDB::ConvertBackend(const string& strFile, bool fToLog)
+{
+    while (true)
+    {
+        {
+            LOCK(bitdb.cs_db);
+            if (!bitdb.mapFileUseCount.count(strFile) || bitdb.mapFileUseCount[strFile] == 0)
+            {
+                bitdb.CloseDb(strFile);
+                bitdb.CheckpointLSN(strFile);
+                bitdb.mapFileUseCount.erase(strFile);
+
+                filesystem::path pathFile = GetDataDir() / strFile;
+                bool fIsLog = CWalletLog::IsLogFile(pathFile);
+                bool fMock = bitdb.IsMock();
+                bool fExists = fIsLog || (fMock ? MockDbExists(strFile) : filesystem::exists(pathFile));
+                if (!fExists || fIsLog == fToLog)
+                    return true;
+
+                printf("Converting %s to %s...\n", strFile.c_str(), fToLog ? "log" : "bdb");
+                int64 nStart = GetTimeMillis();
+
+                // read everything through the current backend
+                vector<pair<CSerializeData, CSerializeData> > vRecords;
+                {
+                    CDB db(strFile.c_str(), "r");
+                    CDBCursor* pcursor = db.GetCursor();
+                    if (!pcursor)
+                        return error("CDB::ConvertBackend() : cannot read %s", strFile.c_str());
+                    while (true)
+                    {
+                        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                        int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+                        if (ret == DB_NOTFOUND)
+                            break;
+                        if (ret != 0)
+                        {
+                            delete pcursor;
+                            return error("CDB::ConvertBackend() : error scanning %s", strFile.c_str());
+                        }
+                        vRecords.push_back(make_pair(CSerializeData(ssKey.begin(), ssKey.end()),
+                                                     CSerializeData(ssValue.begin(), ssValue.end())));
+                    }
+                    delete pcursor;
+                }
+                bitdb.CloseDb(strFile);
+                bitdb.CheckpointLSN(strFile);
+                bitdb.mapFileUseCount.erase(strFile);
+
+                // keep the original until the new file is complete
+                string strBackup = strprintf("%s.%"PRI64d".bak", strFile.c_str(), GetTime());
+                filesystem::path pathBackup = GetDataDir() / strBackup;
+                if (fMock && !fIsLog) {
+                    if (bitdb.dbenv.dbrename(NULL, NULL, strFile.c_str(), strBackup.c_str(), DB_AUTO_COMMIT) != 0)
+                        return error("CDB::ConvertBackend() : cannot move %s aside", strFile.c_str());
+                } else {
+                    try {
+                        filesystem::rename(pathFile, pathBackup);
+                    } catch(const filesystem::filesystem_error &e) {
+                        return error("CDB::ConvertBackend() : cannot move %s aside: %s", strFile.c_str(), e.what());
+                    }
+                }
+
+                bool fSuccess = true;
+                if (fToLog)
+                {
+                    CWalletLog log;
+                    fSuccess = log.Open(pathFile, true);
+                    for (unsigned int i = 0; fSuccess && i < vRecords.size(); i += WALLETLOG_COMPACT_FRAME)
+                    {
+                        CWalletLogBatch batch;
+                        for (unsigned int j = i; j < vRecords.size() && j < i + WALLETLOG_COMPACT_FRAME; j++)
+                        {
+                            const CSerializeData& vchKey = vRecords[j].first;
+                            const CSerializeData& vchValue = vRecords[j].second;
+                            batch.Write(&vchKey[0], &vchKey[0] + vchKey.size(),
+                                        vchValue.empty() ? NULL : &vchValue[0], vchValue.empty() ? NULL : &vchValue[0] + vchValue.size());
+                        }
+                        fSuccess = log.Commit(batch, false);
+                    }
+                    fSuccess = fSuccess && log.Sync();
+                    log.Close();
+                }
+                else
+                {
+                    fSuccess = bitdb.Open(GetDataDir());
+                    Db* pdbNew = fSuccess ? new Db(&bitdb.dbenv, 0) : NULL;
+                    if (pdbNew)
+                    {
+                        if (fMock)
+                            pdbNew->get_mpf()->set_flags(DB_MPOOL_NOFILE, 1);
+                        int ret = pdbNew->open(NULL,                             // Txn pointer
+                                               fMock ? NULL : strFile.c_str(),   // Filename
+                                               fMock ? strFile.c_str() : "main", // Logical db name
+                                               DB_BTREE,                         // Database type
+                                               DB_CREATE,                        // Flags
+                                               0);
+                        fSuccess = (ret == 0);
+                        for (unsigned int i = 0; fSuccess && i < vRecords.size(); i++)
+                        {
+                            Dbt datKey(&vRecords[i].first[0], vRecords[i].first.size());
+                            Dbt datValue(vRecords[i].second.empty() ? NULL : &vRecords[i].second[0], vRecords[i].second.size());
+                            if (pdbNew->put(NULL, &datKey, &datValue, DB_NOOVERWRITE) != 0)
+                                fSuccess = false;
+                        }
+                        if (pdbNew->close(0))
+                            fSuccess = false;
+                        delete pdbNew;
+                        if (fSuccess)
+                            bitdb.CheckpointLSN(strFile);
+                    }
+                }
+
+                if (!fSuccess)
+                {
+                    printf("Converting %s FAILED, restoring %s\n", strFile.c_str(), pathBackup.string().c_str());
+                    if (fMock && fIsLog)
+                        bitdb.dbenv.dbremove(NULL, NULL, strFile.c_str(), DB_AUTO_COMMIT);
+                    try {
+                        filesystem::remove(pathFile);
+                        if (!fMock || fIsLog)
+                            filesystem::rename(pathBackup, pathFile);
+                    } catch(const filesystem::filesystem_error &e) {
+                        printf("error restoring %s: %s\n", strFile.c_str(), e.what());
+                    }
+                    if (fMock && !fIsLog)
+                        bitdb.dbenv.dbrename(NULL, NULL, strBackup.c_str(), strFile.c_str(), DB_AUTO_COMMIT);
+                    return false;
+                }
+                printf("Converted %s (%"PRIszu" records) in %"PRI64d"ms, original kept as %s\n", strFile.c_str(),
+                       vRecords.size(), GetTimeMillis() - nStart, pathBackup.string().c_str());
+                return true;
+            }
+        }
+        MilliSleep(100);
+    }
+    return false;
+}
+
 
 void CDBEnv::Flush(bool fShutdown)
 {
@@ -431,6 +976,22 @@ void CDBEnv::Flush(bool fShutdown)
     // Flush log data to the actual data file
     //  on all files that are not in use
     printf("Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
+    {
+        // log-structured files need no environment; drop the ones not in use
+        LOCK(cs_db);
+        map<string, CWalletLog*>::iterator mi = mapLogDb.begin();
+        while (mi != mapLogDb.end())
+        {
+            string strFile = (*mi).first;
+            mi++;
+            if (mapFileUseCount[strFile] == 0)
+            {
+                CloseDb(strFile);
+                mapFileUseCount.erase(strFile);
+                printf("%s closed\n", strFile.c_str());
+            }
+        }
+    }
     if (!fDbEnvInit)
         return;
     {
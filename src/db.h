@@ -6,6 +6,7 @@
 #define BITCOIN_DB_H
 
 #include "main.h"
+#include "walletlog.h"
 
 #include <map>
 #include <string>
@@ -42,6 +43,8 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    // files using the log-structured backend instead (see walletlog.h)
+    std::map<std::string, CWalletLog*> mapLogDb;
 
     CDBEnv();
     ~CDBEnv();
@@ -67,6 +70,8 @@ public:
     bool Salvage(std::string strFile, bool fAggressive, std::vector<KeyValPair>& vResult);
 
     bool Open(const boost::filesystem::path &path);
+    // whether strFile is a log-structured file, or will be created as one
+    bool UseLog(const std::string& strFile, bool fCreate);
     void Close();
     void Flush(bool fShutdown);
     void CheckpointLSN(std::string strFile);
@@ -87,13 +92,99 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+// CDBCursor::Read() result for a cursor operation the log-structured backend
+// does not implement; apart from Berkeley DB's own error codes
+static const int WALLETLOG_CURSOR_UNSUPPORTED = 99999;
+
+/** Cursor over the records of a CDBStorage, in key order */
+class CDBCursor
+{
+public:
+    virtual ~CDBCursor() {}
+
+    // Like Dbc::get(): fFlags is DB_NEXT or DB_SET_RANGE (with the key in
+    // ssKey); returns 0, DB_NOTFOUND or an error
+    virtual int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags) = 0;
+};
+
+/** The storage calls of a CDB on one open file, with keys and values
+ * already serialized. A transaction belongs to the instance. The key and
+ * value streams passed in may be wiped. */
+class CDBStorage
+{
+public:
+    virtual ~CDBStorage() {}
+
+    virtual bool Read(CDataStream& ssKey, CDataStream& ssValue) = 0;
+    virtual bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite) = 0;
+    virtual bool Erase(CDataStream& ssKey) = 0;
+    virtual bool Exists(CDataStream& ssKey) = 0;
+    // NULL on failure; the caller deletes the cursor
+    virtual CDBCursor* GetCursor() = 0;
+
+    virtual bool TxnBegin() = 0;
+    virtual bool TxnCommit() = 0;
+    virtual bool TxnAbort() = 0;
+    // push written data towards the disk; does nothing inside a transaction
+    virtual void Flush(bool fReadOnly) = 0;
+};
+
+/** CDBStorage on a Berkeley DB handle shared through bitdb.mapDb */
+class CBDBStorage : public CDBStorage
+{
+private:
+    Db* pdb;
+    DbTxn* activeTxn;
+
+public:
+    explicit CBDBStorage(Db* pdbIn) : pdb(pdbIn), activeTxn(NULL) {}
+    ~CBDBStorage() { TxnAbort(); }
+
+    bool Read(CDataStream& ssKey, CDataStream& ssValue);
+    bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite);
+    bool Erase(CDataStream& ssKey);
+    bool Exists(CDataStream& ssKey);
+    CDBCursor* GetCursor();
+
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+    void Flush(bool fReadOnly);
+};
+
+/** CDBStorage on a log-structured wallet file shared through bitdb.mapLogDb.
+ * A transaction queues its changes in a batch that is committed as one
+ * frame; reads inside it see them, cursors only see committed records. */
+class CWalletLogStorage : public CDBStorage
+{
+private:
+    CWalletLog* plog;
+    CWalletLogBatch* pbatchTxn;
+
+public:
+    explicit CWalletLogStorage(CWalletLog* plogIn) : plog(plogIn), pbatchTxn(NULL) {}
+    ~CWalletLogStorage() { delete pbatchTxn; }
+
+    bool Read(CDataStream& ssKey, CDataStream& ssValue);
+    bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite);
+    bool Erase(CDataStream& ssKey);
+    bool Exists(CDataStream& ssKey);
+    CDBCursor* GetCursor();
+
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+    void Flush(bool fReadOnly);
+};
+
+
+/** RAII class that provides access to a Berkeley database, or to a
+ * log-structured wallet file (see CWalletLog) */
 class CDB
 {
 protected:
-    Db* pdb;
+    CDBStorage* pstorage;
     std::string strFile;
-    DbTxn *activeTxn;
     bool fReadOnly;
 
     explicit CDB(const char* pszFile, const char* pszMode="r+");
@@ -105,46 +196,39 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    bool static RewriteLog(const std::string& strFile, const char* pszSkip);
+
 protected:
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pstorage)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
-        Dbt datValue;
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
-        memset(datKey.get_data(), 0, datKey.get_size());
-        if (datValue.get_data() == NULL)
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!pstorage->Read(ssKey, ssValue))
             return false;
 
         // Unserialize value
         try {
-            CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         }
         catch (std::exception &e) {
             return false;
         }
-
-        // Clear and free memory
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datValue.get_data());
-        return (ret == 0);
+        return true;
     }
 
     template<typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite=true)
     {
-        if (!pdb)
+        if (!pstorage)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -153,27 +237,20 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
-        Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
-
-        // Clear memory in case it was a private key
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        return (ret == 0);
+        return pstorage->Write(ssKey, ssValue, fOverwrite);
     }
 
     template<typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pstorage)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -182,114 +259,58 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        return (ret == 0 || ret == DB_NOTFOUND);
+        return pstorage->Erase(ssKey);
     }
 
     template<typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pstorage)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
-        int ret = pdb->exists(activeTxn, &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        return (ret == 0);
+        return pstorage->Exists(ssKey);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
-        if (!pdb)
-            return NULL;
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
-        if (ret != 0)
+        if (!pstorage)
             return NULL;
-        return pcursor;
+        return pstorage->GetCursor();
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
     {
-        // Read at cursor
-        Dbt datKey;
-        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datKey.set_data(&ssKey[0]);
-            datKey.set_size(ssKey.size());
-        }
-        Dbt datValue;
-        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datValue.set_data(&ssValue[0]);
-            datValue.set_size(ssValue.size());
-        }
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
+        return pcursor->Read(ssKey, ssValue, fFlags);
     }
 
 public:
     bool TxnBegin()
     {
-        if (!pdb || activeTxn)
+        if (!pstorage)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
-        if (!ptxn)
-            return false;
-        activeTxn = ptxn;
-        return true;
+        return pstorage->TxnBegin();
     }
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pstorage)
             return false;
-        int ret = activeTxn->commit(0);
-        activeTxn = NULL;
-        return (ret == 0);
+        return pstorage->TxnCommit();
     }
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pstorage)
             return false;
-        int ret = activeTxn->abort();
-        activeTxn = NULL;
-        return (ret == 0);
+        return pstorage->TxnAbort();
     }
 
     bool ReadVersion(int& nVersion)
@@ -304,6 +325,9 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    // move strFile to the log-structured backend or back to Berkeley DB,
+    // keeping the original as <strFile>.<timestamp>.bak
+    bool static ConvertBackend(const std::string& strFile, bool fToLog);
 };
 
 
@@ -1,5 +1,8 @@
 #include "hash.h"
 
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
 inline uint32_t ROTL32 ( uint32_t x, int8_t r )
 {
     return (x << r) | (x >> (32 - r));
@@ -56,3 +59,17 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
     return h1;
 }
+
+void BIP32Hash(const unsigned char chainCode[32], unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
+{
+    unsigned char msg[37];
+    msg[0] = header;
+    memcpy(msg + 1, data, 32);
+    msg[33] = (nChild >> 24) & 0xFF;
+    msg[34] = (nChild >> 16) & 0xFF;
+    msg[35] = (nChild >>  8) & 0xFF;
+    msg[36] = (nChild >>  0) & 0xFF;
+    unsigned int nLen = 64;
+    HMAC(EVP_sha512(), chainCode, 32, msg, sizeof(msg), output, &nLen);
+    OPENSSL_cleanse(msg, sizeof(msg));
+}
@@ -123,4 +123,7 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+// HMAC-SHA512 of header || data[0..32) || ser32(nChild) keyed by chainCode, as used by BIP32 derivation
+void BIP32Hash(const unsigned char chainCode[32], unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
+
 #endif
@@ -10,6 +10,8 @@
 #include "init.h"
 #include "util.h"
 #include "ui_interface.h"
+#include "mimblewimble_verify.h"
+#include "mimblewimble_init.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -85,8 +87,6 @@ bool ShutdownRequested()
     return fRequestShutdown;
 }
 
-static CCoinsViewDB *pcoinsdbview;
-
 void Shutdown()
 {
     printf("Shutdown : In progress...\n");
@@ -110,8 +110,12 @@ void Shutdown()
             pblocktree->Flush();
         if (pcoinsTip)
             pcoinsTip->Flush();
+        if (paddressindex)
+            paddressindex->Flush();
+        ShutdownMimblewimbleProtocol();
         delete pcoinsTip; pcoinsTip = NULL;
         delete pcoinsdbview; pcoinsdbview = NULL;
+        delete paddressindex; paddressindex = NULL;
         delete pblocktree; pblocktree = NULL;
     }
     if (pwalletMain)
@@ -362,15 +366,24 @@ std::string HelpMessage()
         "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n" +
         "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n" +
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
+        "  -usehd                 " + _("Derive the keys of a new wallet from a single seed (BIP32), looking ahead -keypool keys (default: 1)") + "\n" +
+        "  -hdseed=<key>          " + _("Derive the keys of a new wallet from this seed, as returned by dumpprivkey of a wallet's hdseedid, and rescan") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
+        "  -walletbackend=<type>  " + _("Store the wallet in Berkeley DB (bdb) or an append-only log (log); an existing wallet.dat is converted (default: bdb for new wallets)") + "\n" +
+        "  -walletloadthreads=<n> " + strprintf(_("Number of threads decoding the wallet at startup (up to %d, 0 = one per core, default: 0)"), MAX_WALLETLOAD_THREADS) + "\n" +
+        "  -walletkdf=<kdf>       " + _("Derive the key of a newly encrypted wallet, or of a changed passphrase, with scrypt or sha512 (default: scrypt)") + "\n" +
+        "  -walletscryptcost=<n>  " + _("Use N=2^<n> as the scrypt cost, needing 2^<n> KiB of memory (10-20, default: 15)") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 288, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-4, default: 3)") + "\n" +
         "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n" +
+        "  -addressindex          " + _("Maintain an index of outputs and spends by script, for getaddresshistory and getaddressutxos (default: 0)") + "\n" +
+        "  -prune=<n>             " + _("Reduce storage by deleting old blocks, keeping block and undo files below <n> MiB (default: 0 = disabled, minimum: 550)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n" +
         "  -maxorphantx=<n>       " + _("Keep at most <n> unconnectable transactions in memory (default: 25)") + "\n" +
         "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n" +
         "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -mwfastsync            " + _("Without Mimblewimble state, fetch the kernels and unspent outputs from a peer instead of the history (default: 0)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -557,6 +570,23 @@ bool AppInit2(boost::thread_group& threadGroup)
     fDebug = GetBoolArg("-debug");
     fBenchmark = GetBoolArg("-benchmark");
 
+    // -prune=<n> is given in MiB
+    int64 nPruneArg = GetArg("-prune", 0);
+    if (nPruneArg < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64)nPruneArg * 1024 * 1024;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %"PRI64u" MiB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        fPruneMode = true;
+        // a pruned node cannot serve the whole block chain
+        nLocalServices &= ~NODE_NETWORK;
+        nLocalServices |= NODE_NETWORK_LIMITED;
+        printf("Prune mode enabled, keeping block files below %"PRI64u" MiB\n", nPruneTarget / 1024 / 1024);
+    }
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", 0);
     if (nScriptCheckThreads <= 0)
@@ -665,9 +695,11 @@ bool AppInit2(boost::thread_group& threadGroup)
         fprintf(stdout, "Duckbucks server starting\n");
 
     if (nScriptCheckThreads) {
-        printf("Using %u threads for script verification\n", nScriptCheckThreads);
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        printf("Using %u threads for script and Mimblewimble verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadMWCheck);
+        }
     }
 
     int64 nStart;
@@ -701,14 +733,17 @@ bool AppInit2(boost::thread_group& threadGroup)
             }
         }
 
-        if (GetBoolArg("-salvagewallet"))
+        // a wallet log repairs itself when it is replayed; there is nothing to salvage
+        bool fWalletLog = CWalletLog::IsLogFile(GetDataDir() / "wallet.dat");
+
+        if (GetBoolArg("-salvagewallet") && !fWalletLog)
         {
             // Recover readable keypairs:
             if (!CWalletDB::Recover(bitdb, "wallet.dat", true))
                 return false;
         }
 
-        if (filesystem::exists(GetDataDir() / "wallet.dat"))
+        if (filesystem::exists(GetDataDir() / "wallet.dat") && !fWalletLog)
         {
             CDBEnv::VerifyResult r = bitdb.Verify("wallet.dat", CWalletDB::Recover);
             if (r == CDBEnv::RECOVER_OK)
@@ -722,6 +757,24 @@ bool AppInit2(boost::thread_group& threadGroup)
             if (r == CDBEnv::RECOVER_FAIL)
                 return InitError(_("wallet.dat corrupt, salvage failed"));
         }
+
+        if (mapArgs.count("-walletbackend"))
+        {
+            string strBackend = GetArg("-walletbackend", "bdb");
+            if (strBackend != "bdb" && strBackend != "log")
+                return InitError(strprintf(_("Unknown -walletbackend: '%s'"), strBackend.c_str()));
+            bool fToLog = (strBackend == "log");
+            if (filesystem::exists(GetDataDir() / "wallet.dat") && fToLog != fWalletLog)
+            {
+                uiInterface.InitMessage(_("Converting wallet..."));
+                if (!CDB::ConvertBackend("wallet.dat", fToLog))
+                    return InitError(_("Error converting wallet.dat to the requested -walletbackend"));
+            }
+        }
+
+        string strKDF = GetArg("-walletkdf", "scrypt");
+        if (strKDF != "scrypt" && strKDF != "sha512")
+            return InitError(strprintf(_("Unknown -walletkdf: '%s'"), strKDF.c_str()));
     } // (!fDisableWallet)
 
     // ********************************************************* Step 6: network initialization
@@ -879,10 +932,14 @@ bool AppInit2(boost::thread_group& threadGroup)
                 delete pcoinsTip;
                 delete pcoinsdbview;
                 delete pblocktree;
+                delete paddressindex;
+                paddressindex = NULL;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+                if (GetBoolArg("-addressindex", false))
+                    paddressindex = new CAddressIndexDB(nBlockTreeDBCache, false, fReindex);
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -909,12 +966,34 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
+                // Check for changed -addressindex state
+                if (fAddressIndex != GetBoolArg("-addressindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -addressindex");
+                    break;
+                }
+
+                // Deleted blocks only come back by downloading them again
+                if (fHavePruned && !fPruneMode) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode. This will redownload the entire block chain");
+                    break;
+                }
+
+                if (!FinishUTXOSnapshotLoad()) {
+                    strLoadError = _("Error loading the UTXO set snapshot");
+                    break;
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (!VerifyDB(GetArg("-checklevel", 3),
                               GetArg( "-checkblocks", 288))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+
+                if (fAddressIndex && !SyncAddressIndex()) {
+                    strLoadError = _("Error updating the address index");
+                    break;
+                }
             } catch(std::exception &e) {
                 strLoadError = _("Error opening block database");
                 break;
@@ -951,6 +1030,15 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     printf(" block index %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    // Blocks below a snapshot were never downloaded
+    if (fHaveSnapshot) {
+        nLocalServices &= ~NODE_NETWORK;
+        nLocalServices |= NODE_NETWORK_LIMITED;
+    }
+
+    if (!InitMimblewimbleProtocol())
+        return InitError(_("Error opening the Mimblewimble databases"));
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -1028,10 +1116,29 @@ bool AppInit2(boost::thread_group& threadGroup)
             if (nMaxVersion < pwalletMain->GetVersion())
                 strErrors << _("Cannot downgrade wallet") << "\n";
             pwalletMain->SetMaxVersion(nMaxVersion);
+
+            // an existing wallet gets a seed for its new keys; its old keys stay as they are
+            if (!fFirstRun && nMaxVersion >= FEATURE_HD && GetBoolArg("-usehd", true) && !pwalletMain->IsHDEnabled())
+            {
+                if (pwalletMain->IsCrypted())
+                    InitWarning(_("Warning: the wallet is encrypted, so it has no deterministic seed yet. Unlock it and use sethdseed."));
+                else if (!pwalletMain->GenerateHDSeed())
+                    strErrors << _("Cannot create deterministic key chain") << "\n";
+            }
         }
 
+        bool fRestoreHD = fFirstRun && mapArgs.count("-hdseed");
         if (fFirstRun)
         {
+            if (fRestoreHD)
+            {
+                CBitcoinSecret vchSecret;
+                if (!vchSecret.SetString(mapArgs["-hdseed"]) || !pwalletMain->SetHDSeed(vchSecret.GetKey()))
+                    return InitError(_("Invalid -hdseed"));
+            }
+            else if (GetBoolArg("-usehd", true) && !pwalletMain->GenerateHDSeed())
+                strErrors << _("Cannot create deterministic key chain") << "\n";
+
             // Create new keyUser and set as default key
             RandAddSeedPerfmon();
 
@@ -1042,13 +1149,16 @@ bool AppInit2(boost::thread_group& threadGroup)
                     strErrors << _("Cannot write default address") << "\n";
             }
 
-            pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+            // a restored wallet is rescanned from the genesis block below
+            if (!fRestoreHD)
+                pwalletMain->SetBestChain(CBlockLocator(pindexBest));
         }
 
         printf("%s", strErrors.str().c_str());
         printf(" wallet      %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
         RegisterWallet(pwalletMain);
+        RegisterMimblewimbleWalletHooks();
 
         CBlockIndex *pindexRescan = pindexBest;
         if (GetBoolArg("-rescan"))
@@ -1064,6 +1174,9 @@ bool AppInit2(boost::thread_group& threadGroup)
         }
         if (pindexBest && pindexBest != pindexRescan)
         {
+            // The blocks since the last wallet synchronisation must still be on disk
+            if (FindPrunedBlock(pindexRescan->pnext))
+                return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole block chain again)"));
             uiInterface.InitMessage(_("Rescanning..."));
             printf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
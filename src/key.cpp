@@ -7,6 +7,8 @@
 #include <openssl/ecdsa.h>
 #include <openssl/rand.h>
 #include <openssl/obj_mac.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <vector>
 #include "util.h"
 
@@ -94,8 +96,58 @@ public:
     }
 
     bool SignCompact(const uint256 &hash, std::vector<unsigned char> &vchSig) const;
+
+    // replace the public key P with P + tweak*G
+    bool TweakPublic(const unsigned char vchTweak[32]) {
+        bool ret = true;
+        BN_CTX *ctx = BN_CTX_new();
+        if (!ctx) return false;
+        BN_CTX_start(ctx);
+        BIGNUM *bnTweak = BN_CTX_get(ctx);
+        BIGNUM *bnOrder = BN_CTX_get(ctx);
+        BIGNUM *bnOne = BN_CTX_get(ctx);
+        const EC_GROUP *group = EC_KEY_get0_group(pkey);
+        EC_POINT *point = NULL;
+        if (!bnOne || !EC_GROUP_get_order(group, bnOrder, ctx) || !BN_one(bnOne)) { ret = false; goto err; }
+        BN_bin2bn(vchTweak, 32, bnTweak);
+        if (BN_cmp(bnTweak, bnOrder) >= 0) { ret = false; goto err; } // extremely unlikely
+        point = EC_POINT_dup(EC_KEY_get0_public_key(pkey), group);
+        if (!point || !EC_POINT_mul(group, point, bnTweak, point, bnOne, ctx)) { ret = false; goto err; }
+        if (EC_POINT_is_at_infinity(group, point)) { ret = false; goto err; } // ridiculously unlikely
+        if (!EC_KEY_set_public_key(pkey, point)) ret = false;
+    err:
+        if (point) EC_POINT_free(point);
+        BN_CTX_end(ctx);
+        BN_CTX_free(ctx);
+        return ret;
+    }
 };
 
+// vchSecretOut = (vchSecretIn + vchTweak) mod n
+bool TweakSecret(unsigned char vchSecretOut[32], const unsigned char vchSecretIn[32], const unsigned char vchTweak[32]) {
+    bool ret = true;
+    BN_CTX *ctx = BN_CTX_new();
+    if (!ctx) return false;
+    BN_CTX_start(ctx);
+    BIGNUM *bnSecret = BN_CTX_get(ctx);
+    BIGNUM *bnTweak = BN_CTX_get(ctx);
+    BIGNUM *bnOrder = BN_CTX_get(ctx);
+    EC_GROUP *group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    if (!bnOrder || !group || !EC_GROUP_get_order(group, bnOrder, ctx)) { ret = false; goto err; }
+    BN_bin2bn(vchTweak, 32, bnTweak);
+    if (BN_cmp(bnTweak, bnOrder) >= 0) { ret = false; goto err; } // extremely unlikely
+    BN_bin2bn(vchSecretIn, 32, bnSecret);
+    if (!BN_mod_add(bnSecret, bnSecret, bnTweak, bnOrder, ctx)) { ret = false; goto err; }
+    if (BN_is_zero(bnSecret)) { ret = false; goto err; } // ridiculously unlikely
+    if (BN_bn2binpad(bnSecret, vchSecretOut, 32) != 32) ret = false;
+err:
+    if (bnSecret) BN_clear(bnSecret);
+    if (group) EC_GROUP_free(group);
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return ret;
+}
+
 // Standalone function for ECDSA recovery
 int ECDSA_SIG_recover_key_GFp(EC_KEY *eckey, ECDSA_SIG *sig, const unsigned char *msg, int msglen, int recid, int check) {
     if (!eckey) return 0;
@@ -340,3 +392,118 @@ bool CPubKey::Decompress() {
     Set(newKey.begin(), newKey.end());
     return true;
 }
+
+bool CKey::Derive(CKey& keyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const {
+    assert(IsValid());
+    assert(IsCompressed());
+    unsigned char out[64];
+    LockObject(out);
+    if ((nChild & BIP32_HARDENED) == 0) {
+        CPubKey pubkey = GetPubKey();
+        assert(pubkey.begin() + 33 == pubkey.end());
+        BIP32Hash(cc, nChild, *pubkey.begin(), pubkey.begin() + 1, out);
+    } else {
+        BIP32Hash(cc, nChild, 0, begin(), out);
+    }
+    memcpy(ccChild, out + 32, 32);
+    bool ret = TweakSecret(keyChild.vch, vch, out);
+    OPENSSL_cleanse(out, sizeof(out));
+    UnlockObject(out);
+    keyChild.fCompressed = true;
+    keyChild.fValid = ret;
+    return ret;
+}
+
+bool CPubKey::Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const {
+    assert((nChild & BIP32_HARDENED) == 0);
+    assert(begin() + 33 == end());
+    unsigned char out[64];
+    BIP32Hash(cc, nChild, *begin(), begin() + 1, out);
+    memcpy(ccChild, out + 32, 32);
+    CECKey key;
+    if (!key.SetPubKey(std::vector<unsigned char>(begin(), end())) || !key.TweakPublic(out))
+        return false;
+    key.SetCompressedPubKey(true);
+    pubkeyChild = key.GetPubKey();
+    return true;
+}
+
+void CExtKey::SetMaster(const unsigned char *seed, unsigned int nSeedLen) {
+    static const unsigned char hashkey[] = {'B','i','t','c','o','i','n',' ','s','e','e','d'};
+    unsigned char out[64];
+    LockObject(out);
+    unsigned int nLen = 64;
+    HMAC(EVP_sha512(), hashkey, sizeof(hashkey), seed, nSeedLen, out, &nLen);
+    key.Set(&out[0], &out[32], true);
+    memcpy(vchChainCode, &out[32], 32);
+    OPENSSL_cleanse(out, sizeof(out));
+    UnlockObject(out);
+    nDepth = 0;
+    nChild = 0;
+    memset(vchFingerprint, 0, sizeof(vchFingerprint));
+}
+
+bool CExtKey::Derive(CExtKey &out, unsigned int nChildIn) const {
+    out.nDepth = nDepth + 1;
+    CKeyID id = key.GetPubKey().GetID();
+    memcpy(&out.vchFingerprint[0], &id, 4);
+    out.nChild = nChildIn;
+    return key.Derive(out.key, out.vchChainCode, nChildIn, vchChainCode);
+}
+
+CExtPubKey CExtKey::Neuter() const {
+    CExtPubKey ret;
+    ret.nDepth = nDepth;
+    memcpy(&ret.vchFingerprint[0], &vchFingerprint[0], 4);
+    ret.nChild = nChild;
+    ret.pubkey = key.GetPubKey();
+    memcpy(&ret.vchChainCode[0], &vchChainCode[0], 32);
+    return ret;
+}
+
+void CExtKey::Encode(unsigned char code[BIP32_EXTKEY_SIZE]) const {
+    code[0] = nDepth;
+    memcpy(code + 1, vchFingerprint, 4);
+    code[5] = (nChild >> 24) & 0xFF; code[6] = (nChild >> 16) & 0xFF;
+    code[7] = (nChild >>  8) & 0xFF; code[8] = (nChild >>  0) & 0xFF;
+    memcpy(code + 9, vchChainCode, 32);
+    code[41] = 0;
+    assert(key.size() == 32);
+    memcpy(code + 42, key.begin(), 32);
+}
+
+bool CExtKey::Decode(const unsigned char code[BIP32_EXTKEY_SIZE]) {
+    nDepth = code[0];
+    memcpy(vchFingerprint, code + 1, 4);
+    nChild = (code[5] << 24) | (code[6] << 16) | (code[7] << 8) | code[8];
+    memcpy(vchChainCode, code + 9, 32);
+    key.Set(code + 42, code + BIP32_EXTKEY_SIZE, true);
+    return code[41] == 0 && key.IsValid();
+}
+
+void CExtPubKey::Encode(unsigned char code[BIP32_EXTKEY_SIZE]) const {
+    code[0] = nDepth;
+    memcpy(code + 1, vchFingerprint, 4);
+    code[5] = (nChild >> 24) & 0xFF; code[6] = (nChild >> 16) & 0xFF;
+    code[7] = (nChild >>  8) & 0xFF; code[8] = (nChild >>  0) & 0xFF;
+    memcpy(code + 9, vchChainCode, 32);
+    assert(pubkey.size() == 33);
+    memcpy(code + 41, pubkey.begin(), 33);
+}
+
+bool CExtPubKey::Decode(const unsigned char code[BIP32_EXTKEY_SIZE]) {
+    nDepth = code[0];
+    memcpy(vchFingerprint, code + 1, 4);
+    nChild = (code[5] << 24) | (code[6] << 16) | (code[7] << 8) | code[8];
+    memcpy(vchChainCode, code + 9, 32);
+    pubkey.Set(code + 41, code + BIP32_EXTKEY_SIZE);
+    return pubkey.IsCompressed();
+}
+
+bool CExtPubKey::Derive(CExtPubKey &out, unsigned int nChildIn) const {
+    out.nDepth = nDepth + 1;
+    CKeyID id = pubkey.GetID();
+    memcpy(&out.vchFingerprint[0], &id, 4);
+    out.nChild = nChildIn;
+    return pubkey.Derive(out.pubkey, out.vchChainCode, nChildIn, vchChainCode);
+}
@@ -168,6 +168,9 @@ public:
 
     // Turn this public key into an uncompressed public key.
     bool Decompress();
+
+    // Derive BIP32 child pubkey (non-hardened only; this key must be compressed).
+    bool Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const;
 };
 
 
@@ -259,6 +262,9 @@ public:
     //                  add 0x04 for compressed keys.
     bool SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig) const;
 
+    // Derive BIP32 child key (this key must be compressed).
+    bool Derive(CKey& keyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const;
+
     CKey& operator=(const CKey& other) {
         if (this != &other) {  // Self-assignment check
             // Securely clear existing key data
@@ -278,4 +284,47 @@ public:
     }
 };
 
+// BIP32 extended keys: indices with this bit set are hardened
+static const unsigned int BIP32_HARDENED = 0x80000000U;
+// size of an encoded extended key, without version bytes
+static const unsigned int BIP32_EXTKEY_SIZE = 74;
+
+/** A BIP32 extended public key: a public key plus chain code */
+struct CExtPubKey {
+    unsigned char nDepth;
+    unsigned char vchFingerprint[4];
+    unsigned int nChild;
+    unsigned char vchChainCode[32];
+    CPubKey pubkey;
+
+    friend bool operator==(const CExtPubKey &a, const CExtPubKey &b) {
+        return a.nDepth == b.nDepth && memcmp(&a.vchFingerprint[0], &b.vchFingerprint[0], 4) == 0 && a.nChild == b.nChild &&
+               memcmp(&a.vchChainCode[0], &b.vchChainCode[0], 32) == 0 && a.pubkey == b.pubkey;
+    }
+
+    void Encode(unsigned char code[BIP32_EXTKEY_SIZE]) const;
+    bool Decode(const unsigned char code[BIP32_EXTKEY_SIZE]);
+    bool Derive(CExtPubKey &out, unsigned int nChild) const;
+};
+
+/** A BIP32 extended private key */
+struct CExtKey {
+    unsigned char nDepth;
+    unsigned char vchFingerprint[4];
+    unsigned int nChild;
+    unsigned char vchChainCode[32];
+    CKey key;
+
+    friend bool operator==(const CExtKey &a, const CExtKey &b) {
+        return a.nDepth == b.nDepth && memcmp(&a.vchFingerprint[0], &b.vchFingerprint[0], 4) == 0 && a.nChild == b.nChild &&
+               memcmp(&a.vchChainCode[0], &b.vchChainCode[0], 32) == 0 && a.key.GetPubKey() == b.key.GetPubKey();
+    }
+
+    void Encode(unsigned char code[BIP32_EXTKEY_SIZE]) const;
+    bool Decode(const unsigned char code[BIP32_EXTKEY_SIZE]);
+    bool Derive(CExtKey &out, unsigned int nChild) const;
+    CExtPubKey Neuter() const;
+    void SetMaster(const unsigned char *seed, unsigned int nSeedLen);
+};
+
 #endif
@@ -5,6 +5,7 @@
 
 #include "keystore.h"
 #include "script.h"
+#include "util.h"
 
 bool CKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
 {
@@ -83,9 +84,17 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
+        // Check the master key against a few keys spread over the wallet;
+        // the others are only decrypted when they are used.
+        unsigned int nStep = std::max((unsigned int)(mapCryptedKeys.size() / UNLOCK_CHECK_KEYS), 1U);
+        unsigned int n = 0;
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        for (; mi != mapCryptedKeys.end(); ++mi, ++n)
         {
+            if (n % nStep != 0)
+                continue;
+            if (n / nStep >= UNLOCK_CHECK_KEYS)
+                break;
             const CPubKey &vchPubKey = (*mi).second.first;
             const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
             CKeyingMaterial vchSecret;
@@ -95,9 +104,8 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
                 return false;
             CKey key;
             key.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
-            if (key.GetPubKey() == vchPubKey)
-                break;
-            return false;
+            if (key.GetPubKey() != vchPubKey)
+                return false;
         }
         vMasterKey = vMasterKeyIn;
     }
@@ -126,6 +134,19 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     return true;
 }
 
+bool CCryptoKeyStore::EncryptKey(const CKey& key, const CPubKey &pubkey, std::vector<unsigned char> &vchCryptedSecret) const
+{
+    CKeyingMaterial vMasterKeyCopy;
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted() || IsLocked())
+            return false;
+        vMasterKeyCopy = vMasterKey;
+    }
+    CKeyingMaterial vchSecret(key.begin(), key.end());
+    return EncryptSecret(vMasterKeyCopy, vchSecret, pubkey.GetHash(), vchCryptedSecret);
+}
+
 
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
@@ -143,6 +164,9 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
     {
         LOCK(cs_KeyStore);
+        boost::unordered_map<CKeyID, unsigned int, CKeyIDHasher>::const_iterator it = mapHDKeyIndex.find(address);
+        if (it != mapHDKeyIndex.end())
+            return DeriveHDKey(it->second, keyOut);
         if (!IsCrypted())
             return CBasicKeyStore::GetKey(address, keyOut);
 
@@ -167,6 +191,12 @@ bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) co
 {
     {
         LOCK(cs_KeyStore);
+        boost::unordered_map<CKeyID, unsigned int, CKeyIDHasher>::const_iterator it = mapHDKeyIndex.find(address);
+        if (it != mapHDKeyIndex.end())
+        {
+            vchPubKeyOut = vHDPubKeys[it->second];
+            return true;
+        }
         if (!IsCrypted())
             return CKeyStore::GetPubKey(address, vchPubKeyOut);
 
@@ -203,3 +233,71 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
     }
     return true;
 }
+
+bool CCryptoKeyStore::SetHDChain(const CHDChain &chain)
+{
+    CExtPubKey extpub;
+    if (chain.vchChainPubKey.size() != BIP32_EXTKEY_SIZE || !extpub.Decode(&chain.vchChainPubKey[0]))
+        return false;
+
+    LOCK(cs_KeyStore);
+    if (chain.seedID != hdChain.seedID)
+    {
+        vHDPubKeys.clear();
+        mapHDKeyIndex.clear();
+    }
+    hdChain = chain;
+    extpubChain = extpub;
+    return true;
+}
+
+bool CCryptoKeyStore::ExtendHDChain(unsigned int nEnd)
+{
+    LOCK(cs_KeyStore);
+    if (hdChain.IsNull())
+        return false;
+    while (vHDPubKeys.size() < nEnd)
+    {
+        CExtPubKey extpubChild;
+        if (!extpubChain.Derive(extpubChild, vHDPubKeys.size()))
+            return false; // an invalid child (probability < 2^-127); BIP32 says to skip it, but ours is never reached
+        mapHDKeyIndex[extpubChild.pubkey.GetID()] = vHDPubKeys.size();
+        vHDPubKeys.push_back(extpubChild.pubkey);
+    }
+    return true;
+}
+
+bool CCryptoKeyStore::GetHDPubKey(unsigned int nIndex, CPubKey &pubkeyOut) const
+{
+    LOCK(cs_KeyStore);
+    if (nIndex >= vHDPubKeys.size())
+        return false;
+    pubkeyOut = vHDPubKeys[nIndex];
+    return true;
+}
+
+bool CCryptoKeyStore::GetHDKeyIndex(const CKeyID &address, unsigned int &nIndexOut) const
+{
+    LOCK(cs_KeyStore);
+    boost::unordered_map<CKeyID, unsigned int, CKeyIDHasher>::const_iterator it = mapHDKeyIndex.find(address);
+    if (it == mapHDKeyIndex.end())
+        return false;
+    nIndexOut = it->second;
+    return true;
+}
+
+bool CCryptoKeyStore::DeriveHDKey(unsigned int nIndex, CKey& keyOut) const
+{
+    // m/0'/0/nIndex from the seed; fails while the wallet is locked
+    CKey seed;
+    if (!GetKey(hdChain.seedID, seed))
+        return false;
+    CExtKey master, account, chain, child;
+    master.SetMaster(seed.begin(), seed.size());
+    if (!master.Derive(account, 0 | BIP32_HARDENED) || !account.Derive(chain, 0) || !chain.Derive(child, nIndex))
+        return false;
+    if (child.key.GetPubKey() != vHDPubKeys[nIndex])
+        return error("CCryptoKeyStore::DeriveHDKey() : key %u does not match the chain", nIndex);
+    keyOut = child.key;
+    return true;
+}
@@ -8,6 +8,7 @@
 #include "crypter.h"
 #include "sync.h"
 #include <boost/signals2/signal.hpp>
+#include <boost/unordered_map.hpp>
 
 class CScript;
 
@@ -90,6 +91,59 @@ public:
 
 typedef std::map<CKeyID, std::pair<CPubKey, std::vector<unsigned char> > > CryptedKeyMap;
 
+/** Hierarchical deterministic key chain (BIP32).
+ *
+ * Keys are derived along m/0'/0/i from a seed that is kept as an ordinary key
+ * of the wallet, so it is encrypted along with the others. The extended public
+ * key of m/0'/0 is stored too: public keys can be derived from it while the
+ * wallet is locked, and only signing needs the seed.
+ */
+class CHDChain
+{
+public:
+    // the seed key
+    CKeyID seedID;
+    // encoded CExtPubKey of m/0'/0
+    std::vector<unsigned char> vchChainPubKey;
+    // keys below this index have been handed out
+    unsigned int nNextIndex;
+
+    CHDChain()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        if (!(nType & SER_GETHASH))
+            READWRITE(nVersion);
+        READWRITE(seedID);
+        READWRITE(vchChainPubKey);
+        READWRITE(nNextIndex);
+    )
+
+    void SetNull()
+    {
+        seedID = CKeyID();
+        vchChainPubKey.clear();
+        nNextIndex = 0;
+    }
+
+    bool IsNull() const
+    {
+        return seedID == CKeyID();
+    }
+};
+
+struct CKeyIDHasher
+{
+    // key IDs are hashes already
+    size_t operator()(const CKeyID &id) const { return id.Get64(); }
+};
+
+// number of keys Unlock() decrypts to check the master key
+static const unsigned int UNLOCK_CHECK_KEYS = 4;
+
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
  */
@@ -104,6 +158,15 @@ private:
     // if fUseCrypto is false, vMasterKey must be empty
     bool fUseCrypto;
 
+    // the deterministic chain, if any, and the public keys derived from it
+    // so far (its lookahead window), by index and by key ID
+    CHDChain hdChain;
+    CExtPubKey extpubChain;
+    std::vector<CPubKey> vHDPubKeys;
+    boost::unordered_map<CKeyID, unsigned int, CKeyIDHasher> mapHDKeyIndex;
+
+    bool DeriveHDKey(unsigned int nIndex, CKey& keyOut) const;
+
 protected:
     bool SetCrypted();
 
@@ -138,10 +201,15 @@ public:
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    // encrypt key with the master key without adding it; the encryption
+    // itself runs outside cs_KeyStore, so several threads can use this at once
+    bool EncryptKey(const CKey& key, const CPubKey &pubkey, std::vector<unsigned char> &vchCryptedSecret) const;
     bool HaveKey(const CKeyID &address) const
     {
         {
             LOCK(cs_KeyStore);
+            if (mapHDKeyIndex.count(address))
+                return true;
             if (!IsCrypted())
                 return CBasicKeyStore::HaveKey(address);
             return mapCryptedKeys.count(address) > 0;
@@ -153,18 +221,43 @@ public:
     void GetKeys(std::set<CKeyID> &setAddress) const
     {
         if (!IsCrypted())
-        {
             CBasicKeyStore::GetKeys(setAddress);
-            return;
-        }
-        setAddress.clear();
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        while (mi != mapCryptedKeys.end())
+        else
         {
-            setAddress.insert((*mi).first);
-            mi++;
+            setAddress.clear();
+            CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
+            while (mi != mapCryptedKeys.end())
+            {
+                setAddress.insert((*mi).first);
+                mi++;
+            }
         }
+        LOCK(cs_KeyStore);
+        for (std::vector<CPubKey>::const_iterator it = vHDPubKeys.begin(); it != vHDPubKeys.end(); it++)
+            setAddress.insert(it->GetID());
+    }
+
+    bool IsHDEnabled() const
+    {
+        LOCK(cs_KeyStore);
+        return !hdChain.IsNull();
+    }
+    CHDChain GetHDChain() const
+    {
+        LOCK(cs_KeyStore);
+        return hdChain;
+    }
+    // install chain (loaded or newly created); keeps the derived keys if it is the same chain
+    bool SetHDChain(const CHDChain &chain);
+    // derive public keys until there are nEnd of them
+    bool ExtendHDChain(unsigned int nEnd);
+    unsigned int GetHDChainSize() const
+    {
+        LOCK(cs_KeyStore);
+        return vHDPubKeys.size();
     }
+    bool GetHDPubKey(unsigned int nIndex, CPubKey &pubkeyOut) const;
+    bool GetHDKeyIndex(const CKeyID &address, unsigned int &nIndexOut) const;
 
     /* Wallet status (encrypted, locked) changed.
      * Note: Called without locks held.
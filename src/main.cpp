@@ -11,6 +11,7 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "checkqueue.h"
+#include "mimblewimble_sync.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -50,6 +51,11 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
+bool fPruneMode = false;     // -prune given: delete old block files
+bool fHavePruned = false;    // block files have been deleted at some point
+bool fHaveSnapshot = false;  // the chain was started from a UTXO set snapshot
+uint64 nPruneTarget = 0;     // target size of block and undo files, in bytes
 unsigned int nCoinCacheSize = 5000;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
@@ -121,8 +127,10 @@ void static EraseFromWallets(uint256 hash)
 // make sure all wallets know about the given transaction, in the given block
 void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate)
 {
-    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered) {
         pwallet->AddToWalletIfInvolvingMe(hash, tx, pblock, fUpdate);
+        pwallet->UpdatedBestChain();
+    }
 }
 
 // notify wallets about a new best chain
@@ -132,6 +140,13 @@ void static SetBestChain(const CBlockLocator& loc)
         pwallet->SetBestChain(loc);
 }
 
+// notify wallets that the best block moved
+void static UpdatedBestChain()
+{
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+        pwallet->UpdatedBestChain();
+}
+
 // notify wallets about an updated transaction
 void static UpdatedTransaction(const uint256& hashTx)
 {
@@ -279,8 +294,61 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
     return mempool.exists(txid) || base->HaveCoins(txid);
 }
 
+// Each unspent output is committed to as an element of the multiset,
+// identified by its outpoint and carrying its metadata and contents.
+uint256 static GetCoinsCommitmentElement(const uint256 &txid, unsigned int n, int nHeight, bool fCoinBase, const CTxOut &out)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid << VARINT(n) << VARINT(nHeight*2+(fCoinBase ? 1 : 0)) << out;
+    return ss.GetHash();
+}
+
+void CCoinsCommitment::AddOutput(const uint256 &txid, unsigned int n, int nHeight, bool fCoinBase, const CTxOut &out)
+{
+    muhash.Insert(GetCoinsCommitmentElement(txid, n, nHeight, fCoinBase, out));
+    nTransactionOutputs++;
+    nTotalAmount += out.nValue;
+}
+
+void CCoinsCommitment::RemoveOutput(const uint256 &txid, unsigned int n, int nHeight, bool fCoinBase, const CTxOut &out)
+{
+    muhash.Remove(GetCoinsCommitmentElement(txid, n, nHeight, fCoinBase, out));
+    nTransactionOutputs--;
+    nTotalAmount -= out.nValue;
+}
+
+CCoinsCommitment& CCoinsCommitment::operator+=(const CCoinsCommitment &delta)
+{
+    muhash *= delta.muhash;
+    nTransactions += delta.nTransactions;
+    nTransactionOutputs += delta.nTransactionOutputs;
+    nTotalAmount += delta.nTotalAmount;
+    return *this;
+}
+
+void CCoinsCommitment::GetStats(CCoinsStats &stats) const
+{
+    stats.nTransactions = nTransactions;
+    stats.nTransactionOutputs = nTransactionOutputs;
+    stats.nTotalAmount = nTotalAmount;
+    stats.hashMuHash = muhash.Finalize();
+}
+
+bool GetCoinsCommitmentStats(const CBlockIndex *pindex, CCoinsStats &stats)
+{
+    CCoinsCommitment commit;
+    if (!pblocktree->ReadCoinsCommitment(pindex->GetBlockHash(), commit))
+        return false;
+    commit.GetStats(stats);
+    stats.hashBlock = pindex->GetBlockHash();
+    stats.nHeight = pindex->nHeight;
+    return true;
+}
+
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CAddressIndexDB *paddressindex = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1070,6 +1138,8 @@ CBlockIndex* FindBlockByHeight(int nHeight)
 
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex)
 {
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+        return error("CBlock::ReadFromDisk() : block %s not available (pruned)", pindex->GetBlockHash().ToString().c_str());
     if (!ReadFromDisk(pindex->GetBlockPos()))
         return false;
     if (GetHash() != pindex->GetBlockHash())
@@ -1365,7 +1435,7 @@ unsigned int CTransaction::GetP2SHSigOpCount(CCoinsViewCache& inputs) const
     return nSigOps;
 }
 
-void CTransaction::UpdateCoins(CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight, const uint256 &txhash) const
+void CTransaction::UpdateCoins(CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight, const uint256 &txhash, CCoinsCommitment *pcommit) const
 {
     bool ret;
     // mark inputs spent
@@ -1375,12 +1445,25 @@ void CTransaction::UpdateCoins(CValidationState &state, CCoinsViewCache &inputs,
             CTxInUndo undo;
             ret = coins.Spend(txin.prevout, undo);
             assert(ret);
+            if (pcommit) {
+                pcommit->RemoveOutput(txin.prevout.hash, txin.prevout.n, coins.nHeight, coins.fCoinBase, undo.txout);
+                if (coins.vout.empty())
+                    pcommit->RemoveTransaction();
+            }
             txundo.vprevout.push_back(undo);
         }
     }
 
     // add outputs
-    assert(inputs.SetCoins(txhash, CCoins(*this, nHeight)));
+    CCoins coinsNew(*this, nHeight);
+    if (pcommit) {
+        for (unsigned int i = 0; i < coinsNew.vout.size(); i++)
+            if (!coinsNew.vout[i].IsNull())
+                pcommit->AddOutput(txhash, i, nHeight, coinsNew.fCoinBase, coinsNew.vout[i]);
+        if (!coinsNew.IsPruned())
+            pcommit->AddTransaction();
+    }
+    assert(inputs.SetCoins(txhash, coinsNew));
 }
 
 bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const
@@ -1499,6 +1582,32 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
 
 
 
+// Time spent connecting blocks and on their address index entries, for -benchmark
+// to report the overhead of -addressindex (protected by cs_main)
+static int64 nTimeConnectTotal = 0;
+static int64 nTimeAddressIndexTotal = 0;
+
+// Collect the address index changes made by connecting a transaction at nHeight
+void static GetAddressIndexChanges(const CTransaction &tx, const uint256 &hash, const CTxUndo &txundo, int nHeight,
+                                   CAddressHistory &vHistory, CAddressUnspentMap &mapUnspent)
+{
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint &prevout = tx.vin[j].prevout;
+            const CTxOut &out = txundo.vprevout[j].txout;
+            uint160 hashScript = Hash160(out.scriptPubKey);
+            vHistory.push_back(make_pair(CAddressIndexKey(hashScript, nHeight, hash, j, true), -out.nValue));
+            mapUnspent[CAddressUnspentKey(hashScript, prevout.hash, prevout.n)].SetNull();
+        }
+    }
+    for (unsigned int j = 0; j < tx.vout.size(); j++) {
+        const CTxOut &out = tx.vout[j];
+        uint160 hashScript = Hash160(out.scriptPubKey);
+        vHistory.push_back(make_pair(CAddressIndexKey(hashScript, nHeight, hash, j, false), out.nValue));
+        mapUnspent[CAddressUnspentKey(hashScript, hash, j)] = CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight);
+    }
+}
+
 bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &view, bool *pfClean)
 {
     assert(pindex == view.GetBestBlock());
@@ -1508,6 +1617,10 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
 
     bool fClean = true;
 
+    CCoinsCommitment commitDelta;
+    CAddressHistory vAddressHistory;
+    CAddressUnspentMap mapAddressUnspent;
+
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull())
@@ -1540,6 +1653,18 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
             fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
 
         // remove outputs
+        for (unsigned int j = 0; j < outs.vout.size(); j++)
+            if (!outs.vout[j].IsNull())
+                commitDelta.RemoveOutput(hash, j, outs.nHeight, outs.fCoinBase, outs.vout[j]);
+        if (fAddressIndex) {
+            for (unsigned int j = 0; j < tx.vout.size(); j++) {
+                uint160 hashScript = Hash160(tx.vout[j].scriptPubKey);
+                vAddressHistory.push_back(make_pair(CAddressIndexKey(hashScript, pindex->nHeight, hash, j, false), tx.vout[j].nValue));
+                mapAddressUnspent[CAddressUnspentKey(hashScript, hash, j)].SetNull();
+            }
+        }
+        if (!outs.IsPruned())
+            commitDelta.RemoveTransaction();
         outs = CCoins();
 
         // restore inputs
@@ -1566,9 +1691,17 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
                 }
                 if (coins.IsAvailable(out.n))
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
+                if (coins.IsPruned())
+                    commitDelta.AddTransaction();
                 if (coins.vout.size() < out.n+1)
                     coins.vout.resize(out.n+1);
                 coins.vout[out.n] = undo.txout;
+                commitDelta.AddOutput(out.hash, out.n, coins.nHeight, coins.fCoinBase, undo.txout);
+                if (fAddressIndex) {
+                    uint160 hashScript = Hash160(undo.txout.scriptPubKey);
+                    vAddressHistory.push_back(make_pair(CAddressIndexKey(hashScript, pindex->nHeight, hash, j, true), -undo.txout.nValue));
+                    mapAddressUnspent[CAddressUnspentKey(hashScript, out.hash, out.n)] = CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins.nHeight);
+                }
                 if (!view.SetCoins(out.hash, coins))
                     return error("DisconnectBlock() : cannot restore coin inputs");
             }
@@ -1578,6 +1711,20 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev);
 
+    // derive the UTXO set commitment of the previous block, if it is not known yet
+    if (!pfClean && fClean) {
+        CCoinsCommitment commit;
+        if (!pblocktree->ReadCoinsCommitment(pindex->pprev->GetBlockHash(), commit) &&
+            pblocktree->ReadCoinsCommitment(pindex->GetBlockHash(), commit)) {
+            commit += commitDelta;
+            if (!pblocktree->WriteCoinsCommitment(pindex->pprev->GetBlockHash(), commit))
+                return state.Abort(_("Failed to write UTXO set commitment"));
+        }
+    }
+
+    if (fAddressIndex && !pfClean && fClean)
+        paddressindex->UpdateBlock(vAddressHistory, true, mapAddressUnspent, pindex->pprev->GetBlockHash());
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
@@ -1586,6 +1733,9 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
     }
 }
 
+// Set when a new block file is started; the next flush then checks the prune target
+static bool fCheckForPruning = false;
+
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
@@ -1632,6 +1782,8 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     if (GetHash() == hashGenesisBlock) {
         view.SetBestBlock(pindex);
         pindexGenesisBlock = pindex;
+        if (!fJustCheck && !pblocktree->WriteCoinsCommitment(pindex->GetBlockHash(), CCoinsCommitment()))
+            return state.Abort(_("Failed to write UTXO set commitment"));
         return true;
     }
 
@@ -1666,6 +1818,7 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
                          (fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE);
 
     CBlockUndo blockundo;
+    CCoinsCommitment commitDelta;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
@@ -1709,7 +1862,7 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
         }
 
         CTxUndo txundo;
-        tx.UpdateCoins(state, view, txundo, pindex->nHeight, GetTxHash(i));
+        tx.UpdateCoins(state, view, txundo, pindex->nHeight, GetTxHash(i), fJustCheck ? NULL : &commitDelta);
         if (!tx.IsCoinBase())
             blockundo.vtxundo.push_back(txundo);
 
@@ -1758,6 +1911,31 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort(_("Failed to write transaction index"));
 
+    if (fAddressIndex) {
+        int64 nStartIndex = GetTimeMicros();
+        CAddressHistory vAddressHistory;
+        CAddressUnspentMap mapAddressUnspent;
+        CTxUndo txundoCoinbase;
+        for (unsigned int i=0; i<vtx.size(); i++)
+            GetAddressIndexChanges(vtx[i], GetTxHash(i), i > 0 ? blockundo.vtxundo[i-1] : txundoCoinbase, pindex->nHeight, vAddressHistory, mapAddressUnspent);
+        paddressindex->UpdateBlock(vAddressHistory, false, mapAddressUnspent, pindex->GetBlockHash());
+        int64 nTimeIndex = GetTimeMicros() - nStartIndex;
+        nTimeAddressIndexTotal += nTimeIndex;
+        nTimeConnectTotal += nStartIndex - nStart;
+        if (fBenchmark)
+            printf("- Address index %u entries: %.2fms (+%.1f%% on top of connecting, so far)\n", (unsigned)vAddressHistory.size(), 0.001 * nTimeIndex,
+                   100.0 * nTimeAddressIndexTotal / std::max(nTimeConnectTotal, (int64)1));
+    }
+
+    // Extend the UTXO set commitment of the previous block. Databases created by
+    // older versions have none; it gets seeded by the next full gettxoutsetinfo scan.
+    CCoinsCommitment commit;
+    if (pblocktree->ReadCoinsCommitment(pindex->pprev->GetBlockHash(), commit)) {
+        commit += commitDelta;
+        if (!pblocktree->WriteCoinsCommitment(pindex->GetBlockHash(), commit))
+            return state.Abort(_("Failed to write UTXO set commitment"));
+    }
+
     // add this block to the view's block chain
     assert(view.SetBestBlock(pindex));
 
@@ -1857,7 +2035,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 
     // Make sure it's successfully written to disk before changing memory structure
     bool fIsInitialDownload = IsInitialBlockDownload();
-    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize || fCheckForPruning) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -1869,6 +2047,20 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         pblocktree->Sync();
         if (!pcoinsTip->Flush())
             return state.Abort(_("Failed to write to coin database"));
+        // After the coins, so that an interrupted flush leaves the address
+        // index behind them, from where SyncAddressIndex catches up
+        if (fAddressIndex) {
+            int64 nStartIndex = GetTimeMicros();
+            if (!paddressindex->Flush())
+                return state.Abort(_("Failed to write address index"));
+            nTimeAddressIndexTotal += GetTimeMicros() - nStartIndex;
+        }
+        // Only prune once the coins no longer need the blocks being deleted
+        if (fCheckForPruning) {
+            fCheckForPruning = false;
+            if (!PruneBlockFiles())
+                return state.Abort(_("Failed to prune block files"));
+        }
     }
 
     // At this point, all changes have been done to the database.
@@ -1913,6 +2105,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     nBestChainWork = pindexNew->nChainWork;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
+    UpdatedBestChain();
     printf("SetBestChain: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f\n",
       hashBestChain.ToString().c_str(), nBestHeight, log(nBestChainWork.getdouble())/log(2.0), (unsigned long)pindexNew->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexBest->GetBlockTime()).c_str(),
@@ -2016,6 +2209,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
             printf("Leaving block file %i: %s\n", nLastBlockFile, infoLastBlockFile.ToString().c_str());
             FlushBlockFile(true);
             nLastBlockFile++;
+            if (fPruneMode)
+                fCheckForPruning = true;
             infoLastBlockFile.SetNull();
             pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile); // check whether data for the new file somehow already exist; can fail just fine
             fUpdatedLast = true;
@@ -2520,6 +2715,110 @@ bool AbortNode(const std::string &strMessage) {
     return false;
 }
 
+// Number of bytes used by block and undo files (excluding pre-allocation)
+uint64 static CalculateCurrentUsage()
+{
+    LOCK(cs_LastBlockFile);
+
+    uint64 nUsage = infoLastBlockFile.nSize + infoLastBlockFile.nUndoSize;
+    for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+        CBlockFileInfo info;
+        if (pblocktree->ReadBlockFileInfo(nFile, info))
+            nUsage += info.nSize + info.nUndoSize;
+    }
+    return nUsage;
+}
+
+// Mark all blocks stored in the given block file pairs as unavailable, in a
+// single pass over the block index
+bool static PruneBlockFileIndex(const std::set<int> &setFiles)
+{
+    BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex) {
+        CBlockIndex* pindex = item.second;
+        if ((pindex->nStatus & BLOCK_HAVE_MASK) && setFiles.count(pindex->nFile)) {
+            pindex->nStatus &= ~BLOCK_HAVE_MASK;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setBlockIndexValid.erase(pindex);
+            if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)))
+                return false;
+        }
+    }
+    BOOST_FOREACH(int nFile, setFiles) {
+        CBlockFileInfo info;
+        if (!pblocktree->WriteBlockFileInfo(nFile, info))
+            return false;
+    }
+    return true;
+}
+
+bool PruneBlockFiles()
+{
+    if (!fPruneMode || pindexBest == NULL)
+        return true;
+
+    uint64 nUsage = CalculateCurrentUsage();
+    // leave room for the pre-allocation of the next chunks
+    uint64 nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    if (nUsage + nBuffer < nPruneTarget)
+        return true;
+
+    // Never delete the last MIN_BLOCKS_TO_KEEP blocks, so reorganizations
+    // and peers that are slightly behind can still be served.
+    int nLastPrunable = nBestHeight - MIN_BLOCKS_TO_KEEP;
+    int nLastFile;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastFile = nLastBlockFile;
+    }
+
+    std::vector<int> vPruned;
+    for (int nFile = 0; nFile < nLastFile && nUsage + nBuffer >= nPruneTarget; nFile++) {
+        CBlockFileInfo info;
+        if (!pblocktree->ReadBlockFileInfo(nFile, info) || info.nSize == 0)
+            continue;
+        if ((int)std::max(info.nHeightFirst, info.nHeightLast) > nLastPrunable)
+            continue;
+        vPruned.push_back(nFile);
+        nUsage -= info.nSize + info.nUndoSize;
+    }
+    if (vPruned.empty())
+        return true;
+    if (!PruneBlockFileIndex(std::set<int>(vPruned.begin(), vPruned.end())))
+        return error("PruneBlockFiles() : failed to write block index");
+
+    // Record the pruning before any file is deleted
+    if (!fHavePruned) {
+        fHavePruned = true;
+        if (!pblocktree->WriteFlag("prunedblockfiles", true))
+            return error("PruneBlockFiles() : failed to write flag");
+    }
+    if (!pblocktree->Sync())
+        return error("PruneBlockFiles() : failed to sync block index");
+
+    BOOST_FOREACH(int nFile, vPruned) {
+        boost::system::error_code ec;
+        filesystem::remove(GetDataDir() / "blocks" / strprintf("blk%05u.dat", nFile), ec);
+        filesystem::remove(GetDataDir() / "blocks" / strprintf("rev%05u.dat", nFile), ec);
+        printf("Pruned block file %i\n", nFile);
+    }
+    printf("PruneBlockFiles(): block files now use %"PRI64u" MiB (target %"PRI64u" MiB)\n",
+        nUsage / 1024 / 1024, nPruneTarget / 1024 / 1024);
+    return true;
+}
+
+CBlockIndex* FindPrunedBlock(CBlockIndex* pindexStart)
+{
+    // not only pruning: the blocks below a UTXO snapshot have no data either
+    if (pindexStart == NULL)
+        return NULL;
+    for (CBlockIndex* pindex = pindexBest; pindex && pindex->nHeight >= pindexStart->nHeight; pindex = pindex->pprev)
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            return pindex;
+    return NULL;
+}
+
 bool CheckDiskSpace(uint64 nAdditionalBytes)
 {
     uint64 nFreeBytesAvailable = filesystem::space(GetDataDir()).available;
@@ -2631,6 +2930,22 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     printf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    printf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+
+    // Check whether block files have been pruned
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        printf("LoadBlockIndexDB(): block files have been pruned\n");
+
+    // Check whether the chain was started from a snapshot
+    pblocktree->ReadFlag("snapshot", fHaveSnapshot);
+    if (fHaveSnapshot)
+        printf("LoadBlockIndexDB(): chain starts from a UTXO set snapshot\n");
+    if (fPruneMode)
+        fCheckForPruning = true;
+
     // Load hashBestChain pointer to end of best chain
     pindexBest = pcoinsTip->GetBestBlock();
     if (pindexBest == NULL)
@@ -2675,6 +2990,9 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         boost::this_thread::interruption_point();
         if (pindex->nHeight < nBestHeight-nCheckDepth)
             break;
+        // stop at blocks that were loaded from a UTXO snapshot
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!block.ReadFromDisk(pindex))
@@ -2726,6 +3044,243 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
     return true;
 }
 
+bool SyncAddressIndex()
+{
+    // Start over from what is on disk: VerifyDB reconnects blocks the
+    // address index may already have
+    paddressindex->ClearCache();
+    uint256 hashIndexBest = 0;
+    paddressindex->ReadBestBlock(hashIndexBest);
+
+    // An index from before a crash during a reorg would need blocks disconnected too
+    CBlockIndex *pindex = pindexGenesisBlock;
+    if (hashIndexBest != 0) {
+        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashIndexBest);
+        if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+            return error("SyncAddressIndex() : address index is not on the main chain");
+        pindex = mi->second;
+    }
+    if (pindex == NULL || pindex == pindexBest)
+        return true;
+
+    printf("Updating the address index from height %d to %d\n", pindex->nHeight, nBestHeight);
+    while ((pindex = pindex->pnext) != NULL) {
+        boost::this_thread::interruption_point();
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!block.ReadFromDisk(pindex))
+            return error("SyncAddressIndex() : failed to read block at %d", pindex->nHeight);
+        if (!blockundo.ReadFromDisk(pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) || blockundo.vtxundo.size() + 1 != block.vtx.size())
+            return error("SyncAddressIndex() : failed to read undo data at %d", pindex->nHeight);
+        block.BuildMerkleTree();
+
+        CAddressHistory vAddressHistory;
+        CAddressUnspentMap mapAddressUnspent;
+        CTxUndo txundoCoinbase;
+        for (unsigned int i=0; i<block.vtx.size(); i++)
+            GetAddressIndexChanges(block.vtx[i], block.GetTxHash(i), i > 0 ? blockundo.vtxundo[i-1] : txundoCoinbase, pindex->nHeight, vAddressHistory, mapAddressUnspent);
+        paddressindex->UpdateBlock(vAddressHistory, false, mapAddressUnspent, pindex->GetBlockHash());
+    }
+    if (!paddressindex->Flush())
+        return AbortNode(_("Failed to write address index"));
+    return true;
+}
+
+bool DumpUTXOSnapshot(const boost::filesystem::path &path, CSnapshotHeader &header)
+{
+    // Make sure the coin database reflects the current tip
+    if (!pcoinsTip->Flush())
+        return error("DumpUTXOSnapshot() : failed to flush coin cache");
+    CBlockIndex *pindex = pcoinsdbview->GetBestBlock();
+    if (pindex == NULL || pindex->pprev == NULL)
+        return error("DumpUTXOSnapshot() : no blocks to snapshot");
+
+    header.SetNull();
+    memcpy(header.pchNetwork, pchMessageStart, sizeof(header.pchNetwork));
+    header.hashBlock = pindex->GetBlockHash();
+    header.nHeight = pindex->nHeight;
+    header.vHeaders.resize(pindex->nHeight);
+    header.vTxCounts.resize(pindex->nHeight);
+    for (CBlockIndex *pindexWalk = pindex; pindexWalk->pprev; pindexWalk = pindexWalk->pprev) {
+        header.vHeaders[pindexWalk->nHeight - 1] = pindexWalk->GetBlockHeader();
+        header.vTxCounts[pindexWalk->nHeight - 1] = pindexWalk->nTx;
+    }
+
+    FILE *file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        return error("DumpUTXOSnapshot() : cannot open %s", path.string().c_str());
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+
+    // The header has a fixed size, so it is written now and rewritten once
+    // the number of coins and their commitment are known.
+    CCoinsCommitment commit;
+    try {
+        fileout << header;
+        if (!pcoinsdbview->DumpSnapshot(fileout, header.nCoins, commit))
+            return error("DumpUTXOSnapshot() : failed to write coins");
+        header.hashCoins = commit.muhash.Finalize();
+        fseek(fileout, 0, SEEK_SET);
+        fileout << header;
+    } catch (std::exception &e) {
+        return error("DumpUTXOSnapshot() : I/O error: %s", e.what());
+    }
+    FileCommit(fileout);
+
+    printf("DumpUTXOSnapshot() : wrote %"PRI64u" coins at height %d (%s) to %s\n", header.nCoins,
+        header.nHeight, header.hashBlock.ToString().c_str(), path.string().c_str());
+    return true;
+}
+
+bool LoadUTXOSnapshot(const boost::filesystem::path &path, CSnapshotHeader &header)
+{
+    if (pindexGenesisBlock == NULL || pindexBest != pindexGenesisBlock)
+        return error("LoadUTXOSnapshot() : a snapshot can only be loaded into an empty chain");
+    if (fTxIndex || fAddressIndex)
+        return error("LoadUTXOSnapshot() : the transaction and address indexes need the full block chain");
+    // Wallets find their transactions in blocks, which are missing below the
+    // snapshot: only wallets that have none yet can start from it
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+        if (!pwallet->mapWallet.empty())
+            return error("LoadUTXOSnapshot() : a wallet with transactions needs the full block chain");
+
+    FILE *file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("LoadUTXOSnapshot() : cannot open %s", path.string().c_str());
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+
+    long nCoinsPos;
+    try {
+        filein >> header;
+        nCoinsPos = ftell(filein);
+    } catch (std::exception &e) {
+        return error("LoadUTXOSnapshot() : cannot read snapshot header: %s", e.what());
+    }
+    if (header.nVersion != CSnapshotHeader::CURRENT_VERSION)
+        return error("LoadUTXOSnapshot() : unsupported snapshot version %d", header.nVersion);
+    if (memcmp(header.pchNetwork, pchMessageStart, sizeof(header.pchNetwork)) != 0)
+        return error("LoadUTXOSnapshot() : snapshot is for a different network");
+    if (header.nHeight <= 0 || header.vHeaders.size() != (unsigned int)header.nHeight ||
+        header.vTxCounts.size() != header.vHeaders.size() ||
+        std::find(header.vTxCounts.begin(), header.vTxCounts.end(), 0) != header.vTxCounts.end())
+        return error("LoadUTXOSnapshot() : malformed snapshot header");
+
+    // Only snapshots whose block and coins are compiled in are trusted
+    if (!Checkpoints::CheckSnapshot(header.nHeight, header.hashBlock, header.hashCoins))
+        return error("LoadUTXOSnapshot() : unknown snapshot %s at height %d (coins %s)",
+            header.hashBlock.ToString().c_str(), header.nHeight, header.hashCoins.ToString().c_str());
+
+    // The headers must form a valid chain from the genesis block to the snapshot block
+    uint256 hashPrev = hashGenesisBlock;
+    for (unsigned int i = 0; i < header.vHeaders.size(); i++) {
+        boost::this_thread::interruption_point();
+        const CBlockHeader &block = header.vHeaders[i];
+        uint256 hash = block.GetHash();
+        if (block.hashPrevBlock != hashPrev)
+            return error("LoadUTXOSnapshot() : header %u does not connect", i + 1);
+        if (!CheckProofOfWork(CBlock(block).GetPoWHash(), block.nBits))
+            return error("LoadUTXOSnapshot() : header %u has invalid proof of work", i + 1);
+        if (!Checkpoints::CheckBlock(i + 1, hash))
+            return error("LoadUTXOSnapshot() : header %u does not match checkpoint", i + 1);
+        hashPrev = hash;
+    }
+    if (hashPrev != header.hashBlock)
+        return error("LoadUTXOSnapshot() : headers do not lead to the snapshot block");
+
+    // First pass: verify every chunk and the commitment without touching the database
+    CCoinsCommitment commit;
+    if (!pcoinsdbview->LoadSnapshot(filein, header.nCoins, commit, false))
+        return error("LoadUTXOSnapshot() : failed to read coins");
+    if (commit.muhash.Finalize() != header.hashCoins)
+        return error("LoadUTXOSnapshot() : coins do not match the snapshot commitment");
+
+    // Second pass: bulk-load the coins. Until the snapshot block is the best
+    // block of the coin database, the coins written do not match the block
+    // index, so the load is recorded first and finished at the next startup
+    // if it is interrupted (see FinishUTXOSnapshotLoad).
+    if (!pcoinsTip->Flush())
+        return error("LoadUTXOSnapshot() : failed to flush coin cache");
+    if (!pblocktree->WriteSnapshotLoading(path.string()) || !pblocktree->Sync())
+        return AbortNode(_("Failed to write to block index"));
+    fseek(filein, nCoinsPos, SEEK_SET);
+    if (!pcoinsdbview->LoadSnapshot(filein, header.nCoins, commit, true))
+        return AbortNode(_("Failed to write UTXO snapshot"));
+
+    // Add the headers to the block index. Their block data is not available,
+    // so they are only marked valid up to the tree level.
+    CBlockIndex *pindexPrev = pindexGenesisBlock;
+    for (unsigned int i = 0; i < header.vHeaders.size(); i++) {
+        CBlockHeader &block = header.vHeaders[i];
+        uint256 hash = block.GetHash();
+        CBlockIndex *pindexNew;
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end()) {
+            pindexNew = mi->second;
+        } else {
+            pindexNew = new CBlockIndex(block);
+            mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+            pindexNew->phashBlock = &((*mi).first);
+            pindexNew->nStatus = BLOCK_VALID_TREE;
+        }
+        pindexNew->pprev = pindexPrev;
+        pindexNew->nHeight = pindexPrev->nHeight + 1;
+        pindexNew->nTx = header.vTxCounts[i];
+        pindexNew->nChainWork = pindexPrev->nChainWork + pindexNew->GetBlockWork().getuint256();
+        pindexNew->nChainTx = pindexPrev->nChainTx + pindexNew->nTx;
+        pindexPrev->pnext = pindexNew;
+        if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew)))
+            return AbortNode(_("Failed to write block index"));
+        pindexPrev = pindexNew;
+    }
+    if (!pblocktree->WriteCoinsCommitment(header.hashBlock, commit))
+        return AbortNode(_("Failed to write UTXO set commitment"));
+    if (!pblocktree->WriteFlag("snapshot", true))
+        return AbortNode(_("Failed to write to block index"));
+    if (!pblocktree->Sync())
+        return AbortNode(_("Failed to sync block index"));
+
+    // Make the snapshot block the tip, which completes the load
+    if (!pcoinsTip->SetBestBlock(pindexPrev) || !pcoinsTip->Flush())
+        return AbortNode(_("Failed to write to coin database"));
+    if (!pblocktree->WriteSnapshotLoading(""))
+        return AbortNode(_("Failed to write to block index"));
+    fHaveSnapshot = true;
+    // blocks below the snapshot cannot be served
+    nLocalServices &= ~NODE_NETWORK;
+    nLocalServices |= NODE_NETWORK_LIMITED;
+    // and the wallets, having no transactions, need not scan them
+    SetBestChain(CBlockLocator(pindexPrev));
+    pindexBest = pindexPrev;
+    hashBestChain = pindexBest->GetBlockHash();
+    nBestHeight = pindexBest->nHeight;
+    nBestChainWork = pindexBest->nChainWork;
+    nTimeBestReceived = GetTime();
+    nTransactionsUpdated++;
+    mempool.clear();
+
+    printf("LoadUTXOSnapshot() : loaded %"PRI64u" coins, new best=%s height=%d\n", header.nCoins,
+        hashBestChain.ToString().c_str(), nBestHeight);
+    uiInterface.NotifyBlocksChanged();
+    return true;
+}
+
+bool FinishUTXOSnapshotLoad()
+{
+    std::string strPath;
+    if (!pblocktree->ReadSnapshotLoading(strPath))
+        return true;
+
+    // Interrupted after the snapshot block became the best block: only the
+    // record of the load is left
+    if (pindexBest != pindexGenesisBlock)
+        return pblocktree->WriteSnapshotLoading("");
+
+    // Otherwise the coin database holds part of the snapshot's coins; loading
+    // the snapshot again overwrites them and adds the rest
+    printf("FinishUTXOSnapshotLoad() : loading of %s was interrupted, loading it again\n", strPath.c_str());
+    CSnapshotHeader header;
+    return LoadUTXOSnapshot(strPath, header);
+}
+
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
@@ -2767,6 +3322,8 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
     printf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3165,14 +3722,21 @@ void static ProcessGetData(CNode* pfrom)
                          send = false;
                        }
                     }
+                    // Blocks that were pruned or loaded from a UTXO snapshot have no data on disk
+                    if (send && !(((*mi).second)->nStatus & BLOCK_HAVE_DATA))
+                        send = false;
                 } else {
                     send = false;
                 }
+                CBlock block;
+                if (send && !block.ReadFromDisk((*mi).second))
+                {
+                    printf("ProcessGetData(): cannot read block %s from disk\n", inv.hash.ToString().c_str());
+                    send = false;
+                }
                 if (send)
                 {
                     // Send block from disk
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
                     else // MSG_FILTERED_BLOCK)
@@ -3389,6 +3953,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "verack")
     {
         pfrom->SetRecvVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
+        StartMWStateSync(pfrom);
     }
 
 
@@ -3555,6 +4120,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 printf("  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
                 break;
             }
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                continue;
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0)
             {
@@ -3849,6 +4416,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if (ProcessMWStateMessage(pfrom, strCommand, vRecv))
+    {
+        // Mimblewimble fast sync: "getmwstate" and "mwstate"
+    }
+
+
     else
     {
         // Ignore unknown commands for extensibility
@@ -10,6 +10,8 @@
 #include "net.h"
 #include "script.h"
 #include "scrypt.h"
+#include "muhash.h"
+#include "mimblewimble.h"
 
 #include <list>
 
@@ -45,6 +47,10 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Number of blocks below the tip whose block and undo files are never pruned */
+static const int MIN_BLOCKS_TO_KEEP = 288;
+/** Minimum -prune target, so that the kept blocks and the pre-allocated files fit (550 MiB) */
+static const uint64 MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 /** Dust Soft Limit, allowed with additional fee per output */
@@ -99,6 +105,11 @@ extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fPruneMode;
+extern bool fHavePruned;
+extern bool fHaveSnapshot;
+extern uint64 nPruneTarget;
 extern unsigned int nCoinCacheSize;
 
 // Settings
@@ -117,6 +128,9 @@ class CCoins;
 class CTxUndo;
 class CCoinsView;
 class CCoinsViewCache;
+class CCoinsCommitment;
+struct CCoinsStats;
+class CSnapshotHeader;
 class CScriptCheck;
 class CValidationState;
 
@@ -144,8 +158,20 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Delete old block and undo files while their total size exceeds the -prune target */
+bool PruneBlockFiles();
+/** The highest main chain block from pindexStart on whose data is not on disk (pruned, or below a UTXO snapshot), or NULL if there is none */
+CBlockIndex* FindPrunedBlock(CBlockIndex* pindexStart);
 /** Verify consistency of the block and coin databases */
 bool VerifyDB(int nCheckLevel, int nCheckDepth);
+/** Bring the address index up to the tip, after an interrupted flush left it behind */
+bool SyncAddressIndex();
+/** Write the coin database at the current tip to a snapshot file */
+bool DumpUTXOSnapshot(const boost::filesystem::path &path, CSnapshotHeader &header);
+/** Replace an empty chain with the coins and headers of a known snapshot file */
+bool LoadUTXOSnapshot(const boost::filesystem::path &path, CSnapshotHeader &header);
+/** Finish a LoadUTXOSnapshot that was interrupted; true if there was none */
+bool FinishUTXOSnapshotLoad();
 /** Print the loaded block tree */
 void PrintBlockTree();
 /** Find a block by height in the currently-connected chain */
@@ -189,6 +215,8 @@ CBlockIndex * InsertBlockIndex(uint256 hash);
 bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 /** Abort with a message */
 bool AbortNode(const std::string &msg);
+/** Look up the UTXO set statistics as of a given block, using the stored commitments */
+bool GetCoinsCommitmentStats(const CBlockIndex *pindex, CCoinsStats &stats);
 
 
 
@@ -679,7 +707,8 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
                      std::vector<CScriptCheck> *pvChecks = NULL) const;
 
     // Apply the effects of this transaction on the UTXO set represented by view
-    void UpdateCoins(CValidationState &state, CCoinsViewCache &view, CTxUndo &txundo, int nHeight, const uint256 &txhash) const;
+    // If pcommit is not NULL, the changes to the UTXO set are also added to it.
+    void UpdateCoins(CValidationState &state, CCoinsViewCache &view, CTxUndo &txundo, int nHeight, const uint256 &txhash, CCoinsCommitment *pcommit = NULL) const;
 
     // Context-independent validity checks
     bool CheckTransaction(CValidationState &state) const;
@@ -2142,11 +2171,64 @@ struct CCoinsStats
     uint256 hashBlock;
     uint64 nTransactions;
     uint64 nTransactionOutputs;
-    uint64 nSerializedSize;
-    uint256 hashSerialized;
+    uint64 nSerializedSize;     // only computed by a full scan of the coin database
+    uint256 hashSerialized;     // likewise
+    uint256 hashMuHash;         // order-independent commitment to the unspent outputs (see CCoinsCommitment)
     int64 nTotalAmount;
 
-    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
+    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), hashMuHash(0), nTotalAmount(0) {}
+};
+
+/** Rolling commitment to the unspent transaction output set, plus running totals.
+ *
+ *  Every unspent output is an element of a CMuHash3072 multiset, so spending or
+ *  creating an output is a single update instead of a rehash of the whole set.
+ *  ConnectBlock and DisconnectBlock collect the per-block changes as a delta,
+ *  and the resulting state is stored per block in the block tree database, which
+ *  makes gettxoutsetinfo <height> an O(1) lookup for any main chain block.
+ *  When used as a delta, the counters may be negative.
+ */
+class CCoinsCommitment
+{
+public:
+    CMuHash3072 muhash;
+    int64 nTransactions;
+    int64 nTransactionOutputs;
+    int64 nTotalAmount;
+
+    CCoinsCommitment()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(muhash);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nTotalAmount);
+    )
+
+    void SetNull()
+    {
+        muhash.SetNull();
+        nTransactions = 0;
+        nTransactionOutputs = 0;
+        nTotalAmount = 0;
+    }
+
+    // an output becomes unspent, resp. gets spent or disconnected
+    void AddOutput(const uint256 &txid, unsigned int n, int nHeight, bool fCoinBase, const CTxOut &out);
+    void RemoveOutput(const uint256 &txid, unsigned int n, int nHeight, bool fCoinBase, const CTxOut &out);
+
+    // a transaction gains its first, resp. loses its last unspent output
+    void AddTransaction() { nTransactions++; }
+    void RemoveTransaction() { nTransactions--; }
+
+    // apply a delta collected while connecting or disconnecting a block
+    CCoinsCommitment& operator+=(const CCoinsCommitment &delta);
+
+    void GetStats(CCoinsStats &stats) const;
 };
 
 /** Abstract view on the open txout dataset. */
@@ -1,101 +1,192 @@
 #include "mimblewimble.h"
+#include "mimblewimble_coins.h"
 #include "util.h"
 #include "hash.h"
+#include <limits>
 #include <openssl/rand.h>
 
 namespace mw {
 
 // Implementation of BlindingFactor
-BlindingFactor::BlindingFactor() {
-    vch.resize(32);
-    memset(vch.data(), 0, 32);
-}
-
-const std::vector<unsigned char>& BlindingFactor::GetBytes() const {
-    return vch;
-}
-
 BlindingFactor BlindingFactor::Random() {
-    std::vector<unsigned char> bytes(32);
-    if (RAND_bytes(bytes.data(), bytes.size()) != 1)
-        throw std::runtime_error("Failed to generate random blinding factor");
-    return BlindingFactor(bytes);
+    BlindingFactor blind;
+    RandomBlindingFactor(blind.data.data());
+    return blind;
 }
 
 void BlindingFactor::operator+=(const BlindingFactor& rhs) {
-    // Simplified implementation - in real code this would need to be done modulo curve order
-    for (size_t i = 0; i < vch.size() && i < rhs.vch.size(); i++) {
-        vch[i] += rhs.vch[i];
-    }
+    // Sum modulo the curve order, so that the sum of the blinding factors
+    // is the blinding factor of the sum of the commitments
+    if (!AddBlindingFactors(data.data(), data.data(), rhs.data.data()))
+        throw std::runtime_error("BlindingFactor::operator+= : invalid blinding factor");
+}
+
+void BlindingFactor::operator-=(const BlindingFactor& rhs) {
+    if (!SubtractBlindingFactors(data.data(), data.data(), rhs.data.data()))
+        throw std::runtime_error("BlindingFactor::operator-= : invalid blinding factor");
 }
 
 // Implementation of Commitment
 bool Commitment::IsValid() const {
-    // Simplified implementation - real version would check if it's a valid curve point
-    return vch.size() > 0;
+    return IsValidCommitment(data.data());
 }
 
 uint256 Commitment::GetHash() const {
-    return SerializeHash(*this);
+    // same as SerializeHash, without the stream
+    return Hash(data.begin(), data.end());
 }
 
-// Implementation of RangeProof
-bool RangeProof::Verify(const Commitment& commitment) const {
-    // Simplified implementation - real version would verify zero-knowledge proof
-    return commitment.IsValid() && vch.size() > 0;
+CommitmentHasher::CommitmentHasher() {
+    if (RAND_bytes((unsigned char*)&salt, sizeof(salt)) != 1)
+        throw std::runtime_error("CommitmentHasher : RAND_bytes failed");
 }
 
-// Implementation of Output
-bool Output::Verify() const {
-    // Verify that the commitment is valid
+size_t CommitmentHasher::operator()(const Commitment& commitment) const {
+    // 8 bytes of the x coordinate, salted and mixed
+    uint64 x;
+    memcpy(&x, commitment.GetBytes().data() + 1, sizeof(x));
+    x ^= salt;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(x ^ (x >> 32));
+}
+
+// Implementation of RangeProof
+bool RangeProof::Verify(const Commitment& commitment, CBulletproofBatch* batch) const {
     if (!commitment.IsValid())
         return false;
-    
-    // Verify that the range proof is valid for this commitment
-    return rangeProof.Verify(commitment);
+    if (batch) {
+        batch->Add(commitment.GetBytes().data(), data.data());
+        return true;
+    }
+    return BulletproofVerify(commitment.GetBytes().data(), data.data());
+}
+
+// Implementation of Output
+bool Output::Verify(CBulletproofBatch* batch) const {
+    // The range proof shows the commitment is to a value in [0, 2^64)
+    return rangeProof.Verify(commitment, batch);
 }
 
 uint256 Output::GetHash() const {
-    return SerializeHash(*this);
+    if (!fHashCached) {
+        hashCached = SerializeHash(*this);
+        fHashCached = true;
+    }
+    return hashCached;
 }
 
 // Implementation of Input
 uint256 Input::GetHash() const {
-    return SerializeHash(*this);
+    return commitment.GetHash();
 }
 
 // Implementation of Kernel
 uint256 Kernel::GetHash() const {
-    return SerializeHash(*this);
+    if (!fHashCached) {
+        hashCached = SerializeHash(*this);
+        fHashCached = true;
+    }
+    return hashCached;
 }
 
-bool Kernel::Verify() const {
-    // Simplified implementation - real version would verify signature using excess
-    return excess.IsValid();
+uint256 Kernel::GetSignatureHash() const {
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nFee << nLockHeight;
+    return ss.GetHash();
+}
+
+bool Kernel::Sign(const BlindingFactor& blind) {
+    unsigned char bytes[PEDERSEN_COMMITMENT_SIZE];
+    if (!PedersenCommit(bytes, 0, blind.GetBytes().data()))
+        return false;
+    excess = Commitment(bytes);
+    uint256 hash = GetSignatureHash();
+    if (!SchnorrSign(signature.data(), hash.begin(), blind.GetBytes().data()))
+        return false;
+    MarkDirty();
+    return true;
+}
+
+bool Kernel::Verify(CSchnorrBatch* batch) const {
+    if (nFee < 0)
+        return false;
+    uint256 hash = GetSignatureHash();
+    if (batch) {
+        if (!excess.IsValid())
+            return false;
+        batch->Add(excess.GetBytes().data(), hash.begin(), signature.data());
+        return true;
+    }
+    return SchnorrVerify(excess.GetBytes().data(), hash.begin(), signature.data());
 }
 
 // Implementation of Transaction
 uint256 Transaction::GetHash() const {
-    return SerializeHash(*this);
+    if (!fHashCached) {
+        hashCached = SerializeHash(*this);
+        fHashCached = true;
+    }
+    return hashCached;
 }
 
-bool Transaction::Verify() const {
-    // 1. Verify all outputs
+bool Transaction::HaveInputs(CMWCoinsView& view) const {
+    std::set<Commitment> spent;
+    for (const Input& input : vin) {
+        if (!spent.insert(input.commitment).second || !view.HaveCoin(input.commitment))
+            return false;
+    }
+    return true;
+}
+
+bool Transaction::Verify(CBulletproofBatch* batch, CMWCoinsView* view) const {
+    // 0. Inputs must exist and be unspent; with a CMWCoinsViewCache these
+    // are hash map lookups once the outputs are cached
+    if (view && !HaveInputs(*view))
+        return false;
+
+    // 1. Verify all kernel signatures, with one multi-exponentiation
+    CSchnorrBatch kernelBatch;
+    kernelBatch.reserve(kernels.size());
+    for (const Kernel& kernel : kernels) {
+        if (!kernel.Verify(&kernelBatch))
+            return false;
+    }
+    if (!kernelBatch.Verify())
+        return false;
+
+    // 2. Verify all outputs, with one multi-exponentiation for all range proofs
+    CBulletproofBatch ownBatch;
+    CBulletproofBatch* outputBatch = batch ? batch : &ownBatch;
     for (const Output& output : vout) {
-        if (!output.Verify())
+        if (!output.Verify(outputBatch))
             return false;
     }
-    
-    // 2. Verify all kernels
+    if (!batch && !ownBatch.Verify())
+        return false;
+
+    // 3. Nothing is created but the fees
+    return VerifyBalance();
+}
+
+bool Transaction::VerifyBalance() const {
+    // sum(outputs) - sum(inputs) - sum(excess) == offset*G - fee*H
+    std::vector<const unsigned char*> vPositive, vNegative;
+    vPositive.reserve(vout.size());
+    vNegative.reserve(vin.size() + kernels.size());
+    int64 nFees = 0;
+    for (const Output& output : vout)
+        vPositive.push_back(output.commitment.GetBytes().data());
+    for (const Input& input : vin)
+        vNegative.push_back(input.commitment.GetBytes().data());
     for (const Kernel& kernel : kernels) {
-        if (!kernel.Verify())
+        if (kernel.nFee < 0 || kernel.nFee > std::numeric_limits<int64>::max() - nFees)
             return false;
+        nFees += kernel.nFee;
+        vNegative.push_back(kernel.excess.GetBytes().data());
     }
-    
-    // 3. In a real implementation, verify the balance equation:
-    // sum(inputs) - sum(outputs) = sum(kernel.excess) + offset*G
-    
-    return true;
+    if (vPositive.empty() && vNegative.empty())
+        return false;
+    return PedersenCommitBalance(vPositive, vNegative, -nFees, offset.GetBytes().data());
 }
 
 Transaction Transaction::BuildTransaction(
@@ -130,26 +221,17 @@ Transaction Transaction::BuildTransaction(
 
 // Helper functions
 Commitment createCommitment(uint64_t value, const BlindingFactor& blindingFactor) {
-    // Simplified implementation - real version would compute v*H + r*G
-    std::vector<unsigned char> bytes(33, 0);
-    // Encode value in the first 8 bytes
-    memcpy(bytes.data(), &value, 8);
-    // Copy some of blinding factor bytes to make the commitment unique
-    if (blindingFactor.GetBytes().size() >= 24) {
-        memcpy(bytes.data() + 8, blindingFactor.GetBytes().data(), 24);
-    }
+    // v*H + r*G
+    unsigned char bytes[PEDERSEN_COMMITMENT_SIZE];
+    if (!PedersenCommit(bytes, value, blindingFactor.GetBytes().data()))
+        throw std::runtime_error("createCommitment : invalid blinding factor");
     return Commitment(bytes);
 }
 
 RangeProof createRangeProof(uint64_t value, const BlindingFactor& blindingFactor) {
-    // Simplified implementation - real version would create bulletproof
-    std::vector<unsigned char> proof(40, 0);
-    // Store value in the proof
-    memcpy(proof.data(), &value, sizeof(value));
-    // Store some blinding factor data
-    if (blindingFactor.GetBytes().size() >= 32) {
-        memcpy(proof.data() + 8, blindingFactor.GetBytes().data(), 32);
-    }
+    unsigned char proof[BULLETPROOF_SIZE];
+    if (!BulletproofProve(proof, value, blindingFactor.GetBytes().data()))
+        throw std::runtime_error("createRangeProof : invalid blinding factor");
     return RangeProof(proof);
 }
 
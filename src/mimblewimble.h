@@ -3,91 +3,130 @@
 
 #include "serialize.h"
 #include "uint256.h"
+#include "mimblewimble_crypto.h"
+#include <array>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
+class CMWCoinsView;
+
 namespace mw {
 
 // Basic implementation of Mimblewimble protocol
+//
+// The value types below are fixed-size byte arrays: they are trivially
+// copyable, need no heap allocation, and serialize as their bytes with
+// no length prefix.
+
+static const unsigned int KERNEL_SIGNATURE_SIZE = SCHNORR_SIGNATURE_SIZE;
 
 class BlindingFactor {
 private:
-    std::vector<unsigned char> vch;
+    std::array<unsigned char, BLINDING_FACTOR_SIZE> data;
 
 public:
-    ADD_SERIALIZE_METHODS;
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(FLATDATA(data));
+    )
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(vch);
-    }
+    BlindingFactor() { data.fill(0); }
+    explicit BlindingFactor(const unsigned char* p) { memcpy(data.data(), p, data.size()); }
 
-    BlindingFactor();
-    BlindingFactor(const std::vector<unsigned char>& bytes) : vch(bytes) {}
-
-    const std::vector<unsigned char>& GetBytes() const;
+    const std::array<unsigned char, BLINDING_FACTOR_SIZE>& GetBytes() const { return data; }
     static BlindingFactor Random();
     void operator+=(const BlindingFactor& rhs);
+    void operator-=(const BlindingFactor& rhs);
 };
 
 // Pedersen Commitment (v*H + r*G)
 class Commitment {
 private:
-    std::vector<unsigned char> vch;
+    std::array<unsigned char, PEDERSEN_COMMITMENT_SIZE> data;
 
 public:
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(vch);
-    }
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(FLATDATA(data));
+    )
 
-    Commitment() {}
-    Commitment(const std::vector<unsigned char>& bytes) : vch(bytes) {}
+    Commitment() { data.fill(0); }
+    explicit Commitment(const unsigned char* p) { memcpy(data.data(), p, data.size()); }
 
+    const std::array<unsigned char, PEDERSEN_COMMITMENT_SIZE>& GetBytes() const { return data; }
+    // 33 byte compressed secp256k1 point
     bool IsValid() const;
     uint256 GetHash() const;
+
+    friend bool operator==(const Commitment& a, const Commitment& b) { return a.data == b.data; }
+    friend bool operator!=(const Commitment& a, const Commitment& b) { return a.data != b.data; }
+    friend bool operator<(const Commitment& a, const Commitment& b) { return a.data < b.data; }
+};
+
+// Bucket hash for commitment-keyed hash maps. Commitments are chosen by
+// whoever makes the output, so the x coordinate bytes are mixed with a
+// salt drawn for each map.
+class CommitmentHasher {
+private:
+    uint64 salt;
+
+public:
+    CommitmentHasher();
+    size_t operator()(const Commitment& commitment) const;
 };
 
 // Zero-knowledge range proof
 class RangeProof {
 private:
-    std::vector<unsigned char> vch;
+    std::array<unsigned char, BULLETPROOF_SIZE> data;
 
 public:
-    ADD_SERIALIZE_METHODS;
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(FLATDATA(data));
+    )
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(vch);
-    }
+    RangeProof() { data.fill(0); }
+    explicit RangeProof(const unsigned char* p) { memcpy(data.data(), p, data.size()); }
 
-    RangeProof() {}
-    RangeProof(const std::vector<unsigned char>& bytes) : vch(bytes) {}
-    
-    bool Verify(const Commitment& commitment) const;
+    const std::array<unsigned char, BULLETPROOF_SIZE>& GetBytes() const { return data; }
+    // With a batch, the proof is only queued there and checked by batch->Verify()
+    bool Verify(const Commitment& commitment, CBulletproofBatch* batch = nullptr) const;
 };
 
+static_assert(std::is_trivially_copyable<BlindingFactor>::value, "BlindingFactor must be trivially copyable");
+static_assert(std::is_trivially_copyable<Commitment>::value, "Commitment must be trivially copyable");
+static_assert(std::is_trivially_copyable<RangeProof>::value, "RangeProof must be trivially copyable");
+
 // Mimblewimble output (UTXO)
+//
+// Output, Kernel and Transaction cache their hash; like CWalletTx, call
+// MarkDirty() after changing a field of one whose hash may have been taken.
 class Output {
 public:
     Commitment commitment;
     RangeProof rangeProof;
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    IMPLEMENT_SERIALIZE
+    (
         READWRITE(commitment);
         READWRITE(rangeProof);
-    }
+        if (fRead)
+            const_cast<Output*>(this)->MarkDirty();
+    )
+
+    Output() : fHashCached(false) {}
+    Output(const Commitment& commit, const RangeProof& proof)
+        : commitment(commit), rangeProof(proof), fHashCached(false) {}
 
-    Output() {}
-    Output(const Commitment& commit, const RangeProof& proof) 
-        : commitment(commit), rangeProof(proof) {}
-    
-    bool Verify() const;
+    bool Verify(CBulletproofBatch* batch = nullptr) const;
     uint256 GetHash() const;
+    void MarkDirty() { fHashCached = false; }
+
+private:
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
 };
 
 // Mimblewimble input
@@ -95,16 +134,14 @@ class Input {
 public:
     Commitment commitment;
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    IMPLEMENT_SERIALIZE
+    (
         READWRITE(commitment);
-    }
+    )
 
     Input() {}
     Input(const Commitment& commit) : commitment(commit) {}
-    
+
     uint256 GetHash() const;
 };
 
@@ -114,22 +151,33 @@ public:
     int64 nFee;
     unsigned int nLockHeight;
     Commitment excess;
-    std::vector<unsigned char> signature;
+    std::array<unsigned char, KERNEL_SIGNATURE_SIZE> signature;
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    IMPLEMENT_SERIALIZE
+    (
         READWRITE(nFee);
         READWRITE(nLockHeight);
         READWRITE(excess);
-        READWRITE(signature);
-    }
+        READWRITE(FLATDATA(signature));
+        if (fRead)
+            const_cast<Kernel*>(this)->MarkDirty();
+    )
+
+    Kernel() : nFee(0), nLockHeight(0), fHashCached(false) { signature.fill(0); }
 
-    Kernel() : nFee(0), nLockHeight(0) {}
-    
     uint256 GetHash() const;
-    bool Verify() const;
+    // What the excess signs: the fee and the lock height
+    uint256 GetSignatureHash() const;
+    // Set the excess to blind*G and sign with blind
+    bool Sign(const BlindingFactor& blind);
+    // The excess signs the kernel; with a batch, the signature is only
+    // queued there and checked by batch->Verify()
+    bool Verify(CSchnorrBatch* batch = nullptr) const;
+    void MarkDirty() { fHashCached = false; }
+
+private:
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
 };
 
 // Complete Mimblewimble transaction
@@ -140,26 +188,39 @@ public:
     std::vector<Kernel> kernels;
     BlindingFactor offset;
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    IMPLEMENT_SERIALIZE
+    (
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(kernels);
         READWRITE(offset);
-    }
+        if (fRead)
+            const_cast<Transaction*>(this)->MarkDirty();
+    )
+
+    Transaction() : fHashCached(false) {}
 
-    Transaction() {}
-    
     uint256 GetHash() const;
-    bool Verify() const;
-    
+    // Kernel signatures are checked together, and so are the range proofs
+    // of all outputs; pass a batch to check the proofs later with those of
+    // other transactions. With a view, every input must also be an unspent
+    // output in it.
+    bool Verify(CBulletproofBatch* batch = nullptr, CMWCoinsView* view = nullptr) const;
+    // sum(outputs) - sum(inputs) + fee*H == sum(excess) + offset*G
+    bool VerifyBalance() const;
+    // Whether each input is a distinct unspent output in the view
+    bool HaveInputs(CMWCoinsView& view) const;
+    void MarkDirty() { fHashCached = false; }
+
     static Transaction BuildTransaction(
         const std::vector<Output>& inputs,
         const std::vector<Output>& outputs,
         int64 fee,
         unsigned int lockHeight);
+
+private:
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
 };
 
 // Helper functions
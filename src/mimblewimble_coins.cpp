@@ -0,0 +1,218 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_coins.h"
+#include "util.h"
+
+#include <set>
+
+using namespace std;
+using namespace mw;
+
+CMWCoinsViewDB *pmwcoinsdbview = NULL;
+CMWCoinsViewCache *pmwcoinsTip = NULL;
+
+bool CMWCoinsView::GetCoin(const Commitment &commitment, CMWCoin &coin) { return false; }
+bool CMWCoinsView::HaveCoin(const Commitment &commitment) { return false; }
+uint256 CMWCoinsView::GetBestBlock() { return 0; }
+bool CMWCoinsView::BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+
+CMWCoinsViewBacked::CMWCoinsViewBacked(CMWCoinsView &viewIn) : base(&viewIn) { }
+bool CMWCoinsViewBacked::GetCoin(const Commitment &commitment, CMWCoin &coin) { return base->GetCoin(commitment, coin); }
+bool CMWCoinsViewBacked::HaveCoin(const Commitment &commitment) { return base->HaveCoin(commitment); }
+uint256 CMWCoinsViewBacked::GetBestBlock() { return base->GetBestBlock(); }
+void CMWCoinsViewBacked::SetBackend(CMWCoinsView &viewIn) { base = &viewIn; }
+bool CMWCoinsViewBacked::BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+
+CMWCoinsViewCache::CMWCoinsViewCache(CMWCoinsView &baseIn) : CMWCoinsViewBacked(baseIn), hashBlock(0), nCutThrough(0) { }
+
+CMWCoinsMap::iterator CMWCoinsViewCache::FetchCoin(const Commitment &commitment) {
+    CMWCoinsMap::iterator it = cacheCoins.find(commitment);
+    if (it != cacheCoins.end())
+        return it;
+    CMWCoin tmp;
+    if (!base->GetCoin(commitment, tmp))
+        return cacheCoins.end();
+    CMWCoinsCacheEntry &entry = cacheCoins[commitment];
+    entry.coin = tmp;
+    return cacheCoins.find(commitment);
+}
+
+bool CMWCoinsViewCache::GetCoin(const Commitment &commitment, CMWCoin &coin) {
+    CMWCoinsMap::iterator it = FetchCoin(commitment);
+    if (it == cacheCoins.end() || (it->second.nFlags & CMWCoinsCacheEntry::SPENT))
+        return false;
+    coin = it->second.coin;
+    return true;
+}
+
+bool CMWCoinsViewCache::HaveCoin(const Commitment &commitment) {
+    CMWCoinsMap::iterator it = FetchCoin(commitment);
+    return it != cacheCoins.end() && !(it->second.nFlags & CMWCoinsCacheEntry::SPENT);
+}
+
+uint256 CMWCoinsViewCache::GetBestBlock() {
+    if (hashBlock == 0)
+        hashBlock = base->GetBestBlock();
+    return hashBlock;
+}
+
+void CMWCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
+    hashBlock = hashBlockIn;
+}
+
+bool CMWCoinsViewCache::AddCoin(const Output &output, int nHeight) {
+    CMWCoinsMap::iterator it = FetchCoin(output.commitment);
+    if (it != cacheCoins.end()) {
+        if (!(it->second.nFlags & CMWCoinsCacheEntry::SPENT))
+            return false;
+        // spent here but still in the base: overwrite it there
+        it->second.coin = CMWCoin(output, nHeight);
+        it->second.nFlags = CMWCoinsCacheEntry::DIRTY;
+        return true;
+    }
+    CMWCoinsCacheEntry &entry = cacheCoins[output.commitment];
+    entry.coin = CMWCoin(output, nHeight);
+    entry.nFlags = CMWCoinsCacheEntry::DIRTY | CMWCoinsCacheEntry::FRESH;
+    return true;
+}
+
+bool CMWCoinsViewCache::SpendCoin(const Commitment &commitment) {
+    CMWCoinsMap::iterator it = FetchCoin(commitment);
+    if (it == cacheCoins.end() || (it->second.nFlags & CMWCoinsCacheEntry::SPENT))
+        return false;
+    if (it->second.nFlags & CMWCoinsCacheEntry::FRESH) {
+        // cut-through: the base never has to hear about this output
+        cacheCoins.erase(it);
+        nCutThrough++;
+        return true;
+    }
+    it->second.coin = CMWCoin();
+    it->second.nFlags = CMWCoinsCacheEntry::DIRTY | CMWCoinsCacheEntry::SPENT;
+    return true;
+}
+
+bool CMWCoinsViewCache::BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+    for (CMWCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.nFlags & CMWCoinsCacheEntry::DIRTY))
+            continue;
+        bool fSpent = (it->second.nFlags & CMWCoinsCacheEntry::SPENT) != 0;
+        CMWCoinsMap::iterator itUs = cacheCoins.find(it->first);
+        if (itUs == cacheCoins.end()) {
+            CMWCoinsCacheEntry &entry = cacheCoins[it->first];
+            entry.coin = it->second.coin;
+            // fresh to the child means fresh to us too, as we are its whole base
+            entry.nFlags = CMWCoinsCacheEntry::DIRTY | (it->second.nFlags & (CMWCoinsCacheEntry::FRESH | CMWCoinsCacheEntry::SPENT));
+        } else if (fSpent && (itUs->second.nFlags & CMWCoinsCacheEntry::FRESH)) {
+            cacheCoins.erase(itUs);
+            nCutThrough++;
+        } else {
+            itUs->second.coin = it->second.coin;
+            itUs->second.nFlags = CMWCoinsCacheEntry::DIRTY | (itUs->second.nFlags & CMWCoinsCacheEntry::FRESH) |
+                                  (fSpent ? CMWCoinsCacheEntry::SPENT : 0);
+        }
+    }
+    hashBlock = hashBlockIn;
+    return true;
+}
+
+bool CMWCoinsViewCache::Flush() {
+    bool fOk = base->BatchWrite(cacheCoins, GetBestBlock());
+    if (fOk)
+        cacheCoins.clear();
+    return fOk;
+}
+
+unsigned int CMWCoinsViewCache::GetCacheSize() const {
+    return cacheCoins.size();
+}
+
+CMWCoinsViewDB::CMWCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "mwcoins", nCacheSize, fMemory, fWipe) {
+}
+
+bool CMWCoinsViewDB::GetCoin(const Commitment &commitment, CMWCoin &coin) {
+    return db.Read(make_pair('c', commitment), coin);
+}
+
+bool CMWCoinsViewDB::HaveCoin(const Commitment &commitment) {
+    return db.Exists(make_pair('c', commitment));
+}
+
+uint256 CMWCoinsViewDB::GetBestBlock() {
+    uint256 hashBestBlock;
+    if (!db.Read('B', hashBestBlock))
+        return 0;
+    return hashBestBlock;
+}
+
+bool CMWCoinsViewDB::BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock) {
+    CLevelDBBatch batch;
+    unsigned int nChanged = 0;
+    for (CMWCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.nFlags & CMWCoinsCacheEntry::DIRTY))
+            continue;
+        if (it->second.nFlags & CMWCoinsCacheEntry::SPENT)
+            batch.Erase(make_pair('c', it->first));
+        else
+            batch.Write(make_pair('c', it->first), it->second.coin);
+        nChanged++;
+    }
+    if (hashBlock != 0)
+        batch.Write('B', hashBlock);
+
+    printf("Committing %u changed Mimblewimble outputs to database...\n", nChanged);
+    return db.WriteBatch(batch);
+}
+
+bool CMWCoinsViewDB::ForEachCoin(const boost::function<bool (const CMWCoin &)> &fn) {
+    leveldb::Iterator *pcursor = db.NewIterator();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(ssKeySet.str());
+
+    bool fOk = true;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'c')
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CMWCoin coin;
+            ssValue >> coin;
+            if (!fn(coin))
+                break;
+            pcursor->Next();
+        } catch (std::exception &e) {
+            fOk = error("CMWCoinsViewDB::ForEachCoin() : deserialize error");
+            break;
+        }
+    }
+    delete pcursor;
+    return fOk;
+}
+
+bool UpdateMWCoins(const Transaction &tx, CMWCoinsViewCache &view, int nHeight) {
+    // check everything first, so that a failure leaves the view as it was
+    set<Commitment> setSpent;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        if (!setSpent.insert(tx.vin[i].commitment).second || !view.HaveCoin(tx.vin[i].commitment))
+            return false;
+    set<Commitment> setCreated;
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const Commitment &commitment = tx.vout[i].commitment;
+        if (!setCreated.insert(commitment).second || (view.HaveCoin(commitment) && !setSpent.count(commitment)))
+            return false;
+    }
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        view.SpendCoin(tx.vin[i].commitment);
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        view.AddCoin(tx.vout[i], nHeight);
+    return true;
+}
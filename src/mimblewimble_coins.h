@@ -0,0 +1,156 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_COINS_H
+#define BITCOIN_MIMBLEWIMBLE_COINS_H
+
+#include "mimblewimble.h"
+#include "leveldb.h"
+
+#include <unordered_map>
+
+#include <boost/function.hpp>
+
+/** An unspent Mimblewimble output and the height of the block that created it */
+class CMWCoin
+{
+public:
+    mw::Output output;
+    int nHeight;
+
+    CMWCoin() : nHeight(0) {}
+    CMWCoin(const mw::Output &outputIn, int nHeightIn) : output(outputIn), nHeight(nHeightIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(output);
+        READWRITE(nHeight);
+    )
+};
+
+/** A coin in a CMWCoinsViewCache, with what the cache knows about it relative to its base */
+struct CMWCoinsCacheEntry
+{
+    CMWCoin coin;
+    unsigned char nFlags;
+
+    enum
+    {
+        DIRTY = 1,  // differs from the base view; written by Flush()
+        FRESH = 2,  // the base view does not have it, so spending it can simply drop it
+        SPENT = 4   // spent in this view; with DIRTY, erased from the base on Flush()
+    };
+
+    CMWCoinsCacheEntry() : nFlags(0) {}
+};
+
+typedef std::unordered_map<mw::Commitment, CMWCoinsCacheEntry, mw::CommitmentHasher> CMWCoinsMap;
+
+/** Abstract view on the Mimblewimble unspent output set, keyed by commitment */
+class CMWCoinsView
+{
+public:
+    // Retrieve the unspent output with a given commitment
+    virtual bool GetCoin(const mw::Commitment &commitment, CMWCoin &coin);
+
+    // Just check whether an unspent output with this commitment exists
+    virtual bool HaveCoin(const mw::Commitment &commitment);
+
+    // Hash of the block whose state this view represents
+    virtual uint256 GetBestBlock();
+
+    // Apply the DIRTY entries of a cache (additions and spends) and set the best block
+    virtual bool BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    // As we use CMWCoinsViews polymorphically, have a virtual destructor
+    virtual ~CMWCoinsView() {}
+};
+
+/** CMWCoinsView backed by another CMWCoinsView */
+class CMWCoinsViewBacked : public CMWCoinsView
+{
+protected:
+    CMWCoinsView *base;
+
+public:
+    CMWCoinsViewBacked(CMWCoinsView &viewIn);
+    bool GetCoin(const mw::Commitment &commitment, CMWCoin &coin);
+    bool HaveCoin(const mw::Commitment &commitment);
+    uint256 GetBestBlock();
+    void SetBackend(CMWCoinsView &viewIn);
+    bool BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock);
+};
+
+/** CMWCoinsView that adds a memory cache to another CMWCoinsView.
+ *
+ * Outputs are added and spent in the cache only. An output that is created
+ * and spent before the next Flush() is cut through: the cache forgets it
+ * and the base view never sees it.
+ */
+class CMWCoinsViewCache : public CMWCoinsViewBacked
+{
+protected:
+    uint256 hashBlock;
+    CMWCoinsMap cacheCoins;
+    uint64 nCutThrough;
+
+public:
+    CMWCoinsViewCache(CMWCoinsView &baseIn);
+
+    // Standard CMWCoinsView methods
+    bool GetCoin(const mw::Commitment &commitment, CMWCoin &coin);
+    bool HaveCoin(const mw::Commitment &commitment);
+    uint256 GetBestBlock();
+    bool BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    // Add an output; false if an unspent output with its commitment exists
+    bool AddCoin(const mw::Output &output, int nHeight);
+
+    // Spend an output; false if there is no unspent output with this commitment
+    bool SpendCoin(const mw::Commitment &commitment);
+
+    void SetBestBlock(const uint256 &hashBlockIn);
+
+    // Push the modifications applied to this cache to its base.
+    // Failure to call this method before destruction will cause the changes to be forgotten.
+    bool Flush();
+
+    // Calculate the size of the cache (in number of outputs)
+    unsigned int GetCacheSize() const;
+
+    // Outputs created and spent within this cache, which its base never saw
+    uint64 GetCutThroughCount() const { return nCutThrough; }
+
+private:
+    CMWCoinsMap::iterator FetchCoin(const mw::Commitment &commitment);
+
+    // Not copyable: layer a new cache on top with CMWCoinsViewCache(CMWCoinsView&) instead
+    CMWCoinsViewCache(const CMWCoinsViewCache &);
+    CMWCoinsViewCache &operator=(const CMWCoinsViewCache &);
+};
+
+/** CMWCoinsView backed by the Mimblewimble output database (mwcoins/) */
+class CMWCoinsViewDB : public CMWCoinsView
+{
+protected:
+    CLevelDB db;
+public:
+    CMWCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool GetCoin(const mw::Commitment &commitment, CMWCoin &coin);
+    bool HaveCoin(const mw::Commitment &commitment);
+    uint256 GetBestBlock();
+    bool BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock);
+    // Call fn on each unspent output, in commitment order, until it returns false
+    bool ForEachCoin(const boost::function<bool (const CMWCoin &)> &fn);
+};
+
+/** Spend the inputs and add the outputs of a transaction. Returns false, with
+ *  the view unchanged, if an input is missing or an output already exists. */
+bool UpdateMWCoins(const mw::Transaction &tx, CMWCoinsViewCache &view, int nHeight);
+
+/** Global variables that point to the Mimblewimble output database and its cache */
+extern CMWCoinsViewDB *pmwcoinsdbview;
+extern CMWCoinsViewCache *pmwcoinsTip;
+
+#endif // BITCOIN_MIMBLEWIMBLE_COINS_H
@@ -0,0 +1,1129 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_crypto.h"
+#include "hash.h"
+
+#include <boost/thread/once.hpp>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+using namespace std;
+
+namespace mw {
+
+namespace {
+
+//
+// Thin owners for OpenSSL objects, so that every early return frees them
+//
+
+class CScalar
+{
+private:
+    BIGNUM* bn;
+    CScalar(const CScalar&);
+    CScalar& operator=(const CScalar&);
+
+public:
+    CScalar() : bn(BN_new()) {}
+    ~CScalar() { BN_clear_free(bn); }
+    BIGNUM* get() const { return bn; }
+};
+
+class CScalarVector
+{
+private:
+    vector<BIGNUM*> v;
+    CScalarVector(const CScalarVector&);
+    CScalarVector& operator=(const CScalarVector&);
+
+public:
+    explicit CScalarVector(unsigned int n = 0) { resize(n); }
+    ~CScalarVector() { resize(0); }
+    void resize(unsigned int n)
+    {
+        while (v.size() > n) { BN_clear_free(v.back()); v.pop_back(); }
+        while (v.size() < n) v.push_back(BN_new());
+    }
+    unsigned int size() const { return v.size(); }
+    BIGNUM* operator[](unsigned int i) const { return v[i]; }
+};
+
+class CPoint
+{
+private:
+    EC_POINT* point;
+    CPoint(const CPoint&);
+    CPoint& operator=(const CPoint&);
+
+public:
+    explicit CPoint(const EC_GROUP* group) : point(EC_POINT_new(group)) {}
+    ~CPoint() { EC_POINT_free(point); }
+    EC_POINT* get() const { return point; }
+};
+
+class CPointVector
+{
+private:
+    const EC_GROUP* group;
+    vector<EC_POINT*> v;
+    CPointVector(const CPointVector&);
+    CPointVector& operator=(const CPointVector&);
+
+public:
+    CPointVector(const EC_GROUP* groupIn, unsigned int n) : group(groupIn)
+    {
+        for (unsigned int i = 0; i < n; i++)
+            v.push_back(EC_POINT_new(group));
+    }
+    ~CPointVector()
+    {
+        for (unsigned int i = 0; i < v.size(); i++)
+            EC_POINT_free(v[i]);
+    }
+    unsigned int size() const { return v.size(); }
+    EC_POINT* operator[](unsigned int i) const { return v[i]; }
+};
+
+class CBNCtx
+{
+private:
+    BN_CTX* ctx;
+    CBNCtx(const CBNCtx&);
+    CBNCtx& operator=(const CBNCtx&);
+
+public:
+    CBNCtx() : ctx(BN_CTX_new()) {}
+    ~CBNCtx() { BN_CTX_free(ctx); }
+    BN_CTX* get() const { return ctx; }
+};
+
+
+/** The curve, its order and the fixed generators, built on first use */
+class CGenerators
+{
+public:
+    EC_GROUP* group;
+    BIGNUM* order;
+    EC_POINT* H;                // value generator
+    EC_POINT* U;                // inner product generator
+    vector<EC_POINT*> vG;       // bit generators of the left vector
+    vector<EC_POINT*> vH;       // bit generators of the right vector
+
+    CGenerators();
+    ~CGenerators();
+};
+
+// Nothing-up-my-sleeve point: the first SHA-256 of (tag, index, counter) that is the x coordinate of a point
+EC_POINT* HashToPoint(const EC_GROUP* group, const string& strTag, unsigned int nIndex, BN_CTX* ctx)
+{
+    EC_POINT* point = EC_POINT_new(group);
+    CScalar x;
+    for (unsigned int nCounter = 0; ; nCounter++)
+    {
+        vector<unsigned char> vch(strTag.begin(), strTag.end());
+        for (int i = 0; i < 4; i++)
+            vch.push_back((nIndex >> (8 * i)) & 0xff);
+        for (int i = 0; i < 4; i++)
+            vch.push_back((nCounter >> (8 * i)) & 0xff);
+        unsigned char hash[32];
+        SHA256(&vch[0], vch.size(), hash);
+        BN_bin2bn(hash, sizeof(hash), x.get());
+        if (EC_POINT_set_compressed_coordinates(group, point, x.get(), 0, ctx) == 1)
+            break;
+        ERR_clear_error();
+    }
+    return point;
+}
+
+CGenerators::CGenerators()
+{
+    CBNCtx ctx;
+    group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    order = BN_new();
+    EC_GROUP_get_order(group, order, ctx.get());
+    EC_GROUP_precompute_mult(group, ctx.get());
+
+    // H: x = SHA-256(uncompressed G), even y
+    unsigned char pchG[65];
+    EC_POINT_point2oct(group, EC_GROUP_get0_generator(group), POINT_CONVERSION_UNCOMPRESSED, pchG, sizeof(pchG), ctx.get());
+    unsigned char hash[32];
+    SHA256(pchG, sizeof(pchG), hash);
+    CScalar x;
+    BN_bin2bn(hash, sizeof(hash), x.get());
+    H = EC_POINT_new(group);
+    if (EC_POINT_set_compressed_coordinates(group, H, x.get(), 0, ctx.get()) != 1)
+        throw runtime_error("CGenerators() : H is not on the curve");
+
+    U = HashToPoint(group, "Bulletproof U", 0, ctx.get());
+    for (unsigned int i = 0; i < BULLETPROOF_BITS; i++)
+    {
+        vG.push_back(HashToPoint(group, "Bulletproof G", i, ctx.get()));
+        vH.push_back(HashToPoint(group, "Bulletproof H", i, ctx.get()));
+    }
+}
+
+CGenerators::~CGenerators()
+{
+    for (unsigned int i = 0; i < vG.size(); i++)
+        EC_POINT_free(vG[i]);
+    for (unsigned int i = 0; i < vH.size(); i++)
+        EC_POINT_free(vH[i]);
+    EC_POINT_free(U);
+    EC_POINT_free(H);
+    BN_free(order);
+    EC_GROUP_free(group);
+}
+
+CGenerators* pgenerators = NULL;
+boost::once_flag generatorsOnce = BOOST_ONCE_INIT;
+
+void InitGenerators()
+{
+    pgenerators = new CGenerators();
+}
+
+const CGenerators& Generators()
+{
+    boost::call_once(InitGenerators, generatorsOnce);
+    return *pgenerators;
+}
+
+
+//
+// Scalar and point encoding
+//
+
+bool DecodeScalar(BIGNUM* bn, const unsigned char* p, const BIGNUM* order)
+{
+    BN_bin2bn(p, 32, bn);
+    return BN_cmp(bn, order) < 0;
+}
+
+void EncodeScalar(unsigned char* p, const BIGNUM* bn)
+{
+    BN_bn2binpad(bn, p, 32);
+}
+
+bool DecodePoint(const EC_GROUP* group, EC_POINT* point, const unsigned char* p, BN_CTX* ctx)
+{
+    if (p[0] != 0x02 && p[0] != 0x03)
+        return false;
+    if (EC_POINT_oct2point(group, point, p, 33, ctx) != 1)
+    {
+        ERR_clear_error();
+        return false;
+    }
+    return true;
+}
+
+bool EncodePoint(const EC_GROUP* group, const EC_POINT* point, unsigned char* p, BN_CTX* ctx)
+{
+    // the point at infinity has no 33 byte encoding
+    return EC_POINT_point2oct(group, point, POINT_CONVERSION_COMPRESSED, p, 33, ctx) == 33;
+}
+
+void RandomScalar(BIGNUM* bn, const BIGNUM* order)
+{
+    unsigned char buf[32];
+    do {
+        RAND_bytes(buf, sizeof(buf));
+        BN_bin2bn(buf, sizeof(buf), bn);
+    } while (BN_is_zero(bn) || BN_cmp(bn, order) >= 0);
+    OPENSSL_cleanse(buf, sizeof(buf));
+}
+
+void ValueScalar(BIGNUM* bn, uint64 nValue)
+{
+    unsigned char buf[8];
+    for (int i = 0; i < 8; i++)
+        buf[i] = (nValue >> (56 - 8 * i)) & 0xff;
+    BN_bin2bn(buf, sizeof(buf), bn);
+}
+
+// r = sum of vScalars[i] * vPoints[i], plus gScalar * G when given
+bool MultiMul(const EC_GROUP* group, EC_POINT* r, const BIGNUM* gScalar,
+              vector<const EC_POINT*>& vPoints, vector<const BIGNUM*>& vScalars, BN_CTX* ctx)
+{
+    return EC_POINTs_mul(group, r, gScalar, vPoints.size(), vPoints.empty() ? NULL : &vPoints[0],
+                         vScalars.empty() ? NULL : &vScalars[0], ctx) == 1;
+}
+
+
+/** Fiat-Shamir transcript: every challenge hashes the previous one with what was appended since */
+class CTranscript
+{
+private:
+    uint256 hashState;
+    vector<unsigned char> vchPending;
+
+public:
+    explicit CTranscript(const unsigned char* pCommit)
+    {
+        static const string strTag = "DuckBucks bulletproof";
+        vchPending.assign(strTag.begin(), strTag.end());
+        Append(pCommit, PEDERSEN_COMMITMENT_SIZE);
+    }
+
+    void Append(const unsigned char* p, unsigned int n)
+    {
+        vchPending.insert(vchPending.end(), p, p + n);
+    }
+
+    // false in the negligible case of a challenge that is zero or not below the order
+    bool Challenge(BIGNUM* bn, const BIGNUM* order)
+    {
+        vchPending.insert(vchPending.begin(), hashState.begin(), hashState.end());
+        hashState = Hash(vchPending.begin(), vchPending.end());
+        vchPending.clear();
+        BN_bin2bn(hashState.begin(), 32, bn);
+        return !BN_is_zero(bn) && BN_cmp(bn, order) < 0;
+    }
+};
+
+
+/** Decoded proof, laid out as in BULLETPROOF_SIZE */
+class CProof
+{
+public:
+    CPoint A, S, T1, T2;
+    CScalar taux, mu, t;
+    CPointVector vL, vR;
+    CScalar a, b;
+
+    explicit CProof(const EC_GROUP* group) : A(group), S(group), T1(group), T2(group),
+        vL(group, BULLETPROOF_ROUNDS), vR(group, BULLETPROOF_ROUNDS) {}
+
+    bool Decode(const CGenerators& gen, const unsigned char* p, BN_CTX* ctx)
+    {
+        EC_POINT* points[4] = { A.get(), S.get(), T1.get(), T2.get() };
+        for (int i = 0; i < 4; i++, p += 33)
+            if (!DecodePoint(gen.group, points[i], p, ctx))
+                return false;
+        BIGNUM* scalars[3] = { taux.get(), mu.get(), t.get() };
+        for (int i = 0; i < 3; i++, p += 32)
+            if (!DecodeScalar(scalars[i], p, gen.order))
+                return false;
+        for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++, p += 66)
+            if (!DecodePoint(gen.group, vL[j], p, ctx) || !DecodePoint(gen.group, vR[j], p + 33, ctx))
+                return false;
+        if (!DecodeScalar(a.get(), p, gen.order) || !DecodeScalar(b.get(), p + 32, gen.order))
+            return false;
+        return true;
+    }
+};
+
+// <a, b> modulo the order over n elements starting at the given offsets
+void InnerProduct(BIGNUM* r, const CScalarVector& a, unsigned int nA, const CScalarVector& b, unsigned int nB,
+                  unsigned int n, const BIGNUM* order, BN_CTX* ctx)
+{
+    CScalar tmp;
+    BN_zero(r);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        BN_mod_mul(tmp.get(), a[nA + i], b[nB + i], order, ctx);
+        BN_mod_add(r, r, tmp.get(), order, ctx);
+    }
+}
+
+// a scalar from a rewind nonce: SHA-256d(nonce || tag) modulo the order
+void NonceScalar(BIGNUM* bn, const unsigned char* pNonce, const string& strTag, const BIGNUM* order, BN_CTX* ctx)
+{
+    vector<unsigned char> vch(pNonce, pNonce + 32);
+    vch.insert(vch.end(), strTag.begin(), strTag.end());
+    uint256 hash = Hash(vch.begin(), vch.end());
+    BN_bin2bn(hash.begin(), 32, bn);
+    BN_mod(bn, bn, order, ctx);
+}
+
+bool Prove(const CGenerators& gen, unsigned char* pProof, uint64 nValue, const unsigned char* pBlind,
+           const unsigned char* pNonce, const unsigned char* pMessage, BN_CTX* ctx)
+{
+    const EC_GROUP* group = gen.group;
+    const BIGNUM* order = gen.order;
+    const unsigned int n = BULLETPROOF_BITS;
+
+    CScalar gamma, v;
+    if (!DecodeScalar(gamma.get(), pBlind, order))
+        return false;
+    ValueScalar(v.get(), nValue);
+
+    unsigned char pchCommit[PEDERSEN_COMMITMENT_SIZE];
+    CPoint V(group);
+    if (!EC_POINT_mul(group, V.get(), gamma.get(), gen.H, v.get(), ctx) || !EncodePoint(group, V.get(), pchCommit, ctx))
+        return false;
+    CTranscript transcript(pchCommit);
+
+    unsigned char* pA = pProof;
+    unsigned char* pS = pA + 33;
+    unsigned char* pT1 = pS + 33;
+    unsigned char* pT2 = pT1 + 33;
+    unsigned char* pTaux = pT2 + 33;
+    unsigned char* pMu = pTaux + 32;
+    unsigned char* pT = pMu + 32;
+    unsigned char* pLR = pT + 32;
+    unsigned char* pAB = pLR + 66 * BULLETPROOF_ROUNDS;
+
+    // A = alpha*G + <aL, G> + <aR, H> where aL are the bits of the value and aR = aL - 1
+    CScalarVector aL(n), aR(n), sL(n), sR(n);
+    CScalar alpha, rho, one, minusOne;
+    BN_one(one.get());
+    BN_sub(minusOne.get(), order, one.get());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        bool fBit = (nValue >> i) & 1;
+        BN_set_word(aL[i], fBit ? 1 : 0);
+        if (fBit)
+            BN_zero(aR[i]);
+        else
+            BN_copy(aR[i], minusOne.get());
+        RandomScalar(sL[i], order);
+        RandomScalar(sR[i], order);
+    }
+    if (pNonce)
+    {
+        // alpha = alpha' + message, where alpha' and rho come from the nonce
+        CScalar message;
+        NonceScalar(alpha.get(), pNonce, "alpha", order, ctx);
+        NonceScalar(rho.get(), pNonce, "rho", order, ctx);
+        BN_bin2bn(pMessage, BULLETPROOF_MESSAGE_SIZE, message.get());
+        BN_mod_add(alpha.get(), alpha.get(), message.get(), order, ctx);
+    }
+    else
+    {
+        RandomScalar(alpha.get(), order);
+        RandomScalar(rho.get(), order);
+    }
+
+    vector<const EC_POINT*> vPoints;
+    vector<const BIGNUM*> vScalars;
+    vPoints.insert(vPoints.end(), gen.vG.begin(), gen.vG.end());
+    vPoints.insert(vPoints.end(), gen.vH.begin(), gen.vH.end());
+    CPoint P(group);
+    for (unsigned int i = 0; i < n; i++) vScalars.push_back(aL[i]);
+    for (unsigned int i = 0; i < n; i++) vScalars.push_back(aR[i]);
+    if (!MultiMul(group, P.get(), alpha.get(), vPoints, vScalars, ctx) || !EncodePoint(group, P.get(), pA, ctx))
+        return false;
+    vScalars.clear();
+    for (unsigned int i = 0; i < n; i++) vScalars.push_back(sL[i]);
+    for (unsigned int i = 0; i < n; i++) vScalars.push_back(sR[i]);
+    if (!MultiMul(group, P.get(), rho.get(), vPoints, vScalars, ctx) || !EncodePoint(group, P.get(), pS, ctx))
+        return false;
+
+    transcript.Append(pA, 66);
+    CScalar y, z, z2;
+    if (!transcript.Challenge(y.get(), order) || !transcript.Challenge(z.get(), order))
+        return false;
+    BN_mod_sqr(z2.get(), z.get(), order, ctx);
+
+    // l(X) = l0 + l1*X, r(X) = r0 + r1*X
+    //   l0 = aL - z,   r0 = y^i*(aR + z) + z^2*2^i
+    //   l1 = sL,       r1 = y^i*sR
+    CScalarVector l0(n), r0(n), r1(n);
+    CScalar yPow, twoPow, tmp;
+    BN_one(yPow.get());
+    BN_one(twoPow.get());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        BN_mod_sub(l0[i], aL[i], z.get(), order, ctx);
+        BN_mod_add(tmp.get(), aR[i], z.get(), order, ctx);
+        BN_mod_mul(r0[i], tmp.get(), yPow.get(), order, ctx);
+        BN_mod_mul(tmp.get(), z2.get(), twoPow.get(), order, ctx);
+        BN_mod_add(r0[i], r0[i], tmp.get(), order, ctx);
+        BN_mod_mul(r1[i], sR[i], yPow.get(), order, ctx);
+        BN_mod_mul(yPow.get(), yPow.get(), y.get(), order, ctx);
+        BN_mod_add(twoPow.get(), twoPow.get(), twoPow.get(), order, ctx);
+    }
+
+    // t(X) = <l(X), r(X)> = t0 + t1*X + t2*X^2
+    CScalar t1, t2, tau1, tau2;
+    InnerProduct(t1.get(), l0, 0, r1, 0, n, order, ctx);
+    InnerProduct(tmp.get(), sL, 0, r0, 0, n, order, ctx);
+    BN_mod_add(t1.get(), t1.get(), tmp.get(), order, ctx);
+    InnerProduct(t2.get(), sL, 0, r1, 0, n, order, ctx);
+    RandomScalar(tau1.get(), order);
+    RandomScalar(tau2.get(), order);
+    if (!EC_POINT_mul(group, P.get(), tau1.get(), gen.H, t1.get(), ctx) || !EncodePoint(group, P.get(), pT1, ctx))
+        return false;
+    if (!EC_POINT_mul(group, P.get(), tau2.get(), gen.H, t2.get(), ctx) || !EncodePoint(group, P.get(), pT2, ctx))
+        return false;
+
+    transcript.Append(pT1, 66);
+    CScalar x, x2;
+    if (!transcript.Challenge(x.get(), order))
+        return false;
+    BN_mod_sqr(x2.get(), x.get(), order, ctx);
+
+    // taux = tau2*x^2 + tau1*x + z^2*gamma, mu = alpha + rho*x
+    CScalar taux, mu, t;
+    BN_mod_mul(taux.get(), tau2.get(), x2.get(), order, ctx);
+    BN_mod_mul(tmp.get(), tau1.get(), x.get(), order, ctx);
+    BN_mod_add(taux.get(), taux.get(), tmp.get(), order, ctx);
+    BN_mod_mul(tmp.get(), z2.get(), gamma.get(), order, ctx);
+    BN_mod_add(taux.get(), taux.get(), tmp.get(), order, ctx);
+    BN_mod_mul(mu.get(), rho.get(), x.get(), order, ctx);
+    BN_mod_add(mu.get(), mu.get(), alpha.get(), order, ctx);
+
+    // the vectors of the inner product argument, l = l(x) and r = r(x)
+    CScalarVector va(n), vb(n);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        BN_mod_mul(tmp.get(), sL[i], x.get(), order, ctx);
+        BN_mod_add(va[i], l0[i], tmp.get(), order, ctx);
+        BN_mod_mul(tmp.get(), r1[i], x.get(), order, ctx);
+        BN_mod_add(vb[i], r0[i], tmp.get(), order, ctx);
+    }
+    InnerProduct(t.get(), va, 0, vb, 0, n, order, ctx);
+    EncodeScalar(pTaux, taux.get());
+    EncodeScalar(pMu, mu.get());
+    EncodeScalar(pT, t.get());
+
+    transcript.Append(pTaux, 96);
+    CScalar w;
+    if (!transcript.Challenge(w.get(), order))
+        return false;
+    CPoint Q(group);
+    if (!EC_POINT_mul(group, Q.get(), NULL, gen.U, w.get(), ctx))
+        return false;
+
+    // the right generators are H_i * y^-i; the left ones are G_i
+    CPointVector vGens(group, n), vHens(group, n);
+    CScalar yInv, yInvPow;
+    BN_mod_inverse(yInv.get(), y.get(), order, ctx);
+    BN_one(yInvPow.get());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        EC_POINT_copy(vGens[i], gen.vG[i]);
+        if (!EC_POINT_mul(group, vHens[i], NULL, gen.vH[i], yInvPow.get(), ctx))
+            return false;
+        BN_mod_mul(yInvPow.get(), yInvPow.get(), yInv.get(), order, ctx);
+    }
+
+    // each round halves the vectors:
+    //   L = <a_lo, G_hi> + <b_hi, H_lo> + <a_lo, b_hi>*Q
+    //   R = <a_hi, G_lo> + <b_lo, H_hi> + <a_hi, b_lo>*Q
+    //   a' = a_lo*u + a_hi/u, b' = b_lo/u + b_hi*u, G' = G_lo/u + G_hi*u, H' = H_lo*u + H_hi/u
+    CScalar cL, cR, u, uInv;
+    unsigned int nHalf = n;
+    for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++)
+    {
+        nHalf /= 2;
+        unsigned char* pL = pLR + 66 * j;
+        unsigned char* pR = pL + 33;
+        InnerProduct(cL.get(), va, 0, vb, nHalf, nHalf, order, ctx);
+        InnerProduct(cR.get(), va, nHalf, vb, 0, nHalf, order, ctx);
+
+        vPoints.clear();
+        vScalars.clear();
+        for (unsigned int i = 0; i < nHalf; i++)
+        {
+            vPoints.push_back(vGens[nHalf + i]); vScalars.push_back(va[i]);
+            vPoints.push_back(vHens[i]); vScalars.push_back(vb[nHalf + i]);
+        }
+        vPoints.push_back(Q.get()); vScalars.push_back(cL.get());
+        if (!MultiMul(group, P.get(), NULL, vPoints, vScalars, ctx) || !EncodePoint(group, P.get(), pL, ctx))
+            return false;
+
+        vPoints.clear();
+        vScalars.clear();
+        for (unsigned int i = 0; i < nHalf; i++)
+        {
+            vPoints.push_back(vGens[i]); vScalars.push_back(va[nHalf + i]);
+            vPoints.push_back(vHens[nHalf + i]); vScalars.push_back(vb[i]);
+        }
+        vPoints.push_back(Q.get()); vScalars.push_back(cR.get());
+        if (!MultiMul(group, P.get(), NULL, vPoints, vScalars, ctx) || !EncodePoint(group, P.get(), pR, ctx))
+            return false;
+
+        transcript.Append(pL, 66);
+        if (!transcript.Challenge(u.get(), order))
+            return false;
+        BN_mod_inverse(uInv.get(), u.get(), order, ctx);
+
+        for (unsigned int i = 0; i < nHalf; i++)
+        {
+            BN_mod_mul(tmp.get(), va[nHalf + i], uInv.get(), order, ctx);
+            BN_mod_mul(va[i], va[i], u.get(), order, ctx);
+            BN_mod_add(va[i], va[i], tmp.get(), order, ctx);
+            BN_mod_mul(tmp.get(), vb[nHalf + i], u.get(), order, ctx);
+            BN_mod_mul(vb[i], vb[i], uInv.get(), order, ctx);
+            BN_mod_add(vb[i], vb[i], tmp.get(), order, ctx);
+
+            const EC_POINT* pair[2];
+            const BIGNUM* coef[2];
+            pair[0] = vGens[i]; pair[1] = vGens[nHalf + i];
+            coef[0] = uInv.get(); coef[1] = u.get();
+            if (!EC_POINTs_mul(group, vGens[i], NULL, 2, pair, coef, ctx))
+                return false;
+            pair[0] = vHens[i]; pair[1] = vHens[nHalf + i];
+            coef[0] = u.get(); coef[1] = uInv.get();
+            if (!EC_POINTs_mul(group, vHens[i], NULL, 2, pair, coef, ctx))
+                return false;
+        }
+    }
+    EncodeScalar(pAB, va[0]);
+    EncodeScalar(pAB + 32, vb[0]);
+    return true;
+}
+
+/** Accumulates the weighted checks of many proofs as one multi-exponentiation that must be the point at infinity */
+class CBatchCheck
+{
+private:
+    const CGenerators& gen;
+    BN_CTX* ctx;
+    CScalar coefG, coefH, coefU;
+    CScalarVector vCoefG, vCoefH;
+    // per proof points and their coefficients
+    vector<CProof*> vProofs;
+    vector<CPoint*> vCommits;
+    vector<const EC_POINT*> vPoints;
+    CScalarVector vCoefPoints;
+
+public:
+    CBatchCheck(const CGenerators& genIn, BN_CTX* ctxIn) : gen(genIn), ctx(ctxIn),
+        vCoefG(BULLETPROOF_BITS), vCoefH(BULLETPROOF_BITS)
+    {
+        BN_zero(coefG.get());
+        BN_zero(coefH.get());
+        BN_zero(coefU.get());
+        for (unsigned int i = 0; i < BULLETPROOF_BITS; i++)
+        {
+            BN_zero(vCoefG[i]);
+            BN_zero(vCoefH[i]);
+        }
+    }
+
+    ~CBatchCheck()
+    {
+        for (unsigned int i = 0; i < vProofs.size(); i++)
+            delete vProofs[i];
+        for (unsigned int i = 0; i < vCommits.size(); i++)
+            delete vCommits[i];
+    }
+
+    void Reserve(unsigned int nProofs)
+    {
+        vProofs.reserve(nProofs);
+        vCommits.reserve(nProofs);
+        vPoints.reserve(nProofs * (5 + 2 * BULLETPROOF_ROUNDS));
+    }
+
+    // add the checks of one proof, weighted by a random factor unless it is the first
+    bool Add(const unsigned char* pCommit, const unsigned char* pProof);
+
+    bool Check();
+};
+
+bool CBatchCheck::Add(const unsigned char* pCommit, const unsigned char* pProof)
+{
+    const BIGNUM* order = gen.order;
+    const unsigned int n = BULLETPROOF_BITS;
+
+    CPoint* V = new CPoint(gen.group);
+    vCommits.push_back(V);
+    CProof* proof = new CProof(gen.group);
+    vProofs.push_back(proof);
+    if (!DecodePoint(gen.group, V->get(), pCommit, ctx) || !proof->Decode(gen, pProof, ctx))
+        return false;
+
+    // replay the transcript
+    CTranscript transcript(pCommit);
+    const unsigned char* p = pProof;
+    CScalar y, z, x, w;
+    transcript.Append(p, 66);
+    if (!transcript.Challenge(y.get(), order) || !transcript.Challenge(z.get(), order))
+        return false;
+    transcript.Append(p + 66, 66);
+    if (!transcript.Challenge(x.get(), order))
+        return false;
+    transcript.Append(p + 132, 96);
+    if (!transcript.Challenge(w.get(), order))
+        return false;
+    CScalarVector vU(BULLETPROOF_ROUNDS), vUInv(BULLETPROOF_ROUNDS);
+    for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++)
+    {
+        transcript.Append(p + 228 + 66 * j, 66);
+        if (!transcript.Challenge(vU[j], order))
+            return false;
+        BN_mod_inverse(vUInv[j], vU[j], order, ctx);
+    }
+
+    // weight of this proof, and of its polynomial check against its inner product check
+    CScalar weight, c, wc, tmp, tmp2;
+    if (vProofs.size() == 1)
+        BN_one(weight.get());
+    else
+        RandomScalar(weight.get(), order);
+    RandomScalar(c.get(), order);
+    BN_mod_mul(wc.get(), weight.get(), c.get(), order, ctx);
+
+    CScalar z2, z3, yInv;
+    BN_mod_sqr(z2.get(), z.get(), order, ctx);
+    BN_mod_mul(z3.get(), z2.get(), z.get(), order, ctx);
+    BN_mod_inverse(yInv.get(), y.get(), order, ctx);
+
+    // s_i = prod u_j^(+1 if bit (rounds - 1 - j) of i is set, else -1), from s_0 = prod 1/u_j
+    CScalarVector s(n), sInv(n);
+    BN_one(s[0]);
+    BN_one(sInv[0]);
+    for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++)
+    {
+        BN_mod_mul(s[0], s[0], vUInv[j], order, ctx);
+        BN_mod_mul(sInv[0], sInv[0], vU[j], order, ctx);
+    }
+    CScalarVector vU2(BULLETPROOF_ROUNDS), vUInv2(BULLETPROOF_ROUNDS);
+    for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++)
+    {
+        BN_mod_sqr(vU2[j], vU[j], order, ctx);
+        BN_mod_sqr(vUInv2[j], vUInv[j], order, ctx);
+    }
+    for (unsigned int i = 1; i < n; i++)
+    {
+        unsigned int nBit = 0;
+        while ((2U << nBit) <= i)
+            nBit++;
+        unsigned int j = BULLETPROOF_ROUNDS - 1 - nBit;
+        BN_mod_mul(s[i], s[i - (1U << nBit)], vU2[j], order, ctx);
+        BN_mod_mul(sInv[i], sInv[i - (1U << nBit)], vUInv2[j], order, ctx);
+    }
+
+    // generator coefficients, with sum y^i for delta on the way:
+    //   G_i: -z - a*s_i
+    //   H_i: z + (z^2*2^i - b/s_i) * y^-i
+    CScalar yPow, yInvPow, twoPow, sumY;
+    BN_one(yPow.get());
+    BN_one(yInvPow.get());
+    BN_one(twoPow.get());
+    BN_zero(sumY.get());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        BN_mod_add(sumY.get(), sumY.get(), yPow.get(), order, ctx);
+        BN_mod_mul(yPow.get(), yPow.get(), y.get(), order, ctx);
+
+        BN_mod_mul(tmp.get(), proof->a.get(), s[i], order, ctx);
+        BN_mod_add(tmp.get(), tmp.get(), z.get(), order, ctx);
+        BN_mod_mul(tmp.get(), tmp.get(), weight.get(), order, ctx);
+        BN_mod_sub(vCoefG[i], vCoefG[i], tmp.get(), order, ctx);
+
+        BN_mod_mul(tmp.get(), z2.get(), twoPow.get(), order, ctx);
+        BN_mod_mul(tmp2.get(), proof->b.get(), sInv[i], order, ctx);
+        BN_mod_sub(tmp.get(), tmp.get(), tmp2.get(), order, ctx);
+        BN_mod_mul(tmp.get(), tmp.get(), yInvPow.get(), order, ctx);
+        BN_mod_add(tmp.get(), tmp.get(), z.get(), order, ctx);
+        BN_mod_mul(tmp.get(), tmp.get(), weight.get(), order, ctx);
+        BN_mod_add(vCoefH[i], vCoefH[i], tmp.get(), order, ctx);
+
+        BN_mod_mul(yInvPow.get(), yInvPow.get(), yInv.get(), order, ctx);
+        BN_mod_add(twoPow.get(), twoPow.get(), twoPow.get(), order, ctx);
+    }
+
+    // delta = (z - z^2) * sum y^i - z^3 * (2^64 - 1); twoPow is 2^64 now
+    CScalar delta;
+    BN_mod_sub(delta.get(), z.get(), z2.get(), order, ctx);
+    BN_mod_mul(delta.get(), delta.get(), sumY.get(), order, ctx);
+    BN_sub_word(twoPow.get(), 1);
+    BN_mod_mul(tmp.get(), z3.get(), twoPow.get(), order, ctx);
+    BN_mod_sub(delta.get(), delta.get(), tmp.get(), order, ctx);
+
+    // G: -w*(c*taux + mu)
+    BN_mod_mul(tmp.get(), c.get(), proof->taux.get(), order, ctx);
+    BN_mod_add(tmp.get(), tmp.get(), proof->mu.get(), order, ctx);
+    BN_mod_mul(tmp.get(), tmp.get(), weight.get(), order, ctx);
+    BN_mod_sub(coefG.get(), coefG.get(), tmp.get(), order, ctx);
+    // H: w*c*(delta - t)
+    BN_mod_sub(tmp.get(), delta.get(), proof->t.get(), order, ctx);
+    BN_mod_mul(tmp.get(), tmp.get(), wc.get(), order, ctx);
+    BN_mod_add(coefH.get(), coefH.get(), tmp.get(), order, ctx);
+    // U: w*x_ip*(t - a*b)
+    BN_mod_mul(tmp.get(), proof->a.get(), proof->b.get(), order, ctx);
+    BN_mod_sub(tmp.get(), proof->t.get(), tmp.get(), order, ctx);
+    BN_mod_mul(tmp.get(), tmp.get(), w.get(), order, ctx);
+    BN_mod_mul(tmp.get(), tmp.get(), weight.get(), order, ctx);
+    BN_mod_add(coefU.get(), coefU.get(), tmp.get(), order, ctx);
+
+    // V: w*c*z^2, T1: w*c*x, T2: w*c*x^2, A: w, S: w*x, L_j: w*u_j^2, R_j: w*u_j^-2
+    unsigned int nFirst = vCoefPoints.size();
+    vCoefPoints.resize(nFirst + 5 + 2 * BULLETPROOF_ROUNDS);
+    BN_mod_mul(vCoefPoints[nFirst], wc.get(), z2.get(), order, ctx);
+    BN_mod_mul(vCoefPoints[nFirst + 1], wc.get(), x.get(), order, ctx);
+    BN_mod_mul(vCoefPoints[nFirst + 2], vCoefPoints[nFirst + 1], x.get(), order, ctx);
+    BN_copy(vCoefPoints[nFirst + 3], weight.get());
+    BN_mod_mul(vCoefPoints[nFirst + 4], weight.get(), x.get(), order, ctx);
+    vPoints.push_back(V->get());
+    vPoints.push_back(proof->T1.get());
+    vPoints.push_back(proof->T2.get());
+    vPoints.push_back(proof->A.get());
+    vPoints.push_back(proof->S.get());
+    for (unsigned int j = 0; j < BULLETPROOF_ROUNDS; j++)
+    {
+        BN_mod_mul(vCoefPoints[nFirst + 5 + 2 * j], weight.get(), vU2[j], order, ctx);
+        BN_mod_mul(vCoefPoints[nFirst + 6 + 2 * j], weight.get(), vUInv2[j], order, ctx);
+        vPoints.push_back(proof->vL[j]);
+        vPoints.push_back(proof->vR[j]);
+    }
+    return true;
+}
+
+bool CBatchCheck::Check()
+{
+    vector<const EC_POINT*> vAll(vPoints);
+    vector<const BIGNUM*> vScalars;
+    vScalars.reserve(vPoints.size() + 2 * BULLETPROOF_BITS + 2);
+    for (unsigned int i = 0; i < vCoefPoints.size(); i++)
+        vScalars.push_back(vCoefPoints[i]);
+    for (unsigned int i = 0; i < BULLETPROOF_BITS; i++)
+    {
+        vAll.push_back(gen.vG[i]); vScalars.push_back(vCoefG[i]);
+        vAll.push_back(gen.vH[i]); vScalars.push_back(vCoefH[i]);
+    }
+    vAll.push_back(gen.H); vScalars.push_back(coefH.get());
+    vAll.push_back(gen.U); vScalars.push_back(coefU.get());
+
+    CPoint R(gen.group);
+    if (!MultiMul(gen.group, R.get(), coefG.get(), vAll, vScalars, ctx))
+        return false;
+    return EC_POINT_is_at_infinity(gen.group, R.get()) == 1;
+}
+
+bool VerifyBatch(const vector<CBulletproofBatch::CEntry>& vEntries)
+{
+    if (vEntries.empty())
+        return true;
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CBatchCheck check(gen, ctx.get());
+    check.Reserve(vEntries.size());
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        if (!check.Add(vEntries[i].commit, vEntries[i].proof))
+            return false;
+    return check.Check();
+}
+
+
+//
+// Schnorr signatures
+//
+
+// e = SHA-256d(R.x || P || hash) modulo the order
+void SchnorrChallenge(BIGNUM* e, const unsigned char* pRx, const unsigned char* pPubKey, const unsigned char* pHash,
+                      const BIGNUM* order, BN_CTX* ctx)
+{
+    unsigned char buf[32 + PEDERSEN_COMMITMENT_SIZE + 32];
+    memcpy(buf, pRx, 32);
+    memcpy(buf + 32, pPubKey, PEDERSEN_COMMITMENT_SIZE);
+    memcpy(buf + 32 + PEDERSEN_COMMITMENT_SIZE, pHash, 32);
+    uint256 hash = Hash(buf, buf + sizeof(buf));
+    BN_bin2bn(hash.begin(), 32, e);
+    BN_mod(e, e, order, ctx);
+}
+
+// The point with x coordinate pRx and even y; false unless pRx is its canonical encoding
+bool DecodeNonce(const EC_GROUP* group, EC_POINT* point, const unsigned char* pRx, BN_CTX* ctx)
+{
+    CScalar x;
+    BN_bin2bn(pRx, 32, x.get());
+    if (EC_POINT_set_compressed_coordinates(group, point, x.get(), 0, ctx) != 1)
+    {
+        ERR_clear_error();
+        return false;
+    }
+    unsigned char p[33];
+    return EncodePoint(group, point, p, ctx) && memcmp(p + 1, pRx, 32) == 0;
+}
+
+// sum(a_i*s_i)*G - sum(a_i*R_i) - sum(a_i*e_i*P_i) is the point at infinity, with a_0 = 1 and random a_i
+bool VerifySchnorrBatch(const vector<CSchnorrBatch::CEntry>& vEntries)
+{
+    if (vEntries.empty())
+        return true;
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    unsigned int n = vEntries.size();
+    CPointVector vPoints(gen.group, 2 * n);
+    CScalarVector vCoef(2 * n);
+    CScalar coefG, zero, a, e, s;
+    BN_zero(coefG.get());
+    BN_zero(zero.get());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const CSchnorrBatch::CEntry& entry = vEntries[i];
+        if (!DecodePoint(gen.group, vPoints[2 * i], entry.pubkey, ctx.get()) ||
+            !DecodeNonce(gen.group, vPoints[2 * i + 1], entry.sig, ctx.get()) ||
+            !DecodeScalar(s.get(), entry.sig + 32, gen.order))
+            return false;
+        SchnorrChallenge(e.get(), entry.sig, entry.pubkey, entry.hash, gen.order, ctx.get());
+        if (i == 0)
+            BN_one(a.get());
+        else
+            RandomScalar(a.get(), gen.order);
+        BN_mod_mul(s.get(), s.get(), a.get(), gen.order, ctx.get());
+        BN_mod_add(coefG.get(), coefG.get(), s.get(), gen.order, ctx.get());
+        BN_mod_mul(e.get(), e.get(), a.get(), gen.order, ctx.get());
+        BN_mod_sub(vCoef[2 * i], zero.get(), e.get(), gen.order, ctx.get());
+        BN_mod_sub(vCoef[2 * i + 1], zero.get(), a.get(), gen.order, ctx.get());
+    }
+
+    vector<const EC_POINT*> vAll;
+    vector<const BIGNUM*> vScalars;
+    for (unsigned int i = 0; i < 2 * n; i++)
+    {
+        vAll.push_back(vPoints[i]);
+        vScalars.push_back(vCoef[i]);
+    }
+    CPoint R(gen.group);
+    if (!MultiMul(gen.group, R.get(), coefG.get(), vAll, vScalars, ctx.get()))
+        return false;
+    return EC_POINT_is_at_infinity(gen.group, R.get()) == 1;
+}
+
+} // anon namespace
+
+
+bool IsValidBlindingFactor(const unsigned char* p)
+{
+    CScalar bn;
+    return DecodeScalar(bn.get(), p, Generators().order);
+}
+
+void RandomBlindingFactor(unsigned char* pOut)
+{
+    CScalar bn;
+    RandomScalar(bn.get(), Generators().order);
+    EncodeScalar(pOut, bn.get());
+}
+
+bool AddBlindingFactors(unsigned char* pOut, const unsigned char* pA, const unsigned char* pB)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar a, b;
+    if (!DecodeScalar(a.get(), pA, gen.order) || !DecodeScalar(b.get(), pB, gen.order))
+        return false;
+    BN_mod_add(a.get(), a.get(), b.get(), gen.order, ctx.get());
+    EncodeScalar(pOut, a.get());
+    return true;
+}
+
+bool SubtractBlindingFactors(unsigned char* pOut, const unsigned char* pA, const unsigned char* pB)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar a, b;
+    if (!DecodeScalar(a.get(), pA, gen.order) || !DecodeScalar(b.get(), pB, gen.order))
+        return false;
+    BN_mod_sub(a.get(), a.get(), b.get(), gen.order, ctx.get());
+    EncodeScalar(pOut, a.get());
+    return true;
+}
+
+bool IsValidCommitment(const unsigned char* p)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CPoint point(gen.group);
+    return DecodePoint(gen.group, point.get(), p, ctx.get());
+}
+
+bool PedersenCommit(unsigned char* pOut, uint64 nValue, const unsigned char* pBlind)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar v, r;
+    if (!DecodeScalar(r.get(), pBlind, gen.order))
+        return false;
+    ValueScalar(v.get(), nValue);
+    CPoint point(gen.group);
+    return EC_POINT_mul(gen.group, point.get(), r.get(), gen.H, v.get(), ctx.get()) &&
+           EncodePoint(gen.group, point.get(), pOut, ctx.get());
+}
+
+bool PedersenCommitSum(unsigned char* pOut, const vector<const unsigned char*>& vPositive,
+                       const vector<const unsigned char*>& vNegative)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CPoint sum(gen.group), point(gen.group);
+    EC_POINT_set_to_infinity(gen.group, sum.get());
+    for (unsigned int i = 0; i < vPositive.size() + vNegative.size(); i++)
+    {
+        bool fNegative = i >= vPositive.size();
+        if (!DecodePoint(gen.group, point.get(), fNegative ? vNegative[i - vPositive.size()] : vPositive[i], ctx.get()))
+            return false;
+        if (fNegative && !EC_POINT_invert(gen.group, point.get(), ctx.get()))
+            return false;
+        if (!EC_POINT_add(gen.group, sum.get(), sum.get(), point.get(), ctx.get()))
+            return false;
+    }
+    return EncodePoint(gen.group, sum.get(), pOut, ctx.get());
+}
+
+bool PedersenCommitBalance(const vector<const unsigned char*>& vPositive,
+                           const vector<const unsigned char*>& vNegative, int64 nValue, const unsigned char* pBlind)
+{
+    // sum(vPositive) - sum(vNegative) - nValue*H - blind*G must be the point at infinity
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar zero, one, b, v;
+    BN_zero(zero.get());
+    BN_one(one.get());
+    if (!DecodeScalar(b.get(), pBlind, gen.order))
+        return false;
+    BN_mod_sub(b.get(), zero.get(), b.get(), gen.order, ctx.get());
+    ValueScalar(v.get(), nValue < 0 ? -(uint64)nValue : (uint64)nValue);
+    if (nValue > 0)
+        BN_mod_sub(v.get(), zero.get(), v.get(), gen.order, ctx.get());
+
+    unsigned int n = vPositive.size() + vNegative.size();
+    CPointVector vPoints(gen.group, n);
+    vector<const EC_POINT*> vAll;
+    vector<const BIGNUM*> vScalars;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        bool fNegative = i >= vPositive.size();
+        if (!DecodePoint(gen.group, vPoints[i], fNegative ? vNegative[i - vPositive.size()] : vPositive[i], ctx.get()))
+            return false;
+        if (fNegative && !EC_POINT_invert(gen.group, vPoints[i], ctx.get()))
+            return false;
+        vAll.push_back(vPoints[i]);
+        vScalars.push_back(one.get());
+    }
+    vAll.push_back(gen.H);
+    vScalars.push_back(v.get());
+
+    CPoint R(gen.group);
+    if (!MultiMul(gen.group, R.get(), b.get(), vAll, vScalars, ctx.get()))
+        return false;
+    return EC_POINT_is_at_infinity(gen.group, R.get()) == 1;
+}
+
+bool BulletproofProve(unsigned char* pProof, uint64 nValue, const unsigned char* pBlind,
+                      const unsigned char* pNonce, const unsigned char* pMessage)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    // a challenge out of range is a 2^-128 event; fresh randomness gives fresh challenges
+    for (int nTry = 0; nTry < 8; nTry++)
+        if (Prove(gen, pProof, nValue, pBlind, pNonce, pMessage, ctx.get()))
+            return true;
+    return false;
+}
+
+bool BulletproofVerify(const unsigned char* pCommit, const unsigned char* pProof)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CBatchCheck check(gen, ctx.get());
+    return check.Add(pCommit, pProof) && check.Check();
+}
+
+bool BulletproofRewind(const unsigned char* pCommit, const unsigned char* pProof, const unsigned char* pNonce,
+                       unsigned char* pMessage)
+{
+    // replay the challenges y, z and x of the proof
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CTranscript transcript(pCommit);
+    CScalar y, z, x, mu, alpha, rho;
+    transcript.Append(pProof, 66);
+    if (!transcript.Challenge(y.get(), gen.order) || !transcript.Challenge(z.get(), gen.order))
+        return false;
+    transcript.Append(pProof + 66, 66);
+    if (!transcript.Challenge(x.get(), gen.order))
+        return false;
+    if (!DecodeScalar(mu.get(), pProof + 4 * 33 + 32, gen.order))
+        return false;
+
+    // message = mu - rho*x - alpha'
+    NonceScalar(alpha.get(), pNonce, "alpha", gen.order, ctx.get());
+    NonceScalar(rho.get(), pNonce, "rho", gen.order, ctx.get());
+    BN_mod_mul(rho.get(), rho.get(), x.get(), gen.order, ctx.get());
+    BN_mod_sub(mu.get(), mu.get(), rho.get(), gen.order, ctx.get());
+    BN_mod_sub(mu.get(), mu.get(), alpha.get(), gen.order, ctx.get());
+    if (BN_num_bytes(mu.get()) > (int)BULLETPROOF_MESSAGE_SIZE)
+        return false;
+    BN_bn2binpad(mu.get(), pMessage, BULLETPROOF_MESSAGE_SIZE);
+    return true;
+}
+
+void CBulletproofBatch::Add(const unsigned char* pCommit, const unsigned char* pProof)
+{
+    vEntries.resize(vEntries.size() + 1);
+    memcpy(vEntries.back().commit, pCommit, PEDERSEN_COMMITMENT_SIZE);
+    memcpy(vEntries.back().proof, pProof, BULLETPROOF_SIZE);
+}
+
+bool CBulletproofBatch::Verify() const
+{
+    return VerifyBatch(vEntries);
+}
+
+bool SchnorrSign(unsigned char* pSig, const unsigned char* pHash, const unsigned char* pBlind)
+{
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar x, k, e, s;
+    if (!DecodeScalar(x.get(), pBlind, gen.order) || BN_is_zero(x.get()))
+        return false;
+    CPoint P(gen.group), R(gen.group);
+    unsigned char pubkey[PEDERSEN_COMMITMENT_SIZE], nonce[33];
+    if (!EC_POINT_mul(gen.group, P.get(), x.get(), NULL, NULL, ctx.get()) ||
+        !EncodePoint(gen.group, P.get(), pubkey, ctx.get()))
+        return false;
+
+    // k and -k give R and -R: take the one with even y
+    RandomScalar(k.get(), gen.order);
+    if (!EC_POINT_mul(gen.group, R.get(), k.get(), NULL, NULL, ctx.get()) ||
+        !EncodePoint(gen.group, R.get(), nonce, ctx.get()))
+        return false;
+    if (nonce[0] == 0x03)
+        BN_sub(k.get(), gen.order, k.get());
+
+    // s = k + e*x
+    SchnorrChallenge(e.get(), nonce + 1, pubkey, pHash, gen.order, ctx.get());
+    BN_mod_mul(s.get(), e.get(), x.get(), gen.order, ctx.get());
+    BN_mod_add(s.get(), s.get(), k.get(), gen.order, ctx.get());
+    memcpy(pSig, nonce + 1, 32);
+    EncodeScalar(pSig + 32, s.get());
+    return true;
+}
+
+bool SchnorrVerify(const unsigned char* pPubKey, const unsigned char* pHash, const unsigned char* pSig)
+{
+    // s*G - e*P must be R
+    const CGenerators& gen = Generators();
+    CBNCtx ctx;
+    CScalar s, e;
+    CPoint P(gen.group), R(gen.group);
+    if (!DecodePoint(gen.group, P.get(), pPubKey, ctx.get()) || !DecodeScalar(s.get(), pSig + 32, gen.order))
+        return false;
+    SchnorrChallenge(e.get(), pSig, pPubKey, pHash, gen.order, ctx.get());
+    BN_sub(e.get(), gen.order, e.get());
+    unsigned char nonce[33];
+    if (!EC_POINT_mul(gen.group, R.get(), s.get(), P.get(), e.get(), ctx.get()) ||
+        !EncodePoint(gen.group, R.get(), nonce, ctx.get()))
+        return false;
+    return nonce[0] == 0x02 && memcmp(nonce + 1, pSig, 32) == 0;
+}
+
+void CSchnorrBatch::Add(const unsigned char* pPubKey, const unsigned char* pHash, const unsigned char* pSig)
+{
+    vEntries.resize(vEntries.size() + 1);
+    memcpy(vEntries.back().pubkey, pPubKey, PEDERSEN_COMMITMENT_SIZE);
+    memcpy(vEntries.back().hash, pHash, 32);
+    memcpy(vEntries.back().sig, pSig, SCHNORR_SIGNATURE_SIZE);
+}
+
+bool CSchnorrBatch::Verify() const
+{
+    return VerifySchnorrBatch(vEntries);
+}
+
+} // namespace mw
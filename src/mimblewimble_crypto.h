@@ -0,0 +1,128 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_CRYPTO_H
+#define BITCOIN_MIMBLEWIMBLE_CRYPTO_H
+
+#include "serialize.h"
+
+#include <vector>
+
+/** secp256k1 Pedersen commitments and Bulletproof range proofs.
+ *
+ * A commitment to value v with blinding factor r is the point v*H + r*G,
+ * where G is the usual secp256k1 generator and H the generator whose x
+ * coordinate is the SHA-256 of the uncompressed encoding of G (the same H
+ * as libsecp256k1-zkp). Commitments are 33 byte compressed points, blinding
+ * factors 32 byte big-endian scalars below the group order.
+ *
+ * A range proof shows that a commitment is to a value below 2^64 without
+ * revealing it (Bünz et al., "Bulletproofs", 2018, with the inner product
+ * argument of section 3). Proofs are made non-interactive with a SHA-256
+ * transcript that starts with the commitment. A prover that derives the
+ * blinding factors alpha and rho of A and S from a nonce can hide a short
+ * message in alpha: mu = alpha + rho*x gives it back to whoever knows the
+ * nonce, and looks random to anyone else. Verification reduces the
+ * checks of a proof to a single multi-exponentiation; CBulletproofBatch
+ * folds the checks of many proofs, with random weights, into one.
+ *
+ * Kernels are signed with Schnorr signatures whose public key is the kernel
+ * excess, a commitment to zero: blind*G. A signature is the x coordinate of
+ * the nonce point R, taken with even y, and s, such that s*G = R + e*P with
+ * e = SHA-256d(R.x || P || message). CSchnorrBatch checks many at once.
+ */
+namespace mw {
+
+static const unsigned int PEDERSEN_COMMITMENT_SIZE = 33;
+static const unsigned int BLINDING_FACTOR_SIZE = 32;
+// proven bits, and the inner product rounds that takes
+static const unsigned int BULLETPROOF_BITS = 64;
+static const unsigned int BULLETPROOF_ROUNDS = 6;
+// A, S, T1, T2; taux, mu, t; L and R per round; a, b
+static const unsigned int BULLETPROOF_SIZE = 4 * 33 + 3 * 32 + 2 * BULLETPROOF_ROUNDS * 33 + 2 * 32;
+static const unsigned int BULLETPROOF_MESSAGE_SIZE = 16;
+// R.x, s
+static const unsigned int SCHNORR_SIGNATURE_SIZE = 64;
+
+// whether p is a scalar below the group order
+bool IsValidBlindingFactor(const unsigned char* p);
+// a random scalar below the group order
+void RandomBlindingFactor(unsigned char* pOut);
+// pOut = pA + pB modulo the group order
+bool AddBlindingFactors(unsigned char* pOut, const unsigned char* pA, const unsigned char* pB);
+// pOut = pA - pB modulo the group order
+bool SubtractBlindingFactors(unsigned char* pOut, const unsigned char* pA, const unsigned char* pB);
+
+// whether p encodes a point on the curve
+bool IsValidCommitment(const unsigned char* p);
+// pOut = nValue*H + blind*G
+bool PedersenCommit(unsigned char* pOut, uint64 nValue, const unsigned char* pBlind);
+// pOut = sum of vPositive - sum of vNegative (33 bytes each); false if that is the point at infinity
+bool PedersenCommitSum(unsigned char* pOut, const std::vector<const unsigned char*>& vPositive,
+                       const std::vector<const unsigned char*>& vNegative);
+// whether sum of vPositive - sum of vNegative == nValue*H + blind*G, checked with one multi-exponentiation
+bool PedersenCommitBalance(const std::vector<const unsigned char*>& vPositive,
+                           const std::vector<const unsigned char*>& vNegative, int64 nValue, const unsigned char* pBlind);
+
+// prove that PedersenCommit(nValue, pBlind) commits to a value below 2^64; pProof takes BULLETPROOF_SIZE bytes.
+// With a 32 byte pNonce, the proof carries the BULLETPROOF_MESSAGE_SIZE bytes of pMessage, which
+// BulletproofRewind gets back with the same nonce
+bool BulletproofProve(unsigned char* pProof, uint64 nValue, const unsigned char* pBlind,
+                      const unsigned char* pNonce = NULL, const unsigned char* pMessage = NULL);
+bool BulletproofVerify(const unsigned char* pCommit, const unsigned char* pProof);
+// the message of a proof made with pNonce; false, in all likelihood, for a proof made with another nonce
+bool BulletproofRewind(const unsigned char* pCommit, const unsigned char* pProof, const unsigned char* pNonce,
+                       unsigned char* pMessage);
+
+// sign the 32 byte pHash with pBlind; the public key is PedersenCommit(0, pBlind)
+bool SchnorrSign(unsigned char* pSig, const unsigned char* pHash, const unsigned char* pBlind);
+bool SchnorrVerify(const unsigned char* pPubKey, const unsigned char* pHash, const unsigned char* pSig);
+
+/** Range proofs collected for verification with one multi-exponentiation */
+class CBulletproofBatch
+{
+public:
+    struct CEntry
+    {
+        unsigned char commit[PEDERSEN_COMMITMENT_SIZE];
+        unsigned char proof[BULLETPROOF_SIZE];
+    };
+
+private:
+    std::vector<CEntry> vEntries;
+
+public:
+    void Add(const unsigned char* pCommit, const unsigned char* pProof);
+    void reserve(unsigned int n) { vEntries.reserve(n); }
+    unsigned int size() const { return vEntries.size(); }
+    void clear() { vEntries.clear(); }
+    // true if every proof added is valid; a batch that fails does not say which proof failed
+    bool Verify() const;
+};
+
+/** Schnorr signatures collected for verification with one multi-exponentiation */
+class CSchnorrBatch
+{
+public:
+    struct CEntry
+    {
+        unsigned char pubkey[PEDERSEN_COMMITMENT_SIZE];
+        unsigned char hash[32];
+        unsigned char sig[SCHNORR_SIGNATURE_SIZE];
+    };
+
+private:
+    std::vector<CEntry> vEntries;
+
+public:
+    void Add(const unsigned char* pPubKey, const unsigned char* pHash, const unsigned char* pSig);
+    void reserve(unsigned int n) { vEntries.reserve(n); }
+    unsigned int size() const { return vEntries.size(); }
+    void clear() { vEntries.clear(); }
+    // true if every signature added is valid
+    bool Verify() const;
+};
+
+} // namespace mw
+
+#endif // BITCOIN_MIMBLEWIMBLE_CRYPTO_H
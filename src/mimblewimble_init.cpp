@@ -1,64 +1,79 @@
 #include "mimblewimble_init.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_mmr.h"
 #include "util.h"
-#include "test_mimblewimble.cpp"
 
 // Global instances of MW objects
 std::unique_ptr<mw::MimblewimbleWallet> g_pMWWallet;
 
 bool InitMimblewimbleProtocol()
 {
-    LogPrintf("Initializing Mimblewimble protocol...\n");
-    
-    // In a production implementation, we would do several things here:
-    // 1. Load any stored Mimblewimble state from disk
-    // 2. Set up the necessary database tables
-    // 3. Initialize cryptographic components
-    // 4. Register network handlers for MW messages
-    
+    printf("Initializing Mimblewimble protocol...\n");
+
+    // Open the unspent output set (mwcoins/) and its cache
+    try {
+        size_t nCacheSize = 8 << 20; // LevelDB cache of the output set
+        delete pmwcoinsTip;
+        delete pmwcoinsdbview;
+        pmwcoinsdbview = new CMWCoinsViewDB(nCacheSize);
+        pmwcoinsTip = new CMWCoinsViewCache(*pmwcoinsdbview);
+    } catch (const std::exception& e) {
+        printf("Error opening Mimblewimble output database: %s\n", e.what());
+        return false;
+    }
+    printf("Mimblewimble output set at block %s\n", pmwcoinsTip->GetBestBlock().ToString().c_str());
+
+    // Open the kernel and output MMRs (mmr/)
+    try {
+        delete pmwaccumulators;
+        pmwaccumulators = new CMWAccumulators(GetDataDir() / "mmr");
+    } catch (const std::exception& e) {
+        printf("Error opening Mimblewimble MMRs: %s\n", e.what());
+        return false;
+    }
+    printf("Mimblewimble MMRs: %"PRI64u" kernels, %"PRI64u" outputs\n",
+              pmwaccumulators->kernels.GetLeafCount(), pmwaccumulators->outputs.GetLeafCount());
+
     return true;
 }
 
 bool RegisterMimblewimbleWalletHooks()
 {
     if (!pwalletMain) {
-        LogPrintf("Error: Can't register Mimblewimble wallet hooks - wallet not loaded yet\n");
+        printf("Error: Can't register Mimblewimble wallet hooks - wallet not loaded yet\n");
         return false;
     }
     
-    // Create the MW wallet instance
+    // Create the MW wallet instance; it reads its outputs from wallet.dat
     g_pMWWallet.reset(new mw::MimblewimbleWallet(pwalletMain));
     
-    LogPrintf("Mimblewimble wallet hooks registered\n");
-    
-    // In a production implementation, we would:
-    // 1. Hook into tx creation to add MW compatibility
-    // 2. Add callbacks for wallet events (new tx, block connected, etc.)
-    // 3. Register RPC commands for MW functionality
+    printf("Mimblewimble wallet hooks registered\n");
     
     return true;
 }
 
 bool SaveMimblewimbleData()
 {
-    if (!g_pMWWallet) {
-        LogPrintf("Error: Can't save Mimblewimble data - wallet not initialized\n");
+    // Write the cached changes to the output set in one batch
+    if (pmwcoinsTip && !pmwcoinsTip->Flush()) {
+        printf("Error: Can't flush the Mimblewimble output set\n");
         return false;
     }
-    
-    // In a real implementation, this would:
-    // 1. Serialize the MW wallet state
-    // 2. Save it to the wallet database or a separate file
-    // 3. Ensure consistency with the main wallet
-    
-    LogPrintf("Mimblewimble data saved\n");
+    if (pmwaccumulators && !pmwaccumulators->Flush()) {
+        printf("Error: Can't flush the Mimblewimble MMRs\n");
+        return false;
+    }
+
+    // The wallet's outputs are written to wallet.dat as they change
+    printf("Mimblewimble data saved\n");
     return true;
 }
 
-void RunMimblewimbleTest()
+void ShutdownMimblewimbleProtocol()
 {
-    if (pwalletMain) {
-        ::RunMimblewimbleTest(pwalletMain);
-    } else {
-        LogPrintf("Cannot run Mimblewimble test - wallet not loaded\n");
-    }
+    SaveMimblewimbleData();
+    g_pMWWallet.reset();
+    delete pmwcoinsTip; pmwcoinsTip = NULL;
+    delete pmwcoinsdbview; pmwcoinsdbview = NULL;
+    delete pmwaccumulators; pmwaccumulators = NULL;
 } 
\ No newline at end of file
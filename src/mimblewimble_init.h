@@ -6,6 +6,11 @@
 #include "mimblewimble.h"
 #include "mimblewimble_wallet.h"
 
+#include <memory>
+
+/** The Mimblewimble outputs of pwalletMain, NULL without a wallet */
+extern std::unique_ptr<mw::MimblewimbleWallet> g_pMWWallet;
+
 /** Initialize Mimblewimble protocol for DuckBucks */
 bool InitMimblewimbleProtocol();
 
@@ -15,7 +20,7 @@ bool RegisterMimblewimbleWalletHooks();
 /** Save Mimblewimble wallet data */
 bool SaveMimblewimbleData();
 
-/** Run a test transaction using Mimblewimble */
-void RunMimblewimbleTest();
+/** Flush and close the Mimblewimble state and wallet; requires cs_main */
+void ShutdownMimblewimbleProtocol();
 
-#endif // MIMBLEWIMBLE_INIT_H 
\ No newline at end of file
+#endif // MIMBLEWIMBLE_INIT_H 
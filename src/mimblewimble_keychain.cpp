@@ -0,0 +1,216 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_keychain.h"
+#include "mimblewimble_coins.h"
+#include "hash.h"
+#include "util.h"
+
+#include <limits>
+
+#include <openssl/crypto.h>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace mw;
+
+// The range proof message: value (8 bytes, big endian), key index (4 bytes,
+// big endian) and 4 zero bytes
+
+static void EncodeMessage(unsigned char *pMessage, uint64 nValue, unsigned int nIndex)
+{
+    memset(pMessage, 0, BULLETPROOF_MESSAGE_SIZE);
+    for (int i = 0; i < 8; i++)
+        pMessage[i] = (nValue >> (56 - 8 * i)) & 0xff;
+    for (int i = 0; i < 4; i++)
+        pMessage[8 + i] = (nIndex >> (24 - 8 * i)) & 0xff;
+}
+
+static bool DecodeMessage(const unsigned char *pMessage, uint64 &nValue, unsigned int &nIndex)
+{
+    for (unsigned int i = 12; i < BULLETPROOF_MESSAGE_SIZE; i++)
+        if (pMessage[i] != 0)
+            return false;
+    nValue = 0;
+    for (int i = 0; i < 8; i++)
+        nValue = (nValue << 8) | pMessage[i];
+    nIndex = 0;
+    for (int i = 0; i < 4; i++)
+        nIndex = (nIndex << 8) | pMessage[8 + i];
+    return true;
+}
+
+CMWKeyChain::CMWKeyChain(const unsigned char *pSeed, unsigned int nSize)
+{
+    // keep the HD seed itself out of this object
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << string("mimblewimble seed");
+    ss.write((const char*)pSeed, nSize);
+    seed = ss.GetHash();
+}
+
+CMWKeyChain::~CMWKeyChain()
+{
+    OPENSSL_cleanse(seed.begin(), seed.size());
+}
+
+BlindingFactor CMWKeyChain::GetBlind(unsigned int nIndex) const
+{
+    // a hash is a valid nonzero scalar but for 2^-128 of them; the counter
+    // takes the next one then
+    static const uint256 zero(0);
+    for (unsigned int nCounter = 0; ; nCounter++)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << string("blind") << seed << nIndex << nCounter;
+        uint256 hash = ss.GetHash();
+        if (hash != zero && IsValidBlindingFactor(hash.begin()))
+        {
+            BlindingFactor blind(hash.begin());
+            OPENSSL_cleanse(hash.begin(), hash.size());
+            return blind;
+        }
+    }
+}
+
+uint256 CMWKeyChain::GetRewindNonce(const Commitment &commitment) const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << string("rewind") << seed << commitment;
+    return ss.GetHash();
+}
+
+Output CMWKeyChain::CreateOutput(int64 nValue, unsigned int nIndex) const
+{
+    if (IsNull())
+        throw runtime_error("CMWKeyChain::CreateOutput() : no seed");
+    if (nValue < 0)
+        throw runtime_error("CMWKeyChain::CreateOutput() : negative value");
+
+    BlindingFactor blind = GetBlind(nIndex);
+    Commitment commitment = createCommitment(nValue, blind);
+    uint256 nonce = GetRewindNonce(commitment);
+    unsigned char message[BULLETPROOF_MESSAGE_SIZE];
+    EncodeMessage(message, nValue, nIndex);
+
+    unsigned char proof[BULLETPROOF_SIZE];
+    if (!BulletproofProve(proof, nValue, blind.GetBytes().data(), nonce.begin(), message))
+        throw runtime_error("CMWKeyChain::CreateOutput() : range proof failed");
+    return Output(commitment, RangeProof(proof));
+}
+
+bool CMWKeyChain::RewindOutput(const Output &output, int64 &nValue, unsigned int &nIndex) const
+{
+    if (IsNull())
+        return false;
+
+    uint256 nonce = GetRewindNonce(output.commitment);
+    unsigned char message[BULLETPROOF_MESSAGE_SIZE];
+    uint64 nRewound;
+    if (!BulletproofRewind(output.commitment.GetBytes().data(), output.rangeProof.GetBytes().data(),
+                           nonce.begin(), message) ||
+        !DecodeMessage(message, nRewound, nIndex))
+        return false;
+    if (nRewound > (uint64)std::numeric_limits<int64>::max())
+        return false;
+
+    // the message only says which key to try; the commitment must open to it
+    if (createCommitment(nRewound, GetBlind(nIndex)) != output.commitment)
+        return false;
+    nValue = nRewound;
+    return true;
+}
+
+// Rewind coins [nBegin, nEnd) of vCoins
+static void ScanMWCoinSlice(const vector<CMWCoin> &vCoins, size_t nBegin, size_t nEnd,
+                            const CMWKeyChain &keychain, vector<CMWWalletOutput> &vFound)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+    {
+        const CMWCoin &coin = vCoins[i];
+        int64 nValue;
+        unsigned int nIndex;
+        if (keychain.RewindOutput(coin.output, nValue, nIndex))
+            vFound.push_back(CMWWalletOutput(coin.output, nValue, nIndex, coin.nHeight));
+    }
+}
+
+/** Collects coins from the database and rewinds them MW_SCAN_BATCH at a time */
+class CMWCoinScanner
+{
+private:
+    const CMWKeyChain &keychain;
+    unsigned int nThreads;
+    vector<CMWCoin> vBatch;
+    vector<CMWWalletOutput> &vFound;
+
+public:
+    uint64 nScanned;
+
+    CMWCoinScanner(const CMWKeyChain &keychainIn, unsigned int nThreadsIn, vector<CMWWalletOutput> &vFoundIn) :
+        keychain(keychainIn), nThreads(nThreadsIn), vFound(vFoundIn), nScanned(0)
+    {
+        vBatch.reserve(MW_SCAN_BATCH);
+    }
+
+    bool operator()(const CMWCoin &coin)
+    {
+        vBatch.push_back(coin);
+        if (vBatch.size() == MW_SCAN_BATCH)
+            Flush();
+        return true;
+    }
+
+    void Flush()
+    {
+        if (vBatch.empty())
+            return;
+
+        size_t nSlices = std::min((size_t)nThreads, vBatch.size());
+        if (nSlices <= 1)
+            ScanMWCoinSlice(vBatch, 0, vBatch.size(), keychain, vFound);
+        else
+        {
+            vector<vector<CMWWalletOutput> > vSliceFound(nSlices);
+            boost::thread_group threadGroup;
+            size_t nPerSlice = (vBatch.size() + nSlices - 1) / nSlices;
+            for (size_t i = 0; i < nSlices; i++)
+            {
+                size_t nBegin = i * nPerSlice;
+                size_t nEnd = std::min(nBegin + nPerSlice, vBatch.size());
+                threadGroup.create_thread(boost::bind(&ScanMWCoinSlice, boost::cref(vBatch), nBegin, nEnd,
+                                                      boost::cref(keychain), boost::ref(vSliceFound[i])));
+            }
+            threadGroup.join_all();
+            BOOST_FOREACH(const vector<CMWWalletOutput> &v, vSliceFound)
+                vFound.insert(vFound.end(), v.begin(), v.end());
+        }
+        nScanned += vBatch.size();
+        vBatch.clear();
+    }
+};
+
+bool ScanMWCoins(CMWCoinsViewDB &db, const CMWKeyChain &keychain, unsigned int nThreads,
+                 vector<CMWWalletOutput> &vFound)
+{
+    if (keychain.IsNull())
+        return error("ScanMWCoins() : no seed");
+    if (nThreads == 0)
+        nThreads = 1;
+
+    int64 nStart = GetTimeMillis();
+    size_t nFoundBefore = vFound.size();
+    CMWCoinScanner scanner(keychain, nThreads, vFound);
+    if (!db.ForEachCoin(boost::ref(scanner)))
+        return false;
+    scanner.Flush();
+
+    printf("ScanMWCoins() : %"PRI64u" outputs scanned, %"PRIszu" found, %"PRI64d"ms\n",
+           scanner.nScanned, vFound.size() - nFoundBefore, GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_KEYCHAIN_H
+#define BITCOIN_MIMBLEWIMBLE_KEYCHAIN_H
+
+#include "mimblewimble.h"
+
+class CMWCoinsViewDB;
+
+/** Deterministic Mimblewimble wallet keys.
+ *
+ * The blinding factor of the wallet's output n is derived from the wallet's
+ * HD seed and n. Its range proof is made with a nonce derived from the seed
+ * and the commitment, and carries the value and n (see BulletproofRewind).
+ * With the seed alone, the wallet finds its outputs in the unspent output
+ * set by rewinding each range proof: for an output of somebody else the
+ * rewound message is out of range, which costs a few hashes to see and no
+ * curve arithmetic. Blinding factors are never written anywhere.
+ */
+class CMWKeyChain
+{
+private:
+    uint256 seed;
+
+public:
+    CMWKeyChain() : seed(0) {}
+    // from the key material of the wallet's HD seed
+    CMWKeyChain(const unsigned char *pSeed, unsigned int nSize);
+    ~CMWKeyChain();
+
+    bool IsNull() const { return seed == 0; }
+
+    mw::BlindingFactor GetBlind(unsigned int nIndex) const;
+    uint256 GetRewindNonce(const mw::Commitment &commitment) const;
+
+    // Output nIndex, for nValue
+    mw::Output CreateOutput(int64 nValue, unsigned int nIndex) const;
+    // Whether the output is one of ours; its value and index if so
+    bool RewindOutput(const mw::Output &output, int64 &nValue, unsigned int &nIndex) const;
+};
+
+/** An output of the wallet, as stored in wallet.dat */
+class CMWWalletOutput
+{
+public:
+    int nVersion;
+    mw::Output output;
+    int64 nValue;
+    unsigned int nKeyIndex;
+    int nHeight; // of the block that created it, 0 until known
+
+    CMWWalletOutput()
+    {
+        nVersion = 1;
+        nValue = 0;
+        nKeyIndex = 0;
+        nHeight = 0;
+    }
+
+    CMWWalletOutput(const mw::Output &outputIn, int64 nValueIn, unsigned int nKeyIndexIn, int nHeightIn = 0)
+    {
+        nVersion = 1;
+        output = outputIn;
+        nValue = nValueIn;
+        nKeyIndex = nKeyIndexIn;
+        nHeight = nHeightIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(output);
+        READWRITE(nValue);
+        READWRITE(nKeyIndex);
+        READWRITE(nHeight);
+    )
+};
+
+// outputs handed to the scan threads at a time
+static const unsigned int MW_SCAN_BATCH = 4096;
+
+/** Rewind every unspent output in db with nThreads threads; the wallet's
+ *  outputs are appended to vFound. */
+bool ScanMWCoins(CMWCoinsViewDB &db, const CMWKeyChain &keychain, unsigned int nThreads,
+                 std::vector<CMWWalletOutput> &vFound);
+
+#endif // BITCOIN_MIMBLEWIMBLE_KEYCHAIN_H
@@ -0,0 +1,402 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_mmr.h"
+#include "hash.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace boost::interprocess;
+
+CMWAccumulators *pmwaccumulators = NULL;
+
+// Positions and heights of the peaks of an MMR with nLeaves leaves, left to
+// right: one perfect tree per bit set in nLeaves, the tallest first.
+static void GetPeakPositions(uint64 nLeaves, vector<uint64> &vPos, vector<int> &vHeight)
+{
+    uint64 nStart = 0;
+    for (int nHeight = 63; nHeight >= 0; nHeight--) {
+        if (!(nLeaves & (1ULL << nHeight)))
+            continue;
+        uint64 nTreeSize = (2ULL << nHeight) - 1;
+        vPos.push_back(nStart + nTreeSize - 1);
+        vHeight.push_back(nHeight);
+        nStart += nTreeSize;
+    }
+}
+
+// Which of those peaks has leaf nLeaf below it
+static unsigned int GetPeakIndex(uint64 nLeaves, uint64 nLeaf, int &nHeight)
+{
+    unsigned int nIndex = 0;
+    uint64 nStart = 0;
+    for (nHeight = 63; nHeight >= 0; nHeight--) {
+        if (!(nLeaves & (1ULL << nHeight)))
+            continue;
+        nStart += 1ULL << nHeight;
+        if (nLeaf < nStart)
+            break;
+        nIndex++;
+    }
+    return nIndex;
+}
+
+static int BitCount(uint64 n)
+{
+    int nCount = 0;
+    for (; n; n &= n - 1)
+        nCount++;
+    return nCount;
+}
+
+uint64 CMMR::LeafPos(uint64 nLeaf)
+{
+    // also the size of an MMR with nLeaf leaves
+    return 2 * nLeaf - BitCount(nLeaf);
+}
+
+uint256 CMMR::HashLeaf(uint64 nPos, const unsigned char *pData, unsigned int nDataSize)
+{
+    return Hash(BEGIN(nPos), END(nPos), pData, pData + nDataSize);
+}
+
+uint256 CMMR::HashParent(uint64 nPos, const uint256 &left, const uint256 &right)
+{
+    unsigned char buf[sizeof(nPos) + 64];
+    memcpy(buf, &nPos, sizeof(nPos));
+    memcpy(buf + sizeof(nPos), left.begin(), 32);
+    memcpy(buf + sizeof(nPos) + 32, right.begin(), 32);
+    return Hash(buf, buf + sizeof(buf));
+}
+
+uint256 CMMR::BagPeaks(uint64 nSize, const vector<uint256> &vPeaks)
+{
+    if (vPeaks.empty())
+        return 0;
+    uint256 hash = vPeaks.back();
+    for (int i = (int)vPeaks.size() - 2; i >= 0; i--)
+        hash = HashParent(nSize, vPeaks[i], hash);
+    return hash;
+}
+
+bool CMMRProof::Verify(const uint256 &hashRoot, const unsigned char *pData, unsigned int nDataSize) const
+{
+    if (nLeaf >= nLeaves)
+        return false;
+    int nHeight;
+    unsigned int nIndex = GetPeakIndex(nLeaves, nLeaf, nHeight);
+    if (vPath.size() != (unsigned int)nHeight || vPeaks.size() != (unsigned int)BitCount(nLeaves) - 1)
+        return false;
+
+    uint64 nPos = CMMR::LeafPos(nLeaf);
+    uint256 hash = CMMR::HashLeaf(nPos, pData, nDataSize);
+    for (int k = 0; k < nHeight; k++) {
+        if (nLeaf & (1ULL << k)) {
+            // right child: the parent follows it
+            nPos++;
+            hash = CMMR::HashParent(nPos, vPath[k], hash);
+        } else {
+            // left child: the parent follows the sibling subtree
+            nPos += 2ULL << k;
+            hash = CMMR::HashParent(nPos, hash, vPath[k]);
+        }
+    }
+
+    vector<uint256> vAllPeaks(vPeaks);
+    vAllPeaks.insert(vAllPeaks.begin() + nIndex, hash);
+    return CMMR::BagPeaks(CMMR::LeafPos(nLeaves), vAllPeaks) == hashRoot;
+}
+
+CMMR::CMMR(const boost::filesystem::path &pathDirIn, unsigned int nDataSizeIn, bool fLeafSetIn) :
+    pathDir(pathDirIn), nDataSize(nDataSizeIn), fLeafSet(fLeafSetIn), fSpentDirty(false)
+{
+    boost::filesystem::create_directories(pathDir);
+    const char *files[] = { "hash.dat", "data.dat", "leaf.dat" };
+    for (unsigned int i = 0; i < 3; i++) {
+        FILE *file = fopen((pathDir / files[i]).string().c_str(), "ab");
+        if (!file)
+            throw runtime_error(strprintf("CMMR : cannot open %s", (pathDir / files[i]).string().c_str()));
+        fclose(file);
+    }
+
+    // a flush cut short may have written more of one file than the other
+    uint64 nHashes = boost::filesystem::file_size(pathDir / "hash.dat") / sizeof(uint256);
+    nFlushedLeaves = boost::filesystem::file_size(pathDir / "data.dat") / nDataSize;
+    while (LeafPos(nFlushedLeaves) > nHashes)
+        nFlushedLeaves--;
+    nFlushedSize = LeafPos(nFlushedLeaves);
+    boost::filesystem::resize_file(pathDir / "hash.dat", nFlushedSize * sizeof(uint256));
+    boost::filesystem::resize_file(pathDir / "data.dat", nFlushedLeaves * nDataSize);
+
+    if (fLeafSet) {
+        vSpent.resize((nFlushedLeaves + 7) / 8);
+        FILE *file = fopen((pathDir / "leaf.dat").string().c_str(), "rb");
+        if (file && !vSpent.empty()) {
+            if (fread(&vSpent[0], 1, vSpent.size(), file) != vSpent.size())
+                printf("CMMR : leaf set of %s is short, treating the rest as unspent\n", pathDir.string().c_str());
+        }
+        if (file)
+            fclose(file);
+    }
+    Map();
+}
+
+void CMMR::Map()
+{
+    mapped_region().swap(regionHashes);
+    mapped_region().swap(regionData);
+    if (nFlushedSize == 0)
+        return;
+    file_mapping((pathDir / "hash.dat").string().c_str(), read_only).swap(fileHashes);
+    mapped_region(fileHashes, read_only).swap(regionHashes);
+    file_mapping((pathDir / "data.dat").string().c_str(), read_only).swap(fileData);
+    mapped_region(fileData, read_only).swap(regionData);
+}
+
+uint256 CMMR::GetHashAt(uint64 nPos) const
+{
+    if (nPos >= nFlushedSize)
+        return vPendingHashes[nPos - nFlushedSize];
+    uint256 hash;
+    memcpy(hash.begin(), (const unsigned char*)regionHashes.get_address() + nPos * sizeof(uint256), sizeof(uint256));
+    return hash;
+}
+
+bool CMMR::GetLeaf(uint64 nLeaf, vector<unsigned char> &vData) const
+{
+    if (nLeaf >= GetLeafCount())
+        return false;
+    const unsigned char *p;
+    if (nLeaf < nFlushedLeaves)
+        p = (const unsigned char*)regionData.get_address() + nLeaf * nDataSize;
+    else
+        p = &vPendingData[(nLeaf - nFlushedLeaves) * nDataSize];
+    vData.assign(p, p + nDataSize);
+    return true;
+}
+
+uint256 CMMR::GetRoot() const
+{
+    vector<uint256> vPeaks;
+    GetPeaks(vPeaks);
+    return BagPeaks(GetSize(), vPeaks);
+}
+
+void CMMR::GetPeaks(vector<uint256> &vPeaks) const
+{
+    vector<uint64> vPos;
+    vector<int> vHeight;
+    GetPeakPositions(GetLeafCount(), vPos, vHeight);
+    vPeaks.clear();
+    vPeaks.reserve(vPos.size());
+    for (unsigned int i = 0; i < vPos.size(); i++)
+        vPeaks.push_back(GetHashAt(vPos[i]));
+}
+
+uint64 CMMR::Append(const unsigned char *pData)
+{
+    uint64 nLeaf = GetLeafCount();
+    uint64 nPos = GetSize();
+    uint256 hash = HashLeaf(nPos, pData, nDataSize);
+    vPendingHashes.push_back(hash);
+    vPendingData.insert(vPendingData.end(), pData, pData + nDataSize);
+
+    // each trailing one bit of the leaf number is a tree this leaf completes
+    for (int nHeight = 0; nLeaf & (1ULL << nHeight); nHeight++) {
+        uint256 hashLeft = GetHashAt(nPos - ((2ULL << nHeight) - 1));
+        nPos++;
+        hash = HashParent(nPos, hashLeft, hash);
+        vPendingHashes.push_back(hash);
+    }
+
+    if (fLeafSet && nLeaf % 8 == 0)
+        vSpent.push_back(0);
+    return nLeaf;
+}
+
+bool CMMR::Rewind(uint64 nLeaves, const vector<uint64> &vUnspend)
+{
+    if (nLeaves > GetLeafCount())
+        return error("CMMR::Rewind() : cannot rewind %s to %"PRI64u" leaves, it has %"PRI64u,
+                     pathDir.string().c_str(), nLeaves, GetLeafCount());
+
+    bool fTruncate = nLeaves < nFlushedLeaves;
+    if (fTruncate) {
+        vPendingHashes.clear();
+        vPendingData.clear();
+        nFlushedLeaves = nLeaves;
+        nFlushedSize = LeafPos(nLeaves);
+        // no mapping may be open while the files shrink
+        mapped_region().swap(regionHashes);
+        mapped_region().swap(regionData);
+        file_mapping().swap(fileHashes);
+        file_mapping().swap(fileData);
+        boost::filesystem::resize_file(pathDir / "hash.dat", nFlushedSize * sizeof(uint256));
+        boost::filesystem::resize_file(pathDir / "data.dat", nFlushedLeaves * nDataSize);
+        Map();
+    } else {
+        vPendingHashes.resize(LeafPos(nLeaves) - nFlushedSize);
+        vPendingData.resize((nLeaves - nFlushedLeaves) * nDataSize);
+    }
+
+    if (fLeafSet) {
+        vSpent.resize((nLeaves + 7) / 8);
+        if (nLeaves % 8)
+            vSpent.back() &= (1 << (nLeaves % 8)) - 1;
+        for (unsigned int i = 0; i < vUnspend.size(); i++)
+            if (vUnspend[i] < nLeaves)
+                vSpent[vUnspend[i] / 8] &= ~(1 << (vUnspend[i] % 8));
+        fSpentDirty = true;
+    }
+    return fTruncate ? Flush() : true;
+}
+
+bool CMMR::Spend(uint64 nLeaf)
+{
+    if (!fLeafSet || nLeaf >= GetLeafCount() || IsSpent(nLeaf))
+        return false;
+    vSpent[nLeaf / 8] |= 1 << (nLeaf % 8);
+    fSpentDirty = true;
+    return true;
+}
+
+bool CMMR::IsSpent(uint64 nLeaf) const
+{
+    return fLeafSet && nLeaf < GetLeafCount() && (vSpent[nLeaf / 8] & (1 << (nLeaf % 8)));
+}
+
+bool CMMR::GetProof(uint64 nLeaf, CMMRProof &proof) const
+{
+    uint64 nLeaves = GetLeafCount();
+    if (nLeaf >= nLeaves)
+        return false;
+    proof.nLeaves = nLeaves;
+    proof.nLeaf = nLeaf;
+    proof.vPath.clear();
+    proof.vPeaks.clear();
+
+    int nHeight;
+    unsigned int nIndex = GetPeakIndex(nLeaves, nLeaf, nHeight);
+    uint64 nPos = LeafPos(nLeaf);
+    for (int k = 0; k < nHeight; k++) {
+        uint64 nSubtree = (2ULL << k) - 1;
+        if (nLeaf & (1ULL << k)) {
+            proof.vPath.push_back(GetHashAt(nPos - nSubtree));
+            nPos++;
+        } else {
+            proof.vPath.push_back(GetHashAt(nPos + nSubtree));
+            nPos += nSubtree + 1;
+        }
+    }
+
+    vector<uint64> vPos;
+    vector<int> vHeight;
+    GetPeakPositions(nLeaves, vPos, vHeight);
+    for (unsigned int i = 0; i < vPos.size(); i++)
+        if (i != nIndex)
+            proof.vPeaks.push_back(GetHashAt(vPos[i]));
+    return true;
+}
+
+bool CMMR::Flush()
+{
+    if (!vPendingHashes.empty()) {
+        mapped_region().swap(regionHashes);
+        mapped_region().swap(regionData);
+
+        // the records first: on opening, hashes without their records are dropped
+        FILE *file = fopen((pathDir / "data.dat").string().c_str(), "ab");
+        if (!file || fwrite(&vPendingData[0], 1, vPendingData.size(), file) != vPendingData.size()) {
+            if (file)
+                fclose(file);
+            Map();
+            return error("CMMR::Flush() : cannot write %s", (pathDir / "data.dat").string().c_str());
+        }
+        FileCommit(file);
+        fclose(file);
+        file = fopen((pathDir / "hash.dat").string().c_str(), "ab");
+        if (!file || fwrite(&vPendingHashes[0], sizeof(uint256), vPendingHashes.size(), file) != vPendingHashes.size()) {
+            if (file)
+                fclose(file);
+            Map();
+            return error("CMMR::Flush() : cannot write %s", (pathDir / "hash.dat").string().c_str());
+        }
+        FileCommit(file);
+        fclose(file);
+
+        nFlushedLeaves += vPendingData.size() / nDataSize;
+        nFlushedSize += vPendingHashes.size();
+        vPendingHashes.clear();
+        vPendingData.clear();
+        Map();
+    }
+
+    if (fSpentDirty) {
+        FILE *file = fopen((pathDir / "leaf.dat").string().c_str(), "wb");
+        if (!file || (!vSpent.empty() && fwrite(&vSpent[0], 1, vSpent.size(), file) != vSpent.size())) {
+            if (file)
+                fclose(file);
+            return error("CMMR::Flush() : cannot write %s", (pathDir / "leaf.dat").string().c_str());
+        }
+        FileCommit(file);
+        fclose(file);
+        fSpentDirty = false;
+    }
+    return true;
+}
+
+CMWAccumulators::CMWAccumulators(const boost::filesystem::path &pathDirIn) :
+    pathDir(pathDirIn),
+    kernels(pathDirIn / "kernel", KERNEL_SIZE, false),
+    outputs(pathDirIn / "output", OUTPUT_SIZE, true),
+    nSupply(0)
+{
+    FILE *file = fopen((pathDir / "totals.dat").string().c_str(), "rb");
+    if (file) {
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        try {
+            filein >> nSupply >> offset;
+        } catch (std::exception &e) {
+            throw runtime_error(strprintf("CMWAccumulators : cannot read %s", (pathDir / "totals.dat").string().c_str()));
+        }
+    }
+}
+
+uint64 CMWAccumulators::AppendKernel(const mw::Kernel &kernel)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(KERNEL_SIZE);
+    ss << kernel;
+    assert(ss.size() == KERNEL_SIZE);
+    return kernels.Append((const unsigned char*)&ss[0]);
+}
+
+uint64 CMWAccumulators::AppendOutput(const mw::Output &output)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(OUTPUT_SIZE);
+    ss << output;
+    assert(ss.size() == OUTPUT_SIZE);
+    return outputs.Append((const unsigned char*)&ss[0]);
+}
+
+bool CMWAccumulators::Flush()
+{
+    if (!kernels.Flush() || !outputs.Flush())
+        return false;
+
+    FILE *file = fopen((pathDir / "totals.dat").string().c_str(), "wb");
+    if (!file)
+        return error("CMWAccumulators::Flush() : cannot open %s", (pathDir / "totals.dat").string().c_str());
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    try {
+        fileout << nSupply << offset;
+    } catch (std::exception &e) {
+        return error("CMWAccumulators::Flush() : I/O error");
+    }
+    FileCommit(fileout);
+    return true;
+}
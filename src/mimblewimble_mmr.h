@@ -0,0 +1,137 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_MMR_H
+#define BITCOIN_MIMBLEWIMBLE_MMR_H
+
+#include "mimblewimble.h"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/** Proof that a leaf is in a Merkle Mountain Range of a given size: the
+ *  siblings on the way up to the leaf's peak, and the other peaks. */
+class CMMRProof
+{
+public:
+    uint64 nLeaves;
+    uint64 nLeaf;
+    std::vector<uint256> vPath;
+    std::vector<uint256> vPeaks;
+
+    CMMRProof() : nLeaves(0), nLeaf(0) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nLeaves);
+        READWRITE(nLeaf);
+        READWRITE(vPath);
+        READWRITE(vPeaks);
+    )
+
+    // whether the leaf with this data is leaf nLeaf of the MMR with this root
+    bool Verify(const uint256 &hashRoot, const unsigned char *pData, unsigned int nDataSize) const;
+};
+
+/** Append-only Merkle Mountain Range of fixed size records, on disk.
+ *
+ * The nodes are numbered in post-order from 0. Leaf hashes commit to the
+ * position and the record, parent hashes to the position and both children.
+ * The root bags the peaks from right to left.
+ *
+ * Three files live in the directory: the node hashes (32 bytes each), the
+ * records (nDataSize bytes each), and optionally a bitmap with a bit per
+ * leaf that is set once the leaf is spent. Flushed hashes and records are
+ * read through a memory mapping; appends stay in memory until Flush().
+ * Appending a leaf computes and stores one hash per parent it completes,
+ * which is O(log n). Rewind() drops the leaves added after a given count.
+ */
+class CMMR
+{
+private:
+    boost::filesystem::path pathDir;
+    unsigned int nDataSize;
+    bool fLeafSet;
+
+    // flushed to the files and mapped
+    uint64 nFlushedSize;
+    uint64 nFlushedLeaves;
+    boost::interprocess::file_mapping fileHashes;
+    boost::interprocess::mapped_region regionHashes;
+    boost::interprocess::file_mapping fileData;
+    boost::interprocess::mapped_region regionData;
+
+    // appended since
+    std::vector<uint256> vPendingHashes;
+    std::vector<unsigned char> vPendingData;
+
+    std::vector<unsigned char> vSpent;
+    bool fSpentDirty;
+
+    void Map();
+
+public:
+    CMMR(const boost::filesystem::path &pathDirIn, unsigned int nDataSizeIn, bool fLeafSetIn);
+
+    uint64 GetSize() const { return nFlushedSize + vPendingHashes.size(); }
+    uint64 GetLeafCount() const { return nFlushedLeaves + vPendingData.size() / nDataSize; }
+    unsigned int GetDataSize() const { return nDataSize; }
+
+    uint256 GetHashAt(uint64 nPos) const;
+    bool GetLeaf(uint64 nLeaf, std::vector<unsigned char> &vData) const;
+    uint256 GetRoot() const;
+    // peak hashes, left to right
+    void GetPeaks(std::vector<uint256> &vPeaks) const;
+
+    // Append a record; returns the leaf number
+    uint64 Append(const unsigned char *pData);
+
+    // Drop everything after the first nLeaves leaves, and clear the spent
+    // bit of the leaves in vUnspend (which the dropped blocks spent)
+    bool Rewind(uint64 nLeaves, const std::vector<uint64> &vUnspend);
+
+    // Leaf set: only with fLeafSet
+    bool Spend(uint64 nLeaf);
+    bool IsSpent(uint64 nLeaf) const;
+
+    bool GetProof(uint64 nLeaf, CMMRProof &proof) const;
+
+    // Write the appended nodes, records and the leaf set to disk
+    bool Flush();
+
+    // Position of leaf n, and the hash of a node
+    static uint64 LeafPos(uint64 nLeaf);
+    static uint256 HashLeaf(uint64 nPos, const unsigned char *pData, unsigned int nDataSize);
+    static uint256 HashParent(uint64 nPos, const uint256 &left, const uint256 &right);
+    static uint256 BagPeaks(uint64 nSize, const std::vector<uint256> &vPeaks);
+};
+
+/** The kernel and output MMRs of the Mimblewimble chain, in mmr/ */
+class CMWAccumulators
+{
+private:
+    boost::filesystem::path pathDir;
+
+public:
+    // serialized sizes of a Kernel and an Output
+    static const unsigned int KERNEL_SIZE = 8 + 4 + mw::PEDERSEN_COMMITMENT_SIZE + mw::KERNEL_SIGNATURE_SIZE;
+    static const unsigned int OUTPUT_SIZE = mw::PEDERSEN_COMMITMENT_SIZE + mw::BULLETPROOF_SIZE;
+
+    CMMR kernels;
+    CMMR outputs;
+    // Value held by the unspent outputs, and the sum of the kernel offsets
+    // of all blocks; kept up to date by whoever appends blocks
+    int64 nSupply;
+    mw::BlindingFactor offset;
+
+    CMWAccumulators(const boost::filesystem::path &pathDirIn);
+
+    uint64 AppendKernel(const mw::Kernel &kernel);
+    uint64 AppendOutput(const mw::Output &output);
+    bool Flush();
+};
+
+extern CMWAccumulators *pmwaccumulators;
+
+#endif // BITCOIN_MIMBLEWIMBLE_MMR_H
@@ -0,0 +1,243 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_pool.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_verify.h"
+#include "util.h"
+
+#include <set>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace mw;
+
+CMWTxPool mwmempool;
+
+bool CMWTxPool::accept(const Transaction &tx, CMWCoinsView *pview)
+{
+    uint256 hash = tx.GetHash();
+    if (tx.kernels.empty())
+        return error("CMWTxPool::accept() : transaction has no kernel");
+    if (tx.vin.empty() && tx.vout.empty())
+        return error("CMWTxPool::accept() : transaction has no inputs or outputs");
+
+    LOCK(cs);
+    if (mapTx.count(hash))
+        return false;
+
+    set<Commitment> setSpent;
+    BOOST_FOREACH(const Input &input, tx.vin)
+    {
+        if (!setSpent.insert(input.commitment).second)
+            return error("CMWTxPool::accept() : duplicate input");
+        if (mapNextTx.count(input.commitment))
+            return error("CMWTxPool::accept() : input already spent by %s", mapNextTx[input.commitment].ToString().substr(0,10).c_str());
+        if (pview && !mapCreated.count(input.commitment) && !pview->HaveCoin(input.commitment))
+            return error("CMWTxPool::accept() : missing input");
+    }
+    set<Commitment> setCreated;
+    BOOST_FOREACH(const Output &output, tx.vout)
+    {
+        // a transaction spending its own output should have been cut through by its builder
+        if (setSpent.count(output.commitment) || !setCreated.insert(output.commitment).second)
+            return error("CMWTxPool::accept() : duplicate output");
+        if (mapCreated.count(output.commitment) || (pview && pview->HaveCoin(output.commitment)))
+            return error("CMWTxPool::accept() : output already exists");
+    }
+    BOOST_FOREACH(const Kernel &kernel, tx.kernels)
+        if (mapKernels.count(kernel.GetHash()))
+            return error("CMWTxPool::accept() : kernel already in pool");
+
+    // what passes is cached, so that a block with this transaction only checks its sum
+    if (!VerifyMWTransaction(tx))
+        return error("CMWTxPool::accept() : invalid transaction %s", hash.ToString().substr(0,10).c_str());
+
+    addUnchecked(hash, tx);
+    printf("CMWTxPool::accept() : accepted %s (poolsz %"PRIszu")\n", hash.ToString().substr(0,10).c_str(), mapTx.size());
+    return true;
+}
+
+bool CMWTxPool::addUnchecked(const uint256 &hash, const Transaction &tx)
+{
+    // Add to the pool without checking anything.  Don't call this directly,
+    // call CMWTxPool::accept to properly check the transaction first.
+    LOCK(cs);
+    mapTx[hash] = tx;
+    BOOST_FOREACH(const Input &input, tx.vin)
+        mapNextTx[input.commitment] = hash;
+    BOOST_FOREACH(const Output &output, tx.vout)
+        mapCreated[output.commitment] = hash;
+    BOOST_FOREACH(const Kernel &kernel, tx.kernels)
+        mapKernels[kernel.GetHash()] = hash;
+    AggregateAdd(tx);
+    return true;
+}
+
+bool CMWTxPool::remove(const Transaction &tx, bool fRecursive)
+{
+    LOCK(cs);
+    uint256 hash = tx.GetHash();
+    if (fRecursive) {
+        BOOST_FOREACH(const Output &output, tx.vout) {
+            CMWCommitmentTxMap::iterator it = mapNextTx.find(output.commitment);
+            if (it != mapNextTx.end())
+                remove(mapTx[it->second], true);
+        }
+    }
+    if (mapTx.count(hash))
+    {
+        // tx may be the entry in mapTx, so that goes last
+        AggregateRemove(tx);
+        BOOST_FOREACH(const Input &input, tx.vin)
+            mapNextTx.erase(input.commitment);
+        BOOST_FOREACH(const Output &output, tx.vout)
+            mapCreated.erase(output.commitment);
+        BOOST_FOREACH(const Kernel &kernel, tx.kernels)
+            mapKernels.erase(kernel.GetHash());
+        mapTx.erase(hash);
+    }
+    return true;
+}
+
+void CMWTxPool::clear()
+{
+    LOCK(cs);
+    mapTx.clear();
+    mapNextTx.clear();
+    mapCreated.clear();
+    mapKernels.clear();
+    aggregate = Transaction();
+    mapAggInputs.clear();
+    mapAggOutputs.clear();
+    mapAggKernels.clear();
+    nCutThrough = 0;
+}
+
+void CMWTxPool::queryHashes(std::vector<uint256> &vtxid)
+{
+    vtxid.clear();
+
+    LOCK(cs);
+    vtxid.reserve(mapTx.size());
+    for (map<uint256, Transaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back((*mi).first);
+}
+
+void CMWTxPool::GetAggregate(Transaction &txOut)
+{
+    LOCK(cs);
+    txOut = aggregate;
+}
+
+unsigned int CMWTxPool::GetCutThroughCount()
+{
+    LOCK(cs);
+    return nCutThrough;
+}
+
+//
+// The aggregate keeps the position of each input, output and kernel, so that
+// one can be erased by moving the last one into its place.
+//
+
+void CMWTxPool::AggregateAddInput(const Commitment &commitment)
+{
+    if (mapAggOutputs.count(commitment)) {
+        AggregateEraseOutput(commitment);
+        nCutThrough++;
+        return;
+    }
+    mapAggInputs[commitment] = aggregate.vin.size();
+    aggregate.vin.push_back(Input(commitment));
+}
+
+void CMWTxPool::AggregateAddOutput(const Output &output)
+{
+    if (mapAggInputs.count(output.commitment)) {
+        AggregateEraseInput(output.commitment);
+        nCutThrough++;
+        return;
+    }
+    mapAggOutputs[output.commitment] = aggregate.vout.size();
+    aggregate.vout.push_back(output);
+}
+
+void CMWTxPool::AggregateEraseInput(const Commitment &commitment)
+{
+    unsigned int nPos = mapAggInputs[commitment];
+    mapAggInputs.erase(commitment);
+    if (nPos + 1 != aggregate.vin.size()) {
+        aggregate.vin[nPos] = aggregate.vin.back();
+        mapAggInputs[aggregate.vin[nPos].commitment] = nPos;
+    }
+    aggregate.vin.pop_back();
+}
+
+void CMWTxPool::AggregateEraseOutput(const Commitment &commitment)
+{
+    unsigned int nPos = mapAggOutputs[commitment];
+    mapAggOutputs.erase(commitment);
+    if (nPos + 1 != aggregate.vout.size()) {
+        aggregate.vout[nPos] = aggregate.vout.back();
+        mapAggOutputs[aggregate.vout[nPos].commitment] = nPos;
+    }
+    aggregate.vout.pop_back();
+}
+
+void CMWTxPool::AggregateAdd(const Transaction &tx)
+{
+    BOOST_FOREACH(const Input &input, tx.vin)
+        AggregateAddInput(input.commitment);
+    BOOST_FOREACH(const Output &output, tx.vout)
+        AggregateAddOutput(output);
+    BOOST_FOREACH(const Kernel &kernel, tx.kernels) {
+        mapAggKernels[kernel.GetHash()] = aggregate.kernels.size();
+        aggregate.kernels.push_back(kernel);
+    }
+    aggregate.offset += tx.offset;
+    aggregate.MarkDirty();
+}
+
+void CMWTxPool::AggregateRemove(const Transaction &tx)
+{
+    // An output that is not in the aggregate was cut through with the input
+    // of a pooled spender, which now spends it from the chain; an input that
+    // is not was cut through with a pooled output, which is unspent again.
+    BOOST_FOREACH(const Output &output, tx.vout) {
+        if (mapAggOutputs.count(output.commitment)) {
+            AggregateEraseOutput(output.commitment);
+        } else {
+            AggregateAddInput(output.commitment);
+            nCutThrough--;
+        }
+    }
+    BOOST_FOREACH(const Input &input, tx.vin) {
+        if (mapAggInputs.count(input.commitment)) {
+            AggregateEraseInput(input.commitment);
+            continue;
+        }
+        const Transaction &txFrom = mapTx[mapCreated[input.commitment]];
+        BOOST_FOREACH(const Output &output, txFrom.vout) {
+            if (output.commitment == input.commitment) {
+                AggregateAddOutput(output);
+                nCutThrough--;
+                break;
+            }
+        }
+    }
+    BOOST_FOREACH(const Kernel &kernel, tx.kernels) {
+        uint256 hashKernel = kernel.GetHash();
+        unsigned int nPos = mapAggKernels[hashKernel];
+        mapAggKernels.erase(hashKernel);
+        if (nPos + 1 != aggregate.kernels.size()) {
+            aggregate.kernels[nPos] = aggregate.kernels.back();
+            mapAggKernels[aggregate.kernels[nPos].GetHash()] = nPos;
+        }
+        aggregate.kernels.pop_back();
+    }
+    aggregate.offset -= tx.offset;
+    aggregate.MarkDirty();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_POOL_H
+#define BITCOIN_MIMBLEWIMBLE_POOL_H
+
+#include "mimblewimble.h"
+#include "sync.h"
+
+#include <map>
+#include <unordered_map>
+
+class CMWCoinsView;
+
+typedef std::unordered_map<mw::Commitment, uint256, mw::CommitmentHasher> CMWCommitmentTxMap;
+
+/** Pool of Mimblewimble transactions waiting to be mined.
+ *
+ * Besides the transactions, the pool keeps their aggregate: all their inputs,
+ * outputs and kernels with the offsets summed, and with every output that a
+ * pooled transaction spends cut through together with the input spending it.
+ * The aggregate is updated as transactions come and go, at a cost that
+ * depends only on the size of the transaction added or removed, so a block
+ * template can take it as it is.
+ */
+class CMWTxPool
+{
+public:
+    mutable CCriticalSection cs;
+    std::map<uint256, mw::Transaction> mapTx;
+    // which pooled transaction spends / creates each commitment, and holds each kernel
+    CMWCommitmentTxMap mapNextTx;
+    CMWCommitmentTxMap mapCreated;
+    std::map<uint256, uint256> mapKernels;
+
+    CMWTxPool() : nCutThrough(0) {}
+
+    // Check a transaction against the pool and, with pview, the unspent
+    // outputs, and add it. Inputs may be outputs of pooled transactions.
+    bool accept(const mw::Transaction &tx, CMWCoinsView *pview);
+    bool addUnchecked(const uint256 &hash, const mw::Transaction &tx);
+    bool remove(const mw::Transaction &tx, bool fRecursive = false);
+    void clear();
+    void queryHashes(std::vector<uint256> &vtxid);
+
+    // Copy of the aggregate of all pooled transactions
+    void GetAggregate(mw::Transaction &txOut);
+    // Input/output pairs currently cut out of the aggregate
+    unsigned int GetCutThroughCount();
+
+    unsigned long size()
+    {
+        LOCK(cs);
+        return mapTx.size();
+    }
+
+    bool exists(uint256 hash)
+    {
+        return (mapTx.count(hash) != 0);
+    }
+
+    mw::Transaction& lookup(uint256 hash)
+    {
+        return mapTx[hash];
+    }
+
+private:
+    mw::Transaction aggregate;
+    // positions in aggregate.vin, aggregate.vout and aggregate.kernels
+    std::unordered_map<mw::Commitment, unsigned int, mw::CommitmentHasher> mapAggInputs;
+    std::unordered_map<mw::Commitment, unsigned int, mw::CommitmentHasher> mapAggOutputs;
+    std::map<uint256, unsigned int> mapAggKernels;
+    unsigned int nCutThrough;
+
+    void AggregateAddInput(const mw::Commitment &commitment);
+    void AggregateAddOutput(const mw::Output &output);
+    void AggregateEraseInput(const mw::Commitment &commitment);
+    void AggregateEraseOutput(const mw::Commitment &commitment);
+    void AggregateAdd(const mw::Transaction &tx);
+    void AggregateRemove(const mw::Transaction &tx);
+};
+
+extern CMWTxPool mwmempool;
+
+#endif // BITCOIN_MIMBLEWIMBLE_POOL_H
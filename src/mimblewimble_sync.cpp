@@ -0,0 +1,532 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_sync.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_verify.h"
+#include "checkpoints.h"
+#include "hash.h"
+#include "main.h"
+#include "net.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+
+#include <set>
+
+using namespace std;
+using namespace mw;
+
+// chunks a syncing node asks one peer for at a time
+static const unsigned int MW_STATE_MAX_REQUESTS = 8;
+// seconds without a chunk after which another peer may take over
+static const int64 MW_STATE_TIMEOUT = 60;
+
+static unsigned int BitCount(uint64 n)
+{
+    unsigned int nCount = 0;
+    for (; n; n &= n - 1)
+        nCount++;
+    return nCount;
+}
+
+unsigned int CMWStateHeader::GetKernelChunks() const
+{
+    return (nKernels + nKernelsPerChunk - 1) / nKernelsPerChunk;
+}
+
+unsigned int CMWStateHeader::GetOutputChunks() const
+{
+    return (nUnspent + nOutputsPerChunk - 1) / nOutputsPerChunk;
+}
+
+uint256 CMWStateHeader::GetOutputRoot() const
+{
+    return CMMR::BagPeaks(CMMR::LeafPos(nOutputLeaves), vOutputPeaks);
+}
+
+bool CMWStateHeader::IsConsistent() const
+{
+    if (nVersion != MW_STATE_VERSION || nSupply < 0)
+        return false;
+    // chunks must fit in a message
+    if (nKernelsPerChunk == 0 || nKernelsPerChunk > MW_STATE_CHUNK_KERNELS ||
+        nOutputsPerChunk == 0 || nOutputsPerChunk > MW_STATE_CHUNK_OUTPUTS)
+        return false;
+    if (nUnspent > nOutputLeaves || vOutputPeaks.size() != BitCount(nOutputLeaves))
+        return false;
+    return vChunkHashes.size() == (uint64)GetKernelChunks() + GetOutputChunks();
+}
+
+static boost::filesystem::path ChunkPath(const boost::filesystem::path &pathDir, unsigned int nChunk)
+{
+    return pathDir / strprintf("chunk%05u.dat", nChunk);
+}
+
+bool ReadMWStateHeader(const boost::filesystem::path &pathDir, CMWStateHeader &header)
+{
+    FILE *file = fopen((pathDir / "header.dat").string().c_str(), "rb");
+    if (!file)
+        return false;
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    try {
+        filein >> header;
+    } catch (std::exception &e) {
+        return error("ReadMWStateHeader() : I/O error or corrupt %s", (pathDir / "header.dat").string().c_str());
+    }
+    return true;
+}
+
+bool WriteMWStateHeader(const boost::filesystem::path &pathDir, const CMWStateHeader &header)
+{
+    FILE *file = fopen((pathDir / "header.dat").string().c_str(), "wb");
+    if (!file)
+        return error("WriteMWStateHeader() : cannot open %s", (pathDir / "header.dat").string().c_str());
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    try {
+        fileout << header;
+    } catch (std::exception &e) {
+        return error("WriteMWStateHeader() : I/O error");
+    }
+    FileCommit(fileout);
+    return true;
+}
+
+bool ReadMWStateChunk(const boost::filesystem::path &pathDir, unsigned int nChunk, vector<unsigned char> &vData)
+{
+    boost::filesystem::path pathChunk = ChunkPath(pathDir, nChunk);
+    FILE *file = fopen(pathChunk.string().c_str(), "rb");
+    if (!file)
+        return error("ReadMWStateChunk() : cannot open %s", pathChunk.string().c_str());
+    uint64 nSize = boost::filesystem::file_size(pathChunk);
+    if (nSize > MAX_SIZE) {
+        fclose(file);
+        return error("ReadMWStateChunk() : %s too large", pathChunk.string().c_str());
+    }
+    vData.resize(nSize);
+    bool fOk = nSize == 0 || fread(&vData[0], 1, nSize, file) == nSize;
+    fclose(file);
+    if (!fOk)
+        return error("ReadMWStateChunk() : cannot read %s", pathChunk.string().c_str());
+    return true;
+}
+
+bool WriteMWStateChunk(const boost::filesystem::path &pathDir, unsigned int nChunk, const vector<unsigned char> &vData)
+{
+    boost::filesystem::path pathChunk = ChunkPath(pathDir, nChunk);
+    FILE *file = fopen(pathChunk.string().c_str(), "wb");
+    if (!file)
+        return error("WriteMWStateChunk() : cannot open %s", pathChunk.string().c_str());
+    bool fOk = vData.empty() || fwrite(&vData[0], 1, vData.size(), file) == vData.size();
+    FileCommit(file);
+    fclose(file);
+    if (!fOk)
+        return error("WriteMWStateChunk() : cannot write %s", pathChunk.string().c_str());
+    return true;
+}
+
+static bool WriteChunk(const boost::filesystem::path &pathDir, CMWStateHeader &header, CMWStateChunk &chunk)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << chunk;
+    vector<unsigned char> vData(ss.begin(), ss.end());
+    if (!WriteMWStateChunk(pathDir, header.vChunkHashes.size(), vData))
+        return false;
+    header.vChunkHashes.push_back(Hash(vData.begin(), vData.end()));
+    chunk.vKernels.clear();
+    chunk.vOutputs.clear();
+    return true;
+}
+
+bool WriteMWStateArchive(const boost::filesystem::path &pathDir, const CMWAccumulators &acc, CMWCoinsView &view,
+                         int nHeight, const uint256 &hashBlock, CMWStateHeader &header,
+                         unsigned int nKernelsPerChunk, unsigned int nOutputsPerChunk)
+{
+    boost::filesystem::create_directories(pathDir);
+    // without a header, what is left of an older archive is not an archive
+    boost::filesystem::remove(pathDir / "header.dat");
+
+    header = CMWStateHeader();
+    header.nHeight = nHeight;
+    header.hashBlock = hashBlock;
+    header.nSupply = acc.nSupply;
+    header.offset = acc.offset;
+    header.nKernels = acc.kernels.GetLeafCount();
+    header.hashKernelRoot = acc.kernels.GetRoot();
+    header.nOutputLeaves = acc.outputs.GetLeafCount();
+    header.nKernelsPerChunk = nKernelsPerChunk;
+    header.nOutputsPerChunk = nOutputsPerChunk;
+    acc.outputs.GetPeaks(header.vOutputPeaks);
+
+    CMWStateChunk chunk;
+    vector<unsigned char> vData;
+    for (uint64 n = 0; n < header.nKernels; n++) {
+        acc.kernels.GetLeaf(n, vData);
+        CDataStream ss(vData, SER_DISK, CLIENT_VERSION);
+        chunk.vKernels.push_back(Kernel());
+        ss >> chunk.vKernels.back();
+        if (chunk.vKernels.size() == nKernelsPerChunk && !WriteChunk(pathDir, header, chunk))
+            return false;
+    }
+    if (!chunk.vKernels.empty() && !WriteChunk(pathDir, header, chunk))
+        return false;
+
+    for (uint64 n = 0; n < header.nOutputLeaves; n++) {
+        if (acc.outputs.IsSpent(n))
+            continue;
+        acc.outputs.GetLeaf(n, vData);
+        CDataStream ss(vData, SER_DISK, CLIENT_VERSION);
+        CMWStateOutput output;
+        output.nLeaf = n;
+        ss >> output.output;
+        CMWCoin coin;
+        if (!view.GetCoin(output.output.commitment, coin))
+            return error("WriteMWStateArchive() : output %"PRI64u" is not spent but not in the output set either", n);
+        output.nHeight = coin.nHeight;
+        chunk.vOutputs.push_back(output);
+        header.nUnspent++;
+        if (chunk.vOutputs.size() == nOutputsPerChunk && !WriteChunk(pathDir, header, chunk))
+            return false;
+    }
+    if (!chunk.vOutputs.empty() && !WriteChunk(pathDir, header, chunk))
+        return false;
+
+    return WriteMWStateHeader(pathDir, header);
+}
+
+// Add commitments to a running sum
+static bool AddCommitments(Commitment &sum, bool &fHaveSum, const vector<const unsigned char*> &vCommits)
+{
+    vector<const unsigned char*> vPositive(vCommits);
+    if (fHaveSum)
+        vPositive.push_back(sum.GetBytes().data());
+    if (vPositive.empty())
+        return true;
+    unsigned char p[PEDERSEN_COMMITMENT_SIZE];
+    if (!PedersenCommitSum(p, vPositive, vector<const unsigned char*>()))
+        return false;
+    sum = Commitment(p);
+    fHaveSum = true;
+    return true;
+}
+
+static bool LoadMWStateChunks(const boost::filesystem::path &pathDir, const CMWStateHeader &header, int64 nSupply,
+                              CMWAccumulators &acc, CMWCoinsViewCache &view)
+{
+    Commitment sumKernels, sumOutputs;
+    bool fHaveKernels = false, fHaveOutputs = false;
+    unsigned int nKernelChunks = header.GetKernelChunks();
+    uint64 nNextLeaf = 0;
+    vector<unsigned char> vData;
+
+    for (unsigned int nChunk = 0; nChunk < header.vChunkHashes.size(); nChunk++) {
+        if (!ReadMWStateChunk(pathDir, nChunk, vData))
+            return false;
+        if (Hash(vData.begin(), vData.end()) != header.vChunkHashes[nChunk])
+            return error("LoadMWStateArchive() : chunk %u does not match the header", nChunk);
+        CMWStateChunk chunk;
+        try {
+            CDataStream ss(vData, SER_DISK, CLIENT_VERSION);
+            ss >> chunk;
+        } catch (std::exception &e) {
+            return error("LoadMWStateArchive() : chunk %u is corrupt", nChunk);
+        }
+
+        if (nChunk < nKernelChunks) {
+            uint64 nExpected = std::min((uint64)header.nKernelsPerChunk, header.nKernels - (uint64)nChunk * header.nKernelsPerChunk);
+            if (chunk.vKernels.size() != nExpected || !chunk.vOutputs.empty())
+                return error("LoadMWStateArchive() : kernel chunk %u has the wrong size", nChunk);
+            vector<const Kernel*> vKernels;
+            vector<const unsigned char*> vExcess;
+            BOOST_FOREACH(const Kernel &kernel, chunk.vKernels) {
+                vKernels.push_back(&kernel);
+                vExcess.push_back(kernel.excess.GetBytes().data());
+            }
+            if (!VerifyMWBatches(vKernels, vector<const Output*>()))
+                return error("LoadMWStateArchive() : invalid kernel in chunk %u", nChunk);
+            BOOST_FOREACH(const Kernel &kernel, chunk.vKernels)
+                acc.AppendKernel(kernel);
+            if (!AddCommitments(sumKernels, fHaveKernels, vExcess))
+                return error("LoadMWStateArchive() : kernel excesses sum to nothing");
+            continue;
+        }
+
+        uint64 nDone = (uint64)(nChunk - nKernelChunks) * header.nOutputsPerChunk;
+        uint64 nExpected = std::min((uint64)header.nOutputsPerChunk, header.nUnspent - nDone);
+        if (chunk.vOutputs.size() != nExpected || !chunk.vKernels.empty())
+            return error("LoadMWStateArchive() : output chunk %u has the wrong size", nChunk);
+        vector<const Output*> vOutputs;
+        vector<const unsigned char*> vCommits;
+        BOOST_FOREACH(const CMWStateOutput &output, chunk.vOutputs) {
+            // in leaf order, so each leaf at most once
+            if (output.nLeaf < nNextLeaf || output.nLeaf >= header.nOutputLeaves)
+                return error("LoadMWStateArchive() : output leaves out of order in chunk %u", nChunk);
+            nNextLeaf = output.nLeaf + 1;
+            if (!view.AddCoin(output.output, output.nHeight))
+                return error("LoadMWStateArchive() : duplicate output in chunk %u", nChunk);
+            vOutputs.push_back(&output.output);
+            vCommits.push_back(output.output.commitment.GetBytes().data());
+        }
+        if (!VerifyMWBatches(vector<const Kernel*>(), vOutputs))
+            return error("LoadMWStateArchive() : invalid range proof in chunk %u", nChunk);
+        if (!AddCommitments(sumOutputs, fHaveOutputs, vCommits))
+            return error("LoadMWStateArchive() : outputs sum to nothing");
+    }
+
+    if (acc.kernels.GetRoot() != header.hashKernelRoot)
+        return error("LoadMWStateArchive() : kernels do not match the kernel root");
+
+    // sum(outputs) == sum(excess) + offset*G + nSupply*H
+    unsigned char pExpected[PEDERSEN_COMMITMENT_SIZE];
+    if (!PedersenCommit(pExpected, nSupply, header.offset.GetBytes().data()))
+        return error("LoadMWStateArchive() : invalid offset");
+    Commitment expected(pExpected);
+    bool fHaveExpected = true;
+    vector<const unsigned char*> vExcess;
+    if (fHaveKernels)
+        vExcess.push_back(sumKernels.GetBytes().data());
+    if (!fHaveOutputs || !AddCommitments(expected, fHaveExpected, vExcess) || expected != sumOutputs)
+        return error("LoadMWStateArchive() : outputs do not sum to the kernels and the supply");
+
+    acc.nSupply = nSupply;
+    acc.offset = header.offset;
+    return true;
+}
+
+bool LoadMWStateArchive(const boost::filesystem::path &pathDir, const CMWStateHeader &header, int64 nSupply,
+                        CMWAccumulators &acc, CMWCoinsViewCache &view)
+{
+    if (!header.IsConsistent() || nSupply < 0)
+        return error("LoadMWStateArchive() : inconsistent header");
+    if (acc.kernels.GetLeafCount() != 0)
+        return error("LoadMWStateArchive() : already have Mimblewimble kernels");
+
+    int64 nStart = GetTimeMillis();
+    if (!LoadMWStateChunks(pathDir, header, nSupply, acc, view)) {
+        acc.kernels.Rewind(0, vector<uint64>());
+        return false;
+    }
+    printf("LoadMWStateArchive() : %"PRI64u" kernels and %"PRI64u" outputs at height %d in %"PRI64d"ms\n",
+           header.nKernels, header.nUnspent, header.nHeight, GetTimeMillis() - nStart);
+    return true;
+}
+
+//
+// P2P
+//
+
+static CCriticalSection cs_mwsync;
+static struct CMWStateSync
+{
+    string strPeer;             // the peer we sync from, empty when not syncing
+    bool fHaveHeader;
+    CMWStateHeader header;
+    int64 nSupply;              // from Checkpoints::CheckMWState, not from the peer (but see there)
+    unsigned int nNextRequest;
+    set<unsigned int> setReceived;
+    int64 nLastProgress;
+    bool fVerifying;            // every chunk is in, ThreadFinishMWStateSync checks them
+} mwsync;
+
+static boost::filesystem::path MWStateDir() { return GetDataDir() / "mwstate"; }
+static boost::filesystem::path MWStateNewDir() { return GetDataDir() / "mwstate.new"; }
+
+void StartMWStateSync(CNode *pfrom)
+{
+    if (!GetBoolArg("-mwfastsync") || !pmwaccumulators || !pmwcoinsTip || pmwaccumulators->kernels.GetLeafCount() != 0)
+        return;
+    LOCK(cs_mwsync);
+    if (mwsync.fVerifying || (!mwsync.strPeer.empty() && GetTime() - mwsync.nLastProgress < MW_STATE_TIMEOUT))
+        return;
+    mwsync.strPeer = pfrom->addrName;
+    mwsync.fHaveHeader = false;
+    mwsync.nNextRequest = 0;
+    mwsync.setReceived.clear();
+    mwsync.nLastProgress = GetTime();
+    pfrom->PushMessage("getmwstate", uint256(0), -1);
+}
+
+// The state a peer offers must be at a block of our best chain, and be one
+// that is compiled in; nSupply is set to the compiled-in supply. Only testnet
+// with -checkpoints=0 takes the supply from the header.
+// Requires cs_main.
+static bool CheckMWStateAnchor(const CMWStateHeader &header, int64 &nSupply)
+{
+    nSupply = header.nSupply;
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end() || mi->second->nHeight != header.nHeight || !mi->second->IsInMainChain())
+        return error("CheckMWStateAnchor() : block %s at height %d is not in the best chain",
+                     header.hashBlock.ToString().c_str(), header.nHeight);
+    if (!Checkpoints::CheckMWState(header.nHeight, header.hashBlock, header.hashKernelRoot, header.GetOutputRoot(), nSupply))
+        return error("CheckMWStateAnchor() : unknown Mimblewimble state at height %d (kernels %s, outputs %s)",
+                     header.nHeight, header.hashKernelRoot.ToString().c_str(), header.GetOutputRoot().ToString().c_str());
+    return true;
+}
+
+static void RequestMWStateChunks(CNode *pfrom)
+{
+    while (mwsync.nNextRequest < mwsync.header.vChunkHashes.size() &&
+           mwsync.nNextRequest < mwsync.setReceived.size() + MW_STATE_MAX_REQUESTS)
+        pfrom->PushMessage("getmwstate", mwsync.header.hashBlock, (int)mwsync.nNextRequest++);
+}
+
+static bool FinishMWStateSync(const CMWStateHeader &header, int64 nSupply)
+{
+    boost::filesystem::path pathNew = MWStateNewDir();
+    boost::filesystem::path pathMMR = GetDataDir() / "mmr";
+    boost::filesystem::path pathMMRNew = GetDataDir() / "mmr.new";
+
+    // The range proofs take most of the time, so the archive is checked and
+    // loaded into MMRs and a view of its own, without cs_main
+    boost::filesystem::remove_all(pathMMRNew);
+    CMWCoinsView viewEmpty;
+    CMWCoinsViewCache view(viewEmpty);
+    {
+        CMWAccumulators acc(pathMMRNew);
+        if (!LoadMWStateArchive(pathNew, header, nSupply, acc, view) || !acc.Flush())
+            return false;
+    }
+
+    {
+        LOCK(cs_main);
+        if (!pmwaccumulators || !pmwcoinsTip || pmwaccumulators->kernels.GetLeafCount() != 0)
+            return error("FinishMWStateSync() : the Mimblewimble state changed meanwhile");
+        delete pmwaccumulators;
+        pmwaccumulators = NULL;
+        boost::filesystem::remove_all(pathMMR);
+        RenameOver(pathMMRNew, pathMMR);
+        try {
+            pmwaccumulators = new CMWAccumulators(pathMMR);
+        } catch (std::exception &e) {
+            return error("FinishMWStateSync() : %s", e.what());
+        }
+        view.SetBackend(*pmwcoinsTip);
+        view.SetBestBlock(header.hashBlock);
+        if (!view.Flush() || !pmwcoinsTip->Flush())
+            return error("FinishMWStateSync() : cannot write the loaded state");
+    }
+
+    // serve the archive on to others
+    if (WriteMWStateHeader(pathNew, header)) {
+        boost::filesystem::remove_all(MWStateDir());
+        RenameOver(pathNew, MWStateDir());
+    }
+    return true;
+}
+
+static void ThreadFinishMWStateSync(void* parg)
+{
+    RenameThread("bitcoin-mwsync");
+    CMWStateHeader header;
+    int64 nSupply;
+    string strPeer;
+    {
+        LOCK(cs_mwsync);
+        header = mwsync.header;
+        nSupply = mwsync.nSupply;
+        strPeer = mwsync.strPeer;
+    }
+
+    if (FinishMWStateSync(header, nSupply))
+        printf("Mimblewimble fast sync from %s done, at block %s\n", strPeer.c_str(), header.hashBlock.ToString().c_str());
+    else
+        printf("Mimblewimble fast sync from %s failed\n", strPeer.c_str());
+
+    LOCK(cs_mwsync);
+    mwsync.fVerifying = false;
+    mwsync.strPeer.clear();
+}
+
+bool ProcessMWStateMessage(CNode *pfrom, const string &strCommand, CDataStream &vRecv)
+{
+    if (strCommand == "getmwstate")
+    {
+        uint256 hashBlock;
+        int nChunk;
+        vRecv >> hashBlock >> nChunk;
+
+        CMWStateHeader header;
+        if (!ReadMWStateHeader(MWStateDir(), header) || (hashBlock != 0 && hashBlock != header.hashBlock))
+            return true;
+        vector<unsigned char> vData;
+        if (nChunk == -1) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << header;
+            vData.assign(ss.begin(), ss.end());
+        } else if (nChunk < 0 || (unsigned int)nChunk >= header.vChunkHashes.size() ||
+                   !ReadMWStateChunk(MWStateDir(), nChunk, vData)) {
+            return true;
+        }
+        pfrom->PushMessage("mwstate", header.hashBlock, nChunk, vData);
+        return true;
+    }
+
+    if (strCommand == "mwstate")
+    {
+        uint256 hashBlock;
+        int nChunk;
+        vector<unsigned char> vData;
+        vRecv >> hashBlock >> nChunk >> vData;
+
+        LOCK(cs_mwsync);
+        if (mwsync.strPeer != pfrom->addrName)
+            return true;
+
+        if (nChunk == -1) {
+            if (mwsync.fHaveHeader)
+                return true;
+            CMWStateHeader header;
+            try {
+                CDataStream ss(vData, SER_NETWORK, PROTOCOL_VERSION);
+                ss >> header;
+            } catch (std::exception &e) {
+                pfrom->Misbehaving(20);
+                return true;
+            }
+            if (!header.IsConsistent() || header.hashBlock != hashBlock) {
+                pfrom->Misbehaving(20);
+                return true;
+            }
+            int64 nSupply;
+            if (!CheckMWStateAnchor(header, nSupply)) {
+                mwsync.strPeer.clear();
+                return true;
+            }
+            printf("Mimblewimble fast sync from %s: %"PRI64u" kernels, %"PRI64u" outputs in %"PRIszu" chunks at height %d\n",
+                   mwsync.strPeer.c_str(), header.nKernels, header.nUnspent, header.vChunkHashes.size(), header.nHeight);
+            boost::filesystem::remove_all(MWStateNewDir());
+            boost::filesystem::create_directories(MWStateNewDir());
+            mwsync.header = header;
+            mwsync.nSupply = nSupply;
+            mwsync.fHaveHeader = true;
+            mwsync.nLastProgress = GetTime();
+            RequestMWStateChunks(pfrom);
+        } else {
+            if (!mwsync.fHaveHeader || hashBlock != mwsync.header.hashBlock || nChunk < 0 ||
+                (unsigned int)nChunk >= mwsync.nNextRequest || mwsync.setReceived.count(nChunk))
+                return true;
+            if (Hash(vData.begin(), vData.end()) != mwsync.header.vChunkHashes[nChunk]) {
+                pfrom->Misbehaving(20);
+                return true;
+            }
+            if (!WriteMWStateChunk(MWStateNewDir(), nChunk, vData))
+                return true;
+            mwsync.setReceived.insert(nChunk);
+            mwsync.nLastProgress = GetTime();
+            RequestMWStateChunks(pfrom);
+        }
+
+        if (mwsync.fHaveHeader && !mwsync.fVerifying && mwsync.setReceived.size() == mwsync.header.vChunkHashes.size()) {
+            mwsync.fVerifying = true;
+            if (!NewThread(ThreadFinishMWStateSync, NULL)) {
+                mwsync.fVerifying = false;
+                mwsync.strPeer.clear();
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
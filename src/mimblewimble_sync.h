@@ -0,0 +1,158 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_SYNC_H
+#define BITCOIN_MIMBLEWIMBLE_SYNC_H
+
+#include "mimblewimble.h"
+#include "mimblewimble_mmr.h"
+
+#include <boost/filesystem/path.hpp>
+
+class CMWCoinsView;
+class CMWCoinsViewCache;
+class CNode;
+
+/** Mimblewimble fast sync.
+ *
+ * Thanks to cut-through a node does not need the spent outputs of the past,
+ * only the kernels, the unspent outputs and the MMR roots. A state archive
+ * holds them at one block, split into chunks that can be fetched and
+ * checked one at a time:
+ *
+ *   mwstate/header.dat        CMWStateHeader, with the hash of every chunk
+ *   mwstate/chunk00000.dat    the kernels, nKernelsPerChunk per chunk,
+ *   ...                       then the unspent outputs, nOutputsPerChunk per chunk
+ *
+ * Over p2p, "getmwstate" (hashBlock, nChunk) asks for chunk nChunk of the
+ * archive at hashBlock, or the header for nChunk == -1, and "mwstate"
+ * (hashBlock, nChunk, data) answers it.
+ *
+ * Only an archive at a block of the best chain whose state is compiled in
+ * (Checkpoints::CheckMWState) is fetched, and the supply is the compiled-in
+ * one, not the peer's; testnet with -checkpoints=0 takes any archive at a
+ * block of the best chain, and its supply. The archive is then accepted when
+ * the kernels rebuild the kernel MMR root, every range proof is valid, and
+ * the unspent outputs sum to the kernel excesses plus offset*G plus
+ * nSupply*H; that is checked on a thread of its own, without cs_main. Its
+ * size is that of the kernels and the unspent outputs, whatever the length
+ * of the history.
+ */
+
+static const int MW_STATE_VERSION = 1;
+static const unsigned int MW_STATE_CHUNK_KERNELS = 8192;  // about 900kB
+static const unsigned int MW_STATE_CHUNK_OUTPUTS = 1024;  // about 750kB
+
+/** An unspent output in a state archive, with its leaf in the output MMR */
+class CMWStateOutput
+{
+public:
+    uint64 nLeaf;
+    int nHeight;
+    mw::Output output;
+
+    CMWStateOutput() : nLeaf(0), nHeight(0) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nLeaf);
+        READWRITE(nHeight);
+        READWRITE(output);
+    )
+};
+
+class CMWStateChunk
+{
+public:
+    std::vector<mw::Kernel> vKernels;
+    std::vector<CMWStateOutput> vOutputs;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(vKernels);
+        READWRITE(vOutputs);
+    )
+};
+
+class CMWStateHeader
+{
+public:
+    int nVersion;
+    int nHeight;
+    uint256 hashBlock;
+    int64 nSupply;              // as the writer had it; loaders are given the supply
+    mw::BlindingFactor offset;
+    uint64 nKernels;
+    uint256 hashKernelRoot;
+    uint64 nOutputLeaves;
+    std::vector<uint256> vOutputPeaks;
+    uint64 nUnspent;
+    unsigned int nKernelsPerChunk;
+    unsigned int nOutputsPerChunk;
+    std::vector<uint256> vChunkHashes;
+
+    CMWStateHeader()
+    {
+        nVersion = MW_STATE_VERSION;
+        nHeight = 0;
+        hashBlock = 0;
+        nSupply = 0;
+        nKernels = 0;
+        hashKernelRoot = 0;
+        nOutputLeaves = 0;
+        nUnspent = 0;
+        nKernelsPerChunk = MW_STATE_CHUNK_KERNELS;
+        nOutputsPerChunk = MW_STATE_CHUNK_OUTPUTS;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(nSupply);
+        READWRITE(offset);
+        READWRITE(nKernels);
+        READWRITE(hashKernelRoot);
+        READWRITE(nOutputLeaves);
+        READWRITE(vOutputPeaks);
+        READWRITE(nUnspent);
+        READWRITE(nKernelsPerChunk);
+        READWRITE(nOutputsPerChunk);
+        READWRITE(vChunkHashes);
+    )
+
+    unsigned int GetKernelChunks() const;
+    unsigned int GetOutputChunks() const;
+    uint256 GetOutputRoot() const;
+    // whether the counts, the peaks and the chunk hashes fit together
+    bool IsConsistent() const;
+};
+
+/** Write the archive of the current MW state to pathDir. view gives the
+ *  height of each unspent output; nHeight and hashBlock name the block. */
+bool WriteMWStateArchive(const boost::filesystem::path &pathDir, const CMWAccumulators &acc, CMWCoinsView &view,
+                         int nHeight, const uint256 &hashBlock, CMWStateHeader &header,
+                         unsigned int nKernelsPerChunk = MW_STATE_CHUNK_KERNELS,
+                         unsigned int nOutputsPerChunk = MW_STATE_CHUNK_OUTPUTS);
+
+bool ReadMWStateHeader(const boost::filesystem::path &pathDir, CMWStateHeader &header);
+bool WriteMWStateHeader(const boost::filesystem::path &pathDir, const CMWStateHeader &header);
+bool ReadMWStateChunk(const boost::filesystem::path &pathDir, unsigned int nChunk, std::vector<unsigned char> &vData);
+bool WriteMWStateChunk(const boost::filesystem::path &pathDir, unsigned int nChunk, const std::vector<unsigned char> &vData);
+
+/** Check a complete archive and load it: the kernels are appended to the
+ *  (empty) kernel MMR of acc, and the unspent outputs added to view. The
+ *  outputs must hold nSupply, which the caller knows from elsewhere than the
+ *  archive. On failure the kernel MMR is rewound, and the caller drops view. */
+bool LoadMWStateArchive(const boost::filesystem::path &pathDir, const CMWStateHeader &header, int64 nSupply,
+                        CMWAccumulators &acc, CMWCoinsViewCache &view);
+
+/** Handle "getmwstate" and "mwstate"; false for other commands */
+bool ProcessMWStateMessage(CNode *pfrom, const std::string &strCommand, CDataStream &vRecv);
+
+/** Ask a newly connected peer for its MW state, if we have none yet (-mwfastsync) */
+void StartMWStateSync(CNode *pfrom);
+
+#endif // BITCOIN_MIMBLEWIMBLE_SYNC_H
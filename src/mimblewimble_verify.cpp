@@ -0,0 +1,157 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mimblewimble_verify.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "checkqueue.h"
+
+using namespace std;
+using namespace mw;
+
+CMWVerifyCache mwverifycache;
+
+bool CMWVerifyCache::Get(const uint256 &hash)
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_mwcache);
+    return setValid.count(hash) != 0;
+}
+
+void CMWVerifyCache::Set(const uint256 &hash)
+{
+    // Same bound as the signature cache; an entry is 32 bytes plus the set node
+    int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+    if (nMaxCacheSize <= 0) return;
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_mwcache);
+
+    while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
+    {
+        // Evict a random entry, see CSignatureCache
+        std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+        if (it == setValid.end())
+            it = setValid.begin();
+        setValid.erase(it);
+    }
+    setValid.insert(hash);
+}
+
+unsigned int CMWVerifyCache::size()
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_mwcache);
+    return setValid.size();
+}
+
+void CMWVerifyCache::clear()
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_mwcache);
+    setValid.clear();
+}
+
+bool CMWCheck::operator()()
+{
+    if (nType == BALANCE)
+        return ptx == NULL || ptx->VerifyBalance();
+
+    // a batch that fails does not say which entry failed, so only a batch
+    // that passes is remembered
+    if (nType == KERNEL_SIGNATURES) {
+        CSchnorrBatch batch;
+        batch.reserve(vKernels.size());
+        BOOST_FOREACH(const Kernel *kernel, vKernels)
+            if (!kernel->Verify(&batch))
+                return false;
+        if (!batch.Verify())
+            return false;
+        BOOST_FOREACH(const Kernel *kernel, vKernels)
+            mwverifycache.Set(kernel->GetHash());
+        return true;
+    }
+
+    CBulletproofBatch batch;
+    batch.reserve(vOutputs.size());
+    BOOST_FOREACH(const Output *output, vOutputs)
+        if (!output->Verify(&batch))
+            return false;
+    if (!batch.Verify())
+        return false;
+    BOOST_FOREACH(const Output *output, vOutputs)
+        mwverifycache.Set(output->GetHash());
+    return true;
+}
+
+static CCheckQueue<CMWCheck> mwcheckqueue(1);
+// the check queue takes one master at a time; the pool and block
+// verification may both want it
+static boost::mutex cs_mwcheckqueue;
+
+void ThreadMWCheck() {
+    RenameThread("bitcoin-mwcheck");
+    mwcheckqueue.Thread();
+}
+
+bool VerifyMWBatches(const vector<const Kernel*> &vKernels, const vector<const Output*> &vOutputs, const Transaction *ptx)
+{
+    // hash before queueing: the checks then only read the cached hashes
+    vector<CMWCheck> vChecks;
+    vector<const Kernel*> vKernelBatch;
+    BOOST_FOREACH(const Kernel *kernel, vKernels) {
+        if (mwverifycache.Get(kernel->GetHash()))
+            continue;
+        vKernelBatch.push_back(kernel);
+        if (vKernelBatch.size() == MW_CHECK_KERNELS) {
+            vChecks.push_back(CMWCheck(vKernelBatch));
+            vKernelBatch.clear();
+        }
+    }
+    if (!vKernelBatch.empty())
+        vChecks.push_back(CMWCheck(vKernelBatch));
+
+    vector<const Output*> vOutputBatch;
+    BOOST_FOREACH(const Output *output, vOutputs) {
+        if (mwverifycache.Get(output->GetHash()))
+            continue;
+        vOutputBatch.push_back(output);
+        if (vOutputBatch.size() == MW_CHECK_OUTPUTS) {
+            vChecks.push_back(CMWCheck(vOutputBatch));
+            vOutputBatch.clear();
+        }
+    }
+    if (!vOutputBatch.empty())
+        vChecks.push_back(CMWCheck(vOutputBatch));
+
+    if (ptx)
+        vChecks.push_back(CMWCheck(ptx));
+    if (vChecks.empty())
+        return true;
+    if (vChecks.size() == 1)
+        return vChecks[0]();
+
+    boost::unique_lock<boost::mutex> lock(cs_mwcheckqueue);
+    CCheckQueueControl<CMWCheck> control(&mwcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+bool VerifyMWTransaction(const Transaction &tx, CMWCoinsView *view)
+{
+    if (view && !tx.HaveInputs(*view))
+        return error("VerifyMWTransaction() : missing or duplicate input");
+
+    vector<const Kernel*> vKernels;
+    vKernels.reserve(tx.kernels.size());
+    BOOST_FOREACH(const Kernel &kernel, tx.kernels)
+        vKernels.push_back(&kernel);
+    vector<const Output*> vOutputs;
+    vOutputs.reserve(tx.vout.size());
+    BOOST_FOREACH(const Output &output, tx.vout)
+        vOutputs.push_back(&output);
+    if (!VerifyMWBatches(vKernels, vOutputs, &tx))
+        return error("VerifyMWTransaction() : invalid transaction %s", tx.GetHash().ToString().substr(0,10).c_str());
+    return true;
+}
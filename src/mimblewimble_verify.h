@@ -0,0 +1,93 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MIMBLEWIMBLE_VERIFY_H
+#define BITCOIN_MIMBLEWIMBLE_VERIFY_H
+
+#include "mimblewimble.h"
+
+#include <set>
+
+#include <boost/thread/shared_mutex.hpp>
+
+/** Parallel verification of Mimblewimble transactions.
+ *
+ * The MW part of a block is one aggregated transaction. Its checks split
+ * into batches of kernel signatures, batches of range proofs and the single
+ * commitment sum, each one multi-exponentiation, which run as CMWCheck jobs
+ * on a CCheckQueue the way ConnectBlock runs its script checks.
+ *
+ * Kernels and outputs that pass are remembered by hash; the hash of a kernel
+ * covers its signature and that of an output its range proof. A block made
+ * of transactions the pool has accepted then only has its sum checked again.
+ */
+
+// kernel signatures and range proofs per check
+static const unsigned int MW_CHECK_KERNELS = 128;
+static const unsigned int MW_CHECK_OUTPUTS = 32;
+
+/** Kernels and outputs known to be valid, by hash */
+class CMWVerifyCache
+{
+private:
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_mwcache;
+
+public:
+    bool Get(const uint256 &hash);
+    void Set(const uint256 &hash);
+    unsigned int size();
+    void clear();
+};
+
+extern CMWVerifyCache mwverifycache;
+
+/** Closure representing one batch of MW checks. It points into the
+ *  transaction being checked, which must outlive the check. */
+class CMWCheck
+{
+public:
+    enum
+    {
+        KERNEL_SIGNATURES,
+        RANGE_PROOFS,
+        BALANCE,
+    };
+
+private:
+    int nType;
+    std::vector<const mw::Kernel*> vKernels;
+    std::vector<const mw::Output*> vOutputs;
+    const mw::Transaction *ptx;
+
+public:
+    CMWCheck() : nType(BALANCE), ptx(NULL) {}
+    explicit CMWCheck(const std::vector<const mw::Kernel*> &vKernelsIn) :
+        nType(KERNEL_SIGNATURES), vKernels(vKernelsIn), ptx(NULL) {}
+    explicit CMWCheck(const std::vector<const mw::Output*> &vOutputsIn) :
+        nType(RANGE_PROOFS), vOutputs(vOutputsIn), ptx(NULL) {}
+    explicit CMWCheck(const mw::Transaction *ptxIn) : nType(BALANCE), ptx(ptxIn) {}
+
+    bool operator()();
+
+    void swap(CMWCheck &check) {
+        std::swap(nType, check.nType);
+        vKernels.swap(check.vKernels);
+        vOutputs.swap(check.vOutputs);
+        std::swap(ptx, check.ptx);
+    }
+};
+
+/** Check the kernel signatures and range proofs that are not in the cache,
+ *  in batches on the MW check threads, and the balance of ptx if given. */
+bool VerifyMWBatches(const std::vector<const mw::Kernel*> &vKernels, const std::vector<const mw::Output*> &vOutputs,
+                     const mw::Transaction *ptx = NULL);
+
+/** Full check of a transaction, or of the aggregated MW part of a block;
+ *  with a view, the inputs must be unspent outputs in it. */
+bool VerifyMWTransaction(const mw::Transaction &tx, CMWCoinsView *view = NULL);
+
+/** Run an instance of the MW check thread */
+void ThreadMWCheck();
+
+#endif // BITCOIN_MIMBLEWIMBLE_VERIFY_H
@@ -1,24 +1,79 @@
 #include "mimblewimble_wallet.h"
+#include "mimblewimble_coins.h"
+#include "walletdb.h"
 #include "util.h"
-#include <openssl/rand.h>
+#include <algorithm>
 
 namespace mw {
 
-MimblewimbleWallet::MimblewimbleWallet(CWallet* wallet) : pWallet(wallet) {}
+MimblewimbleWallet::MimblewimbleWallet(CWallet* wallet) : pWallet(wallet), nBalance(0), nNextKeyIndex(0) {
+    Load();
+}
+
+bool MimblewimbleWallet::Load() {
+    if (!pWallet || !pWallet->fFileBacked)
+        return true;
+
+    std::vector<CMWWalletOutput> records;
+    unsigned int nIndex = 0;
+    try {
+        CWalletDB walletdb(pWallet->strWalletFile, "r");
+        walletdb.ReadMWKeyIndex(nIndex);
+        walletdb.ListMWOutputs(records);
+    } catch (const std::exception& e) {
+        printf("MW: Cannot read wallet outputs: %s\n", e.what());
+        return false;
+    }
+
+    LOCK(cs_mwwallet);
+    ownedOutputs.clear();
+    nBalance = 0;
+    nNextKeyIndex = nIndex;
+    for (const CMWWalletOutput& record : records) {
+        ownedOutputs[record.output.commitment] = record;
+        nBalance += record.nValue;
+        nNextKeyIndex = std::max(nNextKeyIndex, record.nKeyIndex + 1);
+    }
+    printf("MW: %u wallet outputs, balance %s\n", (unsigned int)ownedOutputs.size(), FormatMoney(nBalance).c_str());
+    return true;
+}
+
+bool MimblewimbleWallet::GetKeyChain(CMWKeyChain& keychain) const {
+    if (!pWallet)
+        return false;
+    // A const getter does not write a seed into wallet.dat: a wallet from
+    // before -usehd has to be given one first
+    if (!pWallet->IsHDEnabled()) {
+        printf("MW: Wallet has no HD seed, give it one with -upgradewallet or sethdseed\n");
+        return false;
+    }
+    CKey seed;
+    if (!pWallet->GetKey(pWallet->GetHDChain().seedID, seed)) {
+        printf("MW: Wallet is locked\n");
+        return false;
+    }
+    keychain = CMWKeyChain(seed.begin(), seed.size());
+    return true;
+}
 
 std::pair<Output, BlindingFactor> MimblewimbleWallet::CreateOutput(int64_t amount) {
-    // Generate a random blinding factor
-    BlindingFactor blind = BlindingFactor::Random();
-    
-    // Create commitment using the amount and blinding factor
-    Commitment commitment = createCommitment(amount, blind);
-    
-    // Create a range proof that proves amount is positive without revealing it
-    RangeProof rangeProof = createRangeProof(amount, blind);
-    
-    // Create and return the output
-    Output output(commitment, rangeProof);
-    return std::make_pair(output, blind);
+    CMWKeyChain keychain;
+    if (!GetKeyChain(keychain))
+        throw std::runtime_error("MimblewimbleWallet::CreateOutput() : wallet is locked or has no HD seed (see -upgradewallet and sethdseed)");
+
+    // Take the next key index, and make sure it is not handed out again
+    unsigned int nIndex;
+    {
+        LOCK(cs_mwwallet);
+        nIndex = nNextKeyIndex++;
+        if (pWallet->fFileBacked && !CWalletDB(pWallet->strWalletFile).WriteMWKeyIndex(nNextKeyIndex))
+            printf("MW: Failed to write the next key index\n");
+    }
+
+    // The commitment and a range proof that carries the amount and the
+    // index, so that the wallet can find the output again from its seed
+    Output output = keychain.CreateOutput(amount, nIndex);
+    return std::make_pair(output, keychain.GetBlind(nIndex));
 }
 
 boost::optional<Transaction> MimblewimbleWallet::CreateTransaction(
@@ -28,112 +83,114 @@ boost::optional<Transaction> MimblewimbleWallet::CreateTransaction(
 {
     // Calculate total input value
     int64_t inputTotal = 0;
-    std::vector<BlindingFactor> inputBlindingFactors;
-    
+
     for (const Output& input : inputs) {
         boost::optional<int64_t> value = GetOutputValue(input);
         if (!value) {
-            LogPrintf("MW: Cannot spend output not owned by wallet\n");
+            printf("MW: Cannot spend output not owned by wallet\n");
             return boost::none;
         }
-        
+
         inputTotal += *value;
-        
-        // Find blinding factor for this input
-        auto it = ownedOutputs.find(input.commitment);
-        if (it != ownedOutputs.end()) {
-            inputBlindingFactors.push_back(it->second.second);
-        } else {
-            LogPrintf("MW: Missing blinding factor for input\n");
-            return boost::none;
-        }
     }
-    
+
     // Calculate total output value
     int64_t outputTotal = 0;
     for (int64_t amount : amounts) {
         outputTotal += amount;
     }
-    
+
     // Ensure we have enough funds (including fee)
     if (inputTotal < outputTotal + fee) {
-        LogPrintf("MW: Insufficient funds: %d < %d + %d\n", inputTotal, outputTotal, fee);
+        printf("MW: Insufficient funds: %"PRI64d" < %"PRI64d" + %"PRI64d"\n", (int64)inputTotal, (int64)outputTotal, (int64)fee);
         return boost::none;
     }
-    
+
     // Handle change if necessary
     int64_t change = inputTotal - outputTotal - fee;
     if (change < 0) {
-        LogPrintf("MW: Invalid change amount\n");
+        printf("MW: Invalid change amount\n");
         return boost::none;
     }
-    
+
     // Create outputs
     std::vector<Output> outputs;
     std::vector<BlindingFactor> outputBlindingFactors;
-    
-    for (int64_t amount : amounts) {
-        auto [output, blind] = CreateOutput(amount);
-        outputs.push_back(output);
-        outputBlindingFactors.push_back(blind);
-    }
-    
-    // Add change output if needed
-    if (change > 0) {
-        auto [changeOutput, changeBlind] = CreateOutput(change);
-        outputs.push_back(changeOutput);
-        outputBlindingFactors.push_back(changeBlind);
-    }
-    
+
+    try {
+        for (int64_t amount : amounts) {
+            auto [output, blind] = CreateOutput(amount);
+            outputs.push_back(output);
+            outputBlindingFactors.push_back(blind);
+        }
+
+        // Add change output if needed
+        if (change > 0) {
+            auto [changeOutput, changeBlind] = CreateOutput(change);
+            outputs.push_back(changeOutput);
+            outputBlindingFactors.push_back(changeBlind);
+        }
+    } catch (const std::exception& e) {
+        printf("MW: %s\n", e.what());
+        return boost::none;
+    }
+
     // Build the transaction
     Transaction tx = Transaction::BuildTransaction(
         inputs,
         outputs,
         fee,
-        pWallet->GetChainTip()->nHeight // Current lock height
+        nBestHeight // Current lock height
     );
-    
+
     // Sign the transaction
     if (!SignTransaction(tx, outputBlindingFactors)) {
-        LogPrintf("MW: Failed to sign transaction\n");
+        printf("MW: Failed to sign transaction\n");
         return boost::none;
     }
-    
-    // Save our outputs to wallet
-    size_t outputIdx = 0;
-    for (int64_t amount : amounts) {
-        if (!SaveOwnedOutput(outputs[outputIdx], outputBlindingFactors[outputIdx], amount)) {
-            LogPrintf("MW: Failed to save output to wallet\n");
-        }
-        outputIdx++;
-    }
-    
-    // Save change output
-    if (change > 0) {
-        if (!SaveOwnedOutput(outputs.back(), outputBlindingFactors.back(), change)) {
-            LogPrintf("MW: Failed to save change output to wallet\n");
-        }
-    }
-    
+
+    // The outputs are recorded by CommitTransaction once the transaction
+    // has been accepted
     return tx;
 }
 
 bool MimblewimbleWallet::SignTransaction(Transaction& tx, const std::vector<BlindingFactor>& blindingFactors) {
-    // In a real implementation, we would:
-    // 1. Calculate the transaction offset
-    // 2. Calculate the kernel excess from input/output blinding factors and offset
-    // 3. Sign the kernel with the excess as private key
-    
-    // For now, we just create a dummy signature
-    if (tx.kernels.empty()) {
-        LogPrintf("MW: No kernels to sign\n");
+    // With a random offset, the kernel excess is what is left of the
+    // blinding factors: sum(outputs) - sum(inputs) - offset. Then
+    // sum(outputs) - sum(inputs) + fee*H == excess + offset*G
+    if (tx.kernels.size() != 1) {
+        printf("MW: Expected one kernel to sign\n");
+        return false;
+    }
+
+    CMWKeyChain keychain;
+    if (!GetKeyChain(keychain))
         return false;
+
+    BlindingFactor excess;
+    for (const BlindingFactor& blind : blindingFactors) {
+        excess += blind;
     }
-    
-    // Just set a dummy excess for now - in real implementation this would be calculated
-    BlindingFactor excess = BlindingFactor::Random();
-    tx.kernels[0].excess = createCommitment(0, excess);
-    
+    {
+        LOCK(cs_mwwallet);
+        for (const Input& input : tx.vin) {
+            auto it = ownedOutputs.find(input.commitment);
+            if (it == ownedOutputs.end()) {
+                printf("MW: Input not owned by this wallet\n");
+                return false;
+            }
+            excess -= keychain.GetBlind(it->second.nKeyIndex);
+        }
+    }
+    tx.offset = BlindingFactor::Random();
+    excess -= tx.offset;
+
+    if (!tx.kernels[0].Sign(excess)) {
+        printf("MW: Failed to sign kernel\n");
+        return false;
+    }
+    tx.MarkDirty();
+
     return true;
 }
 
@@ -141,33 +198,138 @@ bool MimblewimbleWallet::VerifyTransaction(const Transaction& tx) const {
     return tx.Verify();
 }
 
+bool MimblewimbleWallet::AddOutput(const CMWWalletOutput& record) {
+    LOCK(cs_mwwallet);
+    if (ownedOutputs.count(record.output.commitment))
+        return true;
+    if (pWallet->fFileBacked && !CWalletDB(pWallet->strWalletFile).WriteMWOutput(record.output.commitment, record))
+        return false;
+    ownedOutputs[record.output.commitment] = record;
+    nBalance += record.nValue;
+    if (record.nKeyIndex >= nNextKeyIndex) {
+        nNextKeyIndex = record.nKeyIndex + 1;
+        if (pWallet->fFileBacked)
+            CWalletDB(pWallet->strWalletFile).WriteMWKeyIndex(nNextKeyIndex);
+    }
+    return true;
+}
+
 bool MimblewimbleWallet::SaveOwnedOutput(
     const Output& output,
     const BlindingFactor& blindingFactor,
     int64_t amount)
 {
-    ownedOutputs[output.commitment] = std::make_pair(amount, blindingFactor);
-    return true;
+    // Only the key index is kept, so the output must be one the seed opens
+    CMWKeyChain keychain;
+    if (!GetKeyChain(keychain))
+        return false;
+    int64 nValue;
+    unsigned int nIndex;
+    if (!keychain.RewindOutput(output, nValue, nIndex) || nValue != amount ||
+        keychain.GetBlind(nIndex).GetBytes() != blindingFactor.GetBytes()) {
+        printf("MW: Output was not made with this wallet's seed\n");
+        return false;
+    }
+    return AddOutput(CMWWalletOutput(output, nValue, nIndex));
+}
+
+bool MimblewimbleWallet::CommitTransaction(const Transaction& tx) {
+    CMWKeyChain keychain;
+    if (!GetKeyChain(keychain))
+        return false;
+
+    bool fOk = true;
+    {
+        LOCK(cs_mwwallet);
+        for (const Input& input : tx.vin) {
+            auto it = ownedOutputs.find(input.commitment);
+            if (it == ownedOutputs.end())
+                continue;
+            if (pWallet->fFileBacked && !CWalletDB(pWallet->strWalletFile).EraseMWOutput(input.commitment))
+                fOk = false;
+            nBalance -= it->second.nValue;
+            ownedOutputs.erase(it);
+        }
+    }
+    for (const Output& output : tx.vout) {
+        int64 nValue;
+        unsigned int nIndex;
+        if (keychain.RewindOutput(output, nValue, nIndex) && !AddOutput(CMWWalletOutput(output, nValue, nIndex)))
+            fOk = false;
+    }
+    if (!fOk)
+        printf("MW: Failed to update wallet outputs for transaction %s\n", tx.GetHash().ToString().c_str());
+    return fOk;
+}
+
+int MimblewimbleWallet::ScanForOutputs(CMWCoinsViewDB& db, unsigned int nThreads) {
+    CMWKeyChain keychain;
+    if (!GetKeyChain(keychain))
+        return -1;
+
+    std::vector<CMWWalletOutput> found;
+    if (!ScanMWCoins(db, keychain, nThreads, found))
+        return -1;
+
+    int nNew = 0;
+    for (const CMWWalletOutput& record : found) {
+        if (GetOutputValue(record.output))
+            continue;
+        if (!AddOutput(record))
+            return -1;
+        nNew++;
+    }
+    printf("MW: Scan found %u wallet outputs, %d new\n", (unsigned int)found.size(), nNew);
+    return nNew;
 }
 
 std::vector<Output> MimblewimbleWallet::GetOwnedOutputs() const {
+    LOCK(cs_mwwallet);
     std::vector<Output> outputs;
-    for (const auto& [commitment, valueAndBlind] : ownedOutputs) {
-        // Note: In a real implementation, we'd reconstruct the output with the
-        // correct range proof from stored data
-        Output output;
-        output.commitment = commitment;
-        outputs.push_back(output);
+    outputs.reserve(ownedOutputs.size());
+    for (const auto& [commitment, record] : ownedOutputs) {
+        outputs.push_back(record.output);
     }
     return outputs;
 }
 
+bool MimblewimbleWallet::SelectInputs(int64_t target, std::vector<Output>& inputs) const {
+    LOCK(cs_mwwallet);
+    inputs.clear();
+    if (target > nBalance)
+        return false;
+
+    std::vector<const CMWWalletOutput*> records;
+    records.reserve(ownedOutputs.size());
+    for (const auto& [commitment, record] : ownedOutputs) {
+        records.push_back(&record);
+    }
+    std::sort(records.begin(), records.end(), [](const CMWWalletOutput* a, const CMWWalletOutput* b) {
+        return a->nValue > b->nValue;
+    });
+
+    int64_t total = 0;
+    for (const CMWWalletOutput* record : records) {
+        if (total >= target && !inputs.empty())
+            break;
+        inputs.push_back(record->output);
+        total += record->nValue;
+    }
+    return total >= target;
+}
+
+int64_t MimblewimbleWallet::GetBalance() const {
+    LOCK(cs_mwwallet);
+    return nBalance;
+}
+
 boost::optional<int64_t> MimblewimbleWallet::GetOutputValue(const Output& output) const {
+    LOCK(cs_mwwallet);
     auto it = ownedOutputs.find(output.commitment);
     if (it != ownedOutputs.end()) {
-        return it->second.first;
+        return it->second.nValue;
     }
     return boost::none;
 }
 
-} // namespace mw 
\ No newline at end of file
+} // namespace mw
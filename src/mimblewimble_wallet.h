@@ -2,19 +2,41 @@
 #define MIMBLEWIMBLE_WALLET_H
 
 #include "mimblewimble.h"
+#include "mimblewimble_keychain.h"
 #include "wallet.h"
 #include <boost/optional.hpp>
+#include <unordered_map>
+
+class CMWCoinsViewDB;
 
 namespace mw {
 
+/**
+ * The Mimblewimble outputs of a wallet.
+ *
+ * Blinding factors come from the wallet's HD seed (see CMWKeyChain), so
+ * creating or spending an output needs the wallet unlocked. A wallet without
+ * a seed is refused until it is given one with -upgradewallet or sethdseed.
+ * Each output is kept as a "mwout" record of wallet.dat keyed by its
+ * commitment, written when it changes; the records hold no secret, and a
+ * wallet that lost them finds its outputs again with ScanForOutputs.
+ */
 class MimblewimbleWallet {
 public:
     MimblewimbleWallet(CWallet* wallet);
+
+    /**
+     * Reads the wallet's outputs from the wallet database
+     * @return Whether the records could be read
+     */
+    bool Load();
     
     /**
-     * Creates a confidential output representing a specific amount of DuckBucks
+     * Creates a confidential output representing a specific amount of DuckBucks,
+     * with the blinding factor of the next key index
      * @param amount The amount to commit to
      * @return A tuple containing the output and the blinding factor used
+     * @throws std::runtime_error if the wallet is locked or has no HD seed
      */
     std::pair<Output, BlindingFactor> CreateOutput(int64_t amount);
     
@@ -31,7 +53,8 @@ public:
         int64_t fee);
     
     /**
-     * Sign a transaction with the necessary blinding factors
+     * Sign a transaction with the necessary blinding factors; those of the
+     * inputs are derived again from the wallet's seed
      * @param tx The transaction to sign
      * @param blindingFactors The blinding factors used for outputs
      * @return Whether the signing was successful
@@ -46,19 +69,51 @@ public:
     bool VerifyTransaction(const Transaction& tx) const;
     
     /**
-     * Save an output as owned by this wallet
+     * Save an output as owned by this wallet. It must have been made by
+     * CreateOutput, with this wallet's seed
      * @param output The output to save
      * @param blindingFactor The blinding factor for this output
      * @param amount The amount this output represents
      * @return Whether the operation was successful
      */
     bool SaveOwnedOutput(const Output& output, const BlindingFactor& blindingFactor, int64_t amount);
+
+    /**
+     * Record a transaction made by CreateTransaction once it has been
+     * accepted: its inputs are spent and its outputs are ours
+     * @param tx The transaction
+     * @return Whether the wallet database was updated
+     */
+    bool CommitTransaction(const Transaction& tx);
+
+    /**
+     * Finds the wallet's outputs in the unspent output set by rewinding
+     * their range proofs, with nThreads threads
+     * @param db The unspent output set; flush the caches above it first
+     * @param nThreads The number of scan threads
+     * @return The number of outputs found that the wallet did not have, or -1 on error
+     */
+    int ScanForOutputs(CMWCoinsViewDB& db, unsigned int nThreads);
     
     /**
-     * Gets all outputs owned by this wallet
+     * Gets all outputs owned by this wallet. This copies every output; use
+     * GetBalance or SelectInputs where they will do
      * @return A vector of owned outputs
      */
     std::vector<Output> GetOwnedOutputs() const;
+
+    /**
+     * Picks outputs worth at least a target, largest first
+     * @param target The value to cover
+     * @param inputs Set to the outputs picked
+     * @return Whether the wallet's outputs cover the target
+     */
+    bool SelectInputs(int64_t target, std::vector<Output>& inputs) const;
+
+    /**
+     * The sum of the values of the wallet's outputs, kept as they come and go
+     */
+    int64_t GetBalance() const;
     
     /**
      * Gets the value of a specific output if owned by this wallet
@@ -69,9 +124,18 @@ public:
     
 private:
     CWallet* pWallet;
-    
-    // Map of output commitments to their values and blinding factors
-    std::map<Commitment, std::pair<int64_t, BlindingFactor>> ownedOutputs;
+
+    mutable CCriticalSection cs_mwwallet;
+    // The wallet's outputs by commitment, as in wallet.dat
+    std::unordered_map<Commitment, CMWWalletOutput, CommitmentHasher> ownedOutputs;
+    int64_t nBalance;
+    // key index of the next output
+    unsigned int nNextKeyIndex;
+
+    // the keys of the wallet's HD seed; false if it is locked or has none,
+    // which -upgradewallet or sethdseed gives it
+    bool GetKeyChain(CMWKeyChain& keychain) const;
+    bool AddOutput(const CMWWalletOutput& record);
 };
 
 } // namespace mw
@@ -0,0 +1,131 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include <openssl/bn.h>
+#include <openssl/sha.h>
+
+#include <stdexcept>
+
+namespace {
+
+/** Owns the modulus 2^3072 - 1103717 for the lifetime of the process */
+class CMuHashModulus
+{
+public:
+    BIGNUM *p;
+
+    CMuHashModulus()
+    {
+        p = BN_new();
+        BIGNUM *c = BN_new();
+        if (!p || !c || !BN_set_bit(p, 3072) || !BN_set_word(c, 1103717) || !BN_sub(p, p, c))
+            throw std::runtime_error("CMuHashModulus : initialization failed");
+        BN_free(c);
+    }
+
+    ~CMuHashModulus()
+    {
+        BN_free(p);
+    }
+};
+
+const CMuHashModulus modulus;
+
+/** Scoped BIGNUM arithmetic context */
+class CMuHashCtx
+{
+public:
+    BN_CTX *ctx;
+    BIGNUM *a;
+    BIGNUM *b;
+
+    CMuHashCtx()
+    {
+        ctx = BN_CTX_new();
+        a = BN_new();
+        b = BN_new();
+        if (!ctx || !a || !b)
+            throw std::runtime_error("CMuHashCtx : allocation failed");
+    }
+
+    ~CMuHashCtx()
+    {
+        BN_clear_free(a);
+        BN_clear_free(b);
+        BN_CTX_free(ctx);
+    }
+};
+
+// Expand a 256-bit element into a 3072-bit number: SHA256(hash || i) for i = 0..11
+void ExpandElement(const uint256 &hash, unsigned char out[CMuHash3072::BYTE_SIZE])
+{
+    unsigned char buf[33];
+    memcpy(buf, hash.begin(), 32);
+    for (unsigned int i = 0; i < CMuHash3072::BYTE_SIZE / 32; i++) {
+        buf[32] = (unsigned char)i;
+        SHA256(buf, sizeof(buf), out + 32 * i);
+    }
+}
+
+// target := target * factor (mod p), both little-endian
+void MulMod(unsigned char target[CMuHash3072::BYTE_SIZE], const unsigned char factor[CMuHash3072::BYTE_SIZE])
+{
+    CMuHashCtx c;
+    if (!BN_lebin2bn(target, CMuHash3072::BYTE_SIZE, c.a) ||
+        !BN_lebin2bn(factor, CMuHash3072::BYTE_SIZE, c.b) ||
+        !BN_mod_mul(c.a, c.a, c.b, modulus.p, c.ctx) ||
+        BN_bn2lebinpad(c.a, target, CMuHash3072::BYTE_SIZE) < 0)
+        throw std::runtime_error("CMuHash3072 : modular multiplication failed");
+}
+
+} // anon namespace
+
+CMuHash3072& CMuHash3072::Insert(const uint256 &hash)
+{
+    unsigned char elem[BYTE_SIZE];
+    ExpandElement(hash, elem);
+    MulMod(num, elem);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::Remove(const uint256 &hash)
+{
+    unsigned char elem[BYTE_SIZE];
+    ExpandElement(hash, elem);
+    MulMod(den, elem);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::operator*=(const CMuHash3072 &other)
+{
+    MulMod(num, other.num);
+    MulMod(den, other.den);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::operator/=(const CMuHash3072 &other)
+{
+    MulMod(num, other.den);
+    MulMod(den, other.num);
+    return *this;
+}
+
+uint256 CMuHash3072::Finalize() const
+{
+    unsigned char result[BYTE_SIZE];
+    {
+        CMuHashCtx c;
+        if (!BN_lebin2bn(num, BYTE_SIZE, c.a) ||
+            !BN_lebin2bn(den, BYTE_SIZE, c.b) ||
+            !BN_mod_inverse(c.b, c.b, modulus.p, c.ctx) ||
+            !BN_mod_mul(c.a, c.a, c.b, modulus.p, c.ctx) ||
+            BN_bn2lebinpad(c.a, result, BYTE_SIZE) < 0)
+            throw std::runtime_error("CMuHash3072::Finalize() : modular inversion failed");
+    }
+    uint256 hash;
+    SHA256(result, BYTE_SIZE, (unsigned char*)&hash);
+    return hash;
+}
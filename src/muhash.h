@@ -0,0 +1,76 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string.h>
+
+/** A rolling hash over a multiset of 256-bit elements.
+ *
+ * Each element is expanded to a 3072-bit number and multiplied into a running
+ * product modulo the prime 2^3072 - 1103717. Removal multiplies into a separate
+ * denominator, so both insertion and removal are a single modular
+ * multiplication, and only Finalize() needs a modular inverse. The result is
+ * independent of the order of operations, which makes it suitable for
+ * committing to a set that is updated incrementally (e.g. the UTXO set).
+ */
+class CMuHash3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+private:
+    // little-endian numerator and denominator, both reduced modulo the prime
+    unsigned char num[BYTE_SIZE];
+    unsigned char den[BYTE_SIZE];
+
+public:
+    CMuHash3072()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(FLATDATA(num));
+        READWRITE(FLATDATA(den));
+    )
+
+    // the hash of the empty set
+    void SetNull()
+    {
+        memset(num, 0, sizeof(num));
+        memset(den, 0, sizeof(den));
+        num[0] = 1;
+        den[0] = 1;
+    }
+
+    // add an element to the set
+    CMuHash3072& Insert(const uint256 &hash);
+
+    // remove an element from the set (it need not have been inserted before)
+    CMuHash3072& Remove(const uint256 &hash);
+
+    // union with, resp. difference from another set
+    CMuHash3072& operator*=(const CMuHash3072 &other);
+    CMuHash3072& operator/=(const CMuHash3072 &other);
+
+    // compute the 256-bit digest of the set
+    uint256 Finalize() const;
+
+    friend bool operator==(const CMuHash3072 &a, const CMuHash3072 &b)
+    {
+        return a.Finalize() == b.Finalize();
+    }
+
+    friend bool operator!=(const CMuHash3072 &a, const CMuHash3072 &b)
+    {
+        return !(a == b);
+    }
+};
+
+#endif // BITCOIN_MUHASH_H
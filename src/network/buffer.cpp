@@ -0,0 +1,152 @@
+#include "buffer.h"
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace {
+// Bytes of free blocks each size class keeps at most, and a cap on the count
+// for the small classes
+constexpr size_t MAX_CACHED_BYTES_PER_CLASS = 4 << 20;
+constexpr size_t MAX_CACHED_BLOCKS_PER_CLASS = 1024;
+
+size_t classCapacity(size_t size_class) {
+    return size_t(1) << (BufferPool::MIN_CLASS_SHIFT + size_class);
+}
+
+size_t classFor(size_t size) {
+    size_t size_class = 0;
+    while (size_class < BufferPool::NUM_CLASSES && classCapacity(size_class) < size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+size_t maxCached(size_t size_class) {
+    size_t blocks = MAX_CACHED_BYTES_PER_CLASS / classCapacity(size_class);
+    if (blocks > MAX_CACHED_BLOCKS_PER_CLASS) blocks = MAX_CACHED_BLOCKS_PER_CLASS;
+    return blocks > 4 ? blocks : 4;
+}
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) noexcept : block_(other.block_) {
+    if (block_) block_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+SharedBuffer& SharedBuffer::operator=(SharedBuffer other) noexcept {
+    std::swap(block_, other.block_);
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer() {
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        BufferPool::instance().release(block_);
+    }
+}
+
+SharedBuffer SharedBuffer::allocate(size_t size) {
+    return BufferPool::instance().allocate(size);
+}
+
+SharedBuffer SharedBuffer::copyOf(const uint8_t* data, size_t size) {
+    SharedBuffer buffer = allocate(size);
+    if (size > 0) memcpy(buffer.data(), data, size);
+    return buffer;
+}
+
+uint8_t* SharedBuffer::data() noexcept {
+    return block_ ? block_->bytes() : nullptr;
+}
+
+const uint8_t* SharedBuffer::data() const noexcept {
+    return block_ ? block_->bytes() : nullptr;
+}
+
+size_t SharedBuffer::size() const noexcept {
+    return block_ ? block_->size : 0;
+}
+
+size_t SharedBuffer::capacity() const noexcept {
+    return block_ ? block_->capacity : 0;
+}
+
+void SharedBuffer::resize(size_t size) {
+    if (size > capacity()) {
+        throw std::length_error("SharedBuffer::resize beyond capacity");
+    }
+    if (block_) block_->size = size;
+}
+
+long SharedBuffer::use_count() const noexcept {
+    return block_ ? block_->refs.load(std::memory_order_relaxed) : 0;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool() {
+    for (auto& size_class : classes_) {
+        for (SharedBuffer::Block* block : size_class.free) {
+            block->~Block();
+            ::operator delete(block);
+        }
+    }
+}
+
+SharedBuffer BufferPool::allocate(size_t size) {
+    size_t size_class = classFor(size);
+    SharedBuffer::Block* block = nullptr;
+
+    if (size_class < NUM_CLASSES) {
+        SizeClass& sc = classes_[size_class];
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        if (!sc.free.empty()) {
+            block = sc.free.back();
+            sc.free.pop_back();
+        }
+    }
+
+    if (block) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        size_t capacity = size_class < NUM_CLASSES ? classCapacity(size_class) : size;
+        void* memory = ::operator new(sizeof(SharedBuffer::Block) + capacity);
+        block = new (memory) SharedBuffer::Block();
+        block->size_class = static_cast<uint32_t>(size_class);
+        block->capacity = capacity;
+    }
+    block->refs.store(1, std::memory_order_relaxed);
+    block->size = size;
+    return SharedBuffer(block);
+}
+
+void BufferPool::release(SharedBuffer::Block* block) {
+    if (block->size_class < NUM_CLASSES) {
+        SizeClass& sc = classes_[block->size_class];
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        if (sc.free.size() < maxCached(block->size_class)) {
+            if (sc.free.capacity() == 0) {
+                sc.free.reserve(maxCached(block->size_class));
+            }
+            sc.free.push_back(block);
+            return;
+        }
+    }
+    block->~Block();
+    ::operator delete(block);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    Stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.cached_bytes = 0;
+    for (size_t i = 0; i < NUM_CLASSES; i++) {
+        SizeClass& sc = classes_[i];
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        stats.cached_bytes += sc.free.size() * classCapacity(i);
+    }
+    return stats;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class BufferPool;
+
+// A reference-counted byte buffer from the BufferPool.
+//
+// Copies share the bytes; the block goes back to the pool when the last
+// copy is gone. Fill a buffer before handing out copies of it: a buffer
+// that is shared, e.g. one message payload queued to several peers, is
+// read-only by convention.
+class SharedBuffer {
+public:
+    SharedBuffer() noexcept : block_(nullptr) {}
+    SharedBuffer(const SharedBuffer& other) noexcept;
+    SharedBuffer(SharedBuffer&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    SharedBuffer& operator=(SharedBuffer other) noexcept;
+    ~SharedBuffer();
+
+    // A buffer of size bytes from the shared pool
+    static SharedBuffer allocate(size_t size);
+    // A pooled copy of [data, data + size)
+    static SharedBuffer copyOf(const uint8_t* data, size_t size);
+
+    uint8_t* data() noexcept;
+    const uint8_t* data() const noexcept;
+    size_t size() const noexcept;
+    size_t capacity() const noexcept;
+    bool empty() const noexcept { return size() == 0; }
+    // Up to capacity(); the bytes are kept
+    void resize(size_t size);
+
+    const uint8_t* begin() const noexcept { return data(); }
+    const uint8_t* end() const noexcept { return data() + size(); }
+    uint8_t operator[](size_t i) const noexcept { return data()[i]; }
+
+    long use_count() const noexcept;
+
+private:
+    friend class BufferPool;
+    struct Block {
+        std::atomic<uint32_t> refs;
+        uint32_t size_class;
+        size_t size;
+        size_t capacity;
+
+        uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+    explicit SharedBuffer(Block* block) noexcept : block_(block) {}
+
+    Block* block_;
+};
+
+// Free lists of buffer blocks in power of two size classes, from 64 bytes to
+// 1 MiB. Once the lists hold the blocks a workload needs, allocating and
+// releasing buffers does not touch the heap. Larger buffers are not pooled.
+// Thread-safe.
+class BufferPool {
+public:
+    static BufferPool& instance();
+
+    SharedBuffer allocate(size_t size);
+
+    struct Stats {
+        uint64_t hits;      // allocations served from a free list
+        uint64_t misses;    // allocations that went to the heap
+        size_t cached_bytes;
+    };
+    Stats stats() const;
+
+    static constexpr size_t MIN_CLASS_SHIFT = 6;
+    static constexpr size_t NUM_CLASSES = 15;
+    static constexpr size_t MAX_POOLED_SIZE = size_t(1) << (MIN_CLASS_SHIFT + NUM_CLASSES - 1);
+
+private:
+    friend class SharedBuffer;
+    BufferPool() = default;
+    ~BufferPool();
+    void release(SharedBuffer::Block* block);
+
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<SharedBuffer::Block*> free;
+    };
+    mutable std::array<SizeClass, NUM_CLASSES> classes_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
@@ -0,0 +1,83 @@
+#include "dispatcher.h"
+#include <spdlog/spdlog.h>
+#include "peer.h"
+
+uint64_t MessageTypeStats::latencyPercentile(double q) const {
+    uint64_t handled = 0;
+    for (uint64_t n : latency) handled += n;
+    if (handled == 0) return 0;
+
+    uint64_t target = static_cast<uint64_t>(q * handled);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen > target || seen == handled) return uint64_t(1) << i;
+    }
+    return uint64_t(1) << (LATENCY_BUCKETS - 1);
+}
+
+void MessageDispatcher::setHandler(MessageType type, Handler handler) {
+    Entry& entry = table_[static_cast<uint8_t>(type)];
+    entry.handler = std::move(handler);
+    entry.executor.reset();
+}
+
+void MessageDispatcher::setHandler(MessageType type, Handler handler, Executor executor) {
+    Entry& entry = table_[static_cast<uint8_t>(type)];
+    entry.handler = std::move(handler);
+    entry.executor = std::move(executor);
+}
+
+void MessageDispatcher::setDefaultHandler(Handler handler) {
+    default_handler_ = std::move(handler);
+}
+
+bool MessageDispatcher::dispatch(const std::shared_ptr<Peer>& peer, const Message& msg) {
+    Entry& entry = table_[static_cast<uint8_t>(msg.getType())];
+    entry.count.fetch_add(1, std::memory_order_relaxed);
+    entry.bytes.fetch_add(msg.getSize(), std::memory_order_relaxed);
+
+    const Handler& handler = entry.handler ? entry.handler : default_handler_;
+    if (!handler) return false;
+
+    Clock::time_point received = Clock::now();
+    if (entry.executor) {
+        // The copy of the message shares its payload
+        boost::asio::post(*entry.executor, [&entry, &handler, peer, msg, received]() {
+            run(entry, handler, peer, msg, received);
+        });
+    } else {
+        run(entry, handler, peer, msg, received);
+    }
+    return true;
+}
+
+void MessageDispatcher::run(Entry& entry, const Handler& handler, const std::shared_ptr<Peer>& peer,
+                            const Message& msg, Clock::time_point received) {
+    // A handler that throws must not take the IO thread down with it
+    try {
+        handler(peer, msg);
+    } catch (const std::exception& e) {
+        spdlog::error("Handler for message type {} from {} failed: {}",
+                      static_cast<int>(msg.getType()), peer->getAddress(), e.what());
+    }
+
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - received).count();
+    size_t bucket = 0;
+    while (micros > 0 && bucket < MessageTypeStats::LATENCY_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+    entry.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+MessageTypeStats MessageDispatcher::getStats(MessageType type) const {
+    const Entry& entry = table_[static_cast<uint8_t>(type)];
+    MessageTypeStats stats;
+    stats.count = entry.count.load(std::memory_order_relaxed);
+    stats.bytes = entry.bytes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < MessageTypeStats::LATENCY_BUCKETS; i++) {
+        stats.latency[i] = entry.latency[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
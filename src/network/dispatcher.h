@@ -0,0 +1,72 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include "message.h"
+
+class Peer;
+
+// What the dispatcher has seen of one message type
+struct MessageTypeStats {
+    static constexpr size_t LATENCY_BUCKETS = 24;
+
+    uint64_t count;
+    uint64_t bytes;
+    // Handler latency, from receipt to the return of the handler, so the
+    // time queued for a worker counts. Bucket 0 holds latencies under 1 us,
+    // bucket i those from 2^(i-1) to 2^i us; the last one takes the rest.
+    std::array<uint64_t, LATENCY_BUCKETS> latency;
+
+    // Upper bound in microseconds of the latency of fraction q of the
+    // handled messages
+    uint64_t latencyPercentile(double q) const;
+};
+
+// Hands each received message to the handler for its type.
+//
+// A handler runs on the strand of the peer, in order with the other
+// messages of that peer, unless its type was given an executor. Then it is
+// posted there, so a slow type (e.g. TRANSACTION validation on a thread
+// pool) does not hold up reading from the peer or cheap types like PING.
+// Messages handed to an executor may be handled concurrently and out of
+// order, unless it is a strand. Work left on an executor holds the peer,
+// so join the executors before the Network goes. Set the handlers before
+// the network is started.
+class MessageDispatcher {
+public:
+    using Handler = std::function<void(const std::shared_ptr<Peer>&, const Message&)>;
+    using Executor = boost::asio::any_io_executor;
+
+    void setHandler(MessageType type, Handler handler);
+    void setHandler(MessageType type, Handler handler, Executor executor);
+    // For the types without a handler of their own
+    void setDefaultHandler(Handler handler);
+
+    // False when no handler takes the message
+    bool dispatch(const std::shared_ptr<Peer>& peer, const Message& msg);
+
+    MessageTypeStats getStats(MessageType type) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Handler handler;
+        std::optional<Executor> executor;
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> bytes{0};
+        std::array<std::atomic<uint64_t>, MessageTypeStats::LATENCY_BUCKETS> latency{};
+    };
+
+    static void run(Entry& entry, const Handler& handler, const std::shared_ptr<Peer>& peer,
+                    const Message& msg, Clock::time_point received);
+
+    // Indexed by the type byte, so types this build does not know are
+    // counted as well
+    std::array<Entry, 256> table_;
+    Handler default_handler_;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Storage for the operations of one asynchronous chain, e.g. the reads of a
+// peer. A chain has one operation outstanding at a time and asio frees an
+// operation before it calls the handler, so one block is reused by every
+// operation of the chain. Anything larger, or a second operation while the
+// block is taken, goes to the heap.
+class HandlerMemory {
+public:
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(std::size_t size) {
+        if (!in_use_ && size <= sizeof(storage_)) {
+            in_use_ = true;
+            return &storage_;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer) {
+        if (pointer == &storage_) {
+            in_use_ = false;
+        } else {
+            ::operator delete(pointer);
+        }
+    }
+
+private:
+    typename std::aligned_storage<1024>::type storage_;
+    bool in_use_{false};
+};
+
+// The allocator asio uses for a handler made by makeHandler
+template <typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : memory_(memory) {}
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+    T* allocate(std::size_t n) const {
+        return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+    }
+    void deallocate(T* pointer, std::size_t) const {
+        memory_.deallocate(pointer);
+    }
+
+    bool operator==(const HandlerAllocator& other) const noexcept { return &memory_ == &other.memory_; }
+    bool operator!=(const HandlerAllocator& other) const noexcept { return &memory_ != &other.memory_; }
+
+private:
+    template <typename> friend class HandlerAllocator;
+    HandlerMemory& memory_;
+};
+
+template <typename Handler>
+class AllocatingHandler {
+public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    AllocatingHandler(HandlerMemory& memory, Handler handler)
+        : memory_(memory), handler_(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept { return allocator_type(memory_); }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory& memory_;
+    Handler handler_;
+};
+
+// Wraps a completion handler so that asio allocates its operations from
+// memory, which must outlive them
+template <typename Handler>
+AllocatingHandler<typename std::decay<Handler>::type> makeHandler(HandlerMemory& memory, Handler&& handler) {
+    return AllocatingHandler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+}
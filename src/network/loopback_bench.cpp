@@ -0,0 +1,325 @@
+// Loopback benchmark of the asio network module.
+//
+// Two Network instances on 127.0.0.1: a client opens a number of connections
+// to a server that answers every PING with a PONG carrying the same payload.
+// Each connection keeps a window of PINGs in flight. Reports the messages
+// delivered per second (both directions), the round trip latency and the heap
+// allocations per message for a range of IO thread counts. Then floods the
+// server with small TRANSACTION messages one way, and last measures PINGs
+// next to slow TRANSACTIONs handled inline or on a worker pool.
+//
+// Build with the loopback_bench target of src/network/CMakeLists.txt, or on
+// its own:
+//   cmake -S src/network -B build-network && cmake --build build-network
+// Usage:
+//   loopback_bench [connections=8] [messages per connection=20000] [window=64] [payload bytes=64]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <spdlog/spdlog.h>
+#include "network.h"
+
+// heap allocations, to check that the message path makes none
+std::atomic<long> heap_allocations{0};
+
+// gcc pairs the replaced operator new with its own operator delete
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Connection {
+    std::shared_ptr<Peer> peer;
+    std::atomic<size_t> sent{0};
+    // written on the peer's strand only
+    std::vector<uint64_t> latencies;
+};
+
+struct Result {
+    double msgsPerSec;
+    double p50Micros;
+    double p99Micros;
+    double allocsPerMsg;
+    double msgsPerWrite;
+    bool complete;
+};
+
+double msgsPerWrite(const Network& a, const Network& b) {
+    NetworkStats sa = a.getStats(), sb = b.getStats();
+    uint64_t writes = sa.writes + sb.writes;
+    return writes ? double(sa.messages_written + sb.messages_written) / writes : 0;
+}
+
+Message makePing(size_t payload) {
+    SharedBuffer data = SharedBuffer::allocate(std::max<size_t>(payload, sizeof(uint64_t)));
+    uint64_t t = nowNanos();
+    memcpy(data.data(), &t, sizeof(t));
+    return Message(MessageType::PING, std::move(data));
+}
+
+void sendNext(Connection& conn, size_t messages, size_t payload) {
+    if (conn.sent.fetch_add(1) < messages) {
+        conn.peer->send(makePing(payload));
+    }
+}
+
+bool waitFor(const std::function<bool()>& done, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!done()) {
+        if (Clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+// TRANSACTIONs sent to the server by one more connection alongside the
+// PINGs, each costing the server some CPU, optionally on a worker pool
+struct Background {
+    size_t transactions = 0;
+    std::chrono::microseconds cost{0};
+    size_t workers = 0;
+};
+
+void spin(std::chrono::microseconds cost) {
+    auto until = Clock::now() + cost;
+    while (Clock::now() < until) {}
+}
+
+Result runLoopback(size_t threads, size_t connections, size_t messages, size_t window, size_t payload,
+                   const Background& background = Background()) {
+    Network server(0, threads);
+    server.getDispatcher().setHandler(MessageType::PING, [](const std::shared_ptr<Peer>& peer, const Message& msg) {
+        peer->send(Message(MessageType::PONG, msg.getPayload()));
+    });
+    // Destroyed before the server, whose peers its work holds
+    std::unique_ptr<boost::asio::thread_pool> workers;
+    if (background.transactions > 0) {
+        auto validate = [cost = background.cost](const std::shared_ptr<Peer>&, const Message&) { spin(cost); };
+        if (background.workers > 0) {
+            workers.reset(new boost::asio::thread_pool(background.workers));
+            server.getDispatcher().setHandler(MessageType::TRANSACTION, validate, workers->get_executor());
+        } else {
+            server.getDispatcher().setHandler(MessageType::TRANSACTION, validate);
+        }
+    }
+    server.start();
+
+    std::vector<std::unique_ptr<Connection>> conns;
+    std::unordered_map<uint64_t, Connection*> byPeer;
+    std::atomic<size_t> received{0};
+
+    Network client(0, threads);
+    client.getDispatcher().setHandler(MessageType::PONG, [&](const std::shared_ptr<Peer>& peer, const Message& msg) {
+        auto it = byPeer.find(peer->getId());
+        if (it == byPeer.end()) return;
+        uint64_t t;
+        memcpy(&t, msg.getPayload().data(), sizeof(t));
+        it->second->latencies.push_back(nowNanos() - t);
+        received++;
+        sendNext(*it->second, messages, payload);
+    });
+    client.start();
+
+    for (size_t i = 0; i < connections; i++) {
+        conns.emplace_back(new Connection);
+        conns.back()->peer = client.connectToPeer("127.0.0.1", server.getPort());
+        conns.back()->latencies.reserve(messages);
+        byPeer[conns.back()->peer->getId()] = conns.back().get();
+    }
+    std::shared_ptr<Peer> flooder;
+    if (background.transactions > 0) {
+        flooder = client.connectToPeer("127.0.0.1", server.getPort());
+    }
+    bool connected = waitFor([&]() {
+        if (server.getPeerCount() < connections + (flooder ? 1 : 0)) return false;
+        if (flooder && !flooder->isConnected()) return false;
+        for (const auto& conn : conns) {
+            if (!conn->peer->isConnected()) return false;
+        }
+        return true;
+    }, 10000);
+    if (!connected) {
+        for (const auto& conn : conns) conn->peer.reset();
+        flooder.reset();
+        return Result{0, 0, 0, 0, 0, false};
+    }
+
+    for (size_t i = 0; i < background.transactions; i++) {
+        flooder->send(Message(MessageType::TRANSACTION, std::vector<uint8_t>(payload)));
+    }
+
+    long allocations = heap_allocations;
+    auto start = Clock::now();
+    for (const auto& conn : conns) {
+        for (size_t i = 0; i < window; i++) {
+            sendNext(*conn, messages, payload);
+        }
+    }
+    bool complete = waitFor([&]() { return received == connections * messages; }, 120000);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    allocations = heap_allocations - allocations;
+    double batch = msgsPerWrite(client, server);
+    waitFor([&]() {
+        MessageTypeStats tx = server.getMessageStats(MessageType::TRANSACTION);
+        uint64_t handled = 0;
+        for (uint64_t n : tx.latency) handled += n;
+        return handled == background.transactions;
+    }, 120000);
+    workers.reset();
+
+    client.stop();
+    server.stop();
+
+    // peers must not outlive the io_context of their Network
+    std::vector<uint64_t> all;
+    for (const auto& conn : conns) {
+        all.insert(all.end(), conn->latencies.begin(), conn->latencies.end());
+        conn->peer.reset();
+    }
+    flooder.reset();
+    if (all.empty()) {
+        return Result{0, 0, 0, 0, 0, false};
+    }
+    std::sort(all.begin(), all.end());
+    Result result;
+    result.msgsPerSec = 2.0 * all.size() / seconds;
+    result.p50Micros = all[all.size() / 2] / 1000.0;
+    result.p99Micros = all[std::min(all.size() - 1, all.size() * 99 / 100)] / 1000.0;
+    result.allocsPerMsg = double(allocations) / (2.0 * all.size());
+    result.msgsPerWrite = batch;
+    result.complete = complete;
+    return result;
+}
+
+// One-way: every connection is sent its messages back to back, as fast as
+// the client can queue them, and the server only counts them
+struct FloodResult {
+    double msgsPerSec;
+    double msgsPerWrite;
+    uint64_t largestBatch;
+};
+
+FloodResult runFlood(size_t threads, size_t connections, size_t messages, size_t payload) {
+    std::atomic<size_t> received{0};
+    Network server(0, threads);
+    server.getDispatcher().setHandler(MessageType::TRANSACTION, [&](const std::shared_ptr<Peer>&, const Message&) {
+        received++;
+    });
+    server.start();
+
+    Network client(0, threads);
+    client.start();
+    std::vector<std::shared_ptr<Peer>> peers;
+    for (size_t i = 0; i < connections; i++) {
+        peers.push_back(client.connectToPeer("127.0.0.1", server.getPort()));
+    }
+    bool connected = waitFor([&]() {
+        if (server.getPeerCount() < connections) return false;
+        for (const auto& peer : peers) {
+            if (!peer->isConnected()) return false;
+        }
+        return true;
+    }, 10000);
+
+    FloodResult result{0, 0, 0};
+    if (connected) {
+        SharedBuffer data = SharedBuffer::allocate(payload);
+        memset(data.data(), 0x42, payload);
+        Message tx(MessageType::TRANSACTION, data);
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < messages; i++) {
+            for (const auto& peer : peers) {
+                peer->send(tx);
+            }
+        }
+        waitFor([&]() { return received == connections * messages; }, 120000);
+        result.msgsPerSec = received / std::chrono::duration<double>(Clock::now() - start).count();
+        result.msgsPerWrite = msgsPerWrite(client, server);
+        result.largestBatch = client.getStats().largest_batch;
+    }
+
+    client.stop();
+    server.stop();
+    peers.clear();
+    return result;
+}
+
+size_t argOr(int argc, char** argv, int i, size_t value) {
+    return argc > i ? static_cast<size_t>(std::strtoul(argv[i], nullptr, 10)) : value;
+}
+
+}
+
+int main(int argc, char** argv) {
+    spdlog::set_level(spdlog::level::warn);
+
+    size_t connections = argOr(argc, argv, 1, 8);
+    size_t messages = argOr(argc, argv, 2, 20000);
+    size_t window = argOr(argc, argv, 3, 64);
+    size_t payload = argOr(argc, argv, 4, 64);
+
+    std::vector<size_t> thread_counts = {1, 2, 4};
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    if (std::find(thread_counts.begin(), thread_counts.end(), cores) == thread_counts.end()) {
+        thread_counts.push_back(cores);
+    }
+
+    printf("%zu connections, %zu messages each, window %zu, %zu byte payload, %zu cores\n",
+           connections, messages, window, payload, cores);
+    printf("%8s %14s %12s %12s %12s %12s\n", "threads", "msgs/s", "p50 us", "p99 us", "allocs/msg", "msgs/write");
+    for (size_t threads : thread_counts) {
+        Result r = runLoopback(threads, connections, messages, window, payload);
+        printf("%8zu %14.0f %12.1f %12.1f %12.3f %12.1f%s\n", threads, r.msgsPerSec, r.p50Micros, r.p99Micros,
+               r.allocsPerMsg, r.msgsPerWrite, r.complete ? "" : "  (incomplete)");
+    }
+
+    printf("\none-way TRANSACTION flood, %zu byte payload\n", payload);
+    printf("%8s %14s %12s %14s\n", "threads", "msgs/s", "msgs/write", "largest batch");
+    for (size_t threads : thread_counts) {
+        FloodResult r = runFlood(threads, connections, messages, payload);
+        printf("%8zu %14.0f %12.1f %14llu\n", threads, r.msgsPerSec, r.msgsPerWrite,
+               static_cast<unsigned long long>(r.largestBatch));
+    }
+
+    // A slow message type handled inline holds up the cheap ones of every
+    // peer on its IO thread; on a worker pool it does not
+    Background background;
+    background.transactions = 2000;
+    background.cost = std::chrono::microseconds(200);
+    printf("\nPING next to %zu TRANSACTIONs costing %lld us each, 1 IO thread\n",
+           background.transactions, static_cast<long long>(background.cost.count()));
+    printf("%16s %12s %12s\n", "TRANSACTION on", "p50 us", "p99 us");
+    for (size_t workers : {size_t(0), size_t(2)}) {
+        background.workers = workers;
+        Result r = runLoopback(1, connections, std::min<size_t>(messages, 500), 1, payload, background);
+        printf("%16s %12.1f %12.1f%s\n", workers ? "2 workers" : "IO thread", r.p50Micros, r.p99Micros,
+               r.complete ? "" : "  (incomplete)");
+    }
+    return 0;
+}
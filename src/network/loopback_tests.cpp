@@ -0,0 +1,133 @@
+// Tests of the asio network module over 127.0.0.1
+#define BOOST_TEST_MODULE Duckbucks Network Test Suite
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <spdlog/spdlog.h>
+#include "network.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+bool waitFor(const std::function<bool()>& done, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!done()) {
+        if (Clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+Message makeMessage(MessageType type, size_t payload) {
+    SharedBuffer data = SharedBuffer::allocate(payload);
+    memset(data.data(), 0x42, payload);
+    return Message(type, std::move(data));
+}
+
+// A client of a server Network that sends it PINGs and never reads: the
+// server answers each with a PONG of the same size, which piles up in its
+// send queue once the socket buffers are full
+struct DeafClient {
+    boost::asio::io_context io_context;
+    tcp::socket socket{io_context};
+    std::vector<uint8_t> pings;
+    std::thread thread;
+
+    DeafClient(uint16_t port, size_t count, size_t payload) {
+        Message ping = makeMessage(MessageType::PING, payload);
+        for (size_t i = 0; i < count; i++) {
+            std::vector<uint8_t> data = ping.serialize();
+            pings.insert(pings.end(), data.begin(), data.end());
+        }
+        socket.open(tcp::v4());
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+        socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+        // Written as far as the server reads; whatever it does not stays
+        // pending until the socket is closed
+        boost::asio::async_write(socket, boost::asio::buffer(pings),
+                                 [](const boost::system::error_code&, std::size_t) {});
+        thread = std::thread([this]() { io_context.run(); });
+    }
+
+    ~DeafClient() {
+        boost::asio::post(io_context, [this]() {
+            boost::system::error_code ec;
+            socket.close(ec);
+        });
+        thread.join();
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(loopback_tests)
+
+BOOST_AUTO_TEST_CASE(send_queue_limits)
+{
+    spdlog::set_level(spdlog::level::off);
+
+    PeerLimits limits;
+    limits.high_watermark = 256 << 10;
+    limits.low_watermark = 64 << 10;
+    limits.max_queued = 4 << 20;
+
+    Network server(0, 2);
+    server.setPeerLimits(limits);
+    server.getDispatcher().setHandler(MessageType::PING, [](const std::shared_ptr<Peer>& peer, const Message& msg) {
+        peer->send(Message(MessageType::PONG, msg.getPayload()));
+    });
+    server.start();
+
+    // 16 MiB of PINGs, more than the socket buffers of both ends hold
+    DeafClient client(server.getPort(), 4096, 4096);
+    BOOST_REQUIRE(waitFor([&]() { return server.getPeerCount() == 1; }, 10000));
+
+    // Over the high watermark the server stops reading from the client, and
+    // does not start again until the queue is under the low one. Writes may
+    // still drain some of it while the socket buffers fill up, so wait until
+    // it stays put above the low watermark.
+    uint64_t last_queued = 0;
+    int unchanged = 0;
+    BOOST_REQUIRE(waitFor([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        NetworkStats now = server.getStats();
+        if (now.read_stalls == 0 || now.queued_bytes <= limits.low_watermark || now.queued_bytes != last_queued) {
+            unchanged = 0;
+        }
+        last_queued = now.queued_bytes;
+        return ++unchanged > 10;
+    }, 30000));
+    NetworkStats stats = server.getStats();
+    BOOST_CHECK_LE(stats.queued_bytes, limits.max_queued);
+    BOOST_CHECK_EQUAL(stats.dropped_messages, 0U);
+
+    // and drops the low priority messages to it, also once the queue is
+    // back between the watermarks
+    for (int i = 0; i < 10; i++) {
+        server.broadcast(makeMessage(MessageType::TRANSACTION, 1024), Peer::Priority::LOW);
+    }
+    BOOST_CHECK(waitFor([&]() { return server.getStats().dropped_messages == 10; }, 10000));
+
+    // Normal messages are queued, until the queue would pass max_queued:
+    // then the client is disconnected
+    server.broadcast(makeMessage(MessageType::BLOCKS, 1 << 20));
+    BOOST_CHECK(waitFor([&]() {
+        NetworkStats now = server.getStats();
+        return now.queued_bytes + now.bytes_written >=
+               stats.queued_bytes + stats.bytes_written + Message::HEADER_SIZE + (1 << 20);
+    }, 10000));
+    BOOST_CHECK_EQUAL(server.getStats().overflows, 0U);
+    BOOST_CHECK_EQUAL(server.getPeerCount(), 1U);
+    for (int i = 0; i < 4; i++) {
+        server.broadcast(makeMessage(MessageType::BLOCKS, 1 << 20));
+    }
+    BOOST_CHECK(waitFor([&]() { return server.getStats().overflows == 1; }, 10000));
+    BOOST_CHECK(waitFor([&]() { return server.getPeerCount() == 0; }, 10000));
+
+    server.stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,38 +1,56 @@
 #include "message.h"
+#include <algorithm>
 #include <stdexcept>
 
-Message::Message(MessageType type, std::vector<uint8_t> payload)
+Message::Message(MessageType type, const std::vector<uint8_t>& payload)
+    : type_(type), payload_(SharedBuffer::copyOf(payload.data(), payload.size())) {}
+
+Message::Message(MessageType type, SharedBuffer payload)
     : type_(type), payload_(std::move(payload)) {}
 
+Message::Header Message::header() const {
+    uint32_t length = static_cast<uint32_t>(payload_.size());
+    return Header{{
+        static_cast<uint8_t>((length >> 24) & 0xFF),
+        static_cast<uint8_t>((length >> 16) & 0xFF),
+        static_cast<uint8_t>((length >> 8) & 0xFF),
+        static_cast<uint8_t>(length & 0xFF),
+        static_cast<uint8_t>(type_)
+    }};
+}
+
+uint32_t Message::parseLength(const Header& header) {
+    return (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+           (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+}
+
+MessageType Message::parseType(const Header& header) {
+    return static_cast<MessageType>(header[4]);
+}
+
 std::vector<uint8_t> Message::serialize() const {
     std::vector<uint8_t> result;
-    result.reserve(payload_.size() + 5);
-    
-    // Message format: [4 bytes length][1 byte type][payload]
-    uint32_t length = static_cast<uint32_t>(payload_.size());
-    result.push_back((length >> 24) & 0xFF);
-    result.push_back((length >> 16) & 0xFF);
-    result.push_back((length >> 8) & 0xFF);
-    result.push_back(length & 0xFF);
-    
-    result.push_back(static_cast<uint8_t>(type_));
+    result.reserve(payload_.size() + HEADER_SIZE);
+
+    Header head = header();
+    result.insert(result.end(), head.begin(), head.end());
     result.insert(result.end(), payload_.begin(), payload_.end());
-    
+
     return result;
 }
 
 Message Message::deserialize(const std::vector<uint8_t>& data) {
-    if (data.size() < 5) {
+    if (data.size() < HEADER_SIZE) {
         throw std::runtime_error("Message too short");
     }
-    
-    uint32_t length = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
-    MessageType type = static_cast<MessageType>(data[4]);
-    
-    if (data.size() != length + 5) {
+
+    Header head;
+    std::copy(data.begin(), data.begin() + HEADER_SIZE, head.begin());
+    uint32_t length = parseLength(head);
+
+    if (data.size() != length + HEADER_SIZE) {
         throw std::runtime_error("Invalid message length");
     }
-    
-    std::vector<uint8_t> payload(data.begin() + 5, data.end());
-    return Message(type, std::move(payload));
-}
\ No newline at end of file
+
+    return Message(parseType(head), SharedBuffer::copyOf(data.data() + HEADER_SIZE, length));
+}
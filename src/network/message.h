@@ -1,7 +1,9 @@
 #pragma once
+#include <array>
 #include <string>
 #include <vector>
 #include <cstdint>
+#include "buffer.h"
 
 enum class MessageType : uint8_t {
     HANDSHAKE = 0,
@@ -14,19 +16,34 @@ enum class MessageType : uint8_t {
     TRANSACTION = 7
 };
 
+// A message is its type and a payload in a pooled buffer. Copies of a
+// message share the payload, so queueing one message to many peers or
+// answering with the payload of another copies no bytes. On the wire it is
+// the 5 byte header followed by the payload, written as two buffers.
 class Message {
 public:
-    Message(MessageType type, std::vector<uint8_t> payload);
-    
+    // Message format: [4 bytes length][1 byte type][payload]
+    static constexpr size_t HEADER_SIZE = 5;
+    using Header = std::array<uint8_t, HEADER_SIZE>;
+
+    // Copies the payload into a pooled buffer
+    Message(MessageType type, const std::vector<uint8_t>& payload);
+    Message(MessageType type, SharedBuffer payload);
+
+    Header header() const;
+    // The payload length a header announces
+    static uint32_t parseLength(const Header& header);
+    static MessageType parseType(const Header& header);
+
     // Serialization
     std::vector<uint8_t> serialize() const;
     static Message deserialize(const std::vector<uint8_t>& data);
-    
+
     MessageType getType() const { return type_; }
-    const std::vector<uint8_t>& getPayload() const { return payload_; }
+    const SharedBuffer& getPayload() const { return payload_; }
     size_t getSize() const { return payload_.size(); }
 
 private:
     MessageType type_;
-    std::vector<uint8_t> payload_;
-};
\ No newline at end of file
+    SharedBuffer payload_;
+};
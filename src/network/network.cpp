@@ -1,8 +1,27 @@
 #include "network.h"
 #include <spdlog/spdlog.h>
 
-Network::Network(uint16_t port) : port_(port) {
-    work_ = std::make_unique<boost::asio::io_context::work>(io_context_);
+namespace {
+size_t defaultThreadCount(size_t threads) {
+    if (threads > 0) return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+}
+
+Network::Network(uint16_t port, size_t threads)
+    : thread_count_(defaultThreadCount(threads)),
+      io_context_(static_cast<int>(thread_count_)),
+      port_(port) {
+    work_ = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(
+        io_context_.get_executor());
+
+    dispatcher_.setHandler(MessageType::HANDSHAKE, [](const std::shared_ptr<Peer>& peer, const Message&) {
+        // Handle peer handshake
+        spdlog::debug("Received handshake from {}", peer->getAddress());
+    });
+    dispatcher_.setHandler(MessageType::GET_PEERS, [this](const std::shared_ptr<Peer>& peer, const Message&) {
+        sendPeerList(peer);
+    });
 }
 
 Network::~Network() {
@@ -11,25 +30,27 @@ Network::~Network() {
 
 void Network::start() {
     if (running_) return;
-    
+
     try {
         // Start acceptor
         tcp::endpoint endpoint(tcp::v4(), port_);
         acceptor_ = std::make_unique<tcp::acceptor>(io_context_, endpoint);
-        
-        startAccept();
-        
-        // Start IO thread
+
         running_ = true;
-        io_thread_ = std::thread([this]() {
-            try {
-                io_context_.run();
-            } catch (const std::exception& e) {
-                spdlog::error("IO context error: {}", e.what());
-            }
-        });
-        
-        spdlog::info("Network started on port {}", port_);
+        startAccept();
+
+        // Start the IO threads
+        for (size_t i = 0; i < thread_count_; i++) {
+            io_threads_.emplace_back([this]() {
+                try {
+                    io_context_.run();
+                } catch (const std::exception& e) {
+                    spdlog::error("IO context error: {}", e.what());
+                }
+            });
+        }
+
+        spdlog::info("Network started on port {} with {} threads", getPort(), thread_count_);
     } catch (const std::exception& e) {
         spdlog::error("Failed to start network: {}", e.what());
         throw;
@@ -37,55 +58,84 @@ void Network::start() {
 }
 
 void Network::stop() {
-    if (!running_) return;
-    
-    running_ = false;
-    
-    // Stop accepting new connections
-    if (acceptor_) {
-        acceptor_->close();
-    }
-    
-    // Disconnect all peers
-    peers_.clear();
-    
+    if (!running_.exchange(false)) return;
+
     // Stop IO context
     work_.reset();
     io_context_.stop();
-    
-    if (io_thread_.joinable()) {
-        io_thread_.join();
+
+    for (auto& thread : io_threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    io_threads_.clear();
+
+    // With the IO threads gone, nothing else touches the sockets: stop
+    // accepting new connections and disconnect all peers
+    boost::system::error_code ec;
+    acceptor_->close(ec);
+    for (const auto& peer : *peers_.snapshot()) {
+        peer->socket().close(ec);
     }
-    
+    peers_.clear();
+
     spdlog::info("Network stopped");
 }
 
-void Network::broadcast(const Message& msg) {
-    for (const auto& [_, peer] : peers_) {
+uint16_t Network::getPort() const {
+    boost::system::error_code ec;
+    if (acceptor_) {
+        auto endpoint = acceptor_->local_endpoint(ec);
+        if (!ec) return endpoint.port();
+    }
+    return port_;
+}
+
+NetworkStats Network::getStats() const {
+    NetworkStats stats;
+    stats.queued_bytes = counters_.queued_bytes;
+    stats.writes = counters_.writes;
+    stats.messages_written = counters_.messages_written;
+    stats.bytes_written = counters_.bytes_written;
+    stats.largest_batch = counters_.largest_batch;
+    stats.read_stalls = counters_.read_stalls;
+    stats.dropped_messages = counters_.dropped_messages;
+    stats.overflows = counters_.overflows;
+    return stats;
+}
+
+void Network::broadcast(const Message& msg, Peer::Priority priority) {
+    // Each send is posted to the peer's strand, so the fan-out only reads
+    // the registry snapshot and never waits on another thread. The peers
+    // share the payload of msg: it is not copied or serialized per peer.
+    auto peers = peers_.snapshot();
+    for (const auto& peer : *peers) {
         if (peer->isConnected()) {
-            peer->send(msg);
+            peer->send(msg, priority);
         }
     }
 }
 
-void Network::connectToPeer(const std::string& host, uint16_t port) {
-    auto peer = std::make_shared<Peer>(io_context_);
+std::shared_ptr<Peer> Network::connectToPeer(const std::string& host, uint16_t port) {
+    auto peer = std::make_shared<Peer>(io_context_, peer_limits_, counters_);
     handlePeer(peer);
     peer->connect(host, port);
+    return peer;
 }
 
 void Network::startAccept() {
-    auto peer = std::make_shared<Peer>(io_context_);
-    
-    acceptor_->async_accept(peer->socket_,
+    auto peer = std::make_shared<Peer>(io_context_, peer_limits_, counters_);
+
+    acceptor_->async_accept(peer->socket(),
         [this, peer](const boost::system::error_code& ec) {
             if (!ec) {
-                spdlog::debug("Accepted connection from: {}", 
-                             peer->getAddress());
                 handlePeer(peer);
                 peer->start();
+                spdlog::debug("Accepted connection from: {}",
+                             peer->getAddress());
             }
-            
+
             if (running_) {
                 startAccept();
             }
@@ -93,46 +143,40 @@ void Network::startAccept() {
 }
 
 void Network::handlePeer(std::shared_ptr<Peer> peer) {
-    peer->onMessage = [this, weak_peer = std::weak_ptr<peer>(peer)]
+    peer->onMessage = [this, weak_peer = std::weak_ptr<Peer>(peer)]
                      (const Message& msg) {
         if (auto peer_ptr = weak_peer.lock()) {
             handleMessage(msg, peer_ptr);
         }
     };
-    
-    peer->onError = [this, weak_peer = std::weak_ptr<peer>(peer)]
+
+    peer->onError = [this, id = peer->getId(), weak_peer = std::weak_ptr<Peer>(peer)]
                     (const std::string& error) {
         if (auto peer_ptr = weak_peer.lock()) {
-            spdlog::error("Peer error {}: {}", 
+            spdlog::error("Peer error {}: {}",
                          peer_ptr->getAddress(), error);
-            peers_.erase(peer_ptr->getAddress());
         }
+        peers_.remove(id);
     };
-    
-    peers_[peer->getAddress()] = peer;
+
+    peers_.add(peer);
 }
 
-void Network::handleMessage(const Message& msg, 
+void Network::handleMessage(const Message& msg,
                           const std::shared_ptr<Peer>& peer) {
-    switch (msg.getType()) {
-        case MessageType::HANDSHAKE:
-            // Handle peer handshake
-            spdlog::debug("Received handshake from {}", peer->getAddress());
-            break;
-            
-        case MessageType::GET_PEERS:
-            // Send peer list
-            std::vector<uint8_t> peer_data;
-            for (const auto& [addr, _] : peers_) {
-                // Format: peer list data
-            }
-            peer->send(Message(MessageType::PEERS, peer_data));
-            break;
-            
-        default:
-            if (messageCallback_) {
-                messageCallback_(msg);
-            }
-            break;
+    if (!dispatcher_.dispatch(peer, msg)) {
+        spdlog::debug("Unhandled message type {} from {}",
+                     static_cast<int>(msg.getType()), peer->getAddress());
     }
-}
\ No newline at end of file
+}
+
+void Network::sendPeerList(const std::shared_ptr<Peer>& peer) {
+    std::vector<uint8_t> peer_data;
+    // Format: the address of each other peer, one per line
+    for (const auto& other : *peers_.snapshot()) {
+        if (other == peer || !other->isConnected()) continue;
+        std::string address = other->getAddress() + "\n";
+        peer_data.insert(peer_data.end(), address.begin(), address.end());
+    }
+    peer->send(Message(MessageType::PEERS, peer_data));
+}
@@ -1,40 +1,73 @@
 #pragma once
 #include <boost/asio.hpp>
-#include <unordered_map>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
+#include "dispatcher.h"
 #include "peer.h"
+#include "peer_registry.h"
 #include "message.h"
 
+// Totals of the send queue counters of all peers (see PeerCounters)
+struct NetworkStats {
+    uint64_t queued_bytes;      // waiting in send queues now
+    uint64_t writes;            // socket writes completed
+    uint64_t messages_written;  // messages in them, messages_written / writes per batch
+    uint64_t bytes_written;
+    uint64_t largest_batch;     // most messages in one write
+    uint64_t read_stalls;       // times a peer was not read from over its high watermark
+    uint64_t dropped_messages;  // low priority messages dropped between the watermarks
+    uint64_t overflows;         // peers dropped for exceeding max_queued
+};
+
+// One io_context run by a pool of threads, one per core by default. Each peer
+// is bound to a strand of it (see Peer), so a peer's messages are handled in
+// order while different peers are handled in parallel: the message handlers
+// may run on several threads at once and must be thread-safe. Set them (see
+// MessageDispatcher), and the peer limits, before start(). HANDSHAKE and
+// GET_PEERS have handlers of the network's own, which may be replaced.
 class Network {
 public:
-    explicit Network(uint16_t port);
+    explicit Network(uint16_t port, size_t threads = 0);
     ~Network();
-    
+
     void start();
     void stop();
-    void broadcast(const Message& msg);
-    void connectToPeer(const std::string& host, uint16_t port);
-    
+    void broadcast(const Message& msg, Peer::Priority priority = Peer::Priority::NORMAL);
+    std::shared_ptr<Peer> connectToPeer(const std::string& host, uint16_t port);
+
     bool isListening() const { return acceptor_ && acceptor_->is_open(); }
     size_t getPeerCount() const { return peers_.size(); }
-    
-    void setMessageCallback(std::function<void(const Message&)> callback) {
-        messageCallback_ = std::move(callback);
-    }
+    size_t getThreadCount() const { return thread_count_; }
+    // The port listened on; the one picked by the system when constructed with 0
+    uint16_t getPort() const;
+    NetworkStats getStats() const;
+
+    void setPeerLimits(const PeerLimits& limits) { peer_limits_ = limits; }
+
+    MessageDispatcher& getDispatcher() { return dispatcher_; }
+    MessageTypeStats getMessageStats(MessageType type) const { return dispatcher_.getStats(type); }
 
 private:
     void startAccept();
     void handlePeer(std::shared_ptr<Peer> peer);
     void handleMessage(const Message& msg, const std::shared_ptr<Peer>& peer);
-    
+    void sendPeerList(const std::shared_ptr<Peer>& peer);
+
+    const size_t thread_count_;
+    // Before the io_context: peers held by its handlers update the counters
+    // when they are destroyed with it
+    PeerLimits peer_limits_;
+    PeerCounters counters_;
     boost::asio::io_context io_context_;
-    std::unique_ptr<boost::asio::io_context::work> work_;
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_;
     std::unique_ptr<tcp::acceptor> acceptor_;
-    std::thread io_thread_;
-    
-    std::unordered_map<std::string, std::shared_ptr<Peer>> peers_;
-    std::function<void(const Message&)> messageCallback_;
-    
+    std::vector<std::thread> io_threads_;
+
+    PeerRegistry peers_;
+    MessageDispatcher dispatcher_;
+
     uint16_t port_;
-    bool running_{false};
-};
\ No newline at end of file
+    std::atomic<bool> running_{false};
+};
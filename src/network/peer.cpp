@@ -1,109 +1,270 @@
 #include "peer.h"
 #include <spdlog/spdlog.h>
 
-Peer::Peer(boost::asio::io_context& io_context)
-    : io_context_(io_context), socket_(io_context) {}
+namespace {
+std::atomic<uint64_t> next_peer_id{1};
+}
+
+Peer::Peer(boost::asio::io_context& io_context, const PeerLimits& limits, PeerCounters& counters)
+    : io_context_(io_context),
+      strand_(boost::asio::make_strand(io_context)),
+      // Completion handlers of the socket run on the strand
+      socket_(strand_),
+      limits_(limits),
+      counters_(counters),
+      id_(next_peer_id++),
+      address_("unknown") {}
+
+Peer::~Peer() {
+    counters_.queued_bytes -= queued_bytes_;
+}
 
 void Peer::connect(const std::string& host, uint16_t port) {
     tcp::resolver resolver(io_context_);
     auto endpoints = resolver.resolve(host, std::to_string(port));
-    
+
     boost::asio::async_connect(socket_, endpoints,
-        [this](const boost::system::error_code& ec, const tcp::endpoint&) {
+        [self = shared_from_this()](const boost::system::error_code& ec, const tcp::endpoint&) {
             if (!ec) {
-                connected_ = true;
-                spdlog::debug("Connected to peer: {}", getAddress());
-                start();
+                self->start();
+                spdlog::debug("Connected to peer: {}", self->getAddress());
             } else {
-                if (onError) {
-                    onError(ec.message());
-                }
+                self->fail(ec);
             }
         });
 }
 
 void Peer::start() {
-    readHeader();
+    // Inline when called from the connect handler, which is on the strand
+    boost::asio::dispatch(strand_, [self = shared_from_this()]() {
+        self->setAddress();
+        self->connected_ = true;
+        self->read_buffer_.resize(READ_BUFFER_SIZE);
+        self->readSome();
+    });
 }
 
-void Peer::send(const Message& msg) {
-    bool write_in_progress = !write_queue_.empty();
-    write_queue_.push(msg.serialize());
-    
-    if (!write_in_progress) {
-        writeMessage();
-    }
+void Peer::send(const Message& msg, Priority priority) {
+    // Nothing is serialized: the header is 5 bytes and the payload buffer
+    // is shared with every other peer the message goes to. A reply sent from
+    // a handler of this peer is queued inline, without a posted operation.
+    boost::asio::dispatch(strand_,
+        [self = shared_from_this(), out = Outgoing{msg.header(), msg.getPayload()}, priority]() mutable {
+            if (self->failed_) return;
+
+            size_t bytes = Message::HEADER_SIZE + out.payload.size();
+            size_t queued = self->queued_bytes_;
+            if (priority == Priority::LOW && self->low_priority_paused_) {
+                self->counters_.dropped_messages++;
+                return;
+            }
+            if (queued + bytes > self->limits_.max_queued) {
+                spdlog::error("Send queue of {} over {} bytes", self->getAddress(), self->limits_.max_queued);
+                self->counters_.overflows++;
+                self->fail(boost::asio::error::no_buffer_space);
+                boost::system::error_code ec;
+                self->socket_.close(ec);
+                return;
+            }
+
+            self->write_queue_.push_back(std::move(out));
+            self->queued_bytes_ += bytes;
+            self->counters_.queued_bytes += bytes;
+            if (self->queued_bytes_ >= self->limits_.high_watermark) {
+                self->low_priority_paused_ = true;
+            }
+            if (!self->writing_ && !self->corked_) {
+                self->writeBatch();
+            }
+        });
+}
+
+void Peer::close() {
+    boost::asio::post(strand_, [self = shared_from_this()]() {
+        boost::system::error_code ec;
+        self->connected_ = false;
+        self->socket_.shutdown(tcp::socket::shutdown_both, ec);
+        self->socket_.close(ec);
+    });
+}
+
+void Peer::setAddress() {
+    boost::system::error_code ec;
+    auto endpoint = socket_.remote_endpoint(ec);
+    if (ec) return;
+
+    std::lock_guard<std::mutex> lock(address_mutex_);
+    address_ = endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
 }
 
 std::string Peer::getAddress() const {
-    try {
-        return socket_.remote_endpoint().address().to_string() + ":" +
-               std::to_string(socket_.remote_endpoint().port());
-    } catch (...) {
-        return "unknown";
+    std::lock_guard<std::mutex> lock(address_mutex_);
+    return address_;
+}
+
+void Peer::fail(const boost::system::error_code& ec) {
+    connected_ = false;
+    if (!failed_.exchange(true) && onError) {
+        onError(ec.message());
     }
 }
 
-void Peer::readHeader() {
-    read_buffer_.resize(HEADER_SIZE);
-    
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_buffer_, HEADER_SIZE),
-        [this](const boost::system::error_code& ec, std::size_t) {
+void Peer::readSome() {
+    socket_.async_read_some(
+        boost::asio::buffer(read_buffer_.data() + read_end_, read_buffer_.size() - read_end_),
+        makeHandler(read_memory_, [self = shared_from_this()](const boost::system::error_code& ec, std::size_t n) {
             if (!ec) {
-                uint32_t body_size = (read_buffer_[0] << 24) |
-                                   (read_buffer_[1] << 16) |
-                                   (read_buffer_[2] << 8) |
-                                   read_buffer_[3];
-                read_buffer_.resize(HEADER_SIZE + body_size);
-                readBody();
+                self->read_end_ += n;
+                self->processReadBuffer();
             } else {
-                connected_ = false;
-                if (onError) {
-                    onError(ec.message());
-                }
+                self->fail(ec);
             }
-        });
+        }));
+}
+
+void Peer::processReadBuffer() {
+    // Replies sent by the handlers are written together after the batch
+    corked_ = true;
+    bool large = false;
+    while (!failed_) {
+        // A peer that does not take its replies is not read from until it
+        // has caught up; the rest of the buffer is handled then
+        if (queued_bytes_ > limits_.high_watermark) {
+            read_paused_ = true;
+            counters_.read_stalls++;
+            break;
+        }
+
+        size_t available = read_end_ - read_start_;
+        if (available < Message::HEADER_SIZE) break;
+
+        const uint8_t* data = read_buffer_.data() + read_start_;
+        std::copy(data, data + Message::HEADER_SIZE, read_header_.begin());
+        uint32_t body_size = Message::parseLength(read_header_);
+        if (body_size > MAX_PAYLOAD_SIZE) {
+            spdlog::error("Message of {} bytes from {}", body_size, getAddress());
+            fail(boost::asio::error::message_size);
+            break;
+        }
+
+        size_t size = Message::HEADER_SIZE + body_size;
+        if (size > read_buffer_.size()) {
+            // Too large for the read buffer: what has arrived is copied to a
+            // payload buffer and the rest is read straight into it
+            read_payload_ = SharedBuffer::allocate(body_size);
+            size_t have = available - Message::HEADER_SIZE;
+            std::copy(data + Message::HEADER_SIZE, data + available, read_payload_.data());
+            read_start_ = read_end_ = 0;
+            large = true;
+            readPayload(have);
+            break;
+        }
+        if (available < size) break;
+
+        deliver(SharedBuffer::copyOf(data + Message::HEADER_SIZE, body_size));
+        read_start_ += size;
+    }
+    corked_ = false;
+    if (!writing_ && write_head_ < write_queue_.size()) {
+        writeBatch();
+    }
+    if (failed_ || read_paused_ || large) return;
+
+    // Keep the partial message at the front and read more
+    if (read_start_ > 0) {
+        std::copy(read_buffer_.begin() + read_start_, read_buffer_.begin() + read_end_, read_buffer_.begin());
+        read_end_ -= read_start_;
+        read_start_ = 0;
+    }
+    readSome();
 }
 
-void Peer::readBody() {
+void Peer::readPayload(size_t have) {
     boost::asio::async_read(socket_,
-        boost::asio::buffer(read_buffer_.data() + HEADER_SIZE,
-                           read_buffer_.size() - HEADER_SIZE),
-        [this](const boost::system::error_code& ec, std::size_t) {
+        boost::asio::buffer(read_payload_.data() + have, read_payload_.size() - have),
+        makeHandler(read_memory_, [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
             if (!ec) {
-                try {
-                    auto msg = Message::deserialize(read_buffer_);
-                    if (onMessage) {
-                        onMessage(msg);
-                    }
-                } catch (const std::exception& e) {
-                    spdlog::error("Failed to parse message: {}", e.what());
-                }
-                readHeader();
+                self->corked_ = true;
+                self->deliver(std::move(self->read_payload_));
+                self->processReadBuffer();
             } else {
-                connected_ = false;
-                if (onError) {
-                    onError(ec.message());
-                }
+                self->fail(ec);
             }
-        });
+        }));
 }
 
-void Peer::writeMessage() {
-    boost::asio::async_write(socket_,
-        boost::asio::buffer(write_queue_.front()),
-        [this](const boost::system::error_code& ec, std::size_t) {
-            if (!ec) {
-                write_queue_.pop();
-                if (!write_queue_.empty()) {
-                    writeMessage();
-                }
-            } else {
-                connected_ = false;
-                if (onError) {
-                    onError(ec.message());
+void Peer::deliver(SharedBuffer payload) {
+    // The message takes the buffer as it is; it goes back to the pool once
+    // the handlers have let go of it
+    Message msg(Message::parseType(read_header_), std::move(payload));
+    if (onMessage) {
+        onMessage(msg);
+    }
+}
+
+void Peer::writeBatch() {
+    // Everything queued goes out in one write, up to the byte budget; the
+    // first message goes whatever its size
+    size_t count = 0;
+    size_t buffers = 0;
+    size_t bytes = 0;
+    while (write_head_ + count < write_queue_.size() && count < MAX_WRITE_BATCH) {
+        const Outgoing& out = write_queue_[write_head_ + count];
+        size_t size = Message::HEADER_SIZE + out.payload.size();
+        if (count > 0 && bytes + size > limits_.write_batch_bytes) break;
+
+        write_headers_[count] = out.header;
+        write_buffers_[buffers++] = boost::asio::buffer(write_headers_[count]);
+        if (!out.payload.empty()) {
+            write_buffers_[buffers++] = boost::asio::buffer(out.payload.data(), out.payload.size());
+        }
+        bytes += size;
+        count++;
+    }
+    write_batch_ = count;
+    writing_ = true;
+
+    uint64_t largest = counters_.largest_batch;
+    while (count > largest && !counters_.largest_batch.compare_exchange_weak(largest, count)) {}
+
+    boost::asio::async_write(socket_, BufferRange{write_buffers_.data(), write_buffers_.data() + buffers},
+        makeHandler(write_memory_, [self = shared_from_this(), bytes](const boost::system::error_code& ec, std::size_t) {
+            self->writing_ = false;
+            if (ec) {
+                self->fail(ec);
+                return;
+            }
+            self->counters_.writes++;
+            self->counters_.messages_written += self->write_batch_;
+            self->counters_.bytes_written += bytes;
+
+            // Release the payloads now rather than when the slots are reused
+            for (size_t i = 0; i < self->write_batch_; i++) {
+                self->write_queue_[self->write_head_ + i].payload = SharedBuffer();
+            }
+            self->write_head_ += self->write_batch_;
+            self->queued_bytes_ -= bytes;
+            self->counters_.queued_bytes -= bytes;
+
+            if (self->write_head_ == self->write_queue_.size()) {
+                self->write_queue_.clear();
+                self->write_head_ = 0;
+            } else if (self->write_head_ >= 64 && self->write_head_ * 2 >= self->write_queue_.size()) {
+                // A queue that never drains is compacted in place
+                self->write_queue_.erase(self->write_queue_.begin(),
+                                         self->write_queue_.begin() + self->write_head_);
+                self->write_head_ = 0;
+            }
+
+            if (self->write_head_ < self->write_queue_.size()) {
+                self->writeBatch();
+            }
+            if (self->queued_bytes_ <= self->limits_.low_watermark) {
+                self->low_priority_paused_ = false;
+                if (self->read_paused_) {
+                    self->read_paused_ = false;
+                    self->processReadBuffer();
                 }
             }
-        });
-}
\ No newline at end of file
+        }));
+}
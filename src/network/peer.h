@@ -1,36 +1,154 @@
 #pragma once
 #include <boost/asio.hpp>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <vector>
+#include "handler_memory.h"
 #include "message.h"
 
 using boost::asio::ip::tcp;
 
+// Bounds on the send queue of a peer
+struct PeerLimits {
+    // Above the high watermark of queued bytes a peer is not read from and
+    // low priority messages to it are dropped, until the queue is back
+    // under the low watermark
+    size_t high_watermark = 1 << 20;
+    size_t low_watermark = 256 << 10;
+    // A peer that gets this far behind is dropped
+    size_t max_queued = 64 << 20;
+    // Queued messages are gathered into one write up to this many bytes
+    size_t write_batch_bytes = 256 << 10;
+};
+
+// Send queue counters, shared by the peers of a Network
+struct PeerCounters {
+    std::atomic<uint64_t> queued_bytes{0};
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint64_t> messages_written{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> largest_batch{0};
+    std::atomic<uint64_t> read_stalls{0};
+    std::atomic<uint64_t> dropped_messages{0};
+    std::atomic<uint64_t> overflows{0};
+};
+
+// A connection to one peer.
+//
+// Every handler of a peer runs on its strand, so the socket, the read buffer
+// and the write queue are only touched from one thread at a time, while
+// different peers are served by all the threads running the io_context.
+// Handlers hold a shared_ptr to the peer, which lives until the last one
+// has run; it must not outlive the io_context it was made with, nor the
+// counters. send() and close() may be called from any thread.
 class Peer : public std::enable_shared_from_this<Peer> {
 public:
-    explicit Peer(boost::asio::io_context& io_context);
-    
+    using Strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+    // Bound to the strand type rather than the type-erased executor of
+    // tcp::socket, which copies the strand to the heap on every operation
+    using Socket = boost::asio::basic_stream_socket<tcp, Strand>;
+
+    enum class Priority {
+        NORMAL,
+        // Dropped from when the peer reaches its high watermark until it
+        // is back under the low one
+        LOW
+    };
+
+    Peer(boost::asio::io_context& io_context, const PeerLimits& limits, PeerCounters& counters);
+    ~Peer();
+
     void connect(const std::string& host, uint16_t port);
     void start();
-    void send(const Message& msg);
-    
+    void send(const Message& msg, Priority priority = Priority::NORMAL);
+    void close();
+
     bool isConnected() const { return connected_; }
+    uint64_t getId() const { return id_; }
     std::string getAddress() const;
-    
+    size_t getQueuedBytes() const { return queued_bytes_; }
+    Socket& socket() { return socket_; }
+
+    // Called on the peer's strand; onError at most once
     std::function<void(const Message&)> onMessage;
     std::function<void(const std::string&)> onError;
 
+    // Larger payloads are a protocol error; the peer is dropped
+    static constexpr size_t MAX_PAYLOAD_SIZE = 32 << 20;
+    // Messages per write: a header and a payload buffer each, within the
+    // 64 buffers asio hands to one writev
+    static constexpr size_t MAX_WRITE_BATCH = 32;
+    static constexpr size_t READ_BUFFER_SIZE = 16 << 10;
+
 private:
-    void readHeader();
-    void readBody();
-    void writeMessage();
-    
+    void readSome();
+    void processReadBuffer();
+    void readPayload(size_t have);
+    void deliver(SharedBuffer payload);
+    void writeBatch();
+    void fail(const boost::system::error_code& ec);
+    void setAddress();
+
     boost::asio::io_context& io_context_;
-    tcp::socket socket_;
-    bool connected_{false};
-    
+    Strand strand_;
+    Socket socket_;
+    const PeerLimits limits_;
+    PeerCounters& counters_;
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> failed_{false};
+    const uint64_t id_;
+
+    mutable std::mutex address_mutex_;
+    std::string address_;
+
+    // Reads take whatever has arrived, so one read yields many small
+    // messages; each payload is copied to a pooled buffer for its Message.
+    // A message larger than the read buffer is read straight into its
+    // payload buffer instead.
     std::vector<uint8_t> read_buffer_;
-    std::queue<std::vector<uint8_t>> write_queue_;
-    
-    static constexpr size_t HEADER_SIZE = 5;
-};
\ No newline at end of file
+    size_t read_start_{0};
+    size_t read_end_{0};
+    Message::Header read_header_;
+    SharedBuffer read_payload_;
+    // Set while reading is held back by a full send queue
+    bool read_paused_{false};
+    // Set from the high watermark down to the low one: low priority
+    // messages are dropped meanwhile
+    bool low_priority_paused_{false};
+    // Set while the messages of a read are handled: sends are queued and
+    // written together afterwards
+    bool corked_{false};
+
+    // The operations of the read chain and of the write chain
+    HandlerMemory read_memory_;
+    HandlerMemory write_memory_;
+
+    // Messages waiting to be written, from write_head_ on; the vector keeps
+    // its capacity, so queueing does not allocate once it is warm
+    struct Outgoing {
+        Message::Header header;
+        SharedBuffer payload;
+    };
+    std::vector<Outgoing> write_queue_;
+    size_t write_head_{0};
+    std::atomic<size_t> queued_bytes_{0};
+
+    // The batch being written: the queue may grow and move meanwhile, so
+    // the headers are copied here and the buffers point at them and at the
+    // payloads, whose bytes do not move
+    struct BufferRange {
+        using value_type = boost::asio::const_buffer;
+        using const_iterator = const boost::asio::const_buffer*;
+        const_iterator first;
+        const_iterator last;
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+    };
+    std::array<Message::Header, MAX_WRITE_BATCH> write_headers_;
+    std::array<boost::asio::const_buffer, 2 * MAX_WRITE_BATCH> write_buffers_;
+    size_t write_batch_{0};
+    bool writing_{false};
+};
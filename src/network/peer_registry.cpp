@@ -0,0 +1,37 @@
+#include "peer_registry.h"
+
+PeerRegistry::PeerRegistry() : snapshot_(std::make_shared<const Snapshot>()) {}
+
+void PeerRegistry::add(const std::shared_ptr<Peer>& peer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peers_[peer->getId()] = peer;
+    publish();
+}
+
+bool PeerRegistry::remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (peers_.erase(id) == 0) return false;
+    publish();
+    return true;
+}
+
+std::shared_ptr<Peer> PeerRegistry::find(uint64_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peers_.find(id);
+    return it != peers_.end() ? it->second : nullptr;
+}
+
+void PeerRegistry::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peers_.clear();
+    publish();
+}
+
+void PeerRegistry::publish() {
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->reserve(peers_.size());
+    for (const auto& [_, peer] : peers_) {
+        snapshot->push_back(peer);
+    }
+    std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+}
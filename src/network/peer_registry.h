@@ -0,0 +1,36 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "peer.h"
+
+// The connected peers, by id.
+//
+// Readers take an immutable snapshot with one atomic load, so broadcast and
+// the peer count never wait for a lock or for each other. Adding or removing
+// a peer copies the snapshot under a mutex; peers come and go far less often
+// than messages are sent.
+class PeerRegistry {
+public:
+    using Snapshot = std::vector<std::shared_ptr<Peer>>;
+
+    PeerRegistry();
+
+    void add(const std::shared_ptr<Peer>& peer);
+    bool remove(uint64_t id);
+    std::shared_ptr<Peer> find(uint64_t id) const;
+    void clear();
+
+    std::shared_ptr<const Snapshot> snapshot() const {
+        return std::atomic_load(&snapshot_);
+    }
+    size_t size() const { return snapshot()->size(); }
+
+private:
+    void publish();
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, std::shared_ptr<Peer>> peers_;
+    std::shared_ptr<const Snapshot> snapshot_;
+};
@@ -70,6 +70,8 @@ enum
 {
     NODE_NETWORK = (1 << 0),
     NODE_BLOOM = (1 << 1),
+    // serves only the last MIN_BLOCKS_TO_KEEP blocks (set instead of NODE_NETWORK when pruning)
+    NODE_NETWORK_LIMITED = (1 << 10),
 };
 
 /** A CService with information about it as peer */
@@ -125,11 +125,13 @@ void MimblewimbleDialog::on_createButton_clicked()
     int unit = model->getOptionsModel()->getDisplayUnit();
     int64_t nAmount = BitcoinUnits::toCoinUnits(unit, amount);
     
+    int64_t fee = COIN / 100; // 0.01 coin fee
+    
     // Check if we have enough outputs
-    std::vector<mw::Output> inputs = mwWallet->GetOwnedOutputs();
-    if (inputs.empty()) {
+    std::vector<mw::Output> inputs;
+    if (!mwWallet->SelectInputs(nAmount + fee, inputs)) {
         QMessageBox::warning(this, tr("No Inputs"),
-            tr("You don't have any Mimblewimble outputs to spend."),
+            tr("You don't have enough Mimblewimble outputs to spend."),
             QMessageBox::Ok, QMessageBox::Ok);
         return;
     }
@@ -147,7 +149,6 @@ void MimblewimbleDialog::on_createButton_clicked()
     
     // Create transaction
     std::vector<int64_t> amounts = {nAmount};
-    int64_t fee = COIN / 100; // 0.01 coin fee
     
     boost::optional<mw::Transaction> txOpt = mwWallet->CreateTransaction(
         inputs, amounts, fee);
@@ -184,11 +185,17 @@ void MimblewimbleDialog::on_testButton_clicked()
     if (!model || !mwWallet)
         return;
     
-    // Generate a test output for 5 coins
-    auto [output, blind] = mwWallet->CreateOutput(5 * COIN);
+    // Generate a test output for 5 coins and save it to the wallet; the
+    // blinding factor comes from the HD seed, so the wallet must be unlocked
+    bool fSaved = false;
+    try {
+        auto [output, blind] = mwWallet->CreateOutput(5 * COIN);
+        fSaved = mwWallet->SaveOwnedOutput(output, blind, 5 * COIN);
+    } catch (const std::exception& e) {
+        fSaved = false;
+    }
     
-    // Save to wallet
-    if (mwWallet->SaveOwnedOutput(output, blind, 5 * COIN)) {
+    if (fSaved) {
         QMessageBox::information(this, tr("Test Output Created"),
             tr("A test output of 5 coins has been created for demonstration purposes."),
             QMessageBox::Ok, QMessageBox::Ok);
@@ -3,9 +3,13 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "main.h"
+#include "txdb.h"
 #include "bitcoinrpc.h"
 
+#include <boost/filesystem.hpp>
+
 using namespace json_spirit;
 using namespace std;
 
@@ -171,7 +175,10 @@ Value getblock(const Array& params, bool fHelp)
 
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex);
+    if (!(pblockindex->nStatus & BLOCK_HAVE_DATA))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    if (!block.ReadFromDisk(pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose)
     {
@@ -186,26 +193,101 @@ Value getblock(const Array& params, bool fHelp)
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
-            "Returns statistics about the unspent transaction output set.");
+            "gettxoutsetinfo [height]\n"
+            "Returns statistics about the unspent transaction output set.\n"
+            "Without [height] the coin database is scanned; with it the rolling\n"
+            "commitment of the main chain block at [height] is looked up, which\n"
+            "has no hash_serialized or bytes_serialized.");
 
     Object ret;
 
     CCoinsStats stats;
-    if (pcoinsTip->GetStats(stats)) {
-        ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (boost::int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (boost::int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bytes_serialized", (boost::int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    if (params.size() == 0) {
+        if (pcoinsTip->GetStats(stats)) {
+            ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
+            ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+            ret.push_back(Pair("transactions", (boost::int64_t)stats.nTransactions));
+            ret.push_back(Pair("txouts", (boost::int64_t)stats.nTransactionOutputs));
+            ret.push_back(Pair("bytes_serialized", (boost::int64_t)stats.nSerializedSize));
+            ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+            ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+            ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        }
+        return ret;
     }
+
+    int nHeight = params[0].get_int();
+    if (nHeight < 0 || nHeight > nBestHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block number out of range");
+    if (!GetCoinsCommitmentStats(FindBlockByHeight(nHeight), stats))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "No UTXO set commitment for this block");
+
+    ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (boost::int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (boost::int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    return ret;
+}
+
+static boost::filesystem::path GetSnapshotPath(const std::string &strFile)
+{
+    boost::filesystem::path path(strFile);
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+static Object SnapshotToJSON(const CSnapshotHeader &header, const boost::filesystem::path &path)
+{
+    Object ret;
+    ret.push_back(Pair("coins", (boost::int64_t)header.nCoins));
+    ret.push_back(Pair("base_hash", header.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", header.nHeight));
+    ret.push_back(Pair("muhash", header.hashCoins.GetHex()));
+    ret.push_back(Pair("path", path.string()));
     return ret;
 }
 
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset <filename>\n"
+            "Write the unspent transaction output set as of the best block to a snapshot file.\n"
+            "Relative paths are taken to be relative to the data directory.");
+
+    boost::filesystem::path path = GetSnapshotPath(params[0].get_str());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CSnapshotHeader header;
+    if (!DumpUTXOSnapshot(path, header)) {
+        boost::filesystem::remove(path);
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to write snapshot (see debug.log)");
+    }
+    return SnapshotToJSON(header, path);
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset <filename>\n"
+            "Load a UTXO set snapshot written by dumptxoutset into an empty chain.\n"
+            "The snapshot must match one compiled into this client, or on testnet -checkpoints=0\n"
+            "must be given; blocks before it are not downloaded.");
+
+    boost::filesystem::path path = GetSnapshotPath(params[0].get_str());
+    CSnapshotHeader header;
+    if (!LoadUTXOSnapshot(path, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to load snapshot (see debug.log)");
+    return SnapshotToJSON(header, path);
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -268,3 +350,89 @@ Value verifychain(const Array& params, bool fHelp)
     return VerifyDB(nCheckLevel, nCheckDepth);
 }
 
+
+// Address index lookups are keyed by the Hash160 of the scriptPubKey
+static uint160 GetAddressIndexScriptHash(const std::string &strAddress)
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled (start with -addressindex -reindex)");
+
+    CScript scriptPubKey;
+    CBitcoinAddress address(strAddress);
+    if (address.IsValid())
+        scriptPubKey.SetDestination(address.Get());
+    else if (IsHex(strAddress)) {
+        std::vector<unsigned char> vch = ParseHex(strAddress);
+        scriptPubKey = CScript(vch.begin(), vch.end());
+    } else
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Duckbucks address or script");
+    return Hash160(scriptPubKey);
+}
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory <address or hex script> [startheight=0] [endheight]\n"
+            "Returns the outputs paid to and inputs spending from an address in the main chain,\n"
+            "ordered by height. Requires -addressindex.");
+
+    uint160 hashScript = GetAddressIndexScriptHash(params[0].get_str());
+    int nStartHeight = 0;
+    int nEndHeight = nBestHeight;
+    if (params.size() > 1)
+        nStartHeight = params[1].get_int();
+    if (params.size() > 2)
+        nEndHeight = params[2].get_int();
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+
+    LOCK(cs_main);
+    CAddressHistory vHistory;
+    if (!paddressindex->ReadAddressHistory(hashScript, nStartHeight, nEndHeight, vHistory))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read address index");
+
+    Array ret;
+    BOOST_FOREACH(const PAIRTYPE(CAddressIndexKey, int64)& item, vHistory)
+    {
+        Object entry;
+        entry.push_back(Pair("txid", item.first.txid.GetHex()));
+        entry.push_back(Pair("index", (int)item.first.nIndex));
+        entry.push_back(Pair("height", item.first.nHeight));
+        entry.push_back(Pair("spending", item.first.fSpending));
+        entry.push_back(Pair("amount", ValueFromAmount(item.second)));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos <address or hex script>\n"
+            "Returns the unspent outputs of an address as of the best block. Requires -addressindex.");
+
+    uint160 hashScript = GetAddressIndexScriptHash(params[0].get_str());
+
+    LOCK(cs_main);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    if (!paddressindex->ReadAddressUnspent(hashScript, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read address index");
+
+    Array ret;
+    for (unsigned int i = 0; i < vUnspent.size(); i++)
+    {
+        const CAddressUnspentKey &key = vUnspent[i].first;
+        const CAddressUnspentValue &value = vUnspent[i].second;
+        Object entry;
+        entry.push_back(Pair("txid", key.txid.GetHex()));
+        entry.push_back(Pair("vout", (int)key.nIndex));
+        entry.push_back(Pair("height", value.nHeight));
+        entry.push_back(Pair("confirmations", nBestHeight - value.nHeight + 1));
+        entry.push_back(Pair("scriptPubKey", HexStr(value.scriptPubKey.begin(), value.scriptPubKey.end())));
+        entry.push_back(Pair("amount", ValueFromAmount(value.nValue)));
+        ret.push_back(entry);
+    }
+    return ret;
+}
@@ -64,11 +64,17 @@ Value importprivkey(const Array& params, bool fHelp)
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
 
-        pwalletMain->MarkDirty();
+        // A rescan would silently miss the transactions in blocks that are not on disk
+        CBlockIndex* pindexPruned = fRescan ? FindPrunedBlock(pindexGenesisBlock) : NULL;
+        if (pindexPruned)
+            throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Rescan is not possible: blocks up to height %d are not on disk (pruned, or below a UTXO snapshot). "
+                "Import with rescan=false, or restart with -reindex to download them again.", pindexPruned->nHeight));
+
         pwalletMain->SetAddressBookName(vchAddress, strLabel);
 
         if (!pwalletMain->AddKeyPubKey(key, pubkey))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+        pwalletMain->MarkDirty(vchAddress);
 
         if (fRescan) {
             pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
@@ -98,3 +104,93 @@ Value dumpprivkey(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
     return CBitcoinSecret(vchSecret).ToString();
 }
+
+Value sethdseed(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "sethdseed [duckbucksprivkey] [rescan]\n"
+            "Gives a wallet without a seed one to derive its new keys from, and returns its hdseedid.\n"
+            "With <duckbucksprivkey>, the output of dumpprivkey for the hdseedid of another wallet,\n"
+            "the keys of that wallet are restored; without it a new seed is made.\n"
+            "Keys the wallet had before are kept but are not derived from the seed, so back them\n"
+            "up with backupwallet. [rescan] defaults to true when a seed is given.");
+
+    EnsureWalletIsUnlocked();
+
+    CKey key;
+    bool fRescan = false;
+    if (params.size() > 0)
+    {
+        CBitcoinSecret vchSecret;
+        if (!vchSecret.SetString(params[0].get_str()))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+        key = vchSecret.GetKey();
+        if (!key.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+        fRescan = true;
+    }
+    if (params.size() > 1)
+        fRescan = params[1].get_bool();
+
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        if (pwalletMain->IsHDEnabled())
+            throw JSONRPCError(RPC_WALLET_ERROR, "Wallet already has a seed");
+
+        // A rescan would silently miss the transactions in blocks that are not on disk
+        CBlockIndex* pindexPruned = fRescan ? FindPrunedBlock(pindexGenesisBlock) : NULL;
+        if (pindexPruned)
+            throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Rescan is not possible: blocks up to height %d are not on disk (pruned, or below a UTXO snapshot). "
+                "Set the seed with rescan=false, or restart with -reindex to download them again.", pindexPruned->nHeight));
+
+        bool fOk = params.size() > 0 ? pwalletMain->SetHDSeed(key) : pwalletMain->GenerateHDSeed();
+        if (!fOk)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error setting the seed");
+
+        if (fRescan) {
+            pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+            pwalletMain->ReacceptWalletTransactions();
+        }
+    }
+
+    return CBitcoinAddress(pwalletMain->GetHDChain().seedID).ToString();
+}
+
+Value getrescaninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of a running wallet rescan.");
+
+    int nStartHeight, nHeight, nStopHeight;
+    bool fRunning = pwalletMain->GetRescanProgress(nStartHeight, nHeight, nStopHeight);
+
+    Object ret;
+    ret.push_back(Pair("rescanning", fRunning));
+    if (fRunning) {
+        ret.push_back(Pair("startheight", nStartHeight));
+        ret.push_back(Pair("height", nHeight));
+        ret.push_back(Pair("stopheight", nStopHeight));
+        double dProgress = nStopHeight > nStartHeight ? (double)(nHeight - nStartHeight) / (nStopHeight - nStartHeight) : 1.0;
+        ret.push_back(Pair("progress", std::min(dProgress, 1.0)));
+    }
+    return ret;
+}
+
+Value abortrescan(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "Stops a running wallet rescan after the current block.\n"
+            "Transactions found up to that block stay in the wallet.");
+
+    int nStartHeight, nHeight, nStopHeight;
+    if (!pwalletMain->GetRescanProgress(nStartHeight, nHeight, nStopHeight))
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
@@ -1,31 +1,19 @@
 #include "mimblewimble.h"
 #include "mimblewimble_wallet.h"
 #include "mimblewimble_init.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_mmr.h"
+#include "mimblewimble_sync.h"
+#include "mimblewimble_pool.h"
 #include "init.h"
 #include "bitcoinrpc.h"
 #include "base58.h"
 
+#include <boost/thread.hpp>
+
 using namespace std;
 using namespace json_spirit;
 
-// Forward declaration
-extern std::unique_ptr<mw::MimblewimbleWallet> g_pMWWallet;
-
-Value runmwtest(const Array& params, bool fHelp)
-{
-    if (fHelp || params.size() != 0)
-        throw runtime_error(
-            "runmwtest\n"
-            "Run Mimblewimble test transaction.\n");
-
-    if (!g_pMWWallet)
-        throw runtime_error("Mimblewimble wallet not initialized");
-
-    RunMimblewimbleTest();
-    
-    return Value::null;
-}
-
 Value getmwbalance(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 0)
@@ -36,18 +24,7 @@ Value getmwbalance(const Array& params, bool fHelp)
     if (!g_pMWWallet)
         throw runtime_error("Mimblewimble wallet not initialized");
     
-    // Get all outputs owned by the wallet
-    std::vector<mw::Output> outputs = g_pMWWallet->GetOwnedOutputs();
-    
-    int64_t balance = 0;
-    for (const mw::Output& output : outputs) {
-        boost::optional<int64_t> value = g_pMWWallet->GetOutputValue(output);
-        if (value) {
-            balance += *value;
-        }
-    }
-    
-    return ValueFromAmount(balance);
+    return ValueFromAmount(g_pMWWallet->GetBalance());
 }
 
 Value createmwoutput(const Array& params, bool fHelp)
@@ -57,22 +34,21 @@ Value createmwoutput(const Array& params, bool fHelp)
             "createmwoutput <amount>\n"
             "Create a test Mimblewimble output for demonstration purposes.\n"
             "This is only for testing and should not be used in production.\n"
-            "<amount> is the amount in " + CURRENCY_UNIT + " to create\n");
+            "<amount> is a real and is rounded to the nearest 0.00000001");
 
     if (!g_pMWWallet)
         throw runtime_error("Mimblewimble wallet not initialized");
     
-    int64_t amount = AmountFromValue(params[0]);
-    
-    auto [output, blind] = g_pMWWallet->CreateOutput(amount);
-    bool success = g_pMWWallet->SaveOwnedOutput(output, blind, amount);
-    
-    if (!success)
-        throw runtime_error("Failed to save output to wallet");
-    
+    int64 nAmount = AmountFromValue(params[0]);
+    EnsureWalletIsUnlocked();
+
+    pair<mw::Output, mw::BlindingFactor> output = g_pMWWallet->CreateOutput(nAmount);
+    if (!g_pMWWallet->SaveOwnedOutput(output.first, output.second, nAmount))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Failed to save output to wallet");
+
     Object result;
-    result.push_back(Pair("commitment", output.commitment.GetHash().ToString()));
-    result.push_back(Pair("amount", ValueFromAmount(amount)));
+    result.push_back(Pair("commitment", output.first.commitment.GetHash().ToString()));
+    result.push_back(Pair("amount", ValueFromAmount(nAmount)));
     
     return result;
 }
@@ -82,47 +58,176 @@ Value createmwtransaction(const Array& params, bool fHelp)
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "createmwtransaction <amount>\n"
-            "Create a Mimblewimble transaction sending the specified amount.\n"
-            "<amount> is the amount in " + CURRENCY_UNIT + " to send\n");
+            "Create a Mimblewimble transaction sending the specified amount and add it to the\n"
+            "Mimblewimble transaction pool, which aggregates pooled transactions into blocks.\n"
+            "<amount> is a real and is rounded to the nearest 0.00000001");
 
     if (!g_pMWWallet)
         throw runtime_error("Mimblewimble wallet not initialized");
     
-    int64_t amount = AmountFromValue(params[0]);
-    
-    // Get all outputs owned by the wallet
-    std::vector<mw::Output> inputs = g_pMWWallet->GetOwnedOutputs();
-    
-    if (inputs.empty())
-        throw runtime_error("No Mimblewimble outputs available to spend");
-    
-    // Create the transaction
-    std::vector<int64_t> amounts = {amount};
-    int64_t fee = COIN / 100; // 0.01 coin fee
-    
-    boost::optional<mw::Transaction> txOpt = g_pMWWallet->CreateTransaction(
-        inputs, amounts, fee);
-    
+    int64 nAmount = AmountFromValue(params[0]);
+    int64 nFee = COIN / 100; // 0.01 coin fee
+    EnsureWalletIsUnlocked();
+
+    // Pick the outputs to spend
+    vector<mw::Output> vInputs;
+    if (!g_pMWWallet->SelectInputs(nAmount + nFee, vInputs))
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient Mimblewimble funds");
+
+    vector<int64_t> vAmounts(1, nAmount);
+    boost::optional<mw::Transaction> txOpt = g_pMWWallet->CreateTransaction(vInputs, vAmounts, nFee);
     if (!txOpt)
-        throw runtime_error("Failed to create transaction");
-    
+        throw JSONRPCError(RPC_WALLET_ERROR, "Failed to create transaction");
     mw::Transaction tx = *txOpt;
-    
+
+    bool fInPool;
+    {
+        LOCK(cs_main);
+        fInPool = mwmempool.accept(tx, pmwcoinsTip);
+    }
+    if (fInPool)
+        g_pMWWallet->CommitTransaction(tx);
+
     Object result;
     result.push_back(Pair("txid", tx.GetHash().ToString()));
-    result.push_back(Pair("fee", ValueFromAmount(fee)));
+    result.push_back(Pair("fee", ValueFromAmount(nFee)));
     result.push_back(Pair("inputs", (int)tx.vin.size()));
     result.push_back(Pair("outputs", (int)tx.vout.size()));
-    
+    result.push_back(Pair("inmempool", fInPool));
     return result;
 }
 
-// Add RPC command table entries
-static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "mimblewimble",       "runmwtest",              &runmwtest,              true,   },
-    { "mimblewimble",       "getmwbalance",           &getmwbalance,           true,   },
-    { "mimblewimble",       "createmwoutput",         &createmwoutput,         true,   },
-    { "mimblewimble",       "createmwtransaction",    &createmwtransaction,    true,   },
-}; 
\ No newline at end of file
+Value scanmwoutputs(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "scanmwoutputs [threads]\n"
+            "Finds the wallet's outputs in the Mimblewimble unspent output set, from the\n"
+            "wallet's HD seed alone, and adds those the wallet did not have.\n"
+            "[threads] defaults to one per core. Requires an unlocked wallet.");
+
+    if (!g_pMWWallet || !pmwcoinsTip || !pmwcoinsdbview)
+        throw runtime_error("Mimblewimble wallet not initialized");
+    EnsureWalletIsUnlocked();
+
+    int nThreads = boost::thread::hardware_concurrency();
+    if (params.size() > 0)
+        nThreads = params[0].get_int();
+    if (nThreads <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of threads");
+
+    // the scan reads the database, which then has every output
+    {
+        LOCK(cs_main);
+        if (!pmwcoinsTip->Flush())
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to flush the Mimblewimble output set");
+    }
+    int nFound = g_pMWWallet->ScanForOutputs(*pmwcoinsdbview, nThreads);
+    if (nFound < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Mimblewimble output scan failed");
+
+    Object result;
+    result.push_back(Pair("found", nFound));
+    result.push_back(Pair("balance", ValueFromAmount(g_pMWWallet->GetBalance())));
+    return result;
+}
+
+static CMMR& MMRFromValue(const Value& value)
+{
+    if (!pmwaccumulators)
+        throw runtime_error("Mimblewimble MMRs not opened");
+    string strName = value.get_str();
+    if (strName == "kernel")
+        return pmwaccumulators->kernels;
+    if (strName == "output")
+        return pmwaccumulators->outputs;
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid MMR, expected kernel or output");
+}
+
+Value getmwmmrinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmwmmrinfo\n"
+            "Returns the size and root of the Mimblewimble kernel and output MMRs.");
+
+    if (!pmwaccumulators)
+        throw runtime_error("Mimblewimble MMRs not opened");
+
+    Object ret;
+    const char* names[] = { "kernel", "output" };
+    for (unsigned int i = 0; i < 2; i++) {
+        CMMR& mmr = MMRFromValue(names[i]);
+        Object obj;
+        obj.push_back(Pair("leaves", (boost::int64_t)mmr.GetLeafCount()));
+        obj.push_back(Pair("size", (boost::int64_t)mmr.GetSize()));
+        obj.push_back(Pair("root", mmr.GetRoot().GetHex()));
+        ret.push_back(Pair(names[i], obj));
+    }
+    return ret;
+}
+
+Value getmwmmrproof(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getmwmmrproof <kernel|output> <leaf>\n"
+            "Returns a proof that leaf number <leaf> is in the kernel or output MMR.\n"
+            "\"proof\" is the serialized proof, \"data\" the serialized kernel or output.");
+
+    CMMR& mmr = MMRFromValue(params[0]);
+    boost::int64_t nLeaf = params[1].get_int64();
+    CMMRProof proof;
+    vector<unsigned char> vData;
+    if (nLeaf < 0 || !mmr.GetProof(nLeaf, proof) || !mmr.GetLeaf(nLeaf, vData))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Leaf out of range");
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << proof;
+
+    Object result;
+    result.push_back(Pair("root", mmr.GetRoot().GetHex()));
+    result.push_back(Pair("leaves", (boost::int64_t)proof.nLeaves));
+    result.push_back(Pair("leaf", (boost::int64_t)proof.nLeaf));
+    if (mmr.IsSpent(nLeaf))
+        result.push_back(Pair("spent", true));
+    result.push_back(Pair("data", HexStr(vData.begin(), vData.end())));
+    result.push_back(Pair("proof", HexStr(ss.begin(), ss.end())));
+    return result;
+}
+
+Value writemwstate(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "writemwstate\n"
+            "Writes the archive of the current Mimblewimble state (kernels, unspent outputs\n"
+            "and MMR roots) to mwstate/, which peers fetch to fast sync (-mwfastsync).");
+
+    if (!pmwaccumulators || !pmwcoinsTip)
+        throw runtime_error("Mimblewimble state not opened");
+
+    LOCK(cs_main);
+    uint256 hashBlock = pmwcoinsTip->GetBestBlock();
+    int nHeight = 0;
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi != mapBlockIndex.end())
+        nHeight = mi->second->nHeight;
+
+    // peers are served from mwstate/, so build the new archive beside it
+    boost::filesystem::path pathNew = GetDataDir() / "mwstate.tmp";
+    boost::filesystem::remove_all(pathNew);
+    CMWStateHeader header;
+    if (!WriteMWStateArchive(pathNew, *pmwaccumulators, *pmwcoinsTip, nHeight, hashBlock, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to write the Mimblewimble state archive");
+    boost::filesystem::remove_all(GetDataDir() / "mwstate");
+    RenameOver(pathNew, GetDataDir() / "mwstate");
+
+    Object result;
+    result.push_back(Pair("height", nHeight));
+    result.push_back(Pair("hash", hashBlock.GetHex()));
+    result.push_back(Pair("kernels", (boost::int64_t)header.nKernels));
+    result.push_back(Pair("outputs", (boost::int64_t)header.nUnspent));
+    result.push_back(Pair("chunks", (int)header.vChunkHashes.size()));
+    return result;
+}
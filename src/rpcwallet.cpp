@@ -48,6 +48,10 @@ void WalletTxToJSON(const CWalletTx& wtx, Object& entry)
     entry.push_back(Pair("normtxid", wtx.GetNormalizedHash().GetHex()));
     entry.push_back(Pair("time", (boost::int64_t)wtx.GetTxTime()));
     entry.push_back(Pair("timereceived", (boost::int64_t)wtx.nTimeReceived));
+    Array conflicts;
+    BOOST_FOREACH(const uint256& conflict, pwalletMain->GetConflicts(wtx.GetHash()))
+        conflicts.push_back(conflict.GetHex());
+    entry.push_back(Pair("walletconflicts", conflicts));
     BOOST_FOREACH(const PAIRTYPE(string,string)& item, wtx.mapValue)
         entry.push_back(Pair(item.first, item.second));
 }
@@ -83,9 +87,17 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("proxy",         (proxy.first.IsValid() ? proxy.first.ToStringIPPort() : string())));
     obj.push_back(Pair("difficulty",    (double)GetDifficulty()));
     obj.push_back(Pair("testnet",       fTestNet));
+    obj.push_back(Pair("pruned",        fPruneMode));
     if (pwalletMain) {
         obj.push_back(Pair("keypoololdest", (boost::int64_t)pwalletMain->GetOldestKeyPoolTime()));
         obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
+        unsigned int nDone, nTarget;
+        if (pwalletMain->GetKeyPoolFillProgress(nDone, nTarget)) {
+            obj.push_back(Pair("keypoolfilldone",   (int)nDone));
+            obj.push_back(Pair("keypoolfilltarget", (int)nTarget));
+        }
+        if (pwalletMain->IsHDEnabled())
+            obj.push_back(Pair("hdseedid",  CBitcoinAddress(pwalletMain->GetHDChain().seedID).ToString()));
     }
     obj.push_back(Pair("paytxfee",      ValueFromAmount(nTransactionFee)));
     obj.push_back(Pair("mininput",      ValueFromAmount(nMinimumInputValue)));
@@ -1297,7 +1309,12 @@ Value keypoolrefill(const Array& params, bool fHelp)
     pwalletMain->TopUpKeyPool();
 
     if (pwalletMain->GetKeyPoolSize() < GetArg("-keypool", 100))
+    {
+        unsigned int nDone, nTarget;
+        if (pwalletMain->GetKeyPoolFillProgress(nDone, nTarget))
+            throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Error: Keypool refill already in progress (%u of %u keys added).", nDone, nTarget));
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
+    }
 
     return Value::null;
 }
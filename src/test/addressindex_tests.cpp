@@ -0,0 +1,306 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bitcoinrpc.h"
+#include "main.h"
+#include "txdb.h"
+
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_AUTO_TEST_CASE(addressindex_history_range)
+{
+    CAddressIndexDB db(1 << 20, true);
+    uint160 hashA = Hash160(CScript() << OP_TRUE);
+    uint160 hashB = Hash160(CScript() << OP_FALSE);
+
+    // heights that sort differently as little-endian integers
+    CAddressHistory vHistory;
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hashA, 70000, 1, 0, false), 5 * COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hashA, 256, 2, 1, false), 3 * COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hashA, 1, 3, 0, false), COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hashA, 300, 4, 0, true), -3 * COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hashB, 2, 5, 0, false), 7 * COIN));
+    db.UpdateBlock(vHistory, false, CAddressUnspentMap(), 1);
+    BOOST_CHECK(db.Flush());
+
+    CAddressHistory vRead;
+    BOOST_CHECK(db.ReadAddressHistory(hashA, 0, 100000, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 4U);
+    BOOST_CHECK_EQUAL(vRead[0].first.nHeight, 1);
+    BOOST_CHECK_EQUAL(vRead[1].first.nHeight, 256);
+    BOOST_CHECK_EQUAL(vRead[2].first.nHeight, 300);
+    BOOST_CHECK(vRead[2].first.fSpending);
+    BOOST_CHECK_EQUAL(vRead[2].second, -3 * COIN);
+    BOOST_CHECK_EQUAL(vRead[3].first.nHeight, 70000);
+
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressHistory(hashA, 2, 300, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 2U);
+
+    // erasing a block's entries (disconnect)
+    vHistory.resize(1);
+    db.UpdateBlock(vHistory, true, CAddressUnspentMap(), 2);
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressHistory(hashA, 0, 100000, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_unspent)
+{
+    CAddressIndexDB db(1 << 20, true);
+    CScript script = CScript() << OP_TRUE;
+    uint160 hash = Hash160(script);
+
+    CAddressUnspentMap mapUnspent;
+    mapUnspent[CAddressUnspentKey(hash, 1, 0)] = CAddressUnspentValue(COIN, script, 10);
+    mapUnspent[CAddressUnspentKey(hash, 2, 1)] = CAddressUnspentValue(2 * COIN, script, 11);
+    mapUnspent[CAddressUnspentKey(Hash160(CScript() << OP_FALSE), 3, 0)] = CAddressUnspentValue(COIN, CScript() << OP_FALSE, 11);
+    db.UpdateBlock(CAddressHistory(), false, mapUnspent, 1);
+    BOOST_CHECK(db.Flush());
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspent(hash, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+
+    // a null value marks a spent output
+    mapUnspent.clear();
+    mapUnspent[CAddressUnspentKey(hash, 1, 0)].SetNull();
+    db.UpdateBlock(CAddressHistory(), false, mapUnspent, 2);
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspent(hash, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txid == uint256(2));
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, 2 * COIN);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, 11);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_cache)
+{
+    CAddressIndexDB db(1 << 20, true);
+    CScript script = CScript() << OP_TRUE;
+    uint160 hash = Hash160(script);
+    uint256 hashBlock;
+    BOOST_CHECK(!db.ReadBestBlock(hashBlock));
+
+    // block 1 creates outputs 1:0 and 1:1, and is written
+    CAddressHistory vHistory;
+    CAddressUnspentMap mapUnspent;
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 1, 1, 0, false), COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 1, 1, 1, false), COIN));
+    mapUnspent[CAddressUnspentKey(hash, 1, 0)] = CAddressUnspentValue(COIN, script, 1);
+    mapUnspent[CAddressUnspentKey(hash, 1, 1)] = CAddressUnspentValue(COIN, script, 1);
+    db.UpdateBlock(vHistory, false, mapUnspent, 101);
+    BOOST_CHECK(db.Flush());
+    BOOST_CHECK(db.ReadBestBlock(hashBlock) && hashBlock == uint256(101));
+
+    // block 2 creates 2:0 and spends 1:0, block 3 spends 2:0, before the next flush
+    vHistory.clear();
+    mapUnspent.clear();
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 2, 2, 0, true), -COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 2, 2, 0, false), COIN));
+    mapUnspent[CAddressUnspentKey(hash, 1, 0)].SetNull();
+    mapUnspent[CAddressUnspentKey(hash, 2, 0)] = CAddressUnspentValue(COIN, script, 2);
+    db.UpdateBlock(vHistory, false, mapUnspent, 102);
+    vHistory.clear();
+    mapUnspent.clear();
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 3, 3, 0, true), -COIN));
+    mapUnspent[CAddressUnspentKey(hash, 2, 0)].SetNull();
+    db.UpdateBlock(vHistory, false, mapUnspent, 103);
+
+    // reads see the cached changes, which are not on disk yet
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspent(hash, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txid == uint256(1) && vUnspent[0].first.nIndex == 1);
+    CAddressHistory vRead;
+    BOOST_CHECK(db.ReadAddressHistory(hash, 0, 10, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 5U);
+    BOOST_CHECK(db.ReadBestBlock(hashBlock) && hashBlock == uint256(101));
+
+    // disconnecting block 3 restores 2:0, whose entry never reached the disk
+    mapUnspent.clear();
+    mapUnspent[CAddressUnspentKey(hash, 2, 0)] = CAddressUnspentValue(COIN, script, 2);
+    db.UpdateBlock(vHistory, true, mapUnspent, 102);
+    BOOST_CHECK(db.Flush());
+    BOOST_CHECK(db.ReadBestBlock(hashBlock) && hashBlock == uint256(102));
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspent(hash, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressHistory(hash, 0, 10, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 4U);
+
+    // an unflushed disconnect of a written block erases its entries, and
+    // ClearCache goes back to what is written
+    vHistory.clear();
+    mapUnspent.clear();
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 2, 2, 0, true), -COIN));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(hash, 2, 2, 0, false), COIN));
+    mapUnspent[CAddressUnspentKey(hash, 1, 0)] = CAddressUnspentValue(COIN, script, 1);
+    mapUnspent[CAddressUnspentKey(hash, 2, 0)].SetNull();
+    db.UpdateBlock(vHistory, true, mapUnspent, 101);
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressHistory(hash, 0, 10, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 2U);
+    db.ClearCache();
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressHistory(hash, 0, 10, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 4U);
+}
+
+// A block connected only to a private view, with its own index entry
+struct CTestBlock
+{
+    CBlock block;
+    uint256 hash;
+    CBlockIndex index;
+
+    CTestBlock(const CBlock &blockIn, CBlockIndex *pprev) : block(blockIn), hash(block.GetHash()), index(block)
+    {
+        index.phashBlock = &hash;
+        index.pprev = pprev;
+        index.nHeight = pprev->nHeight + 1;
+    }
+};
+
+// The nonces were searched for offline: the blocks have to pass CheckBlock's
+// proof of work check inside ConnectBlock
+static CBlock CreateBlock(const uint256 &hashPrev, unsigned int nTime, unsigned int nNonce,
+                          const CScript &scriptSig, const CTransaction &tx)
+{
+    CBlock block;
+    block.vtx.resize(1);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].scriptSig = scriptSig;
+    block.vtx[0].vout.push_back(CTxOut(52 * COIN, CScript() << OP_4));
+    block.vtx.push_back(tx);
+    block.hashPrevBlock = hashPrev;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.nTime = nTime;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = nNonce;
+    return block;
+}
+
+static CTransaction CreateSpend(const uint256 &hashPrev, unsigned int n)
+{
+    CTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(hashPrev, n)));
+    return tx;
+}
+
+static Array CallAddressRPC(const std::string &strMethod, const std::string &strScript)
+{
+    Array params;
+    params.push_back(strScript);
+    if (strMethod == "getaddresshistory") {
+        params.push_back(0);
+        params.push_back(10);
+    }
+    return tableRPC[strMethod]->actor(params, false).get_array();
+}
+
+// Number of entries and their total amount in satoshis
+static std::pair<int, int64> SumAddressRPC(const std::string &strMethod, const std::string &strScript)
+{
+    Array result = CallAddressRPC(strMethod, strScript);
+    int64 nTotal = 0;
+    BOOST_FOREACH(const Value &entry, result)
+        nTotal += roundint64(find_value(entry.get_obj(), "amount").get_real() * COIN);
+    return std::make_pair((int)result.size(), nTotal);
+}
+
+static void CheckAddress(const std::string &strScript, int nHistory, int64 nHistoryTotal, int nUnspent, int64 nUnspentTotal)
+{
+    std::pair<int, int64> history = SumAddressRPC("getaddresshistory", strScript);
+    BOOST_CHECK_EQUAL(history.first, nHistory);
+    BOOST_CHECK_EQUAL(history.second, nHistoryTotal);
+    std::pair<int, int64> unspent = SumAddressRPC("getaddressutxos", strScript);
+    BOOST_CHECK_EQUAL(unspent.first, nUnspent);
+    BOOST_CHECK_EQUAL(unspent.second, nUnspentTotal);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_connect_disconnect)
+{
+    fAddressIndex = true;
+    paddressindex = new CAddressIndexDB(1 << 20, true);
+
+    // Scripts anyone can spend, named by their hex for the RPCs
+    const std::string strA = "51", strB = "52", strC = "53", strMiner = "54";
+    CScript scriptA = CScript() << OP_1, scriptB = CScript() << OP_2, scriptC = CScript() << OP_3;
+
+    // The blocks are connected to a view on top of the genesis block that is
+    // never flushed, so the chain of the other tests is left alone. A coin of
+    // A that is not in any block funds them.
+    CCoinsViewCache view(*pcoinsTip, true);
+    view.SetBestBlock(pindexGenesisBlock);
+    uint256 hashFund = 1;
+    CCoins coinsFund;
+    coinsFund.nVersion = 1;
+    coinsFund.nHeight = 1;
+    coinsFund.vout.push_back(CTxOut(10 * COIN, scriptA));
+    BOOST_CHECK(view.SetCoins(hashFund, coinsFund));
+
+    // block 1 pays 6 to B and 4 back to A
+    CTransaction tx1 = CreateSpend(hashFund, 0);
+    tx1.vout.push_back(CTxOut(6 * COIN, scriptB));
+    tx1.vout.push_back(CTxOut(4 * COIN, scriptA));
+    CTestBlock block1(CreateBlock(hashGenesisBlock, 1691057300, 1536487, CScript() << OP_1 << OP_1, tx1), pindexGenesisBlock);
+
+    // block 2 moves the output of B to C; block 2b, which replaces it, moves it to A
+    CTransaction tx2 = CreateSpend(tx1.GetHash(), 0);
+    tx2.vout.push_back(CTxOut(6 * COIN, scriptC));
+    CTestBlock block2(CreateBlock(block1.hash, 1691057301, 686194, CScript() << OP_2 << OP_1, tx2), &block1.index);
+    CTransaction tx2b = CreateSpend(tx1.GetHash(), 0);
+    tx2b.vout.push_back(CTxOut(6 * COIN, scriptA));
+    CTestBlock block2b(CreateBlock(block1.hash, 1691057302, 728970, CScript() << OP_2 << OP_2, tx2b), &block1.index);
+
+    CValidationState state;
+    BOOST_CHECK(block1.block.ConnectBlock(state, &block1.index, view));
+    CheckAddress(strA, 2, -6 * COIN, 1, 4 * COIN);
+    CheckAddress(strB, 1, 6 * COIN, 1, 6 * COIN);
+    CheckAddress(strC, 0, 0, 0, 0);
+    CheckAddress(strMiner, 1, 52 * COIN, 1, 52 * COIN);
+
+    BOOST_CHECK(block2.block.ConnectBlock(state, &block2.index, view));
+    CheckAddress(strB, 2, 0, 0, 0);
+    CheckAddress(strC, 1, 6 * COIN, 1, 6 * COIN);
+    CheckAddress(strMiner, 2, 104 * COIN, 2, 104 * COIN);
+
+    Array utxos = CallAddressRPC("getaddressutxos", strC);
+    BOOST_CHECK_EQUAL(find_value(utxos[0].get_obj(), "txid").get_str(), tx2.GetHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(utxos[0].get_obj(), "height").get_int(), 2);
+
+    // reorganize to block 2b
+    BOOST_CHECK(block2.block.DisconnectBlock(state, &block2.index, view));
+    CheckAddress(strB, 1, 6 * COIN, 1, 6 * COIN);
+    CheckAddress(strC, 0, 0, 0, 0);
+    CheckAddress(strMiner, 1, 52 * COIN, 1, 52 * COIN);
+
+    BOOST_CHECK(block2b.block.ConnectBlock(state, &block2b.index, view));
+    CheckAddress(strA, 3, 0, 2, 10 * COIN);
+    CheckAddress(strB, 2, 0, 0, 0);
+    CheckAddress(strC, 0, 0, 0, 0);
+    CheckAddress(strMiner, 2, 104 * COIN, 2, 104 * COIN);
+
+    Array history = CallAddressRPC("getaddresshistory", strB);
+    BOOST_CHECK_EQUAL(find_value(history[1].get_obj(), "txid").get_str(), tx2b.GetHash().GetHex());
+    BOOST_CHECK(find_value(history[1].get_obj(), "spending").get_bool());
+    BOOST_CHECK_EQUAL(find_value(history[1].get_obj(), "height").get_int(), 2);
+
+    // back to the genesis block: only the funding coin is left
+    BOOST_CHECK(block2b.block.DisconnectBlock(state, &block2b.index, view));
+    BOOST_CHECK(block1.block.DisconnectBlock(state, &block1.index, view));
+    CheckAddress(strA, 0, 0, 1, 10 * COIN);
+    CheckAddress(strB, 0, 0, 0, 0);
+    CheckAddress(strMiner, 0, 0, 0, 0);
+    utxos = CallAddressRPC("getaddressutxos", strA);
+    BOOST_CHECK_EQUAL(find_value(utxos[0].get_obj(), "txid").get_str(), hashFund.GetHex());
+
+    delete paddressindex;
+    paddressindex = NULL;
+    fAddressIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,154 @@
+#include <boost/test/unit_test.hpp>
+
+#include "coinselection.h"
+#include "main.h"
+#include "wallet.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(coinselection_tests)
+
+static vector<CSelectionCandidate> MakeCandidates(const int64* pValues, unsigned int nCount)
+{
+    vector<CSelectionCandidate> vCandidates;
+    for (unsigned int i = 0; i < nCount; i++)
+        vCandidates.push_back(CSelectionCandidate(NULL, i, pValues[i], 0, 0));
+    sort(vCandidates.begin(), vCandidates.end());
+    return vCandidates;
+}
+
+static unsigned int CountSelected(const vector<char>& vfSelected)
+{
+    unsigned int nCount = 0;
+    for (unsigned int i = 0; i < vfSelected.size(); i++)
+        if (vfSelected[i])
+            nCount++;
+    return nCount;
+}
+
+// Spends the selected outputs of a simulated payment and adds its change
+// output, as CreateTransaction does: the excess of a branch-and-bound
+// selection goes to the fee.
+static void SpendSelected(CWallet& wallet, vector<COutput>& vCoins, const set<pair<const CWalletTx*,unsigned int> >& setCoins,
+                          int64 nChange, bool fUsedBnB, int64 nCostOfChange, unsigned int& nLockTime)
+{
+    for (unsigned int j = 0; j < vCoins.size(); )
+    {
+        if (setCoins.count(make_pair(vCoins[j].tx, (unsigned int)vCoins[j].i)))
+        {
+            delete vCoins[j].tx;
+            vCoins[j] = vCoins.back();
+            vCoins.pop_back();
+        }
+        else
+            j++;
+    }
+
+    if (nChange <= 0 || (fUsedBnB && nChange <= nCostOfChange))
+        return;
+    CTransaction tx;
+    tx.nLockTime = nLockTime++;
+    tx.vout.push_back(CTxOut(nChange, CScript()));
+    vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6*24));
+}
+
+BOOST_AUTO_TEST_CASE(bnb_search)
+{
+    const int64 values[] = { 1*CENT, 2*CENT, 3*CENT, 4*CENT, 5*CENT };
+    vector<CSelectionCandidate> vCandidates = MakeCandidates(values, 5);
+    vector<char> vfSelected;
+    int64 nValue;
+
+    // exact match; large outputs are tried first, so 5+4+1
+    BOOST_CHECK(SelectCoinsBnB(vCandidates, 10*CENT, 0, vfSelected, nValue));
+    BOOST_CHECK_EQUAL(nValue, 10*CENT);
+    BOOST_CHECK_EQUAL(CountSelected(vfSelected), 3U);
+
+    // no subset hits the target exactly, and there is no window
+    BOOST_CHECK(!SelectCoinsBnB(vCandidates, 10*CENT + 1, 0, vfSelected, nValue));
+    BOOST_CHECK_EQUAL(CountSelected(vfSelected), 0U);
+
+    // with a window the smallest excess wins
+    BOOST_CHECK(SelectCoinsBnB(vCandidates, 10*CENT - CENT/2, CENT, vfSelected, nValue));
+    BOOST_CHECK_EQUAL(nValue, 10*CENT);
+
+    // not enough funds at all
+    BOOST_CHECK(!SelectCoinsBnB(vCandidates, 16*CENT, CENT, vfSelected, nValue));
+
+    // out of tries before anything was found
+    BOOST_CHECK(!SelectCoinsBnB(vCandidates, 10*CENT, 0, vfSelected, nValue, 1));
+
+    // equal values are not re-tried, so an impossible target fails fast
+    vector<int64> vThrees(100, 3*COIN);
+    vCandidates = MakeCandidates(&vThrees[0], vThrees.size());
+    BOOST_CHECK(!SelectCoinsBnB(vCandidates, 100*COIN, 0, vfSelected, nValue, 10000));
+    BOOST_CHECK(SelectCoinsBnB(vCandidates, 99*COIN, 0, vfSelected, nValue));
+    BOOST_CHECK_EQUAL(CountSelected(vfSelected), 33U);
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_simulation)
+{
+    // Replay a payment trace against a simulated wallet. The trace comes from
+    // the deterministic insecure_rand; it is drawn up front because the
+    // knapsack reseeds the generator. bench_duckbucks times the same replay.
+    CWallet wallet;
+    vector<COutput> vCoins;
+    seed_insecure_rand(true);
+    vector<int64> vTrace;
+    vector<char> vfDeposit;
+    for (int i = 0; i < 1000; i++)
+    {
+        vTrace.push_back((1 + insecure_rand() % 2000) * (COIN / 1000));
+        vfDeposit.push_back(insecure_rand() % 3 == 0);
+    }
+
+    int64 nFeeRate = max(nTransactionFee, CTransaction::nMinTxFee);
+    int64 nCostOfChange = nFeeRate * (COIN_SELECTION_INPUT_SIZE + COIN_SELECTION_OUTPUT_SIZE) / 1000;
+    unsigned int nLockTime = 0;
+
+    for (int i = 0; i < 700; i++)
+    {
+        if (vCoins.size() < 10 || vfDeposit[i])
+        {
+            CTransaction tx;
+            tx.nLockTime = nLockTime++;
+            tx.vout.push_back(CTxOut(vTrace[i], CScript()));
+            vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6*24));
+            continue;
+        }
+
+        int64 nTarget = vTrace[i] + CTransaction::nMinTxFee;
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        int64 nValueIn = 0;
+        bool fUsedBnB;
+        if (!wallet.SelectCoinsByTier(nTarget, vCoins, setCoins, nValueIn, &fUsedBnB))
+            continue;
+        BOOST_CHECK(nValueIn >= nTarget);
+        SpendSelected(wallet, vCoins, setCoins, nValueIn - nTarget, fUsedBnB, nCostOfChange, nLockTime);
+    }
+
+    // the rest of the trace is payments only
+    int nPayments = 0;
+    unsigned int nStartSize = vCoins.size();
+    for (int i = 0; i < 300; i++)
+    {
+        int64 nTarget = vTrace[700 + i] + CTransaction::nMinTxFee;
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        int64 nValueIn = 0;
+        bool fUsedBnB;
+        if (!wallet.SelectCoinsByTier(nTarget, vCoins, setCoins, nValueIn, &fUsedBnB))
+            continue;
+        BOOST_CHECK(nValueIn >= nTarget);
+        nPayments++;
+        SpendSelected(wallet, vCoins, setCoins, nValueIn - nTarget, fUsedBnB, nCostOfChange, nLockTime);
+    }
+
+    BOOST_CHECK(nPayments > 0);
+    // without deposits, payments can only consume outputs: each adds at most one change output
+    BOOST_CHECK(vCoins.size() <= nStartSize);
+
+    BOOST_FOREACH(COutput& output, vCoins)
+        delete output.tx;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
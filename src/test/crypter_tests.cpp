@@ -0,0 +1,51 @@
+#include <boost/test/unit_test.hpp>
+
+#include "crypter.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(crypter_tests)
+
+BOOST_AUTO_TEST_CASE(crypter_scrypt)
+{
+    SecureString strPassphrase("duckbucks");
+    CMasterKey kMasterKey;
+    for (unsigned int i = 0; i < WALLET_CRYPTO_SALT_SIZE; i++)
+        kMasterKey.vchSalt.push_back(i);
+    kMasterKey.SetScrypt(10, 8, 1);
+
+    // key and IV are the first 48 bytes of scrypt(passphrase, salt, 2^10, 8, 1)
+    string strPlaintext = "wallet master key 32 bytes long!";
+    CKeyingMaterial vchPlaintext(strPlaintext.begin(), strPlaintext.end());
+    vector<unsigned char> vchCiphertext;
+    CCrypter crypter;
+    BOOST_CHECK(crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    BOOST_CHECK(crypter.Encrypt(vchPlaintext, vchCiphertext));
+    BOOST_CHECK_EQUAL(HexStr(vchCiphertext), "0fab6014c944ada5750ee3246946f5e3406cd5c0d1ee68cd0abadc89facd9383a01b90037c19558364c7165836207419");
+
+    CKeyingMaterial vchDecrypted;
+    BOOST_CHECK(crypter.Decrypt(vchCiphertext, vchDecrypted));
+    BOOST_CHECK(vchDecrypted == vchPlaintext);
+
+    // the wrong passphrase, or other cost parameters, give another key
+    CCrypter crypterWrong;
+    BOOST_CHECK(crypterWrong.SetKeyFromPassphrase(SecureString("duckbuck"), kMasterKey));
+    vector<unsigned char> vchOther;
+    BOOST_CHECK(crypterWrong.Encrypt(vchPlaintext, vchOther));
+    BOOST_CHECK(vchOther != vchCiphertext);
+    kMasterKey.SetScrypt(11, 8, 1);
+    BOOST_CHECK(crypterWrong.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    BOOST_CHECK(crypterWrong.Encrypt(vchPlaintext, vchOther));
+    BOOST_CHECK(vchOther != vchCiphertext);
+
+    // malformed or excessive parameters are refused
+    kMasterKey.vchOtherDerivationParameters.resize(2);
+    BOOST_CHECK(!crypterWrong.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    kMasterKey.SetScrypt(WALLET_CRYPTO_SCRYPT_MAX_LOGN + 1, 8, 1);
+    BOOST_CHECK(!crypterWrong.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    kMasterKey.SetScrypt(10, 0, 1);
+    BOOST_CHECK(!crypterWrong.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -138,4 +138,43 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(bip32_test_vector1)
+{
+    // BIP32 test vector 1, chain m/0'/1
+    std::vector<unsigned char> vchSeed = ParseHex("000102030405060708090a0b0c0d0e0f");
+    CExtKey master;
+    master.SetMaster(&vchSeed[0], vchSeed.size());
+    BOOST_CHECK(HexStr(master.vchChainCode, master.vchChainCode + 32) == "873dff81c02f525623fd1fe5167eac3a55a049de3d314bb42ee227ffed37d508");
+    BOOST_CHECK(HexStr(master.key.begin(), master.key.end()) == "e8f32e723decf4051aefac8e2c93c9c5b214313817cdb01a1494b917c8436b35");
+
+    CExtKey account;
+    BOOST_CHECK(master.Derive(account, 0 | BIP32_HARDENED));
+    BOOST_CHECK(HexStr(account.vchChainCode, account.vchChainCode + 32) == "47fdacbd0f1097043b78c63c20c34ef4ed9a111d980047ad16282c7ae6236141");
+    BOOST_CHECK(HexStr(account.key.begin(), account.key.end()) == "edb2e14f9ee77d26dd93b4ecede8d16ed408ce149b6cd80b0715a2d911a0afea");
+    CPubKey pubkeyAccount = account.key.GetPubKey();
+    BOOST_CHECK(HexStr(pubkeyAccount.begin(), pubkeyAccount.end()) == "035a784662a4a20a65bf6aab9ae98a6c068a81c52e4b032c0fb5400c706cfccc56");
+
+    CExtKey child;
+    BOOST_CHECK(account.Derive(child, 1));
+    BOOST_CHECK(HexStr(child.vchChainCode, child.vchChainCode + 32) == "2a7857631386ba23dacac34180dd1983734e444fdbf774041578e9b6adb37c19");
+    BOOST_CHECK(HexStr(child.key.begin(), child.key.end()) == "3c6cb8d0f6a264c91ea8b5030fadaa8e538b020f0a387421a12de9319dc93368");
+
+    // public derivation reaches the same child
+    CExtPubKey extpubChild;
+    BOOST_CHECK(account.Neuter().Derive(extpubChild, 1));
+    BOOST_CHECK(extpubChild == child.Neuter());
+    BOOST_CHECK(HexStr(extpubChild.pubkey.begin(), extpubChild.pubkey.end()) == "03501e454bf00751f24b1b489aa925215d66af2234e3891c3b21a52bedb3cd711c");
+
+    // encoding round trip
+    unsigned char code[BIP32_EXTKEY_SIZE];
+    child.Encode(code);
+    CExtKey decoded;
+    BOOST_CHECK(decoded.Decode(code));
+    BOOST_CHECK(decoded == child);
+    extpubChild.Encode(code);
+    CExtPubKey decodedPub;
+    BOOST_CHECK(decodedPub.Decode(code));
+    BOOST_CHECK(decodedPub == extpubChild);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
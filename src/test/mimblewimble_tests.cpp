@@ -0,0 +1,985 @@
+#include <boost/test/unit_test.hpp>
+
+#include "hash.h"
+#include "main.h"
+#include "mimblewimble.h"
+#include "mimblewimble_coins.h"
+#include "mimblewimble_keychain.h"
+#include "mimblewimble_mmr.h"
+#include "mimblewimble_pool.h"
+#include "mimblewimble_sync.h"
+#include "mimblewimble_verify.h"
+#include "net.h"
+#include "util.h"
+
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <new>
+#include <unordered_map>
+
+using namespace std;
+using namespace mw;
+
+// heap allocations, counted for the MW deserialization test
+static std::atomic<long> nHeapAllocations(0);
+
+void* operator new(size_t n)
+{
+    nHeapAllocations++;
+    void* p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+BOOST_AUTO_TEST_SUITE(mimblewimble_tests)
+
+BOOST_AUTO_TEST_CASE(pedersen_commitment)
+{
+    // with a zero blinding factor, a commitment to 1 is H itself
+    unsigned char zero[BLINDING_FACTOR_SIZE] = {0};
+    unsigned char commit[PEDERSEN_COMMITMENT_SIZE];
+    BOOST_CHECK(PedersenCommit(commit, 1, zero));
+    BOOST_CHECK_EQUAL(HexStr(commit, commit + sizeof(commit)), "0250929b74c1a04954b78b4b6035e97a5e078a5a0f28ec96d547bfee9ace803ac0");
+    BOOST_CHECK(IsValidCommitment(commit));
+
+    // commit(5, r1) + commit(7, r2) == commit(12, r1 + r2)
+    unsigned char r1[BLINDING_FACTOR_SIZE], r2[BLINDING_FACTOR_SIZE], r3[BLINDING_FACTOR_SIZE];
+    unsigned char c1[PEDERSEN_COMMITMENT_SIZE], c2[PEDERSEN_COMMITMENT_SIZE], c3[PEDERSEN_COMMITMENT_SIZE], sum[PEDERSEN_COMMITMENT_SIZE];
+    RandomBlindingFactor(r1);
+    RandomBlindingFactor(r2);
+    BOOST_CHECK(AddBlindingFactors(r3, r1, r2));
+    BOOST_CHECK(PedersenCommit(c1, 5, r1));
+    BOOST_CHECK(PedersenCommit(c2, 7, r2));
+    BOOST_CHECK(PedersenCommit(c3, 12, r3));
+    vector<const unsigned char*> vPositive, vNegative;
+    vPositive.push_back(c1);
+    vPositive.push_back(c2);
+    BOOST_CHECK(PedersenCommitSum(sum, vPositive, vNegative));
+    BOOST_CHECK(memcmp(sum, c3, sizeof(sum)) == 0);
+
+    // ... and commit(12, r1 + r2) - commit(7, r2) == commit(5, r1)
+    vPositive.assign(1, c3);
+    vNegative.assign(1, c2);
+    BOOST_CHECK(PedersenCommitSum(sum, vPositive, vNegative));
+    BOOST_CHECK(memcmp(sum, c1, sizeof(sum)) == 0);
+    // a sum that cancels out is the point at infinity, which is no commitment
+    vNegative.assign(1, c3);
+    BOOST_CHECK(!PedersenCommitSum(sum, vPositive, vNegative));
+
+    // blinding factors at or above the group order are refused
+    unsigned char high[BLINDING_FACTOR_SIZE];
+    memset(high, 0xff, sizeof(high));
+    BOOST_CHECK(!IsValidBlindingFactor(high));
+    BOOST_CHECK(!PedersenCommit(commit, 1, high));
+    commit[0] = 0x04;
+    BOOST_CHECK(!IsValidCommitment(commit));
+}
+
+BOOST_AUTO_TEST_CASE(bulletproof_prove_verify)
+{
+    uint64 values[] = { 0, 1, 1000000, ~(uint64)0 };
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        unsigned char blind[BLINDING_FACTOR_SIZE], commit[PEDERSEN_COMMITMENT_SIZE];
+        RandomBlindingFactor(blind);
+        BOOST_CHECK(PedersenCommit(commit, values[i], blind));
+        unsigned char proof[BULLETPROOF_SIZE];
+        BOOST_CHECK(BulletproofProve(proof, values[i], blind));
+        BOOST_CHECK(BulletproofVerify(commit, proof));
+
+        // the proof is for this commitment only
+        unsigned char other[PEDERSEN_COMMITMENT_SIZE];
+        BOOST_CHECK(PedersenCommit(other, values[i] + 1, blind));
+        BOOST_CHECK(!BulletproofVerify(other, proof));
+
+        // and any change to it is caught
+        for (unsigned int nByte = 0; nByte < BULLETPROOF_SIZE; nByte += 97)
+        {
+            unsigned char bad[BULLETPROOF_SIZE];
+            memcpy(bad, proof, sizeof(bad));
+            bad[nByte] ^= 0x01;
+            BOOST_CHECK(!BulletproofVerify(commit, bad));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bulletproof_batch)
+{
+    static const unsigned int nDistinct = 16;
+    vector<vector<unsigned char> > vCommits, vProofs;
+    for (unsigned int i = 0; i < nDistinct; i++)
+    {
+        unsigned char blind[BLINDING_FACTOR_SIZE], commit[PEDERSEN_COMMITMENT_SIZE];
+        RandomBlindingFactor(blind);
+        uint64 nValue = (uint64)i * 100000000 + i;
+        BOOST_CHECK(PedersenCommit(commit, nValue, blind));
+        vector<unsigned char> vchProof(BULLETPROOF_SIZE);
+        BOOST_CHECK(BulletproofProve(&vchProof[0], nValue, blind));
+        vCommits.push_back(vector<unsigned char>(commit, commit + sizeof(commit)));
+        vProofs.push_back(vchProof);
+    }
+
+    CBulletproofBatch batch;
+    BOOST_CHECK(batch.Verify());
+    for (unsigned int i = 0; i < nDistinct; i++)
+        batch.Add(&vCommits[i][0], &vProofs[i][0]);
+    BOOST_CHECK_EQUAL(batch.size(), nDistinct);
+    BOOST_CHECK(batch.Verify());
+
+    // one bad proof, or a proof against the wrong commitment, fails the batch
+    vector<unsigned char> vchBad(vProofs[5]);
+    vchBad[BULLETPROOF_SIZE - 1] ^= 0x01;
+    batch.Add(&vCommits[4][0], &vchBad[0]);
+    BOOST_CHECK(!batch.Verify());
+    batch.clear();
+    for (unsigned int i = 0; i < nDistinct; i++)
+        batch.Add(&vCommits[i][0], &vProofs[(i + 1) % nDistinct][0]);
+    BOOST_CHECK(!batch.Verify());
+
+    // batches larger than the distinct proofs, as a block with repeats
+    unsigned int vnBatch[] = { 64, 256, 1024 };
+    for (unsigned int n = 0; n < sizeof(vnBatch) / sizeof(vnBatch[0]); n++)
+    {
+        batch.clear();
+        for (unsigned int i = 0; i < vnBatch[n]; i++)
+            batch.Add(&vCommits[i % nDistinct][0], &vProofs[i % nDistinct][0]);
+        BOOST_CHECK(batch.Verify());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mw_value_types)
+{
+    // fixed-size fields serialize as their bytes alone
+    BlindingFactor blind = BlindingFactor::Random();
+    Output output = createOutput(5 * COIN, blind);
+    BOOST_CHECK(output.commitment.IsValid());
+    BOOST_CHECK(output.Verify());
+    BOOST_CHECK_EQUAL(::GetSerializeSize(output.commitment, SER_NETWORK, PROTOCOL_VERSION), PEDERSEN_COMMITMENT_SIZE);
+    BOOST_CHECK_EQUAL(::GetSerializeSize(output, SER_NETWORK, PROTOCOL_VERSION), PEDERSEN_COMMITMENT_SIZE + BULLETPROOF_SIZE);
+    BOOST_CHECK_EQUAL(::GetSerializeSize(Kernel(), SER_NETWORK, PROTOCOL_VERSION), 8 + 4 + PEDERSEN_COMMITMENT_SIZE + KERNEL_SIGNATURE_SIZE);
+    BOOST_CHECK(output.commitment.GetHash() == SerializeHash(output.commitment));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << output;
+    Output output2;
+    ss >> output2;
+    BOOST_CHECK(output2.commitment == output.commitment);
+    BOOST_CHECK(output2.GetHash() == output.GetHash());
+
+    // cached hashes hold until MarkDirty()
+    uint256 hash = output2.GetHash();
+    output2.commitment = createCommitment(6 * COIN, blind);
+    BOOST_CHECK(output2.GetHash() == hash);
+    output2.MarkDirty();
+    BOOST_CHECK(output2.GetHash() != hash);
+    BOOST_CHECK(output2.GetHash() == SerializeHash(output2));
+    BOOST_CHECK(!output2.Verify());
+
+    // commitment-keyed hash map
+    unordered_map<Commitment, int, CommitmentHasher> mapCommitments;
+    mapCommitments[output.commitment] = 1;
+    mapCommitments[output2.commitment] = 2;
+    BOOST_CHECK_EQUAL(mapCommitments.size(), 2U);
+    BOOST_CHECK_EQUAL(mapCommitments[output.commitment], 1);
+    BOOST_CHECK(mapCommitments.count(Commitment()) == 0);
+}
+
+// pick an offset and sign the kernel of tx so that it balances, given the
+// blinding factors of its outputs and inputs
+static void MWSignTx(Transaction &tx, const vector<BlindingFactor> &vOutBlinds, const vector<BlindingFactor> &vInBlinds)
+{
+    tx.offset = BlindingFactor::Random();
+    BlindingFactor excess;
+    for (unsigned int i = 0; i < vOutBlinds.size(); i++)
+        excess += vOutBlinds[i];
+    for (unsigned int i = 0; i < vInBlinds.size(); i++)
+        excess -= vInBlinds[i];
+    excess -= tx.offset;
+    BOOST_CHECK(tx.kernels[0].Sign(excess));
+    tx.MarkDirty();
+}
+
+// a signed transaction spending nValue in two outputs and the fee
+static Transaction MWSignedTx(int64 nValue, int64 nFee)
+{
+    vector<Output> vInputs, vOutputs;
+    vector<BlindingFactor> vInBlinds(1, BlindingFactor::Random()), vOutBlinds;
+    vInputs.push_back(createOutput(nValue, vInBlinds[0]));
+    for (unsigned int i = 0; i < 2; i++) {
+        vOutBlinds.push_back(BlindingFactor::Random());
+        vOutputs.push_back(createOutput(i ? nValue - nFee - nValue / 3 : nValue / 3, vOutBlinds[i]));
+    }
+    Transaction tx = Transaction::BuildTransaction(vInputs, vOutputs, nFee, 0);
+    MWSignTx(tx, vOutBlinds, vInBlinds);
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(mw_kernel_signature)
+{
+    BlindingFactor blind = BlindingFactor::Random();
+    Kernel kernel;
+    kernel.nFee = 3;
+    BOOST_CHECK(!kernel.Verify());
+    BOOST_CHECK(kernel.Sign(blind));
+    BOOST_CHECK(kernel.excess == createCommitment(0, blind));
+    BOOST_CHECK(kernel.Verify());
+
+    // the signature covers the fee and the lock height
+    Kernel kernel2 = kernel;
+    kernel2.nFee = 4;
+    BOOST_CHECK(!kernel2.Verify());
+    kernel2 = kernel;
+    kernel2.nLockHeight = 1;
+    BOOST_CHECK(!kernel2.Verify());
+    kernel2 = kernel;
+    kernel2.signature[40] ^= 1;
+    BOOST_CHECK(!kernel2.Verify());
+    kernel2 = kernel;
+    kernel2.excess = createCommitment(0, BlindingFactor::Random());
+    BOOST_CHECK(!kernel2.Verify());
+    BOOST_CHECK(!kernel2.Sign(BlindingFactor()));
+
+    // a batch passes if all do, and fails for one bad signature
+    vector<Kernel> vKernels(200);
+    for (unsigned int i = 0; i < vKernels.size(); i++) {
+        vKernels[i].nFee = i;
+        BOOST_CHECK(vKernels[i].Sign(BlindingFactor::Random()));
+    }
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        BOOST_CHECK(vKernels[i].Verify());
+    CSchnorrBatch batch;
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        BOOST_CHECK(vKernels[i].Verify(&batch));
+    BOOST_CHECK(batch.Verify());
+    vKernels[150].nFee++;
+    batch.clear();
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        vKernels[i].Verify(&batch);
+    BOOST_CHECK(!batch.Verify());
+}
+
+BOOST_AUTO_TEST_CASE(mw_balance)
+{
+    // commit(5, r1) + commit(7, r2) == 12*H + (r1 + r2)*G
+    unsigned char r1[BLINDING_FACTOR_SIZE], r2[BLINDING_FACTOR_SIZE], r3[BLINDING_FACTOR_SIZE];
+    unsigned char c1[PEDERSEN_COMMITMENT_SIZE], c2[PEDERSEN_COMMITMENT_SIZE];
+    RandomBlindingFactor(r1);
+    RandomBlindingFactor(r2);
+    BOOST_CHECK(PedersenCommit(c1, 5, r1));
+    BOOST_CHECK(PedersenCommit(c2, 7, r2));
+    vector<const unsigned char*> vPositive, vNegative;
+    vPositive.push_back(c1);
+    vPositive.push_back(c2);
+    BOOST_CHECK(AddBlindingFactors(r3, r1, r2));
+    BOOST_CHECK(PedersenCommitBalance(vPositive, vNegative, 12, r3));
+    BOOST_CHECK(!PedersenCommitBalance(vPositive, vNegative, 11, r3));
+    // commit(5, r1) - commit(7, r2) == -2*H + (r1 - r2)*G
+    vPositive.pop_back();
+    vNegative.push_back(c2);
+    BOOST_CHECK(SubtractBlindingFactors(r3, r1, r2));
+    BOOST_CHECK(PedersenCommitBalance(vPositive, vNegative, -2, r3));
+    BOOST_CHECK(!PedersenCommitBalance(vPositive, vNegative, 2, r3));
+
+    // a transaction balances only with the fee and offset it was signed with
+    Transaction tx = MWSignedTx(10 * COIN, COIN / 100);
+    BOOST_CHECK(tx.VerifyBalance());
+    BOOST_CHECK(tx.Verify());
+    Transaction tx2 = tx;
+    tx2.offset = BlindingFactor::Random();
+    tx2.MarkDirty();
+    BOOST_CHECK(!tx2.VerifyBalance());
+    tx2 = tx;
+    tx2.kernels[0].nFee = COIN / 50;
+    tx2.kernels[0].MarkDirty();
+    tx2.MarkDirty();
+    BOOST_CHECK(!tx2.VerifyBalance());
+    BOOST_CHECK(!tx2.Verify());
+
+    // so does an aggregate of transactions
+    Transaction tx3 = MWSignedTx(5 * COIN, 7);
+    Transaction agg = tx;
+    agg.vin.insert(agg.vin.end(), tx3.vin.begin(), tx3.vin.end());
+    agg.vout.insert(agg.vout.end(), tx3.vout.begin(), tx3.vout.end());
+    agg.kernels.insert(agg.kernels.end(), tx3.kernels.begin(), tx3.kernels.end());
+    agg.offset += tx3.offset;
+    agg.MarkDirty();
+    BOOST_CHECK(agg.Verify());
+}
+
+BOOST_AUTO_TEST_CASE(mw_transaction_serialize)
+{
+    // a two-output transaction, deserialized and verified repeatedly
+    Transaction tx = MWSignedTx(10 * COIN, COIN / 100);
+    BOOST_CHECK(tx.Verify());
+
+    static const unsigned int nTx = 256;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    for (unsigned int i = 0; i < nTx; i++)
+        ss << tx;
+    vector<Transaction> vtx(nTx);
+
+    // with fixed-size fields the only allocations are the three vectors of each transaction
+    long nAllocationsStart = nHeapAllocations;
+    for (unsigned int i = 0; i < nTx; i++)
+        ss >> vtx[i];
+    long nAllocations = nHeapAllocations - nAllocationsStart;
+    BOOST_CHECK(nAllocations <= 3 * (long)nTx);
+    for (unsigned int i = 0; i < nTx; i++)
+        BOOST_CHECK(vtx[i].GetHash() == tx.GetHash());
+
+    // verify all range proofs of the transactions in one batch
+    CBulletproofBatch batch;
+    batch.reserve(nTx * tx.vout.size());
+    for (unsigned int i = 0; i < nTx; i++)
+        BOOST_CHECK(vtx[i].Verify(&batch));
+    BOOST_CHECK(batch.Verify());
+}
+
+// an output with a distinct commitment; the coins views do not look at the proof
+static Output MWTestOutput(unsigned int n)
+{
+    unsigned char p[PEDERSEN_COMMITMENT_SIZE] = {0x02};
+    memcpy(p + 1, &n, sizeof(n));
+    return Output(Commitment(p), RangeProof());
+}
+
+// counts the entries each flush pushes through to the base
+class CMWCoinsViewCounter : public CMWCoinsViewBacked
+{
+public:
+    unsigned int nWritten;
+    CMWCoinsViewCounter(CMWCoinsView &baseIn) : CMWCoinsViewBacked(baseIn), nWritten(0) {}
+    bool BatchWrite(const CMWCoinsMap &mapCoins, const uint256 &hashBlock)
+    {
+        for (CMWCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
+            if (it->second.nFlags & CMWCoinsCacheEntry::DIRTY)
+                nWritten++;
+        return base->BatchWrite(mapCoins, hashBlock);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(mw_coins_cut_through)
+{
+    CMWCoinsViewDB db(1 << 20, true);
+    CMWCoinsViewCounter counter(db);
+    Output a = MWTestOutput(1), b = MWTestOutput(2), c = MWTestOutput(3), d = MWTestOutput(4), e = MWTestOutput(5);
+
+    // b is created and spent in the same window: it never reaches the database
+    {
+        CMWCoinsViewCache cache(counter);
+        BOOST_CHECK(cache.AddCoin(a, 1));
+        BOOST_CHECK(cache.AddCoin(b, 1));
+        BOOST_CHECK(cache.AddCoin(c, 1));
+        BOOST_CHECK(!cache.AddCoin(c, 1));
+        BOOST_CHECK(cache.SpendCoin(b.commitment));
+        BOOST_CHECK(!cache.SpendCoin(b.commitment));
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+        BOOST_CHECK_EQUAL(cache.GetCutThroughCount(), 1U);
+        cache.SetBestBlock(1);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(counter.nWritten, 2U);
+    BOOST_CHECK(db.HaveCoin(a.commitment) && !db.HaveCoin(b.commitment) && db.HaveCoin(c.commitment));
+    BOOST_CHECK(db.GetBestBlock() == 1);
+    CMWCoin coin;
+    BOOST_CHECK(db.GetCoin(c.commitment, coin));
+    BOOST_CHECK(coin.output.GetHash() == c.GetHash());
+    BOOST_CHECK_EQUAL(coin.nHeight, 1);
+
+    // nested caches: e is created in the inner one and spent in the outer one
+    counter.nWritten = 0;
+    {
+        CMWCoinsViewCache cache(counter);
+        BOOST_CHECK(cache.GetBestBlock() == 1);
+        BOOST_CHECK(cache.SpendCoin(a.commitment));
+        BOOST_CHECK(!cache.HaveCoin(a.commitment));
+        BOOST_CHECK(cache.AddCoin(d, 2));
+        {
+            CMWCoinsView &outer = cache;
+            CMWCoinsViewCache inner(outer);
+            BOOST_CHECK(inner.HaveCoin(d.commitment));
+            BOOST_CHECK(inner.SpendCoin(d.commitment));
+            BOOST_CHECK(inner.AddCoin(e, 2));
+            inner.SetBestBlock(2);
+            BOOST_CHECK(inner.Flush());
+        }
+        BOOST_CHECK(!cache.HaveCoin(d.commitment));
+        BOOST_CHECK_EQUAL(cache.GetCutThroughCount(), 1U);
+        BOOST_CHECK(cache.SpendCoin(e.commitment));
+        BOOST_CHECK_EQUAL(cache.GetCutThroughCount(), 2U);
+        BOOST_CHECK(cache.Flush());
+    }
+    // only the spend of a reaches the database
+    BOOST_CHECK_EQUAL(counter.nWritten, 1U);
+    BOOST_CHECK(!db.HaveCoin(a.commitment) && db.HaveCoin(c.commitment));
+    BOOST_CHECK(!db.HaveCoin(d.commitment) && !db.HaveCoin(e.commitment));
+    BOOST_CHECK(db.GetBestBlock() == 2);
+
+    // transactions spend inputs and add outputs atomically
+    CMWCoinsViewCache cache(db);
+    Transaction tx;
+    tx.vin.push_back(Input(c.commitment));
+    tx.vout.push_back(a);
+    BOOST_CHECK(tx.HaveInputs(cache));
+    BOOST_CHECK(UpdateMWCoins(tx, cache, 3));
+    BOOST_CHECK(!tx.HaveInputs(cache));
+    BOOST_CHECK(!UpdateMWCoins(tx, cache, 3));
+    BOOST_CHECK(cache.HaveCoin(a.commitment) && !cache.HaveCoin(c.commitment));
+    Transaction tx2;
+    tx2.vin.push_back(Input(a.commitment));
+    tx2.vin.push_back(Input(a.commitment));
+    BOOST_CHECK(!tx2.HaveInputs(cache));
+    BOOST_CHECK(!UpdateMWCoins(tx2, cache, 3));
+    BOOST_CHECK(cache.HaveCoin(a.commitment));
+
+    // many coins in one cache
+    for (unsigned int i = 0; i < 10000; i++)
+        BOOST_CHECK(cache.AddCoin(MWTestOutput(100 + i), 3));
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < 10000; i++)
+        nFound += cache.HaveCoin(MWTestOutput(100 + i).commitment);
+    BOOST_CHECK_EQUAL(nFound, 10000U);
+}
+
+// a transaction from synthetic outputs; only CMWTxPool::accept() verifies
+static Transaction MWTestTx(unsigned int nIn, unsigned int nOut1, unsigned int nOut2, int64 nFee)
+{
+    Transaction tx;
+    tx.vin.push_back(Input(MWTestOutput(nIn).commitment));
+    tx.vout.push_back(MWTestOutput(nOut1));
+    if (nOut2)
+        tx.vout.push_back(MWTestOutput(nOut2));
+    Kernel kernel;
+    kernel.nFee = nFee;
+    tx.kernels.push_back(kernel);
+    tx.offset = BlindingFactor::Random();
+    return tx;
+}
+
+static bool MWHasInput(const Transaction &tx, unsigned int n)
+{
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        if (tx.vin[i].commitment == MWTestOutput(n).commitment)
+            return true;
+    return false;
+}
+
+static bool MWHasOutput(const Transaction &tx, unsigned int n)
+{
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        if (tx.vout[i].commitment == MWTestOutput(n).commitment)
+            return true;
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(mw_pool_aggregate)
+{
+    CMWTxPool pool;
+    Transaction agg;
+
+    // tx2 spends output 2 of tx1: the pair is cut through
+    Transaction tx1 = MWTestTx(1, 2, 3, 1), tx2 = MWTestTx(2, 4, 0, 2);
+    BlindingFactor offset = tx1.offset;
+    offset += tx2.offset;
+    pool.addUnchecked(tx1.GetHash(), tx1);
+    pool.addUnchecked(tx2.GetHash(), tx2);
+    pool.GetAggregate(agg);
+    BOOST_CHECK_EQUAL(agg.vin.size(), 1U);
+    BOOST_CHECK_EQUAL(agg.vout.size(), 2U);
+    BOOST_CHECK_EQUAL(agg.kernels.size(), 2U);
+    BOOST_CHECK(MWHasInput(agg, 1) && MWHasOutput(agg, 3) && MWHasOutput(agg, 4));
+    BOOST_CHECK(agg.offset.GetBytes() == offset.GetBytes());
+    BOOST_CHECK_EQUAL(pool.GetCutThroughCount(), 1U);
+
+    // without tx1, tx2 spends output 2 from the chain
+    pool.remove(tx1);
+    pool.GetAggregate(agg);
+    BOOST_CHECK_EQUAL(agg.vin.size(), 1U);
+    BOOST_CHECK_EQUAL(agg.vout.size(), 1U);
+    BOOST_CHECK_EQUAL(agg.kernels.size(), 1U);
+    BOOST_CHECK(MWHasInput(agg, 2) && MWHasOutput(agg, 4));
+    BOOST_CHECK(agg.offset.GetBytes() == tx2.offset.GetBytes());
+    BOOST_CHECK_EQUAL(pool.GetCutThroughCount(), 0U);
+
+    // removing tx1 recursively takes tx2 with it
+    pool.addUnchecked(tx1.GetHash(), tx1);
+    BOOST_CHECK_EQUAL(pool.GetCutThroughCount(), 1U);
+    pool.remove(tx1, true);
+    pool.GetAggregate(agg);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK(agg.vin.empty() && agg.vout.empty() && agg.kernels.empty());
+    BOOST_CHECK(agg.offset.GetBytes() == BlindingFactor().GetBytes());
+
+    // accept() checks inputs against the view and the pool
+    CMWCoinsViewDB db(1 << 20, true);
+    CMWCoinsViewCache view(db);
+    vector<BlindingFactor> vBlinds0(1, BlindingFactor::Random()), vBlinds3(1, BlindingFactor::Random()), vBlinds4(1, BlindingFactor::Random());
+    BOOST_CHECK(view.AddCoin(createOutput(5 * COIN, vBlinds0[0]), 1));
+    Transaction tx3;
+    tx3.vin.push_back(Input(createCommitment(5 * COIN, vBlinds0[0])));
+    tx3.vout.push_back(createOutput(5 * COIN, vBlinds3[0]));
+    tx3.kernels.push_back(Kernel());
+    // an unsigned kernel is refused
+    BOOST_CHECK(!pool.accept(tx3, &view));
+    MWSignTx(tx3, vBlinds3, vBlinds0);
+    BOOST_CHECK(pool.accept(tx3, &view));
+    BOOST_CHECK(!pool.accept(tx3, &view));
+    Transaction tx4 = tx3;
+    tx4.kernels[0].nFee = COIN;
+    tx4.vout[0] = createOutput(4 * COIN, vBlinds4[0]);
+    MWSignTx(tx4, vBlinds4, vBlinds0);
+    BOOST_CHECK(!pool.accept(tx4, &view));
+    tx4.vin[0] = Input(MWTestOutput(6).commitment);
+    tx4.MarkDirty();
+    BOOST_CHECK(!pool.accept(tx4, &view));
+    tx4.vin[0] = Input(tx3.vout[0].commitment);
+    MWSignTx(tx4, vBlinds4, vBlinds3);
+    BOOST_CHECK(pool.accept(tx4, &view));
+    pool.GetAggregate(agg);
+    BOOST_CHECK_EQUAL(agg.vin.size(), 1U);
+    BOOST_CHECK_EQUAL(agg.vout.size(), 1U);
+    BOOST_CHECK(agg.vout[0].commitment == tx4.vout[0].commitment);
+    pool.clear();
+
+    // a chain of 10000 transactions, each spending the change of the one before
+    const unsigned int nTx = 10000;
+    vector<Transaction> vtx;
+    vtx.reserve(nTx);
+    for (unsigned int i = 0; i < nTx; i++)
+        vtx.push_back(MWTestTx(100 + i, 101 + i, 100000 + i, 1 + i));
+    for (unsigned int i = 0; i < nTx; i++)
+        pool.addUnchecked(vtx[i].GetHash(), vtx[i]);
+    pool.GetAggregate(agg);
+    BOOST_CHECK_EQUAL(agg.vin.size(), 1U);
+    BOOST_CHECK_EQUAL(agg.vout.size(), nTx + 1);
+    BOOST_CHECK_EQUAL(agg.kernels.size(), nTx);
+    BOOST_CHECK_EQUAL(pool.GetCutThroughCount(), nTx - 1);
+
+    // adding one more extends the chain
+    Transaction tx = MWTestTx(100 + nTx, 200000, 0, 1 + nTx);
+    pool.addUnchecked(tx.GetHash(), tx);
+    BOOST_CHECK_EQUAL(pool.GetCutThroughCount(), nTx);
+}
+
+BOOST_AUTO_TEST_CASE(mw_mmr)
+{
+    boost::filesystem::path pathMMR = GetDataDir() / "mmrtest";
+    boost::filesystem::remove_all(pathMMR);
+    vector<uint256> vRoots;
+    {
+        CMMR mmr(pathMMR, sizeof(uint64), true);
+        BOOST_CHECK(mmr.GetRoot() == 0);
+        vRoots.push_back(0);
+        for (uint64 n = 0; n < 40; n++) {
+            BOOST_CHECK_EQUAL(mmr.Append((const unsigned char*)&n), n);
+            BOOST_CHECK_EQUAL(mmr.GetSize(), CMMR::LeafPos(n + 1));
+            vRoots.push_back(mmr.GetRoot());
+            if (n == 16)
+                BOOST_CHECK(mmr.Flush());
+        }
+        // a single leaf is its own peak and root
+        uint64 nZero = 0;
+        BOOST_CHECK(vRoots[1] == CMMR::HashLeaf(0, (const unsigned char*)&nZero, sizeof(nZero)));
+
+        // every leaf has a proof against the root, from the mapping and from memory
+        for (uint64 n = 0; n < 40; n++) {
+            CMMRProof proof;
+            BOOST_CHECK(mmr.GetProof(n, proof));
+            BOOST_CHECK(proof.Verify(vRoots[40], (const unsigned char*)&n, sizeof(n)));
+            uint64 nOther = n + 1;
+            BOOST_CHECK(!proof.Verify(vRoots[40], (const unsigned char*)&nOther, sizeof(nOther)));
+            BOOST_CHECK(!proof.Verify(vRoots[39], (const unsigned char*)&n, sizeof(n)));
+        }
+        CMMRProof proof;
+        BOOST_CHECK(!mmr.GetProof(40, proof));
+
+        BOOST_CHECK(mmr.Spend(3));
+        BOOST_CHECK(!mmr.Spend(3));
+        BOOST_CHECK(mmr.Spend(30));
+        BOOST_CHECK(mmr.IsSpent(3) && mmr.IsSpent(30) && !mmr.IsSpent(4));
+        BOOST_CHECK(mmr.Flush());
+    }
+
+    // reopened, the mapped files give the same roots
+    CMMR mmr(pathMMR, sizeof(uint64), true);
+    BOOST_CHECK_EQUAL(mmr.GetLeafCount(), 40U);
+    BOOST_CHECK(mmr.GetRoot() == vRoots[40]);
+    BOOST_CHECK(mmr.IsSpent(3) && mmr.IsSpent(30));
+    vector<unsigned char> vData;
+    BOOST_CHECK(mmr.GetLeaf(25, vData));
+    BOOST_CHECK(vData.size() == sizeof(uint64) && *(uint64*)&vData[0] == 25);
+
+    // rewinds, within the unflushed leaves and below the flushed ones
+    vector<uint64> vUnspend;
+    for (uint64 n = 40; n < 45; n++)
+        mmr.Append((const unsigned char*)&n);
+    BOOST_CHECK(mmr.Rewind(42, vUnspend));
+    BOOST_CHECK_EQUAL(mmr.GetLeafCount(), 42U);
+    BOOST_CHECK(mmr.Rewind(40, vUnspend));
+    BOOST_CHECK(mmr.GetRoot() == vRoots[40]);
+    vUnspend.push_back(3);
+    BOOST_CHECK(mmr.Rewind(20, vUnspend));
+    BOOST_CHECK(!mmr.Rewind(21, vUnspend));
+    BOOST_CHECK(mmr.GetRoot() == vRoots[20]);
+    BOOST_CHECK(!mmr.IsSpent(3));
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathMMR / "hash.dat"), CMMR::LeafPos(20) * sizeof(uint256));
+    for (uint64 n = 20; n < 40; n++)
+        mmr.Append((const unsigned char*)&n);
+    BOOST_CHECK(mmr.GetRoot() == vRoots[40]);
+    BOOST_CHECK(!mmr.IsSpent(30));
+    BOOST_CHECK(mmr.Rewind(0, vUnspend));
+    BOOST_CHECK(mmr.GetRoot() == 0);
+
+    // kernel appends, a flush per 10000 as if per block
+    const unsigned int nAppends = 200000;
+    unsigned char kernel[CMWAccumulators::KERNEL_SIZE] = {0};
+    CMMR mmrKernels(pathMMR / "kernel", sizeof(kernel), false);
+    for (unsigned int i = 0; i < nAppends; i++) {
+        memcpy(kernel, &i, sizeof(i));
+        mmrKernels.Append(kernel);
+        if (i % 10000 == 9999)
+            BOOST_CHECK(mmrKernels.Flush());
+    }
+    CMMRProof proof;
+    BOOST_CHECK(mmrKernels.GetProof(123456, proof));
+    unsigned int n = 123456;
+    memcpy(kernel, &n, sizeof(n));
+    BOOST_CHECK(proof.Verify(mmrKernels.GetRoot(), kernel, sizeof(kernel)));
+    BOOST_CHECK_EQUAL(proof.vPath.size() + proof.vPeaks.size(), 17U + 5U);
+
+    boost::filesystem::remove_all(pathMMR);
+}
+
+// A state of 20 kernels and 24 outputs, of which every third is spent, whose
+// unspent outputs balance against its kernels: the blinding factor of the last
+// unspent output makes up the difference
+static vector<Output> MWBalancedState(CMWAccumulators &acc, CMWCoinsViewCache &view)
+{
+    BlindingFactor sumKernels;
+    for (unsigned int i = 0; i < 20; i++) {
+        BlindingFactor blind = BlindingFactor::Random();
+        Kernel kernel;
+        kernel.nFee = i;
+        BOOST_CHECK(kernel.Sign(blind));
+        acc.AppendKernel(kernel);
+        sumKernels += blind;
+    }
+    acc.offset = BlindingFactor::Random();
+    BlindingFactor blindLeft = sumKernels;
+    blindLeft += acc.offset;
+    const unsigned int nOutputs = 24;
+    vector<Output> vOutputs;
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        BlindingFactor blind = BlindingFactor::Random();
+        bool fSpent = i % 3 == 0;
+        if (!fSpent && i == nOutputs - 1)
+            blind = blindLeft;
+        else if (!fSpent)
+            blindLeft -= blind;
+        vOutputs.push_back(createOutput((i + 1) * COIN, blind));
+        BOOST_CHECK_EQUAL(acc.AppendOutput(vOutputs.back()), i);
+        if (fSpent)
+            BOOST_CHECK(acc.outputs.Spend(i));
+        else {
+            BOOST_CHECK(view.AddCoin(vOutputs.back(), 5));
+            acc.nSupply += (i + 1) * COIN;
+        }
+    }
+    BOOST_CHECK(acc.Flush());
+    return vOutputs;
+}
+
+BOOST_AUTO_TEST_CASE(mw_state_archive)
+{
+    boost::filesystem::path pathTest = GetDataDir() / "mwstatetest";
+    boost::filesystem::remove_all(pathTest);
+
+    CMWAccumulators acc(pathTest / "src");
+    CMWCoinsViewDB db(1 << 20, true);
+    CMWCoinsViewCache view(db);
+    vector<Output> vOutputs = MWBalancedState(acc, view);
+    const unsigned int nOutputs = vOutputs.size();
+
+    CMWStateHeader header;
+    BOOST_CHECK(WriteMWStateArchive(pathTest / "archive", acc, view, 7, 1234, header, 8, 5));
+    BOOST_CHECK(header.IsConsistent());
+    BOOST_CHECK_EQUAL(header.nUnspent, 16U);
+    BOOST_CHECK_EQUAL(header.vChunkHashes.size(), 3U + 4U);
+    BOOST_CHECK(header.GetOutputRoot() == acc.outputs.GetRoot());
+    CMWStateHeader headerRead;
+    BOOST_CHECK(ReadMWStateHeader(pathTest / "archive", headerRead));
+    BOOST_CHECK(SerializeHash(headerRead) == SerializeHash(header));
+
+    // load it into a new node
+    {
+        CMWAccumulators accNew(pathTest / "new");
+        CMWCoinsViewDB dbNew(1 << 20, true);
+        CMWCoinsViewCache viewNew(dbNew);
+        BOOST_CHECK(LoadMWStateArchive(pathTest / "archive", header, acc.nSupply, accNew, viewNew));
+        BOOST_CHECK(accNew.kernels.GetRoot() == acc.kernels.GetRoot());
+        BOOST_CHECK_EQUAL(accNew.nSupply, acc.nSupply);
+        for (unsigned int i = 0; i < nOutputs; i++)
+            BOOST_CHECK(viewNew.HaveCoin(vOutputs[i].commitment) == (i % 3 != 0));
+        CMWCoin coin;
+        BOOST_CHECK(viewNew.GetCoin(vOutputs[1].commitment, coin) && coin.nHeight == 5);
+        // only into an empty state
+        CMWCoinsViewCache viewAgain(dbNew);
+        BOOST_CHECK(!LoadMWStateArchive(pathTest / "archive", header, acc.nSupply, accNew, viewAgain));
+    }
+
+    // a wrong supply, or a chunk that is not the one the header names, is refused
+    // and leaves the kernel MMR empty
+    for (unsigned int nCase = 0; nCase < 3; nCase++) {
+        CMWStateHeader headerBad = header;
+        int64 nSupplyBad = acc.nSupply;
+        if (nCase == 0)
+            nSupplyBad += 1;
+        else if (nCase == 1)
+            headerBad.vChunkHashes[4] = headerBad.vChunkHashes[5];
+        else
+            headerBad.hashKernelRoot = 0;
+        CMWAccumulators accBad(pathTest / strprintf("bad%u", nCase));
+        CMWCoinsViewDB dbBad(1 << 20, true);
+        CMWCoinsViewCache viewBad(dbBad);
+        BOOST_CHECK(!LoadMWStateArchive(pathTest / "archive", headerBad, nSupplyBad, accBad, viewBad));
+        BOOST_CHECK_EQUAL(accBad.kernels.GetLeafCount(), 0U);
+    }
+
+    boost::filesystem::remove_all(pathTest);
+}
+
+// Hands the messages queued on pnodeFrom to the node at the other end, which
+// knows the sender as pnodeTo; returns how many there were
+static unsigned int MWRelayMessages(CNode *pnodeFrom, CNode *pnodeTo)
+{
+    unsigned int nMessages = 0;
+    while (!pnodeFrom->vSendMsg.empty()) {
+        CDataStream ss(pnodeFrom->vSendMsg.front().begin(), pnodeFrom->vSendMsg.front().end(), SER_NETWORK, PROTOCOL_VERSION);
+        pnodeFrom->vSendMsg.pop_front();
+        CMessageHeader hdr;
+        ss >> hdr;
+        BOOST_CHECK(ProcessMWStateMessage(pnodeTo, hdr.GetCommand(), ss));
+        nMessages++;
+    }
+    pnodeFrom->nSendSize = 0;
+    return nMessages;
+}
+
+BOOST_AUTO_TEST_CASE(mw_state_sync)
+{
+    // Two nodes in one process: A serves the archive in mwstate/, B has no
+    // Mimblewimble state and fetches it. pnodeA is A as B sees it, pnodeB is
+    // B as A sees it. The archive is at the genesis block, which is in the
+    // best chain.
+    boost::filesystem::path pathTest = GetDataDir() / "mwsynctest";
+    boost::filesystem::remove_all(pathTest);
+    boost::filesystem::remove_all(GetDataDir() / "mwstate");
+    boost::filesystem::remove_all(GetDataDir() / "mmr");
+    CMWAccumulators acc(pathTest / "src");
+    CMWCoinsViewDB db(1 << 20, true);
+    CMWCoinsViewCache view(db);
+    vector<Output> vOutputs = MWBalancedState(acc, view);
+    uint256 hashGenesis = pindexGenesisBlock->GetBlockHash();
+    CMWStateHeader header;
+    BOOST_CHECK(WriteMWStateArchive(GetDataDir() / "mwstate", acc, view, 0, hashGenesis, header, 8, 5));
+
+    pmwcoinsdbview = new CMWCoinsViewDB(1 << 20, true);
+    pmwcoinsTip = new CMWCoinsViewCache(*pmwcoinsdbview);
+    pmwaccumulators = new CMWAccumulators(GetDataDir() / "mmr");
+    CNode *pnodeA = new CNode(INVALID_SOCKET, CAddress(), "nodeA", true);
+    CNode *pnodeB = new CNode(INVALID_SOCKET, CAddress(), "nodeB", true);
+    mapArgs["-mwfastsync"] = "1";
+    bool fTestNet_stored = fTestNet;
+    fTestNet = true;
+
+    // a state that is not compiled in is refused after its header
+    {
+        LOCK(cs_main);
+        StartMWStateSync(pnodeA);
+        BOOST_CHECK_EQUAL(MWRelayMessages(pnodeA, pnodeB), 1U);
+        BOOST_CHECK_EQUAL(MWRelayMessages(pnodeB, pnodeA), 1U);
+        BOOST_CHECK_EQUAL(MWRelayMessages(pnodeA, pnodeB), 0U);
+    }
+
+    // on testnet with -checkpoints=0 it is fetched chunk by chunk, checked
+    // and loaded
+    mapArgs["-checkpoints"] = "0";
+    {
+        LOCK(cs_main);
+        StartMWStateSync(pnodeA);
+        unsigned int nMessages = 0, nRound;
+        while ((nRound = MWRelayMessages(pnodeA, pnodeB) + MWRelayMessages(pnodeB, pnodeA)) > 0)
+            nMessages += nRound;
+        // the header and 3 + 4 chunks, asked for and sent
+        BOOST_CHECK_EQUAL(nMessages, 2U * (1 + header.vChunkHashes.size()));
+    }
+    for (int i = 0; i < 1000; i++) {
+        {
+            LOCK(cs_main);
+            if (pmwaccumulators && pmwaccumulators->kernels.GetLeafCount() != 0 &&
+                !boost::filesystem::exists(GetDataDir() / "mwstate.new"))
+                break;
+        }
+        MilliSleep(10);
+    }
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(pmwaccumulators);
+        BOOST_CHECK(pmwaccumulators->kernels.GetRoot() == acc.kernels.GetRoot());
+        BOOST_CHECK_EQUAL(pmwaccumulators->nSupply, acc.nSupply);
+        BOOST_CHECK(pmwcoinsTip->GetBestBlock() == hashGenesis);
+        for (unsigned int i = 0; i < vOutputs.size(); i++)
+            BOOST_CHECK(pmwcoinsTip->HaveCoin(vOutputs[i].commitment) == (i % 3 != 0));
+
+        // with a state, B asks nobody for one
+        StartMWStateSync(pnodeA);
+        BOOST_CHECK_EQUAL(MWRelayMessages(pnodeA, pnodeB), 0U);
+    }
+
+    fTestNet = fTestNet_stored;
+    mapArgs.erase("-checkpoints");
+    mapArgs.erase("-mwfastsync");
+    delete pnodeA;
+    delete pnodeB;
+    delete pmwaccumulators;
+    pmwaccumulators = NULL;
+    delete pmwcoinsTip;
+    pmwcoinsTip = NULL;
+    delete pmwcoinsdbview;
+    pmwcoinsdbview = NULL;
+    boost::filesystem::remove_all(GetDataDir() / "mwstate");
+    boost::filesystem::remove_all(GetDataDir() / "mmr");
+    boost::filesystem::remove_all(pathTest);
+}
+
+BOOST_AUTO_TEST_CASE(mw_verify_engine)
+{
+    // pool transactions, aggregated the way a block carries them
+    const unsigned int nTx = 48;
+    CMWTxPool pool;
+    mwverifycache.clear();
+    vector<Transaction> vtx;
+    for (unsigned int i = 0; i < nTx; i++)
+        vtx.push_back(MWSignedTx((i + 1) * COIN, 1000 + i));
+    for (unsigned int i = 0; i < nTx; i++)
+        BOOST_CHECK(pool.accept(vtx[i], NULL));
+    BOOST_CHECK_EQUAL(mwverifycache.size(), 3 * nTx);
+    Transaction agg;
+    pool.GetAggregate(agg);
+
+    // the pool checked every kernel and output: only the sum is left, and
+    // with the cache cleared the check queue verifies them all again
+    BOOST_CHECK(VerifyMWTransaction(agg));
+    mwverifycache.clear();
+    BOOST_CHECK(VerifyMWTransaction(agg));
+    BOOST_CHECK_EQUAL(mwverifycache.size(), 3 * nTx);
+    BOOST_CHECK(agg.Verify());
+
+    // a bad range proof, a bad signature or a wrong offset fails the block
+    Transaction bad = agg;
+    bad.vout[5].rangeProof = bad.vout[6].rangeProof;
+    bad.vout[5].MarkDirty();
+    bad.MarkDirty();
+    BOOST_CHECK(!VerifyMWTransaction(bad));
+    bad = agg;
+    bad.kernels[3].nFee++;
+    bad.kernels[3].MarkDirty();
+    bad.MarkDirty();
+    BOOST_CHECK(!VerifyMWTransaction(bad));
+    bad = agg;
+    bad.offset = BlindingFactor::Random();
+    bad.MarkDirty();
+    BOOST_CHECK(!VerifyMWTransaction(bad));
+    mwverifycache.clear();
+}
+
+BOOST_AUTO_TEST_CASE(mw_keychain_rewind)
+{
+    unsigned char seed1[32], seed2[32];
+    memset(seed1, 1, sizeof(seed1));
+    memset(seed2, 2, sizeof(seed2));
+    CMWKeyChain keychain(seed1, sizeof(seed1)), other(seed2, sizeof(seed2));
+
+    // blinding factors are deterministic and differ per index and per seed
+    BOOST_CHECK(keychain.GetBlind(7).GetBytes() == CMWKeyChain(seed1, sizeof(seed1)).GetBlind(7).GetBytes());
+    BOOST_CHECK(keychain.GetBlind(7).GetBytes() != keychain.GetBlind(8).GetBytes());
+    BOOST_CHECK(keychain.GetBlind(7).GetBytes() != other.GetBlind(7).GetBytes());
+
+    // a rewindable output is an ordinary valid output
+    Output output = keychain.CreateOutput(42 * COIN, 7);
+    BOOST_CHECK(output.Verify());
+    BOOST_CHECK(output.commitment == createCommitment(42 * COIN, keychain.GetBlind(7)));
+
+    int64 nValue = 0;
+    unsigned int nIndex = 0;
+    BOOST_CHECK(keychain.RewindOutput(output, nValue, nIndex));
+    BOOST_CHECK_EQUAL(nValue, 42 * COIN);
+    BOOST_CHECK_EQUAL(nIndex, 7U);
+
+    // another seed, an output with a random proof or a tampered commitment do not rewind
+    BOOST_CHECK(!other.RewindOutput(output, nValue, nIndex));
+    BOOST_CHECK(!keychain.RewindOutput(createOutput(42 * COIN, keychain.GetBlind(7)), nValue, nIndex));
+    Output bad = keychain.CreateOutput(5 * COIN, 9);
+    bad.commitment = createCommitment(6 * COIN, keychain.GetBlind(9));
+    BOOST_CHECK(!keychain.RewindOutput(bad, nValue, nIndex));
+    BOOST_CHECK(!CMWKeyChain().RewindOutput(output, nValue, nIndex));
+
+    // CMWWalletOutput round trip
+    CMWWalletOutput record(output, 42 * COIN, 7, 3), record2;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << record;
+    ss >> record2;
+    BOOST_CHECK(record2.output.GetHash() == output.GetHash());
+    BOOST_CHECK_EQUAL(record2.nValue, 42 * COIN);
+    BOOST_CHECK_EQUAL(record2.nKeyIndex, 7U);
+    BOOST_CHECK_EQUAL(record2.nHeight, 3);
+}
+
+BOOST_AUTO_TEST_CASE(mw_keychain_scan)
+{
+    unsigned char seed1[32], seed2[32];
+    memset(seed1, 3, sizeof(seed1));
+    memset(seed2, 4, sizeof(seed2));
+    CMWKeyChain keychain(seed1, sizeof(seed1)), other(seed2, sizeof(seed2));
+
+    // an output set where every third output is ours
+    CMWCoinsViewDB db(1 << 20, true);
+    const unsigned int nOutputs = 24;
+    int64 nOurs = 0;
+    {
+        CMWCoinsViewCache cache(db);
+        for (unsigned int i = 0; i < nOutputs; i++) {
+            bool fOurs = (i % 3 == 0);
+            Output output = (fOurs ? keychain : other).CreateOutput((i + 1) * COIN, i);
+            BOOST_CHECK(cache.AddCoin(output, i + 1));
+            if (fOurs)
+                nOurs += (i + 1) * COIN;
+        }
+        cache.SetBestBlock(1);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // the same outputs are found whatever the number of threads
+    for (unsigned int nThreads = 1; nThreads <= 4; nThreads += 3) {
+        vector<CMWWalletOutput> vFound;
+        BOOST_CHECK(ScanMWCoins(db, keychain, nThreads, vFound));
+        BOOST_CHECK_EQUAL(vFound.size(), nOutputs / 3);
+        int64 nFound = 0;
+        for (unsigned int i = 0; i < vFound.size(); i++) {
+            const CMWWalletOutput &record = vFound[i];
+            BOOST_CHECK_EQUAL(record.nKeyIndex % 3, 0U);
+            BOOST_CHECK_EQUAL(record.nValue, (record.nKeyIndex + 1) * COIN);
+            BOOST_CHECK_EQUAL(record.nHeight, (int)record.nKeyIndex + 1);
+            nFound += record.nValue;
+        }
+        BOOST_CHECK_EQUAL(nFound, nOurs);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
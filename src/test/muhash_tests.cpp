@@ -0,0 +1,91 @@
+#include <boost/test/unit_test.hpp>
+
+#include "muhash.h"
+#include "main.h"
+
+BOOST_AUTO_TEST_SUITE(muhash_tests)
+
+BOOST_AUTO_TEST_CASE(muhash_order_independence)
+{
+    uint256 a = 1, b = 2, c = 3;
+
+    CMuHash3072 x;
+    x.Insert(a).Insert(b);
+
+    CMuHash3072 y;
+    y.Insert(b).Insert(c).Insert(a).Remove(c);
+    BOOST_CHECK(x == y);
+
+    // removing before inserting is fine too
+    CMuHash3072 z;
+    z.Remove(c).Insert(a).Insert(c).Insert(b);
+    BOOST_CHECK(x == z);
+
+    CMuHash3072 empty;
+    BOOST_CHECK(x != empty);
+    x.Remove(a).Remove(b);
+    BOOST_CHECK(x == empty);
+}
+
+BOOST_AUTO_TEST_CASE(muhash_combine)
+{
+    CMuHash3072 all, part1, part2;
+    for (int i = 0; i < 10; i++) {
+        all.Insert(uint256(i));
+        if (i % 2)
+            part1.Insert(uint256(i));
+        else
+            part2.Insert(uint256(i));
+    }
+    part1 *= part2;
+    BOOST_CHECK(part1 == all);
+    part1 /= part2;
+    part2 *= part1;
+    BOOST_CHECK(part2 == all);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << all;
+    CMuHash3072 read;
+    ss >> read;
+    BOOST_CHECK(read.Finalize() == all.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(coins_commitment_delta)
+{
+    CTxOut out1(50 * COIN, CScript() << OP_TRUE);
+    CTxOut out2(25 * COIN, CScript() << OP_TRUE << OP_DROP << OP_TRUE);
+
+    CCoinsCommitment base;
+    base.AddTransaction();
+    base.AddOutput(1, 0, 10, true, out1);
+
+    // block: spend the coinbase, create out2
+    CCoinsCommitment connect;
+    connect.RemoveOutput(1, 0, 10, true, out1);
+    connect.RemoveTransaction();
+    connect.AddOutput(2, 0, 11, false, out2);
+    connect.AddTransaction();
+
+    CCoinsCommitment tip = base;
+    tip += connect;
+    BOOST_CHECK_EQUAL(tip.nTransactions, 1);
+    BOOST_CHECK_EQUAL(tip.nTransactionOutputs, 1);
+    BOOST_CHECK_EQUAL(tip.nTotalAmount, 25 * COIN);
+
+    CCoinsCommitment expected;
+    expected.AddTransaction();
+    expected.AddOutput(2, 0, 11, false, out2);
+    BOOST_CHECK(tip.muhash == expected.muhash);
+
+    // disconnecting the block restores the previous commitment
+    CCoinsCommitment disconnect;
+    disconnect.RemoveOutput(2, 0, 11, false, out2);
+    disconnect.RemoveTransaction();
+    disconnect.AddOutput(1, 0, 10, true, out1);
+    disconnect.AddTransaction();
+    tip += disconnect;
+    BOOST_CHECK(tip.muhash == base.muhash);
+    BOOST_CHECK_EQUAL(tip.nTotalAmount, base.nTotalAmount);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
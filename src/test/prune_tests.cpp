@@ -0,0 +1,166 @@
+#include <boost/test/unit_test.hpp>
+
+#include "base58.h"
+#include "bitcoinrpc.h"
+#include "init.h"
+#include "main.h"
+#include "txdb.h"
+
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(prune_tests)
+
+// A main chain of 1000 block index entries on top of the genesis block, in
+// block files 1 to 10 of 100 blocks and 20+2 MiB each. The block data is not
+// on disk: pruning only reads the file infos and removes missing files.
+struct CPruneTestChain
+{
+    std::vector<CBlockIndex*> vIndex;
+    CBlockIndex* pindexBestSaved;
+    int nBestHeightSaved;
+    int nLastBlockFileSaved;
+    CBlockFileInfo infoLastBlockFileSaved;
+    CBlockFileInfo infoGenesisFile;
+
+    CPruneTestChain()
+    {
+        pindexBestSaved = pindexBest;
+        nBestHeightSaved = nBestHeight;
+        nLastBlockFileSaved = nLastBlockFile;
+        infoLastBlockFileSaved = infoLastBlockFile;
+        // leave the genesis block's file alone
+        pblocktree->ReadBlockFileInfo(0, infoGenesisFile);
+        pblocktree->WriteBlockFileInfo(0, CBlockFileInfo());
+
+        CBlockIndex* pindexPrev = pindexGenesisBlock;
+        CBlockFileInfo info;
+        for (int nHeight = 1; nHeight <= 1000; nHeight++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(std::make_pair(uint256(1000000 + nHeight), pindex)).first;
+            pindex->phashBlock = &mi->first;
+            pindex->pprev = pindexPrev;
+            pindexPrev->pnext = pindex;
+            pindex->nHeight = nHeight;
+            pindex->nChainWork = pindexPrev->nChainWork + uint256(1);
+            pindex->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+            pindex->nFile = 1 + (nHeight - 1) / 100;
+            pindex->nDataPos = 8;
+            pindex->nUndoPos = 8;
+            setBlockIndexValid.insert(pindex);
+            vIndex.push_back(pindex);
+            pindexPrev = pindex;
+
+            info.AddBlock(nHeight, nHeight);
+            if (nHeight % 100 == 0) {
+                info.nSize = 20 * 1024 * 1024;
+                info.nUndoSize = 2 * 1024 * 1024;
+                pblocktree->WriteBlockFileInfo(pindex->nFile, info);
+                if (nHeight == 1000) {
+                    nLastBlockFile = pindex->nFile;
+                    infoLastBlockFile = info;
+                }
+                info.SetNull();
+            }
+        }
+        pindexBest = pindexPrev;
+        nBestHeight = pindexPrev->nHeight;
+        fPruneMode = true;
+    }
+
+    ~CPruneTestChain()
+    {
+        fPruneMode = false;
+        fHavePruned = false;
+        nPruneTarget = 0;
+        pindexBest = pindexBestSaved;
+        nBestHeight = nBestHeightSaved;
+        nLastBlockFile = nLastBlockFileSaved;
+        infoLastBlockFile = infoLastBlockFileSaved;
+        pindexGenesisBlock->pnext = NULL;
+        for (int nFile = 1; nFile <= 10; nFile++)
+            pblocktree->WriteBlockFileInfo(nFile, CBlockFileInfo());
+        pblocktree->WriteBlockFileInfo(0, infoGenesisFile);
+        BOOST_FOREACH(CBlockIndex* pindex, vIndex) {
+            setBlockIndexValid.erase(pindex);
+            mapBlockIndex.erase(pindex->GetBlockHash());
+            delete pindex;
+        }
+    }
+
+    bool FileInfoEmpty(int nFile)
+    {
+        CBlockFileInfo info;
+        return pblocktree->ReadBlockFileInfo(nFile, info) && info.nSize == 0;
+    }
+
+    bool HaveData(int nHeight)
+    {
+        CBlockIndex* pindex = vIndex[nHeight - 1];
+        return (pindex->nStatus & BLOCK_HAVE_MASK) != 0 && setBlockIndexValid.find(pindex) != setBlockIndexValid.end();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(prune_target)
+{
+    CPruneTestChain chain;
+
+    // Below the target, including room for the next chunks, nothing is pruned
+    nPruneTarget = 250 * 1024 * 1024;
+    BOOST_CHECK(PruneBlockFiles());
+    BOOST_CHECK(!fHavePruned);
+    BOOST_CHECK(chain.HaveData(1));
+    BOOST_CHECK(FindPrunedBlock(pindexGenesisBlock) == NULL);
+
+    // 220 MiB in use plus 17 MiB of chunks must get below 150 MiB: four files go
+    nPruneTarget = 150 * 1024 * 1024;
+    BOOST_CHECK(PruneBlockFiles());
+    BOOST_CHECK(fHavePruned);
+    for (int nFile = 1; nFile <= 4; nFile++)
+        BOOST_CHECK(chain.FileInfoEmpty(nFile));
+    BOOST_CHECK(!chain.FileInfoEmpty(5));
+
+    // and the index entries of their blocks lose their data and undo positions
+    BOOST_CHECK(!chain.HaveData(1));
+    BOOST_CHECK(!chain.HaveData(400));
+    BOOST_CHECK(chain.HaveData(401));
+    BOOST_CHECK_EQUAL(chain.vIndex[399]->nFile, 0);
+    BOOST_CHECK(chain.vIndex[399]->GetUndoPos().IsNull());
+    BOOST_CHECK(FindPrunedBlock(pindexGenesisBlock) == chain.vIndex[399]);
+    BOOST_CHECK(FindPrunedBlock(chain.vIndex[400]) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(prune_keep_recent)
+{
+    CPruneTestChain chain;
+
+    // However low the target, the last MIN_BLOCKS_TO_KEEP blocks stay: with
+    // the tip at 1000 only files up to height 712 go, and the file being
+    // written to never does
+    nPruneTarget = 1;
+    BOOST_CHECK(PruneBlockFiles());
+    for (int nFile = 1; nFile <= 7; nFile++)
+        BOOST_CHECK(chain.FileInfoEmpty(nFile));
+    for (int nFile = 8; nFile <= 10; nFile++)
+        BOOST_CHECK(!chain.FileInfoEmpty(nFile));
+    BOOST_CHECK(!chain.HaveData(700));
+    BOOST_CHECK(chain.HaveData(701));
+    BOOST_CHECK(chain.HaveData(1000 - MIN_BLOCKS_TO_KEEP));
+}
+
+BOOST_AUTO_TEST_CASE(prune_refuse_rescan)
+{
+    CPruneTestChain chain;
+    nPruneTarget = 150 * 1024 * 1024;
+    BOOST_CHECK(PruneBlockFiles());
+
+    CKey key;
+    key.MakeNewKey(true);
+    Array params;
+    params.push_back(CBitcoinSecret(key).ToString());
+    params.push_back("");
+    params.push_back(true);
+    BOOST_CHECK_THROW(tableRPC["importprivkey"]->actor(params, false), Object);
+    BOOST_CHECK(!pwalletMain->HaveKey(key.GetPubKey().GetID()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
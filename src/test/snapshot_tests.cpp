@@ -0,0 +1,90 @@
+#include <boost/test/unit_test.hpp>
+
+#include "checkpoints.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(snapshot_tests)
+
+static void FillCoins(CCoinsViewDB &view, unsigned int nTx, std::map<uint256, CCoins> &mapCoins)
+{
+    for (unsigned int i = 0; i < nTx; i++) {
+        CCoins coins;
+        coins.fCoinBase = (i % 7 == 0);
+        coins.nHeight = i;
+        coins.nVersion = 1;
+        coins.vout.resize(1 + i % 3);
+        for (unsigned int j = 0; j < coins.vout.size(); j++) {
+            coins.vout[j].nValue = (i + 1) * COIN + j;
+            coins.vout[j].scriptPubKey = CScript() << OP_TRUE << (int64)i;
+        }
+        mapCoins[GetRandHash()] = coins;
+    }
+    BOOST_CHECK(view.BatchWrite(mapCoins, NULL));
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    std::map<uint256, CCoins> mapCoins;
+    CCoinsViewDB viewFrom(1 << 20, true);
+    // more than one chunk
+    FillCoins(viewFrom, SNAPSHOT_CHUNK_COINS + 100, mapCoins);
+
+    boost::filesystem::path path = GetTempPath() / strprintf("test_snapshot_%i", (int)GetRand(100000));
+    uint64 nCoins = 0;
+    CCoinsCommitment commitDump;
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(viewFrom.DumpSnapshot(fileout, nCoins, commitDump));
+    }
+    BOOST_CHECK_EQUAL(nCoins, mapCoins.size());
+    BOOST_CHECK_EQUAL(commitDump.nTransactions, (int64)mapCoins.size());
+
+    CCoinsViewDB viewTo(1 << 20, true);
+    CCoinsCommitment commitLoad;
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(viewTo.LoadSnapshot(filein, nCoins, commitLoad, true));
+    }
+    BOOST_CHECK(commitLoad.muhash == commitDump.muhash);
+    BOOST_CHECK_EQUAL(commitLoad.nTotalAmount, commitDump.nTotalAmount);
+
+    for (std::map<uint256, CCoins>::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        CCoins coins;
+        BOOST_CHECK(viewTo.GetCoins(it->first, coins));
+        BOOST_CHECK(coins == it->second);
+    }
+
+    // A flipped byte in the coin data makes the chunk checksum fail
+    {
+        FILE *file = fopen(path.string().c_str(), "r+b");
+        fseek(file, 64, SEEK_SET);
+        unsigned char ch = fgetc(file);
+        fseek(file, 64, SEEK_SET);
+        fputc(ch ^ 0x01, file);
+        fclose(file);
+    }
+    CCoinsViewDB viewBad(1 << 20, true);
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!viewBad.LoadSnapshot(filein, nCoins, commitLoad, false));
+    }
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_checkpoints)
+{
+    // Only compiled-in snapshots are accepted, except on testnet with -checkpoints=0
+    BOOST_CHECK(!Checkpoints::CheckSnapshot(100, GetRandHash(), GetRandHash()));
+    mapArgs["-checkpoints"] = "0";
+    BOOST_CHECK(!Checkpoints::CheckSnapshot(100, GetRandHash(), GetRandHash()));
+    bool fTestNet_stored = fTestNet;
+    fTestNet = true;
+    BOOST_CHECK(Checkpoints::CheckSnapshot(100, GetRandHash(), GetRandHash()));
+    mapArgs.erase("-checkpoints");
+    BOOST_CHECK(!Checkpoints::CheckSnapshot(100, GetRandHash(), GetRandHash()));
+    fTestNet = fTestNet_stored;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include "txdb.h"
 #include "main.h"
 #include "wallet.h"
+#include "mimblewimble_verify.h"
 #include "util.h"
 
 CWallet* pwalletMain;
@@ -15,7 +16,6 @@ extern bool fPrintToConsole;
 extern void noui_connect();
 
 struct TestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
@@ -35,8 +35,10 @@ struct TestingSetup {
         pwalletMain->LoadWallet(fFirstRun);
         RegisterWallet(pwalletMain);
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadMWCheck);
+        }
     }
     ~TestingSetup()
     {
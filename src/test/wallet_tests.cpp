@@ -1,7 +1,10 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
+#include "init.h"
 #include "main.h"
 #include "wallet.h"
+#include "bloom.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -292,4 +295,415 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(rescan_filter)
+{
+    CWallet keywallet;
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(keywallet.AddKeyPubKey(key, pubkey));
+    CScript redeem = CScript() << OP_1 << pubkey << OP_1 << OP_CHECKMULTISIG;
+    BOOST_CHECK(keywallet.AddCScript(redeem));
+
+    CBloomFilter filter = keywallet.GetRescanFilter();
+    CKeyID keyID = pubkey.GetID();
+    CScriptID scriptID = Hash160(redeem);
+    BOOST_CHECK(filter.contains(vector<unsigned char>(keyID.begin(), keyID.end())));
+    BOOST_CHECK(filter.contains(vector<unsigned char>(pubkey.begin(), pubkey.end())));
+    BOOST_CHECK(filter.contains(vector<unsigned char>(scriptID.begin(), scriptID.end())));
+
+    CKey other;
+    other.MakeNewKey(true);
+    CKeyID otherID = other.GetPubKey().GetID();
+    BOOST_CHECK(!filter.contains(vector<unsigned char>(otherID.begin(), otherID.end())));
+}
+
+BOOST_AUTO_TEST_CASE(rescan_pipeline)
+{
+    // A chain of 20 blocks: only the first, a copy of the genesis block,
+    // has data on disk; the others are skipped as if they were pruned
+    const int nBlocks = 20;
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    vIndex[0] = *pindexGenesisBlock;
+    for (int i = 0; i < nBlocks; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i > 0 ? &vIndex[i-1] : NULL;
+        vIndex[i].pnext = i + 1 < nBlocks ? &vIndex[i+1] : NULL;
+    }
+
+    // a filter with the key the genesis coinbase pays to, and one without
+    CBlock genesis;
+    BOOST_CHECK(genesis.ReadFromDisk(pindexGenesisBlock));
+    const CScript &script = genesis.vtx[0].vout[0].scriptPubKey;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    vector<unsigned char> vchPubKey;
+    BOOST_CHECK(script.GetOp(pc, opcode, vchPubKey));
+    CBloomFilter filter(10, 0.0001, 0, BLOOM_UPDATE_NONE);
+    filter.insert(vchPubKey);
+    CBloomFilter filterEmpty(10, 0.0001, 0, BLOOM_UPDATE_NONE);
+
+    // all blocks in chain order, through a window smaller than the chain
+    {
+        CRescanPipeline pipeline(filter, &vIndex[0], 4, 3);
+        CRescanSlot *pslot;
+        int nHeight = 0;
+        while ((pslot = pipeline.Next()) != NULL) {
+            BOOST_CHECK(pslot->pindex == &vIndex[nHeight]);
+            BOOST_CHECK_EQUAL(pslot->fHaveBlock, nHeight == 0);
+            if (nHeight == 0) {
+                BOOST_CHECK(pslot->block.GetHash() == hashGenesisBlock);
+                BOOST_CHECK_EQUAL(pslot->vHash.size(), 1U);
+                BOOST_CHECK(pslot->vHash[0] == genesis.vtx[0].GetHash());
+                BOOST_CHECK(pslot->vMatch[0]);
+            } else
+                BOOST_CHECK(pslot->vHash.empty());
+            pipeline.Release();
+            nHeight++;
+        }
+        BOOST_CHECK_EQUAL(nHeight, nBlocks);
+        // and it stays at the end
+        BOOST_CHECK(pipeline.Next() == NULL);
+    }
+
+    // giving up part-way, while the reader waits for the window to free up
+    {
+        CRescanPipeline pipeline(filterEmpty, &vIndex[0], 4, 2);
+        for (int i = 0; i < 5; i++) {
+            CRescanSlot *pslot = pipeline.Next();
+            BOOST_REQUIRE(pslot != NULL);
+            BOOST_CHECK(pslot->pindex == &vIndex[i]);
+            if (i == 0)
+                BOOST_CHECK(!pslot->vMatch[0]);
+            pipeline.Release();
+        }
+        CRescanSlot *pslot = pipeline.Next();
+        BOOST_REQUIRE(pslot != NULL);
+        BOOST_CHECK(pslot->pindex == &vIndex[5]);
+    }
+
+    // starting at the tip, and past it
+    {
+        CRescanPipeline pipeline(filter, &vIndex[nBlocks - 1], 4, 1);
+        CRescanSlot *pslot = pipeline.Next();
+        BOOST_REQUIRE(pslot != NULL);
+        BOOST_CHECK(pslot->pindex == &vIndex[nBlocks - 1]);
+        pipeline.Release();
+        BOOST_CHECK(pipeline.Next() == NULL);
+    }
+    {
+        CRescanPipeline pipeline(filter, NULL, 4, 1);
+        BOOST_CHECK(pipeline.Next() == NULL);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, pubkey));
+
+    int64 nBalance = pwalletMain->GetBalance();
+    int64 nUnconfirmed = pwalletMain->GetUnconfirmedBalance();
+
+    // one output to us, one to someone else
+    CTransaction txCredit;
+    txCredit.vin.resize(1);
+    txCredit.vout.resize(2);
+    txCredit.vout[0].nValue = 5 * COIN;
+    txCredit.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
+    txCredit.vout[1].nValue = 7 * COIN;
+    txCredit.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    uint256 hashCredit = txCredit.GetHash();
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, txCredit)));
+
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 5 * COIN);
+
+    vector<COutput> vAvailable;
+    pwalletMain->AvailableCoins(vAvailable, false);
+    int nFound = 0;
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        if (out.tx->GetHash() == hashCredit)
+        {
+            BOOST_CHECK_EQUAL(out.i, 0);
+            nFound++;
+        }
+    BOOST_CHECK_EQUAL(nFound, 1);
+
+    // spending the output drops it from the index and the tallies
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(hashCredit, 0)));
+    txSpend.vout.push_back(CTxOut(5 * COIN, CScript() << OP_TRUE));
+    pwalletMain->WalletUpdateSpent(txSpend);
+
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+    pwalletMain->AvailableCoins(vAvailable, false);
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        BOOST_CHECK(out.tx->GetHash() != hashCredit);
+
+    BOOST_CHECK(pwalletMain->EraseFromWallet(hashCredit));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+}
+
+static void GetBalanceThread(int64 *pnBalance)
+{
+    *pnBalance = pwalletMain->GetBalance();
+}
+
+BOOST_AUTO_TEST_CASE(balance_without_cs_main)
+{
+    // once main has refreshed the tallies, a balance query does not wait for cs_main
+    int64 nBalance = -1;
+    boost::thread thread;
+    {
+        LOCK(cs_main);
+        pwalletMain->UpdatedBestChain();
+        thread = boost::thread(GetBalanceThread, &nBalance);
+        BOOST_CHECK(thread.timed_join(boost::posix_time::seconds(10)));
+    }
+    thread.join();
+    BOOST_CHECK_EQUAL(nBalance, pwalletMain->GetBalance());
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_import)
+{
+    CKey key, keyImport;
+    key.MakeNewKey(true);
+    keyImport.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, pubkey));
+    CScript redeem = CScript() << OP_1 << pubkey << OP_1 << OP_CHECKMULTISIG;
+
+    int64 nUnconfirmed = pwalletMain->GetUnconfirmedBalance();
+
+    // one output to us, one to a key imported later, and one to a script of
+    // ours that is added later
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(3);
+    tx.vout[0].nValue = 2 * COIN;
+    tx.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
+    tx.vout[1].nValue = 3 * COIN;
+    tx.vout[1].scriptPubKey.SetDestination(keyImport.GetPubKey().GetID());
+    tx.vout[2].nValue = 4 * COIN;
+    tx.vout[2].scriptPubKey.SetDestination(CScriptID(Hash160(redeem)));
+    uint256 hash = tx.GetHash();
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, tx)));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 2 * COIN);
+
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(keyImport, keyImport.GetPubKey()));
+    pwalletMain->MarkDirty(keyImport.GetPubKey().GetID());
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 5 * COIN);
+
+    BOOST_CHECK(pwalletMain->AddCScript(redeem));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 9 * COIN);
+
+    vector<COutput> vAvailable;
+    pwalletMain->AvailableCoins(vAvailable, false);
+    int nFound = 0;
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        if (out.tx->GetHash() == hash)
+            nFound++;
+    BOOST_CHECK_EQUAL(nFound, 3);
+
+    BOOST_CHECK(pwalletMain->EraseFromWallet(hash));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+}
+
+BOOST_AUTO_TEST_CASE(keypool_fill)
+{
+    // more than one batch, generated on the script check threads
+    mapArgs["-keypool"] = "2500";
+    BOOST_CHECK(pwalletMain->TopUpKeyPool());
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 2501);
+
+    unsigned int nDone, nTarget;
+    BOOST_CHECK(!pwalletMain->GetKeyPoolFillProgress(nDone, nTarget));
+
+    // every pool entry is on disk and its key is in the wallet, and no key is handed out twice
+    std::set<CKeyID> setKeys;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        BOOST_FOREACH(int64 nIndex, pwalletMain->setKeyPool)
+        {
+            CKeyPool keypool;
+            BOOST_CHECK(walletdb.ReadPool(nIndex, keypool));
+            BOOST_CHECK(pwalletMain->HaveKey(keypool.vchPubKey.GetID()));
+            setKeys.insert(keypool.vchPubKey.GetID());
+        }
+    }
+    BOOST_CHECK_EQUAL(setKeys.size(), 2501U);
+
+    // already full
+    BOOST_CHECK(pwalletMain->TopUpKeyPool());
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 2501);
+    mapArgs.erase("-keypool");
+}
+
+BOOST_AUTO_TEST_CASE(hd_chain)
+{
+    mapArgs["-keypool"] = "10";
+    CWallet walletHD("test_hdchain.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(walletHD.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK(fFirstRun);
+    BOOST_CHECK(walletHD.GenerateHDSeed());
+    BOOST_CHECK(!walletHD.GenerateHDSeed());
+    BOOST_CHECK_EQUAL(walletHD.GetKeyPoolSize(), 11);
+
+    // handed out in order, and the private key derived for signing matches
+    int64 nIndex;
+    CKeyPool keypool;
+    walletHD.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, -2);
+    walletHD.KeepKey(nIndex);
+    CPubKey pubkeyFirst = keypool.vchPubKey;
+    CKey key;
+    BOOST_CHECK(walletHD.GetKey(pubkeyFirst.GetID(), key));
+    BOOST_CHECK(key.GetPubKey() == pubkeyFirst);
+    BOOST_CHECK_EQUAL(walletHD.GetKeyPoolSize(), 11);
+
+    // a returned key is handed out again
+    walletHD.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, -3);
+    walletHD.ReturnKey(nIndex);
+    BOOST_CHECK_EQUAL(walletHD.GetHDChain().nNextIndex, 1U);
+
+    // a payment to the last key of the window moves the window along
+    CPubKey pubkeyLast;
+    BOOST_CHECK(!walletHD.GetHDPubKey(12, pubkeyLast));
+    BOOST_CHECK(walletHD.GetHDPubKey(11, pubkeyLast));
+    CTransaction tx;
+    tx.vout.push_back(CTxOut(COIN, CScript() << OP_DUP << OP_HASH160 << pubkeyLast.GetID() << OP_EQUALVERIFY << OP_CHECKSIG));
+    BOOST_CHECK(walletHD.AddToWallet(CWalletTx(&walletHD, tx)));
+    BOOST_CHECK_EQUAL(walletHD.GetHDChain().nNextIndex, 12U);
+    BOOST_CHECK_EQUAL(walletHD.GetHDChainSize(), 23U);
+    BOOST_CHECK(walletHD.IsMine(tx.vout[0]));
+    mapArgs.erase("-keypool");
+}
+
+BOOST_AUTO_TEST_CASE(hd_restore)
+{
+    mapArgs["-keypool"] = "10";
+    bool fFirstRun;
+    CWallet walletOld("test_hdold.dat");
+    BOOST_CHECK_EQUAL(walletOld.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK(walletOld.GenerateHDSeed());
+    int64 nIndex;
+    CKeyPool keypool;
+    walletOld.ReserveKeyFromKeyPool(nIndex, keypool);
+    walletOld.KeepKey(nIndex);
+    CKey seed;
+    BOOST_CHECK(walletOld.GetKey(walletOld.GetHDChain().seedID, seed));
+
+    // a wallet that already has keys of its own takes the seed, keeps its
+    // keys, and derives the keys of the old wallet
+    CWallet walletNew("test_hdnew.dat");
+    BOOST_CHECK_EQUAL(walletNew.LoadWallet(fFirstRun), DB_LOAD_OK);
+    CPubKey pubkeyOwn = walletNew.GenerateNewKey();
+    BOOST_CHECK(walletNew.SetHDSeed(seed));
+    BOOST_CHECK(!walletNew.SetHDSeed(seed));
+    BOOST_CHECK(walletNew.GetHDChain().seedID == walletOld.GetHDChain().seedID);
+    BOOST_CHECK(walletNew.HaveKey(pubkeyOwn.GetID()));
+    BOOST_CHECK(walletNew.HaveKey(keypool.vchPubKey.GetID()));
+    CKey key;
+    BOOST_CHECK(walletNew.GetKey(keypool.vchPubKey.GetID(), key));
+    BOOST_CHECK(key.GetPubKey() == keypool.vchPubKey);
+    mapArgs.erase("-keypool");
+}
+
+BOOST_AUTO_TEST_CASE(wallet_load_parallel)
+{
+    // a wallet file with enough records for several batches
+    string strFile = "test_walletload.dat";
+    std::vector<CPubKey> vPubKeys;
+    {
+        CWalletDB walletdb(strFile, "cr+");
+        BOOST_CHECK(walletdb.WriteVersion(CLIENT_VERSION));
+        for (int i = 0; i < 1000; i++)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            vPubKeys.push_back(key.GetPubKey());
+            BOOST_CHECK(walletdb.WriteKey(vPubKeys.back(), key.GetPrivKey()));
+            BOOST_CHECK(walletdb.WriteName(CBitcoinAddress(vPubKeys.back().GetID()).ToString(), strprintf("key%d", i)));
+        }
+        for (int i = 0; i < 2000; i++)
+        {
+            CTransaction tx;
+            tx.vin.push_back(CTxIn(COutPoint(uint256(i + 1), 0)));
+            tx.vout.push_back(CTxOut(CENT, CScript() << vPubKeys[i % 1000] << OP_CHECKSIG));
+            CWalletTx wtx(NULL, tx);
+            wtx.nOrderPos = i;
+            BOOST_CHECK(walletdb.WriteTx(tx.GetHash(), wtx));
+        }
+        BOOST_CHECK(walletdb.WriteOrderPosNext(2000));
+    }
+
+    // loads the same wallet with one worker and with several
+    const char* pszThreads[] = { "1", "4" };
+    for (unsigned int n = 0; n < 2; n++)
+    {
+        mapArgs["-walletloadthreads"] = pszThreads[n];
+        CWallet walletLoad(strFile);
+        bool fFirstRun;
+        BOOST_CHECK_EQUAL(walletLoad.LoadWallet(fFirstRun), DB_LOAD_OK);
+
+        BOOST_CHECK_EQUAL(walletLoad.mapWallet.size(), 2000U);
+        BOOST_CHECK_EQUAL(walletLoad.mapAddressBook.size(), 1000U);
+        BOOST_CHECK_EQUAL(walletLoad.nOrderPosNext, 2000);
+        std::set<CKeyID> setKeys;
+        walletLoad.GetKeys(setKeys);
+        BOOST_CHECK_EQUAL(setKeys.size(), 1000U);
+        BOOST_FOREACH(const CPubKey& pubkey, vPubKeys)
+            BOOST_CHECK(walletLoad.HaveKey(pubkey.GetID()));
+    }
+    mapArgs.erase("-walletloadthreads");
+}
+
+BOOST_AUTO_TEST_CASE(spend_index)
+{
+    CWallet walletSpends("test_spendindex.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(walletSpends.LoadWallet(fFirstRun), DB_LOAD_OK);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(walletSpends.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    CTransaction txFund;
+    txFund.vin.push_back(CTxIn(COutPoint(uint256(1), 0)));
+    txFund.vout.push_back(CTxOut(COIN, scriptMine));
+    txFund.vout.push_back(CTxOut(COIN, scriptMine));
+
+    // the spend arrives first: the funding output is marked spent when it shows up
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(txFund.GetHash(), 0)));
+    txSpend.vout.push_back(CTxOut(COIN / 2, CScript() << OP_TRUE));
+    BOOST_CHECK(walletSpends.AddToWallet(CWalletTx(&walletSpends, txSpend)));
+    BOOST_CHECK(walletSpends.AddToWallet(CWalletTx(&walletSpends, txFund)));
+    BOOST_CHECK(walletSpends.mapWallet[txFund.GetHash()].IsSpent(0));
+    BOOST_CHECK(!walletSpends.mapWallet[txFund.GetHash()].IsSpent(1));
+
+    // a double spend of the same output conflicts with the first spend, and back
+    CTransaction txDouble;
+    txDouble.vin.push_back(CTxIn(COutPoint(txFund.GetHash(), 0)));
+    txDouble.vin.push_back(CTxIn(COutPoint(txFund.GetHash(), 1)));
+    txDouble.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+    BOOST_CHECK(walletSpends.AddToWallet(CWalletTx(&walletSpends, txDouble)));
+    std::set<uint256> setConflicts = walletSpends.GetConflicts(txSpend.GetHash());
+    BOOST_CHECK_EQUAL(setConflicts.size(), 1U);
+    BOOST_CHECK(setConflicts.count(txDouble.GetHash()));
+    BOOST_CHECK(walletSpends.GetConflicts(txDouble.GetHash()).count(txSpend.GetHash()));
+    BOOST_CHECK(walletSpends.GetConflicts(txFund.GetHash()).empty());
+
+    // erased transactions leave the index
+    BOOST_CHECK(walletSpends.EraseFromWallet(txDouble.GetHash()));
+    BOOST_CHECK(walletSpends.GetConflicts(txSpend.GetHash()).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,321 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+
+#include "init.h"
+#include "walletdb.h"
+#include "walletlog.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(walletlog_tests)
+
+static vector<unsigned char> Key(const string& str)
+{
+    return vector<unsigned char>(str.begin(), str.end());
+}
+
+static void WriteRecord(CWalletLogBatch& batch, const string& strKey, const string& strValue)
+{
+    batch.Write(strKey.data(), strKey.data() + strKey.size(), strValue.data(), strValue.data() + strValue.size());
+}
+
+static string ReadFileBytes(const boost::filesystem::path& path)
+{
+    ifstream file(path.string().c_str(), ios::in | ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static void CheckPool(const string& strFile, int64 nCount, const CPubKey& pubkey)
+{
+    CWalletDB walletdb(strFile, "r");
+    for (int64 i = 0; i < nCount; i++)
+    {
+        CKeyPool keypool;
+        BOOST_CHECK(walletdb.ReadPool(i, keypool));
+        BOOST_CHECK(keypool.vchPubKey == pubkey);
+    }
+}
+
+static string ReadRecord(const CWalletLog& log, const string& strKey)
+{
+    CSerializeData vchValue;
+    if (!log.Read(Key(strKey), vchValue))
+        return "";
+    return string(vchValue.begin(), vchValue.end());
+}
+
+static CDataStream Stream(const string& str)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.write(str.data(), str.size());
+    return ss;
+}
+
+static bool StorageWrite(CDBStorage& storage, const string& strKey, const string& strValue, bool fOverwrite=true)
+{
+    CDataStream ssKey = Stream(strKey), ssValue = Stream(strValue);
+    return storage.Write(ssKey, ssValue, fOverwrite);
+}
+
+static string StorageRead(CDBStorage& storage, const string& strKey)
+{
+    CDataStream ssKey = Stream(strKey), ssValue(SER_DISK, CLIENT_VERSION);
+    if (!storage.Read(ssKey, ssValue))
+        return "";
+    return ssValue.str();
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_roundtrip)
+{
+    boost::filesystem::path path = GetDataDir() / "test_walletlog_roundtrip.dat";
+    {
+        CWalletLog log;
+        BOOST_CHECK(!log.Open(path, false));
+        BOOST_CHECK(log.Open(path, true));
+        BOOST_CHECK(CWalletLog::IsLogFile(path));
+
+        CWalletLogBatch batch;
+        WriteRecord(batch, "b", "2");
+        WriteRecord(batch, "a", "1");
+        WriteRecord(batch, "c", "3");
+        BOOST_CHECK(log.Commit(batch, true));
+
+        CWalletLogBatch batch2;
+        WriteRecord(batch2, "a", "one");
+        string strErase = "c";
+        batch2.Erase(strErase.data(), strErase.data() + strErase.size());
+        BOOST_CHECK(log.Commit(batch2, false));
+        BOOST_CHECK(log.Sync());
+        log.Close();
+    }
+
+    CWalletLog log;
+    BOOST_CHECK(log.Open(path, false));
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 2U);
+    BOOST_CHECK_EQUAL(ReadRecord(log, "a"), "one");
+    BOOST_CHECK_EQUAL(ReadRecord(log, "b"), "2");
+    BOOST_CHECK(!log.Exists(Key("c")));
+
+    // keys come back in byte order
+    vector<unsigned char> vchKey;
+    CSerializeData vchValue;
+    BOOST_CHECK(log.Seek(Key(""), true, vchKey, vchValue));
+    BOOST_CHECK(vchKey == Key("a"));
+    BOOST_CHECK(log.Seek(vchKey, false, vchKey, vchValue));
+    BOOST_CHECK(vchKey == Key("b"));
+    BOOST_CHECK(!log.Seek(vchKey, false, vchKey, vchValue));
+    log.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_torn_tail)
+{
+    boost::filesystem::path path = GetDataDir() / "test_walletlog_torn.dat";
+    uint64 nGoodSize;
+    {
+        CWalletLog log;
+        BOOST_CHECK(log.Open(path, true));
+        CWalletLogBatch batch;
+        WriteRecord(batch, "key", "value");
+        BOOST_CHECK(log.Commit(batch, true));
+        nGoodSize = log.GetFileSize();
+
+        CWalletLogBatch batch2;
+        WriteRecord(batch2, "key2", "value2");
+        BOOST_CHECK(log.Commit(batch2, true));
+        log.Close();
+    }
+
+    // cut the second frame short, as a crash in the middle of an append would
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 3);
+    {
+        CWalletLog log;
+        BOOST_CHECK(log.Open(path, false));
+        BOOST_CHECK_EQUAL(ReadRecord(log, "key"), "value");
+        BOOST_CHECK(!log.Exists(Key("key2")));
+        BOOST_CHECK_EQUAL(log.GetFileSize(), nGoodSize);
+        log.Close();
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nGoodSize);
+
+    // a complete frame with a bad checksum is dropped the same way
+    {
+        FILE* file = fopen(path.string().c_str(), "ab");
+        const unsigned char garbage[] = { 5, 0, 0, 0, 1, 2, 3, 4, 'x', 'x', 'x', 'x', 'x' };
+        fwrite(garbage, 1, sizeof(garbage), file);
+        fclose(file);
+    }
+    CWalletLog log;
+    BOOST_CHECK(log.Open(path, false));
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 1U);
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nGoodSize);
+    log.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_compact)
+{
+    boost::filesystem::path path = GetDataDir() / "test_walletlog_compact.dat";
+    CWalletLog log;
+    BOOST_CHECK(log.Open(path, true));
+
+    // overwrite the same records until the garbage dominates the file
+    string strValue(1000, 'v');
+    for (int nRound = 0; !log.NeedsCompaction(); nRound++)
+    {
+        BOOST_REQUIRE(nRound < 10000);
+        CWalletLogBatch batch;
+        for (int i = 0; i < 10; i++)
+            WriteRecord(batch, strprintf("key%d", i), strValue + strprintf("%d", nRound));
+        BOOST_CHECK(log.Commit(batch, false));
+    }
+    uint64 nSizeBefore = log.GetFileSize();
+    string strLast = ReadRecord(log, "key7");
+    BOOST_CHECK(log.Compact());
+    BOOST_CHECK(log.GetFileSize() < nSizeBefore / 10);
+    BOOST_CHECK(!log.NeedsCompaction());
+    BOOST_CHECK_EQUAL(ReadRecord(log, "key7"), strLast);
+
+    // the compacted file can still be appended to and replayed
+    CWalletLogBatch batch;
+    WriteRecord(batch, "after", "compaction");
+    BOOST_CHECK(log.Commit(batch, true));
+    log.Close();
+    BOOST_CHECK(log.Open(path, false));
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 11U);
+    BOOST_CHECK_EQUAL(ReadRecord(log, "key7"), strLast);
+    BOOST_CHECK_EQUAL(ReadRecord(log, "after"), "compaction");
+    log.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_damaged_frame)
+{
+    boost::filesystem::path path = GetDataDir() / "test_walletlog_damaged.dat";
+    uint64 nFirstFrameEnd;
+    {
+        CWalletLog log;
+        BOOST_CHECK(log.Open(path, true));
+        CWalletLogBatch batch;
+        WriteRecord(batch, "key", "value");
+        BOOST_CHECK(log.Commit(batch, true));
+        nFirstFrameEnd = log.GetFileSize();
+
+        CWalletLogBatch batch2;
+        WriteRecord(batch2, "key2", "value2");
+        BOOST_CHECK(log.Commit(batch2, true));
+        log.Close();
+    }
+
+    // damage the first frame: a frame followed by others is not a torn
+    // append, so the log refuses to open and leaves the file as it was
+    {
+        FILE* file = fopen(path.string().c_str(), "r+b");
+        fseek(file, nFirstFrameEnd - 1, SEEK_SET);
+        int c = fgetc(file);
+        fseek(file, nFirstFrameEnd - 1, SEEK_SET);
+        fputc(c ^ 0xff, file);
+        fclose(file);
+    }
+    string strBefore = ReadFileBytes(path);
+    CWalletLog log;
+    BOOST_CHECK(!log.Open(path, false));
+    BOOST_CHECK(ReadFileBytes(path) == strBefore);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_storage)
+{
+    // the calls CDB makes on a log-structured file
+    boost::filesystem::path path = GetDataDir() / "test_walletlog_storage.dat";
+    CWalletLog log;
+    BOOST_CHECK(log.Open(path, true));
+    CDBStorage* pstorage = new CWalletLogStorage(&log);
+
+    // outside of a transaction every change is committed at once
+    BOOST_CHECK(StorageWrite(*pstorage, "a", "1"));
+    BOOST_CHECK_EQUAL(ReadRecord(log, "a"), "1");
+    BOOST_CHECK(!StorageWrite(*pstorage, "a", "x", false));
+    BOOST_CHECK_EQUAL(StorageRead(*pstorage, "a"), "1");
+
+    // a transaction sees its own changes, and an aborted one leaves no trace
+    BOOST_CHECK(pstorage->TxnBegin());
+    BOOST_CHECK(!pstorage->TxnBegin());
+    BOOST_CHECK(StorageWrite(*pstorage, "b", "2"));
+    CDataStream ssKey = Stream("a");
+    BOOST_CHECK(pstorage->Erase(ssKey));
+    BOOST_CHECK_EQUAL(StorageRead(*pstorage, "b"), "2");
+    ssKey = Stream("a");
+    BOOST_CHECK(!pstorage->Exists(ssKey));
+    BOOST_CHECK(!log.Exists(Key("b")));
+    BOOST_CHECK(pstorage->TxnAbort());
+    BOOST_CHECK_EQUAL(StorageRead(*pstorage, "a"), "1");
+    BOOST_CHECK_EQUAL(StorageRead(*pstorage, "b"), "");
+
+    BOOST_CHECK(pstorage->TxnBegin());
+    BOOST_CHECK(StorageWrite(*pstorage, "c", "3"));
+    BOOST_CHECK(StorageWrite(*pstorage, "b", "2"));
+    BOOST_CHECK(pstorage->TxnCommit());
+    BOOST_CHECK(!pstorage->TxnCommit());
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 3U);
+
+    // cursors walk the records in key order
+    CDBCursor* pcursor = pstorage->GetCursor();
+    BOOST_REQUIRE(pcursor);
+    CDataStream ssCursorKey = Stream("b"), ssValue(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_EQUAL(pcursor->Read(ssCursorKey, ssValue, DB_SET_RANGE), 0);
+    BOOST_CHECK_EQUAL(ssCursorKey.str(), "b");
+    BOOST_CHECK_EQUAL(ssValue.str(), "2");
+    BOOST_CHECK_EQUAL(pcursor->Read(ssCursorKey, ssValue, DB_NEXT), 0);
+    BOOST_CHECK_EQUAL(ssCursorKey.str(), "c");
+    BOOST_CHECK_EQUAL(pcursor->Read(ssCursorKey, ssValue, DB_NEXT), DB_NOTFOUND);
+    BOOST_CHECK_EQUAL(pcursor->Read(ssCursorKey, ssValue, DB_SET), WALLETLOG_CURSOR_UNSUPPORTED);
+    delete pcursor;
+
+    delete pstorage;
+    log.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_convert_backend)
+{
+    // a Berkeley DB file (in the mock environment here) converted to the log
+    // and back keeps its records, with the original kept aside each time
+    string strFile = "test_walletlog_convert.dat";
+    CPubKey pubkey = pwalletMain->GenerateNewKey();
+    {
+        CWalletDB walletdb(strFile, "cr+");
+        for (int64 i = 0; i < 10; i++)
+            BOOST_CHECK(walletdb.WritePool(i, CKeyPool(pubkey)));
+    }
+
+    SetMockTime(1400000000);
+    BOOST_CHECK(CDB::ConvertBackend(strFile, true));
+    BOOST_CHECK(CWalletLog::IsLogFile(GetDataDir() / strFile));
+    CheckPool(strFile, 10, pubkey);
+    // converting to the backend a file already uses does nothing
+    BOOST_CHECK(CDB::ConvertBackend(strFile, true));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / (strFile + ".1400000000.bak")));
+
+    SetMockTime(1400000001);
+    BOOST_CHECK(CDB::ConvertBackend(strFile, false));
+    BOOST_CHECK(!CWalletLog::IsLogFile(GetDataDir() / strFile));
+    CheckPool(strFile, 10, pubkey);
+    SetMockTime(0);
+
+    // the log it was converted from
+    boost::filesystem::path pathLogBackup = GetDataDir() / (strFile + ".1400000001.bak");
+    BOOST_CHECK(CWalletLog::IsLogFile(pathLogBackup));
+    boost::filesystem::remove(pathLogBackup);
+
+    // and the in-memory Berkeley DB file the log was made from
+    string strBackup = strFile + ".1400000000.bak";
+    bitdb.CloseDb(strFile);
+    bitdb.mapFileUseCount.erase(strFile);
+    BOOST_CHECK(bitdb.dbenv.dbremove(NULL, NULL, strBackup.c_str(), DB_AUTO_COMMIT) == 0);
+    BOOST_CHECK(bitdb.dbenv.dbremove(NULL, NULL, strFile.c_str(), DB_AUTO_COMMIT) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -107,6 +107,17 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotLoading(const std::string &strPath) {
+    if (strPath.empty())
+        return Erase('S');
+    else
+        return Write('S', strPath);
+}
+
+bool CBlockTreeDB::ReadSnapshotLoading(std::string &strPath) {
+    return Read('S', strPath);
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
@@ -119,6 +130,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
     stats.hashBlock = GetBestBlock()->GetBlockHash();
     ss << stats.hashBlock;
     int64 nTotalAmount = 0;
+    CCoinsCommitment commit;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -138,6 +150,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
                 ss << (coins.fCoinBase ? 'c' : 'n'); 
                 ss << VARINT(coins.nHeight);
                 stats.nTransactions++;
+                commit.AddTransaction();
                 for (unsigned int i=0; i<coins.vout.size(); i++) {
                     const CTxOut &out = coins.vout[i];
                     if (!out.IsNull()) {
@@ -145,6 +158,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
                         ss << VARINT(i+1);
                         ss << out;
                         nTotalAmount += out.nValue;
+                        commit.AddOutput(txhash, i, coins.nHeight, coins.fCoinBase, out);
                     }
                 }
                 stats.nSerializedSize += 32 + slValue.size();
@@ -159,6 +173,122 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
     stats.nHeight = GetBestBlock()->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
+    stats.hashMuHash = commit.muhash.Finalize();
+
+    // Seed the incrementally maintained commitment, so later blocks can extend it
+    if (!pblocktree->WriteCoinsCommitment(stats.hashBlock, commit))
+        return error("%s() : failed to write UTXO set commitment", __PRETTY_FUNCTION__);
+    return true;
+}
+
+// Write one snapshot chunk: the serialized records followed by their checksum
+void static WriteSnapshotChunk(CAutoFile &fileout, CDataStream &ssChunk, unsigned int nCount) {
+    CDataStream ssOut(SER_DISK, CLIENT_VERSION);
+    WriteCompactSize(ssOut, nCount);
+    ssOut.write(&ssChunk[0], ssChunk.size());
+    std::vector<unsigned char> vchChunk(ssOut.begin(), ssOut.end());
+    fileout << vchChunk;
+    fileout << Hash(vchChunk.begin(), vchChunk.end());
+    ssChunk.clear();
+}
+
+bool CCoinsViewDB::DumpSnapshot(CAutoFile &fileout, uint64 &nCoins, CCoinsCommitment &commit) {
+    leveldb::Iterator *pcursor = db.NewIterator();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('c', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+
+    nCoins = 0;
+    commit.SetNull();
+    CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+    unsigned int nChunk = 0;
+    try {
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'c')
+                break;
+            uint256 txhash;
+            ssKey >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+
+            commit.AddTransaction();
+            for (unsigned int i=0; i<coins.vout.size(); i++)
+                if (!coins.vout[i].IsNull())
+                    commit.AddOutput(txhash, i, coins.nHeight, coins.fCoinBase, coins.vout[i]);
+
+            ssChunk << txhash << coins;
+            nCoins++;
+            if (++nChunk == SNAPSHOT_CHUNK_COINS) {
+                WriteSnapshotChunk(fileout, ssChunk, nChunk);
+                nChunk = 0;
+            }
+            pcursor->Next();
+        }
+        if (nChunk > 0)
+            WriteSnapshotChunk(fileout, ssChunk, nChunk);
+    } catch (std::exception &e) {
+        delete pcursor;
+        return error("%s() : %s", __PRETTY_FUNCTION__, e.what());
+    }
+    delete pcursor;
+    return true;
+}
+
+bool CCoinsViewDB::LoadSnapshot(CAutoFile &filein, uint64 nCoins, CCoinsCommitment &commit, bool fWrite) {
+    commit.SetNull();
+    uint64 nRead = 0;
+    uint256 hashPrev = 0;
+    try {
+        while (nRead < nCoins) {
+            boost::this_thread::interruption_point();
+            std::vector<unsigned char> vchChunk;
+            uint256 hashChunk;
+            filein >> vchChunk;
+            filein >> hashChunk;
+            if (Hash(vchChunk.begin(), vchChunk.end()) != hashChunk)
+                return error("%s() : checksum mismatch in chunk after %"PRI64u" coins", __PRETTY_FUNCTION__, nRead);
+
+            CDataStream ssChunk(vchChunk, SER_DISK, CLIENT_VERSION);
+            uint64 nCount = ReadCompactSize(ssChunk);
+            if (nCount == 0 || nCount > SNAPSHOT_CHUNK_COINS || nRead + nCount > nCoins)
+                return error("%s() : invalid chunk size %"PRI64u, __PRETTY_FUNCTION__, nCount);
+
+            // Records are in database key order, so each chunk is one sorted batch
+            // that goes straight to LevelDB instead of through the coins cache.
+            CLevelDBBatch batch;
+            for (uint64 n = 0; n < nCount; n++) {
+                uint256 txhash;
+                CCoins coins;
+                ssChunk >> txhash >> coins;
+                if (nRead + n > 0 && memcmp(txhash.begin(), hashPrev.begin(), 32) <= 0)
+                    return error("%s() : coins out of order at %s", __PRETTY_FUNCTION__, txhash.ToString().c_str());
+                if (coins.IsPruned())
+                    return error("%s() : spent coins %s in snapshot", __PRETTY_FUNCTION__, txhash.ToString().c_str());
+                hashPrev = txhash;
+
+                commit.AddTransaction();
+                for (unsigned int i=0; i<coins.vout.size(); i++)
+                    if (!coins.vout[i].IsNull())
+                        commit.AddOutput(txhash, i, coins.nHeight, coins.fCoinBase, coins.vout[i]);
+                if (fWrite)
+                    BatchWriteCoins(batch, txhash, coins);
+            }
+            if (!ssChunk.empty())
+                return error("%s() : trailing data in chunk", __PRETTY_FUNCTION__);
+            if (fWrite && !db.WriteBatch(batch))
+                return error("%s() : failed to write coins", __PRETTY_FUNCTION__);
+            nRead += nCount;
+        }
+    } catch (std::exception &e) {
+        return error("%s() : %s", __PRETTY_FUNCTION__, e.what());
+    }
     return true;
 }
 
@@ -173,6 +303,14 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadCoinsCommitment(const uint256 &hashBlock, CCoinsCommitment &commit) {
+    return Read(make_pair('s', hashBlock), commit);
+}
+
+bool CBlockTreeDB::WriteCoinsCommitment(const uint256 &hashBlock, const CCoinsCommitment &commit) {
+    return Write(make_pair('s', hashBlock), commit);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -241,3 +379,162 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     return true;
 }
+
+CAddressIndexDB::CAddressIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "addrindex", nCacheSize, fMemory, fWipe) {
+    hashBestBlock = 0;
+}
+
+void CAddressIndexDB::UpdateBlock(const CAddressHistory &vHistory, bool fErase, const CAddressUnspentMap &mapUnspent, const uint256 &hashBlock) {
+    for (CAddressHistory::const_iterator it = vHistory.begin(); it != vHistory.end(); it++)
+        vHistoryChanges.push_back(make_pair(*it, fErase));
+    for (CAddressUnspentMap::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); it++) {
+        bool fSpent = it->second.IsNull();
+        std::map<CAddressUnspentKey, CCacheEntry<CAddressUnspentValue> >::iterator itCache = cacheUnspent.find(it->first);
+        if (itCache == cacheUnspent.end()) {
+            // Without a change since the last flush, the database holds the
+            // output as of the block it is up to date with: an output added
+            // now was not unspent then, one being spent was
+            CCacheEntry<CAddressUnspentValue> &entry = cacheUnspent[it->first];
+            entry.value = it->second;
+            entry.fErase = fSpent;
+            entry.fFresh = !fSpent;
+        } else if (fSpent && itCache->second.fFresh) {
+            cacheUnspent.erase(itCache);
+        } else {
+            itCache->second.value = it->second;
+            itCache->second.fErase = fSpent;
+        }
+    }
+    hashBestBlock = hashBlock;
+}
+
+bool CAddressIndexDB::Flush() {
+    if (hashBestBlock == 0)
+        return true;
+    CLevelDBBatch batch;
+    for (unsigned int i = 0; i < vHistoryChanges.size(); i++) {
+        if (vHistoryChanges[i].second)
+            batch.Erase(make_pair('a', vHistoryChanges[i].first.first));
+        else
+            batch.Write(make_pair('a', vHistoryChanges[i].first.first), vHistoryChanges[i].first.second);
+    }
+    for (std::map<CAddressUnspentKey, CCacheEntry<CAddressUnspentValue> >::const_iterator it = cacheUnspent.begin(); it != cacheUnspent.end(); it++) {
+        if (it->second.fErase)
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second.value);
+    }
+    batch.Write('B', hashBestBlock);
+    if (!WriteBatch(batch))
+        return false;
+    ClearCache();
+    return true;
+}
+
+void CAddressIndexDB::ClearCache() {
+    vHistoryChanges.clear();
+    cacheUnspent.clear();
+    hashBestBlock = 0;
+}
+
+bool CAddressIndexDB::ReadBestBlock(uint256 &hashBlock) {
+    return Read('B', hashBlock);
+}
+
+bool CAddressIndexDB::ReadAddressHistory(const uint160 &hashScript, int nStartHeight, int nEndHeight, CAddressHistory &vHistory) {
+    leveldb::Iterator *pcursor = NewIterator();
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('a', CAddressIndexKey(hashScript, nStartHeight, 0, 0, false));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressIndexKey key;
+            ssKey >> chType;
+            if (chType != 'a')
+                break;
+            ssKey >> key;
+            if (key.hashScript != hashScript || key.nHeight > nEndHeight)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            int64 nDelta;
+            ssValue >> nDelta;
+            vHistory.push_back(make_pair(key, nDelta));
+            pcursor->Next();
+        } catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+    delete pcursor;
+
+    // changes not written yet override the database
+    if (vHistoryChanges.empty())
+        return true;
+    std::map<CAddressIndexKey, int64> mapHistory(vHistory.begin(), vHistory.end());
+    for (unsigned int i = 0; i < vHistoryChanges.size(); i++) {
+        const CAddressIndexKey &key = vHistoryChanges[i].first.first;
+        if (key.hashScript != hashScript || key.nHeight < nStartHeight || key.nHeight > nEndHeight)
+            continue;
+        if (vHistoryChanges[i].second)
+            mapHistory.erase(key);
+        else
+            mapHistory[key] = vHistoryChanges[i].first.second;
+    }
+    vHistory.assign(mapHistory.begin(), mapHistory.end());
+    return true;
+}
+
+bool CAddressIndexDB::ReadAddressUnspent(const uint160 &hashScript, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent) {
+    leveldb::Iterator *pcursor = NewIterator();
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('u', CAddressUnspentKey(hashScript, 0, 0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressUnspentKey key;
+            ssKey >> chType;
+            if (chType != 'u')
+                break;
+            ssKey >> key;
+            if (key.hashScript != hashScript)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspent.push_back(make_pair(key, value));
+            pcursor->Next();
+        } catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+    delete pcursor;
+
+    // changes not written yet override the database
+    if (cacheUnspent.empty())
+        return true;
+    std::map<CAddressUnspentKey, CAddressUnspentValue> mapUnspent(vUnspent.begin(), vUnspent.end());
+    std::map<CAddressUnspentKey, CCacheEntry<CAddressUnspentValue> >::const_iterator it = cacheUnspent.lower_bound(CAddressUnspentKey(hashScript, 0, 0));
+    for (; it != cacheUnspent.end() && it->first.hashScript == hashScript; it++) {
+        if (it->second.fErase)
+            mapUnspent.erase(it->first);
+        else
+            mapUnspent[it->first] = it->second.value;
+    }
+    vUnspent.assign(mapUnspent.begin(), mapUnspent.end());
+    return true;
+}
@@ -8,6 +8,64 @@
 #include "main.h"
 #include "leveldb.h"
 
+/** Number of coin records per checksummed chunk of a UTXO set snapshot */
+static const unsigned int SNAPSHOT_CHUNK_COINS = 16384;
+
+/** Header of a UTXO set snapshot file (see dumptxoutset/loadtxoutset)
+ *
+ * The header is followed by the coin database records in key order, grouped
+ * in chunks of up to SNAPSHOT_CHUNK_COINS. Each chunk is a byte vector holding
+ * VARINT(count) and count (txid, CCoins) pairs, followed by the double-SHA256
+ * of that vector. CCoins uses the CTxOutCompressor encoding, so the snapshot is
+ * about as compact as the chainstate itself.
+ *
+ * The transaction counts are not covered by the compiled-in snapshot hashes;
+ * they only feed nChainTx, for progress estimates.
+ */
+class CSnapshotHeader
+{
+public:
+    static const int CURRENT_VERSION = 2;
+    int nVersion;
+    unsigned char pchNetwork[4];        // pchMessageStart of the network the snapshot belongs to
+    uint256 hashBlock;                  // block whose UTXO set this is
+    int nHeight;
+    uint64 nCoins;                      // number of (txid, CCoins) records
+    uint256 hashCoins;                  // digest of the unspent outputs (see CCoinsCommitment)
+    std::vector<CBlockHeader> vHeaders; // main chain headers from height 1 up to hashBlock
+    std::vector<unsigned int> vTxCounts; // number of transactions in each of vHeaders
+
+    CSnapshotHeader()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(FLATDATA(pchNetwork));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nCoins);
+        READWRITE(hashCoins);
+        READWRITE(vHeaders);
+        READWRITE(vTxCounts);
+    )
+
+    void SetNull()
+    {
+        nVersion = CSnapshotHeader::CURRENT_VERSION;
+        memset(pchNetwork, 0, sizeof(pchNetwork));
+        hashBlock = 0;
+        nHeight = 0;
+        nCoins = 0;
+        hashCoins = 0;
+        vHeaders.clear();
+        vTxCounts.clear();
+    }
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -23,8 +81,18 @@ public:
     bool SetBestBlock(CBlockIndex *pindex);
     bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
+
+    // Write all coins to a snapshot file in chunks, computing their commitment
+    bool DumpSnapshot(CAutoFile &fileout, uint64 &nCoins, CCoinsCommitment &commit);
+
+    // Read the chunks of a snapshot file, verifying their checksums and computing the
+    // commitment of the coins. If fWrite, the coins are also bulk-loaded into the database.
+    bool LoadSnapshot(CAutoFile &filein, uint64 nCoins, CCoinsCommitment &commit, bool fWrite);
 };
 
+/** Global variable that points to the coin database (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDB
 {
@@ -43,11 +111,202 @@ public:
     bool WriteLastBlockFile(int nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    bool WriteSnapshotLoading(const std::string &strPath);
+    bool ReadSnapshotLoading(std::string &strPath);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadCoinsCommitment(const uint256 &hashBlock, CCoinsCommitment &commit);
+    bool WriteCoinsCommitment(const uint256 &hashBlock, const CCoinsCommitment &commit);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
 };
 
+/** Key of an address index history entry: one output paid to, or one input
+ *  spending from a script at a given height. The height is serialized
+ *  big-endian, so the entries of a script are ordered by height in LevelDB.
+ */
+class CAddressIndexKey
+{
+public:
+    uint160 hashScript;   // Hash160 of the scriptPubKey
+    int nHeight;
+    uint256 txid;         // transaction creating (resp. spending) the output
+    unsigned int nIndex;  // output (resp. input) index in txid
+    bool fSpending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(const uint160 &hashScriptIn, int nHeightIn, const uint256 &txidIn, unsigned int nIndexIn, bool fSpendingIn) :
+        hashScript(hashScriptIn), nHeight(nHeightIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    void SetNull()
+    {
+        hashScript = 0;
+        nHeight = 0;
+        txid = 0;
+        nIndex = 0;
+        fSpending = false;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 20 + 4 + 32 + 4 + 1;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const
+    {
+        hashScript.Serialize(s, nType, nVersion);
+        unsigned char pchHeight[4] = { (unsigned char)(nHeight >> 24), (unsigned char)(nHeight >> 16),
+                                       (unsigned char)(nHeight >> 8), (unsigned char)nHeight };
+        s.write((const char*)pchHeight, sizeof(pchHeight));
+        txid.Serialize(s, nType, nVersion);
+        ::Serialize(s, nIndex, nType, nVersion);
+        ::Serialize(s, fSpending, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion)
+    {
+        hashScript.Unserialize(s, nType, nVersion);
+        unsigned char pchHeight[4];
+        s.read((char*)pchHeight, sizeof(pchHeight));
+        nHeight = (pchHeight[0] << 24) | (pchHeight[1] << 16) | (pchHeight[2] << 8) | pchHeight[3];
+        txid.Unserialize(s, nType, nVersion);
+        ::Unserialize(s, nIndex, nType, nVersion);
+        ::Unserialize(s, fSpending, nType, nVersion);
+    }
+
+    friend bool operator<(const CAddressIndexKey &a, const CAddressIndexKey &b)
+    {
+        if (a.hashScript != b.hashScript)
+            return a.hashScript < b.hashScript;
+        if (a.nHeight != b.nHeight)
+            return a.nHeight < b.nHeight;
+        if (a.txid != b.txid)
+            return a.txid < b.txid;
+        if (a.nIndex != b.nIndex)
+            return a.nIndex < b.nIndex;
+        return a.fSpending < b.fSpending;
+    }
+};
+
+/** Key of an unspent output in the address index */
+class CAddressUnspentKey
+{
+public:
+    uint160 hashScript;
+    uint256 txid;
+    unsigned int nIndex;
+
+    CAddressUnspentKey() : hashScript(0), txid(0), nIndex(0) {}
+    CAddressUnspentKey(const uint160 &hashScriptIn, const uint256 &txidIn, unsigned int nIndexIn) :
+        hashScript(hashScriptIn), txid(txidIn), nIndex(nIndexIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(hashScript);
+        READWRITE(txid);
+        READWRITE(nIndex);
+    )
+
+    friend bool operator<(const CAddressUnspentKey &a, const CAddressUnspentKey &b)
+    {
+        if (a.hashScript != b.hashScript)
+            return a.hashScript < b.hashScript;
+        if (a.txid != b.txid)
+            return a.txid < b.txid;
+        return a.nIndex < b.nIndex;
+    }
+};
+
+/** An unspent output in the address index; null marks an output that was spent */
+class CAddressUnspentValue
+{
+public:
+    int64 nValue;
+    CScript scriptPubKey;
+    int nHeight;
+
+    CAddressUnspentValue()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentValue(int64 nValueIn, const CScript &scriptPubKeyIn, int nHeightIn) :
+        nValue(nValueIn), scriptPubKey(scriptPubKeyIn), nHeight(nHeightIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(scriptPubKey);
+        READWRITE(nHeight);
+    )
+
+    void SetNull()
+    {
+        nValue = -1;
+        scriptPubKey.clear();
+        nHeight = 0;
+    }
+
+    bool IsNull() const
+    {
+        return nValue == -1;
+    }
+};
+
+typedef std::vector<std::pair<CAddressIndexKey, int64> > CAddressHistory;
+typedef std::map<CAddressUnspentKey, CAddressUnspentValue> CAddressUnspentMap;
+
+/** Access to the optional address index database (addrindex/). The changes
+ *  of connected and disconnected blocks are cached in memory and written
+ *  after the coins (see Flush), so the unspent entries of outputs that are
+ *  created and spent in between never reach the database. The database
+ *  records the block it is up to date with.
+ */
+class CAddressIndexDB : public CLevelDB
+{
+public:
+    CAddressIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CAddressIndexDB(const CAddressIndexDB&);
+    void operator=(const CAddressIndexDB&);
+
+    /** A change not written yet: a new value, or an erase. A fresh entry is
+     *  not in the database, so erasing it just drops the change. */
+    template<typename T>
+    struct CCacheEntry
+    {
+        T value;
+        bool fErase;
+        bool fFresh;
+    };
+
+    // History entries are only erased again by a reorg: their changes are
+    // kept in order, true for an erase, and written in that order
+    std::vector<std::pair<std::pair<CAddressIndexKey, int64>, bool> > vHistoryChanges;
+    std::map<CAddressUnspentKey, CCacheEntry<CAddressUnspentValue> > cacheUnspent;
+    uint256 hashBestBlock;  // block the cached changes lead to, 0 if there are none
+public:
+    // Cache the changes of one block, after which the index is up to date with
+    // hashBlock; fErase removes the history entries instead (disconnect)
+    void UpdateBlock(const CAddressHistory &vHistory, bool fErase, const CAddressUnspentMap &mapUnspent, const uint256 &hashBlock);
+    // Write the cached changes and the block they lead to in one batch
+    bool Flush();
+    // Drop the cached changes, leaving the index at the block it has on disk
+    void ClearCache();
+    bool ReadBestBlock(uint256 &hashBlock);
+    // History of a script between two heights (inclusive), ordered by height
+    bool ReadAddressHistory(const uint160 &hashScript, int nStartHeight, int nEndHeight, CAddressHistory &vHistory);
+    bool ReadAddressUnspent(const uint160 &hashScript, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent);
+};
+
+/** Global variable that points to the address index, if enabled (protected by cs_main) */
+extern CAddressIndexDB *paddressindex;
+
 #endif // BITCOIN_TXDB_LEVELDB_H
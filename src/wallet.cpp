@@ -9,6 +9,8 @@
 #include "ui_interface.h"
 #include "base58.h"
 #include "coincontrol.h"
+#include "bloom.h"
+#include "coinselection.h"
 #include <boost/algorithm/string/replace.hpp>
 
 using namespace std;
@@ -81,15 +83,131 @@ bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigne
     return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
 }
 
+// number of keys derived ahead of the last one handed out
+static unsigned int GetHDLookahead()
+{
+    return max(GetArg("-keypool", 100), 0LL) + 1;
+}
+
+bool CWallet::GenerateHDSeed()
+{
+    RandAddSeedPerfmon();
+    CKey seed;
+    seed.MakeNewKey(true);
+    return SetHDSeed(seed);
+}
+
+bool CWallet::SetHDSeed(const CKey &seed)
+{
+    LOCK(cs_wallet);
+    if (IsHDEnabled())
+        return error("CWallet::SetHDSeed() : wallet already has a deterministic chain");
+    if (IsLocked())
+        return false;
+
+    CPubKey pubkeySeed = seed.GetPubKey();
+    CExtKey master, account, chain;
+    master.SetMaster(seed.begin(), seed.size());
+    if (!master.Derive(account, 0 | BIP32_HARDENED) || !account.Derive(chain, 0))
+        return error("CWallet::SetHDSeed() : derivation failed");
+
+    CHDChain hdChainNew;
+    hdChainNew.seedID = pubkeySeed.GetID();
+    hdChainNew.vchChainPubKey.resize(BIP32_EXTKEY_SIZE);
+    chain.Neuter().Encode(&hdChainNew.vchChainPubKey[0]);
+
+    // the seed is stored (and encrypted) like any other key; a restored seed
+    // may have been imported already
+    SetMinVersion(FEATURE_HD);
+    if (!HaveKey(hdChainNew.seedID) && !AddKeyPubKey(seed, pubkeySeed))
+        return error("CWallet::SetHDSeed() : storing the seed failed");
+    if (!WriteHDChain(hdChainNew) || !SetHDChain(hdChainNew))
+        return error("CWallet::SetHDSeed() : storing the chain failed");
+    return ExtendHDChain(GetHDLookahead());
+}
+
+bool CWallet::LoadHDChain(const CHDChain &chain)
+{
+    if (!SetHDChain(chain))
+        return false;
+    return ExtendHDChain(chain.nNextIndex + GetHDLookahead());
+}
+
+bool CWallet::WriteHDChain(const CHDChain &chain)
+{
+    if (!fFileBacked)
+        return true;
+    return CWalletDB(strWalletFile).WriteHDChain(chain);
+}
+
+void CWallet::MarkHDKeysUsed(const CTransaction &tx)
+{
+    // Called with every transaction added to the wallet: a payment to a
+    // key in the lookahead window moves the window along, so that keys handed
+    // out later (or by a restored copy of this wallet) keep being found.
+    if (!IsHDEnabled())
+        return;
+    CHDChain chain = GetHDChain();
+    unsigned int nNext = chain.nNextIndex;
+    BOOST_FOREACH(const CTxOut &txout, tx.vout)
+    {
+        CTxDestination dest;
+        unsigned int nIndex;
+        if (ExtractDestination(txout.scriptPubKey, dest) && boost::get<CKeyID>(&dest) &&
+            GetHDKeyIndex(boost::get<CKeyID>(dest), nIndex) && nIndex >= nNext)
+            nNext = nIndex + 1;
+    }
+    if (nNext == chain.nNextIndex)
+        return;
+    chain.nNextIndex = nNext;
+    if (!WriteHDChain(chain))
+        printf("MarkHDKeysUsed() : writing the chain failed\n");
+    SetHDChain(chain);
+    ExtendHDChain(nNext + GetHDLookahead());
+}
+
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    // outputs to the script may have become ours
+    MarkDirty(Hash160(redeemScript));
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
+// Choose how a master key is derived from strPassphrase: scrypt with the
+// configured cost, or (-walletkdf=sha512) SHA-512 rounds calibrated to take
+// about 0.1 seconds here. crypter is left holding the derived key.
+static bool SetMasterKeyDerivation(CMasterKey& kMasterKey, const SecureString& strPassphrase, CCrypter& crypter)
+{
+    if (GetArg("-walletkdf", "scrypt") == "scrypt")
+    {
+        int nLogN = GetArg("-walletscryptcost", WALLET_CRYPTO_SCRYPT_LOGN);
+        nLogN = std::max(10, std::min(nLogN, (int)WALLET_CRYPTO_SCRYPT_MAX_LOGN));
+        kMasterKey.SetScrypt(nLogN, WALLET_CRYPTO_SCRYPT_R, WALLET_CRYPTO_SCRYPT_P);
+        printf("Deriving the wallet master key with scrypt, N=2^%d r=%u p=%u\n", nLogN, WALLET_CRYPTO_SCRYPT_R, WALLET_CRYPTO_SCRYPT_P);
+        return crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey);
+    }
+
+    kMasterKey.nDerivationMethod = WALLET_CRYPTO_DERIVE_SHA512;
+    kMasterKey.vchOtherDerivationParameters.clear();
+    int64 nStartTime = GetTimeMillis();
+    crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey.vchSalt, 25000, kMasterKey.nDerivationMethod);
+    kMasterKey.nDeriveIterations = 2500000 / ((double)(GetTimeMillis() - nStartTime));
+
+    nStartTime = GetTimeMillis();
+    crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey);
+    kMasterKey.nDeriveIterations = (kMasterKey.nDeriveIterations + kMasterKey.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
+
+    if (kMasterKey.nDeriveIterations < 25000)
+        kMasterKey.nDeriveIterations = 25000;
+
+    printf("Deriving the wallet master key with an nDeriveIterations of %i\n", kMasterKey.nDeriveIterations);
+    return crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey);
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 {
     if (!IsLocked())
@@ -102,7 +220,7 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
         LOCK(cs_wallet);
         BOOST_FOREACH(const MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if(!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if(!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 return false;
@@ -125,29 +243,19 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
         CKeyingMaterial vMasterKey;
         BOOST_FOREACH(MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if(!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if(!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 return false;
             if (CCryptoKeyStore::Unlock(vMasterKey))
             {
-                int64 nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
-                pMasterKey.second.nDeriveIterations = pMasterKey.second.nDeriveIterations * (100 / ((double)(GetTimeMillis() - nStartTime)));
-
-                nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
-                pMasterKey.second.nDeriveIterations = (pMasterKey.second.nDeriveIterations + pMasterKey.second.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
-
-                if (pMasterKey.second.nDeriveIterations < 25000)
-                    pMasterKey.second.nDeriveIterations = 25000;
-
-                printf("Wallet passphrase changed to an nDeriveIterations of %i\n", pMasterKey.second.nDeriveIterations);
-
-                if (!crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+                // a new passphrase also moves the master key to the current derivation
+                if (!SetMasterKeyDerivation(pMasterKey.second, strNewWalletPassphrase, crypter))
                     return false;
                 if (!crypter.Encrypt(vMasterKey, pMasterKey.second.vchCryptedKey))
                     return false;
+                if (pMasterKey.second.nDerivationMethod == WALLET_CRYPTO_DERIVE_SCRYPT)
+                    SetMinVersion(FEATURE_SCRYPTKDF);
                 CWalletDB(strWalletFile).WriteMasterKey(pMasterKey.first, pMasterKey.second);
                 if (fWasLocked)
                     Lock();
@@ -239,20 +347,7 @@ bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
     RAND_bytes(&kMasterKey.vchSalt[0], WALLET_CRYPTO_SALT_SIZE);
 
     CCrypter crypter;
-    int64 nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, 25000, kMasterKey.nDerivationMethod);
-    kMasterKey.nDeriveIterations = 2500000 / ((double)(GetTimeMillis() - nStartTime));
-
-    nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod);
-    kMasterKey.nDeriveIterations = (kMasterKey.nDeriveIterations + kMasterKey.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
-
-    if (kMasterKey.nDeriveIterations < 25000)
-        kMasterKey.nDeriveIterations = 25000;
-
-    printf("Encrypting Wallet with an nDeriveIterations of %i\n", kMasterKey.nDeriveIterations);
-
-    if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod))
+    if (!SetMasterKeyDerivation(kMasterKey, strWalletPassphrase, crypter))
         return false;
     if (!crypter.Encrypt(vMasterKey, kMasterKey.vchCryptedKey))
         return false;
@@ -277,6 +372,8 @@ bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 
         // Encryption was introduced in version 0.4.0
         SetMinVersion(FEATURE_WALLETCRYPT, pwalletdbEncryption, true);
+        if (kMasterKey.nDerivationMethod == WALLET_CRYPTO_DERIVE_SCRYPT)
+            SetMinVersion(FEATURE_SCRYPTKDF, pwalletdbEncryption);
 
         if (fFileBacked)
         {
@@ -357,6 +454,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    UpdateUnspent(txin.prevout.hash, wtx);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -368,9 +466,169 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        setWalletUnspent.clear();
+        setForeignOutputs.clear();
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        {
             item.second.MarkDirty();
+            UpdateUnspent(item.first, item.second);
+        }
+        nUnspentGeneration++;
+    }
+}
+
+// The key and script ids an output pays to
+static std::vector<uint160> GetOutputIDs(const CScript &scriptPubKey)
+{
+    std::vector<uint160> vIDs;
+    txnouttype type;
+    std::vector<CTxDestination> vDest;
+    int nRequired;
+    if (ExtractDestinations(scriptPubKey, type, vDest, nRequired))
+    {
+        BOOST_FOREACH(const CTxDestination &dest, vDest)
+        {
+            if (const CKeyID *keyID = boost::get<CKeyID>(&dest))
+                vIDs.push_back(*keyID);
+            else if (const CScriptID *scriptID = boost::get<CScriptID>(&dest))
+                vIDs.push_back(*scriptID);
+        }
+    }
+    return vIDs;
+}
+
+void CWallet::MarkDirty(const uint160 &hashID)
+{
+    LOCK(cs_wallet);
+    // a key may also complete a script of the wallet that involves it
+    std::vector<uint160> vIDs(1, hashID);
+    {
+        LOCK(cs_KeyStore);
+        for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); it++)
+        {
+            std::vector<uint160> vScriptIDs = GetOutputIDs(it->second);
+            if (std::find(vScriptIDs.begin(), vScriptIDs.end(), hashID) != vScriptIDs.end())
+                vIDs.push_back(it->first);
+        }
+    }
+
+    BOOST_FOREACH(const uint160 &id, vIDs)
+    {
+        std::set<std::pair<uint160, COutPoint> >::iterator it = setForeignOutputs.lower_bound(make_pair(id, COutPoint(0, 0)));
+        while (it != setForeignOutputs.end() && it->first == id)
+        {
+            const COutPoint outpoint = it->second;
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(outpoint.hash);
+            if (mi != mapWallet.end() && !IsMine(mi->second.vout[outpoint.n])) {
+                it++;
+                continue;
+            }
+            setForeignOutputs.erase(it++);
+            if (mi == mapWallet.end())
+                continue;
+            CWalletTx &wtx = mi->second;
+            wtx.MarkDirty();
+            UpdateUnspent(outpoint.hash, wtx);
+            // the transactions spending the output now debit the wallet
+            pair<TxSpends::iterator, TxSpends::iterator> range = mapTxSpends.equal_range(outpoint);
+            for (TxSpends::iterator its = range.first; its != range.second; its++)
+            {
+                map<uint256, CWalletTx>::iterator mis = mapWallet.find(its->second);
+                if (mis != mapWallet.end())
+                    mis->second.MarkDirty();
+            }
+        }
+    }
+}
+
+void CWallet::UpdateUnspent(const uint256 &hash, const CWalletTx &wtx)
+{
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (!IsMine(wtx.vout[i])) {
+            setWalletUnspent.erase(COutPoint(hash, i));
+            BOOST_FOREACH(const uint160 &hashID, GetOutputIDs(wtx.vout[i].scriptPubKey))
+                setForeignOutputs.insert(make_pair(hashID, COutPoint(hash, i)));
+        } else if (!wtx.IsSpent(i))
+            setWalletUnspent.insert(COutPoint(hash, i));
+        else
+            setWalletUnspent.erase(COutPoint(hash, i));
+    }
+    nUnspentGeneration++;
+}
+
+void CWallet::AddToSpends(const uint256 &hash, const CWalletTx &wtx)
+{
+    if (wtx.IsCoinBase())
+        return;
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+        mapTxSpends.insert(make_pair(txin.prevout, hash));
+}
+
+void CWallet::UpdateUnconfirmed(const uint256 &hash, const CWalletTx &wtx)
+{
+    if (wtx.IsCoinBase() || wtx.GetDepthInMainChain() > 0)
+        setUnconfirmed.erase(hash);
+    else
+        setUnconfirmed.insert(hash);
+}
+
+void CWallet::RemoveFromSpends(const uint256 &hash, const CWalletTx &wtx)
+{
+    if (wtx.IsCoinBase())
+        return;
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+    {
+        pair<TxSpends::iterator, TxSpends::iterator> range = mapTxSpends.equal_range(txin.prevout);
+        for (TxSpends::iterator it = range.first; it != range.second; )
+        {
+            if (it->second == hash)
+                mapTxSpends.erase(it++);
+            else
+                it++;
+        }
+    }
+}
+
+bool CWallet::IsSpentByWallet(const COutPoint &outpoint) const
+{
+    return mapTxSpends.count(outpoint) > 0;
+}
+
+set<uint256> CWallet::GetConflicts(const uint256 &hash) const
+{
+    set<uint256> setConflicts;
+    LOCK(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end() || mi->second.IsCoinBase())
+        return setConflicts;
+    BOOST_FOREACH(const CTxIn& txin, mi->second.vin)
+    {
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(txin.prevout);
+        for (TxSpends::const_iterator it = range.first; it != range.second; it++)
+            if (it->second != hash)
+                setConflicts.insert(it->second);
+    }
+    return setConflicts;
+}
+
+bool CWallet::HasConfirmedConflict(const uint256 &hash, const CWalletTx &wtx) const
+{
+    if (wtx.IsCoinBase())
+        return false;
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+    {
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(txin.prevout);
+        for (TxSpends::const_iterator it = range.first; it != range.second; it++)
+        {
+            if (it->second == hash)
+                continue;
+            map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+            if (mi != mapWallet.end() && mi->second.GetDepthInMainChain() > 0)
+                return true;
+        }
     }
+    return false;
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn)
@@ -436,7 +694,15 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         }
 
         bool fUpdated = false;
-        if (!fInsertedNew)
+        if (fInsertedNew)
+        {
+            AddToSpends(hash, wtx);
+            // outputs already spent by transactions the wallet saw first
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                if (!wtx.IsSpent(i) && IsSpentByWallet(COutPoint(hash, i)) && IsMine(wtx.vout[i]))
+                    wtx.MarkSpent(i);
+        }
+        else
         {
             // Merge
             if (wtxIn.hashBlock != 0 && wtxIn.hashBlock != wtx.hashBlock)
@@ -461,6 +727,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         //// debug print
         printf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString().c_str(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
+        UpdateUnspent(hash, wtx);
+        UpdateUnconfirmed(hash, wtx);
+        if (fInsertedNew)
+            MarkHDKeysUsed(wtx);
+
         // Write to disk
         if (fInsertedNew || fUpdated)
             if (!wtx.WriteToDisk())
@@ -532,8 +803,21 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            for (unsigned int i = 0; i < (*mi).second.vout.size(); i++)
+            {
+                setWalletUnspent.erase(COutPoint(hash, i));
+                BOOST_FOREACH(const uint160 &hashID, GetOutputIDs((*mi).second.vout[i].scriptPubKey))
+                    setForeignOutputs.erase(make_pair(hashID, COutPoint(hash, i)));
+            }
+            nUnspentGeneration++;
+            RemoveFromSpends(hash, mi->second);
+            setUnconfirmed.erase(hash);
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return true;
 }
@@ -783,31 +1067,255 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+// Whether any output of tx pushes a key, key hash or script hash in the filter
+bool PaysToFilter(const CBloomFilter &filter, const CTransaction &tx)
+{
+    BOOST_FOREACH(const CTxOut &txout, tx.vout)
+    {
+        const CScript &script = txout.scriptPubKey;
+        CScript::const_iterator pc = script.begin();
+        std::vector<unsigned char> data;
+        opcodetype opcode;
+        while (pc < script.end())
+        {
+            if (!script.GetOp(pc, opcode, data))
+                break;
+            if (data.size() != 0 && filter.contains(data))
+                return true;
+        }
+    }
+    return false;
+}
+
+void CRescanSlot::SetNull()
+{
+    pindex = NULL;
+    block.SetNull();
+    fHaveBlock = false;
+    vHash.clear();
+    vMatch.clear();
+    fFiltered = false;
+}
+
+CRescanPipeline::CRescanPipeline(const CBloomFilter &filterIn, CBlockIndex *pindexStart, unsigned int nWindow, int nWorkers) :
+    filter(filterIn), vSlots(nWindow), pindexNext(pindexStart), nRead(0), nClaimed(0), nConsumed(0), fEnd(false), fStop(false)
+{
+    for (unsigned int i = 0; i < vSlots.size(); i++)
+        vSlots[i].SetNull();
+    threads.create_thread(boost::bind(&CRescanPipeline::ThreadRead, this));
+    for (int i = 0; i < nWorkers; i++)
+        threads.create_thread(boost::bind(&CRescanPipeline::ThreadFilter, this));
+}
+
+CRescanPipeline::~CRescanPipeline()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+}
+
+void CRescanPipeline::ThreadRead()
+{
+    while (true)
+    {
+        CBlockIndex *pindex;
+        CRescanSlot *pslot;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && nRead - nConsumed >= (int)vSlots.size())
+                cond.wait(lock);
+            if (fStop)
+                return;
+            if (pindexNext == NULL) {
+                fEnd = true;
+                cond.notify_all();
+                return;
+            }
+            pindex = pindexNext;
+            pindexNext = pindexNext->pnext;
+            pslot = &vSlots[nRead % vSlots.size()];
+        }
+        pslot->pindex = pindex;
+        // blocks pruned or loaded from a UTXO snapshot cannot be scanned
+        pslot->fHaveBlock = (pindex->nStatus & BLOCK_HAVE_DATA) && pslot->block.ReadFromDisk(pindex);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nRead++;
+        }
+        cond.notify_all();
+    }
+}
+
+void CRescanPipeline::ThreadFilter()
+{
+    while (true)
+    {
+        CRescanSlot *pslot;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && !fEnd && nClaimed == nRead)
+                cond.wait(lock);
+            if (fStop || nClaimed == nRead)
+                return;
+            pslot = &vSlots[nClaimed++ % vSlots.size()];
+        }
+        if (!pslot->fHaveBlock)
+            pslot->block.SetNull();
+        const std::vector<CTransaction> &vtx = pslot->block.vtx;
+        pslot->vHash.resize(vtx.size());
+        pslot->vMatch.resize(vtx.size());
+        for (unsigned int i = 0; i < vtx.size(); i++) {
+            pslot->vHash[i] = vtx[i].GetHash();
+            pslot->vMatch[i] = PaysToFilter(filter, vtx[i]);
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pslot->fFiltered = true;
+        }
+        cond.notify_all();
+    }
+}
+
+CRescanSlot *CRescanPipeline::Next()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true)
+    {
+        if (nConsumed < nRead) {
+            CRescanSlot &slot = vSlots[nConsumed % vSlots.size()];
+            if (slot.fFiltered)
+                return &slot;
+        } else if (fEnd)
+            return NULL;
+        cond.wait(lock);
+    }
+}
+
+void CRescanPipeline::Release()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vSlots[nConsumed % vSlots.size()].SetNull();
+        nConsumed++;
+    }
+    cond.notify_all();
+}
+
+CBloomFilter CWallet::GetRescanFilter() const
+{
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+
+    LOCK(cs_KeyStore);
+    unsigned int nElements = std::max((unsigned int)(2 * setKeys.size() + mapScripts.size()), 1U);
+    CBloomFilter filter(nElements, 0.0001, GetRand(std::numeric_limits<unsigned int>::max()), BLOOM_UPDATE_NONE);
+    BOOST_FOREACH(const CKeyID &keyID, setKeys)
+    {
+        filter.insert(std::vector<unsigned char>(keyID.begin(), keyID.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyID, pubkey))
+            filter.insert(std::vector<unsigned char>(pubkey.begin(), pubkey.end()));
+    }
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); it++)
+        filter.insert(std::vector<unsigned char>(it->first.begin(), it->first.end()));
+    return filter;
+}
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
+    if (pindexStart == NULL)
+        return 0;
 
-    CBlockIndex* pindex = pindexStart;
+    int64 nStart = GetTimeMillis();
     {
         LOCK(cs_wallet);
-        while (pindex)
         {
-            CBlock block;
-            block.ReadFromDisk(pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            LOCK(cs_rescan);
+            fRescanning = true;
+            fAbortRescan = false;
+            nRescanStartHeight = nRescanHeight = pindexStart->nHeight;
+            nRescanStopHeight = nBestHeight;
+        }
+
+        int nSkipped = 0;
+        bool fAborted = false;
+        unsigned int nHDKeys = GetHDChainSize();
+        for (int nPass = 0; ; nPass++)
+        {
+            // Finding payments to the deterministic chain derives more keys,
+            // which the filter of this pass does not know: scan again for them.
+            if (nPass > 0)
+            {
+                if (fAborted || GetHDChainSize() == nHDKeys)
+                    break;
+                printf("ScanForWalletTransactions() : %u more derived keys, scanning again\n", GetHDChainSize() - nHDKeys);
+                nHDKeys = GetHDChainSize();
+                nSkipped = 0;
+            }
+            CBloomFilter filter = GetRescanFilter();
+            CRescanPipeline pipeline(filter, pindexStart, 64, std::max(nScriptCheckThreads, 1));
+            CRescanSlot *pslot;
+            while ((pslot = pipeline.Next()) != NULL)
             {
-                if (AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, fUpdate))
-                    ret++;
+                if (!pslot->fHaveBlock)
+                    nSkipped++;
+                else for (unsigned int i = 0; i < pslot->block.vtx.size(); i++)
+                {
+                    const CTransaction &tx = pslot->block.vtx[i];
+                    const uint256 &hash = pslot->vHash[i];
+                    bool fCandidate = pslot->vMatch[i] || mapWallet.count(hash) > 0;
+                    for (unsigned int j = 0; !fCandidate && j < tx.vin.size(); j++)
+                        fCandidate = mapWallet.count(tx.vin[j].prevout.hash) > 0;
+                    if (fCandidate && AddToWalletIfInvolvingMe(hash, tx, &pslot->block, fUpdate))
+                        ret++;
+                }
+                {
+                    LOCK(cs_rescan);
+                    nRescanHeight = pslot->pindex->nHeight;
+                    if (fAbortRescan) {
+                        printf("ScanForWalletTransactions() : aborted at block %d\n", nRescanHeight);
+                        fAborted = true;
+                        break;
+                    }
+                }
+                pipeline.Release();
             }
-            pindex = pindex->pnext;
+        }
+        if (nSkipped)
+            printf("ScanForWalletTransactions() : skipped %d blocks without data on disk\n", nSkipped);
+
+        {
+            LOCK(cs_rescan);
+            fRescanning = false;
         }
     }
+    printf("ScanForWalletTransactions() : found %d transactions in %"PRI64d"ms\n", ret, GetTimeMillis() - nStart);
     return ret;
 }
 
+bool CWallet::GetRescanProgress(int &nStartHeight, int &nHeight, int &nStopHeight) const
+{
+    LOCK(cs_rescan);
+    nStartHeight = nRescanStartHeight;
+    nHeight = nRescanHeight;
+    nStopHeight = nRescanStopHeight;
+    return fRescanning;
+}
+
+void CWallet::AbortRescan()
+{
+    LOCK(cs_rescan);
+    if (fRescanning)
+        fAbortRescan = true;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     bool fRepeat = true;
@@ -816,43 +1324,67 @@ void CWallet::ReacceptWalletTransactions()
         LOCK(cs_wallet);
         fRepeat = false;
         bool fMissing = false;
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+
+        // Only outputs the wallet still counts as unspent can turn out to be
+        // spent. Those spent by another wallet transaction are known from the
+        // spend index; the coins database is only asked about the rest.
+        vector<COutPoint> vUnspent(setWalletUnspent.begin(), setWalletUnspent.end());
+        set<uint256> setUpdated;
+        uint256 hashCoins = 0;
+        CCoins coins;
+        bool fConfirmed = false;
+        BOOST_FOREACH(const COutPoint& outpoint, vUnspent)
         {
-            CWalletTx& wtx = item.second;
-            if (wtx.IsCoinBase() && wtx.IsSpent(0))
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(outpoint.hash);
+            if (mi == mapWallet.end())
                 continue;
-
-            CCoins coins;
-            bool fUpdated = false;
-            bool fFound = pcoinsTip->GetCoins(wtx.GetHash(), coins);
-            if (fFound || wtx.GetDepthInMainChain() > 0)
+            CWalletTx& wtx = (*mi).second;
+            bool fSpent = IsSpentByWallet(outpoint);
+            if (!fSpent)
             {
-                // Update fSpent if a tx got spent somewhere else by a copy of wallet.dat
-                for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                if (outpoint.hash != hashCoins)
                 {
-                    if (wtx.IsSpent(i))
-                        continue;
-                    if ((i >= coins.vout.size() || coins.vout[i].IsNull()) && IsMine(wtx.vout[i]))
-                    {
-                        wtx.MarkSpent(i);
-                        fUpdated = true;
-                        fMissing = true;
-                    }
-                }
-                if (fUpdated)
-                {
-                    printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
-                    wtx.MarkDirty();
-                    wtx.WriteToDisk();
+                    hashCoins = outpoint.hash;
+                    coins = CCoins();
+                    fConfirmed = pcoinsTip->GetCoins(hashCoins, coins) || wtx.GetDepthInMainChain() > 0;
                 }
+                // Update fSpent if a tx got spent somewhere else by a copy of wallet.dat
+                fSpent = fConfirmed && (outpoint.n >= coins.vout.size() || coins.vout[outpoint.n].IsNull());
+                fMissing |= fSpent;
             }
-            else
+            if (fSpent)
             {
-                // Re-accept any txes of ours that aren't already in a block
-                if (!wtx.IsCoinBase())
-                    wtx.AcceptWalletTransaction(false);
+                wtx.MarkSpent(outpoint.n);
+                setUpdated.insert(outpoint.hash);
             }
         }
+        BOOST_FOREACH(const uint256& hash, setUpdated)
+        {
+            CWalletTx& wtx = mapWallet[hash];
+            printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), hash.ToString().c_str());
+            wtx.MarkDirty();
+            wtx.WriteToDisk();
+            UpdateUnspent(hash, wtx);
+        }
+
+        // Re-accept any txes of ours that aren't already in a block, except
+        // those a confirmed wallet transaction conflicts with. Accepting one
+        // updates setUnconfirmed, so walk a copy.
+        vector<uint256> vUnconfirmed(setUnconfirmed.begin(), setUnconfirmed.end());
+        BOOST_FOREACH(const uint256& hash, vUnconfirmed)
+        {
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+            if (mi == mapWallet.end())
+                continue;
+            CWalletTx& wtx = (*mi).second;
+            UpdateUnconfirmed(hash, wtx);
+            if (!setUnconfirmed.count(hash))
+                continue;
+            if (HasConfirmedConflict(hash, wtx) || pcoinsTip->HaveCoins(hash))
+                continue;
+            wtx.AcceptWalletTransaction(false);
+        }
+
         if (fMissing)
         {
             // TODO: optimize this to scan just part of the block chain?
@@ -934,49 +1466,79 @@ void CWallet::ResendWalletTransactions()
 //
 
 
-int64 CWallet::GetBalance() const
+// Recompute the balance tallies if the wallet or the best chain changed since
+// the last call. Depth and maturity move with every block, so the tallies are
+// rebuilt from the unspent outputs rather than adjusted in place; transactions
+// without unspent outputs of ours contribute nothing and are never visited.
+void CWallet::UpdateBalances() const
 {
-    int64 nTotal = 0;
+    hashBestBlock = hashBestChain;
+    if (BalancesValid())
+        return;
+
+    nBalanceAvailable = nBalanceUnconfirmed = nBalanceImmature = 0;
+    uint256 hashPrev = 0;
+    BOOST_FOREACH(const COutPoint& outpoint, setWalletUnspent)
     {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        // outpoints are ordered by txid, so each transaction is seen once
+        if (outpoint.hash == hashPrev)
+            continue;
+        hashPrev = outpoint.hash;
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+        if (it == mapWallet.end())
+            continue;
+        const CWalletTx* pcoin = &(*it).second;
+        bool fConfirmed = pcoin->IsConfirmed();
+        int64 nCredit = pcoin->GetAvailableCredit();
+        if (fConfirmed)
+            nBalanceAvailable += nCredit;
+        if (!pcoin->IsFinal() || !fConfirmed)
+            nBalanceUnconfirmed += nCredit;
+        nBalanceImmature += pcoin->GetImmatureCredit();
     }
+    hashBalanceBlock = hashBestBlock;
+    nBalanceGeneration = nUnspentGeneration;
+}
 
-    return nTotal;
+void CWallet::UpdatedBestChain()
+{
+    LOCK(cs_wallet);
+    UpdateBalances();
 }
 
-int64 CWallet::GetUnconfirmedBalance() const
+// The tallies are kept up to date from main, which holds cs_main. Only a
+// change made by the wallet itself since (a sent transaction, an imported
+// key) leaves them stale, and then cs_main has to be taken to recompute them.
+void CWallet::RefreshBalances() const
 {
-    int64 nTotal = 0;
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || !pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        if (BalancesValid())
+            return;
     }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalances();
+}
+
+int64 CWallet::GetBalance() const
+{
+    RefreshBalances();
+    LOCK(cs_wallet);
+    return nBalanceAvailable;
+}
+
+int64 CWallet::GetUnconfirmedBalance() const
+{
+    RefreshBalances();
+    LOCK(cs_wallet);
+    return nBalanceUnconfirmed;
 }
 
 int64 CWallet::GetImmatureBalance() const
 {
-    int64 nTotal = 0;
-    {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    RefreshBalances();
+    LOCK(cs_wallet);
+    return nBalanceImmature;
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -986,29 +1548,45 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const CWalletTx* pcoin = NULL;
+        int nDepth = 0;
+        uint256 hashPrev = 0;
+        BOOST_FOREACH(const COutPoint& outpoint, setWalletUnspent)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            // the transaction-level checks are done once per txid
+            if (outpoint.hash != hashPrev)
+            {
+                hashPrev = outpoint.hash;
+                pcoin = NULL;
 
-            if (!pcoin->IsFinal())
-                continue;
+                map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+                if (it == mapWallet.end())
+                    continue;
+                const CWalletTx* pwtx = &(*it).second;
 
-            if (fOnlyConfirmed && !pcoin->IsConfirmed())
-                continue;
+                if (!pwtx->IsFinal())
+                    continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                if (fOnlyConfirmed && !pwtx->IsConfirmed())
+                    continue;
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+                if (pwtx->IsCoinBase() && pwtx->GetBlocksToMaturity() > 0)
+                    continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i))) 
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+                nDepth = pwtx->GetDepthInMainChain();
+                if (nDepth < 0)
+                    continue;
+
+                pcoin = pwtx;
             }
+            if (!pcoin)
+                continue;
+
+            // setWalletUnspent only holds unspent outputs that are ours
+            unsigned int i = outpoint.n;
+            if (!IsLockedCoin(outpoint.hash, i) && pcoin->vout[i].nValue >= nMinimumInputValue &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(outpoint.hash, i)))
+                vCoins.push_back(COutput(pcoin, i, nDepth));
         }
     }
 }
@@ -1158,8 +1736,11 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
     return true;
 }
 
-bool CWallet::SelectCoins(int64 nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(int64 nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, const CCoinControl* coinControl, bool* pfUsedBnB) const
 {
+    if (pfUsedBnB)
+        *pfUsedBnB = false;
+
     vector<COutput> vCoins;
     AvailableCoins(vCoins, true, coinControl);
     
@@ -1174,9 +1755,76 @@ bool CWallet::SelectCoins(int64 nTargetValue, set<pair<const CWalletTx*,unsigned
         return (nValueRet >= nTargetValue);
     }
 
-    return (SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-            SelectCoinsMinConf(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet)));
+    return SelectCoinsByTier(nTargetValue, vCoins, setCoinsRet, nValueRet, pfUsedBnB);
+}
+
+// The fee of an input, and the cost of a change output (creating it now and
+// spending it later), at the fee rate CreateTransaction will pay
+static void GetSelectionCosts(int64& nInputFee, int64& nCostOfChange)
+{
+    int64 nFeeRate = max(nTransactionFee, CTransaction::nMinTxFee);
+    nInputFee = nFeeRate * COIN_SELECTION_INPUT_SIZE / 1000;
+    nCostOfChange = nFeeRate * (COIN_SELECTION_INPUT_SIZE + COIN_SELECTION_OUTPUT_SIZE) / 1000;
+}
+
+bool CWallet::SelectCoinsByTier(int64 nTargetValue, const vector<COutput>& vCoins, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, bool* pfUsedBnB) const
+{
+    if (pfUsedBnB)
+        *pfUsedBnB = false;
+
+    static const int nTierConf[3][2] = { {1, 6}, {1, 1}, {0, 1} };
+    int nTiers = bSpendZeroConfChange ? 3 : 2;
+
+    int64 nInputFee, nCostOfChange;
+    GetSelectionCosts(nInputFee, nCostOfChange);
+
+    // Candidates are sorted once by effective value and tagged with the first
+    // tier that may spend them; outputs that cost more to spend than they are
+    // worth are left to the knapsack.
+    vector<CSelectionCandidate> vCandidates;
+    vCandidates.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& output, vCoins)
+    {
+        bool fFromMe = output.tx->IsFromMe();
+        for (int nTier = 0; nTier < nTiers; nTier++)
+        {
+            if (output.nDepth >= (fFromMe ? nTierConf[nTier][0] : nTierConf[nTier][1]))
+            {
+                CSelectionCandidate candidate(output.tx, output.i, output.tx->vout[output.i].nValue, nInputFee, nTier);
+                if (candidate.nEffectiveValue > 0)
+                    vCandidates.push_back(candidate);
+                break;
+            }
+        }
+    }
+    sort(vCandidates.begin(), vCandidates.end());
+
+    vector<CSelectionCandidate> vEligible;
+    vector<char> vfSelected;
+    for (int nTier = 0; nTier < nTiers; nTier++)
+    {
+        setCoinsRet.clear();
+        nValueRet = 0;
+
+        vEligible.clear();
+        BOOST_FOREACH(const CSelectionCandidate& candidate, vCandidates)
+            if (candidate.nTier <= nTier)
+                vEligible.push_back(candidate);
+
+        if (SelectCoinsBnB(vEligible, nTargetValue, nCostOfChange, vfSelected, nValueRet))
+        {
+            for (unsigned int i = 0; i < vEligible.size(); i++)
+                if (vfSelected[i])
+                    setCoinsRet.insert(vEligible[i].coin);
+            if (pfUsedBnB)
+                *pfUsedBnB = true;
+            return true;
+        }
+
+        if (SelectCoinsMinConf(nTargetValue, nTierConf[nTier][0], nTierConf[nTier][1], vCoins, setCoinsRet, nValueRet))
+            return true;
+    }
+    return false;
 }
 
 
@@ -1230,7 +1878,8 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend,
                 // Choose coins to use
                 set<pair<const CWalletTx*,unsigned int> > setCoins;
                 int64 nValueIn = 0;
-                if (!SelectCoins(nTotalValue, setCoins, nValueIn, coinControl))
+                bool fUsedBnB;
+                if (!SelectCoins(nTotalValue, setCoins, nValueIn, coinControl, &fUsedBnB))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -1255,6 +1904,17 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend,
                     nFeeRet += nMoveToFee;
                 }
 
+                // branch and bound only looks for selections whose excess is worth
+                // less than creating and later spending a change output: that
+                // excess goes to the fee
+                int64 nInputFee, nCostOfChange;
+                GetSelectionCosts(nInputFee, nCostOfChange);
+                if (fUsedBnB && nChange > 0 && nChange <= nCostOfChange)
+                {
+                    nFeeRet += nChange;
+                    nChange = 0;
+                }
+
                 if (nChange > 0)
                 {
                     // Fill a vout to ourself
@@ -1380,6 +2040,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                UpdateUnspent(txin.prevout.hash, coin);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -1475,6 +2136,22 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    // build the unspent output, spend and unconfirmed indexes from the loaded
+    // transactions
+    int64 nStart = GetTimeMillis();
+    {
+        LOCK(cs_wallet);
+        mapTxSpends.clear();
+        setUnconfirmed.clear();
+        BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        {
+            AddToSpends(item.first, item.second);
+            UpdateUnconfirmed(item.first, item.second);
+        }
+    }
+    MarkDirty();
+    printf("LoadWallet() : indexed %"PRIszu" transactions in %"PRI64d"ms\n", mapWallet.size(), GetTimeMillis() - nStart);
+
     return DB_LOAD_OK;
 }
 
@@ -1558,6 +2235,10 @@ bool CWallet::NewKeyPool()
             walletdb.ErasePool(nIndex);
         setKeyPool.clear();
 
+        // the seed of a deterministic chain is encrypted with the other keys
+        if (IsHDEnabled())
+            return TopUpKeyPool();
+
         if (IsLocked())
             return false;
 
@@ -1573,41 +2254,252 @@ bool CWallet::NewKeyPool()
     return true;
 }
 
+namespace {
+
+// keys committed per wallet DB transaction while filling the key pool; this
+// stays well below the lock limits of the Berkeley DB environment
+static const unsigned int KEYPOOL_FILL_BATCH = 1000;
+
+struct CGeneratedKey
+{
+    CKey key;
+    CPubKey pubkey;
+    // the encrypted secret, for encrypted wallets
+    std::vector<unsigned char> vchCryptedSecret;
+};
+
+/** Generates keys for TopUpKeyPool on worker threads.
+ *
+ * Workers create (and for an encrypted wallet, encrypt) keys until the
+ * requested number has been produced, staying at most two batches ahead of
+ * the caller, which collects them with Take() and writes them to the wallet.
+ * Generation stops early if encryption fails, i.e. the wallet got locked.
+ */
+class CKeyPoolFiller
+{
+private:
+    const CCryptoKeyStore &keystore;
+    const bool fCompressed;
+    const bool fCrypted;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CGeneratedKey> vReady;
+    unsigned int nClaimed;  // keys started by a worker
+    unsigned int nWanted;
+    int nRunning;           // workers that have not exited yet
+    bool fFailed;
+    bool fStop;
+    boost::thread_group threads;
+
+    void ThreadGenerate()
+    {
+        while (true)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && !fFailed && vReady.size() >= 2 * KEYPOOL_FILL_BATCH)
+                    cond.wait(lock);
+                if (fStop || fFailed || nClaimed == nWanted) {
+                    nRunning--;
+                    cond.notify_all();
+                    return;
+                }
+                nClaimed++;
+            }
+            CGeneratedKey generated;
+            generated.key.MakeNewKey(fCompressed);
+            generated.pubkey = generated.key.GetPubKey();
+            bool fOk = !fCrypted || keystore.EncryptKey(generated.key, generated.pubkey, generated.vchCryptedSecret);
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fOk)
+                    vReady.push_back(generated);
+                else
+                    fFailed = true;
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CKeyPoolFiller(const CCryptoKeyStore &keystoreIn, unsigned int nWantedIn, bool fCompressedIn, int nWorkers) :
+        keystore(keystoreIn), fCompressed(fCompressedIn), fCrypted(keystoreIn.IsCrypted()),
+        nClaimed(0), nWanted(nWantedIn), nRunning(nWorkers), fFailed(false), fStop(false)
+    {
+        for (int i = 0; i < nWorkers; i++)
+            threads.create_thread(boost::bind(&CKeyPoolFiller::ThreadGenerate, this));
+    }
+
+    ~CKeyPoolFiller()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+    }
+
+    bool IsCrypted() const { return fCrypted; }
+
+    // Wait for the next batch of up to nMax keys; false once there are no more
+    bool Take(std::vector<CGeneratedKey> &vKeys, unsigned int nMax)
+    {
+        vKeys.clear();
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fFailed && nRunning > 0 && vReady.size() < nMax)
+                cond.wait(lock);
+            if (fFailed)
+                return false;
+            if (vReady.size() <= nMax)
+                vKeys.swap(vReady);
+            else {
+                vKeys.assign(vReady.begin(), vReady.begin() + nMax);
+                vReady.erase(vReady.begin(), vReady.begin() + nMax);
+            }
+        }
+        cond.notify_all();
+        return !vKeys.empty();
+    }
+};
+
+} // anon namespace
+
 bool CWallet::TopUpKeyPool()
 {
+    // Keys are generated without holding cs_wallet and added in batches, so
+    // the wallet stays usable during a large fill. Only one fill runs at a
+    // time; a caller that finds one running gets the keys already in the pool.
+    if (IsHDEnabled())
+    {
+        // derived keys need no pool, only a lookahead window
+        LOCK(cs_wallet);
+        return ExtendHDChain(GetHDChain().nNextIndex + GetHDLookahead());
+    }
+
+    TRY_LOCK(cs_KeyPoolFill, lockFill);
+    if (!lockFill)
+        return true;
+
+    unsigned int nTargetSize = max(GetArg("-keypool", 100), 0LL);
+    unsigned int nWanted;
+    bool fCompressed;
     {
         LOCK(cs_wallet);
 
         if (IsLocked())
             return false;
+        if (setKeyPool.size() >= nTargetSize + 1)
+            return true;
+        nWanted = nTargetSize + 1 - setKeyPool.size();
 
-        CWalletDB walletdb(strWalletFile);
+        fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+        // Compressed public keys were introduced in version 0.6.0
+        if (fCompressed)
+            SetMinVersion(FEATURE_COMPRPUBKEY);
+        nKeyPoolFillDone = 0;
+        nKeyPoolFillTarget = nWanted;
+    }
+    RandAddSeedPerfmon();
 
-        // Top up key pool
-        unsigned int nTargetSize = max(GetArg("-keypool", 100), 0LL);
-        while (setKeyPool.size() < (nTargetSize + 1))
+    bool fComplete = false;
+    int64 nStart = GetTimeMillis();
+    try {
+        CKeyPoolFiller filler(*this, nWanted, fCompressed, std::max(nScriptCheckThreads, 1));
+        std::vector<CGeneratedKey> vKeys;
+        while (true)
         {
+            if (!filler.Take(vKeys, KEYPOOL_FILL_BATCH))
+            {
+                LOCK(cs_wallet);
+                fComplete = (nKeyPoolFillDone == nWanted);
+                break;
+            }
+
+            LOCK(cs_wallet);
+            // the wallet may have been encrypted or locked while these were generated
+            if (IsCrypted() != filler.IsCrypted() || IsLocked())
+                break;
+
+            CWalletDB walletdb(strWalletFile);
+            if (!walletdb.TxnBegin())
+                throw runtime_error("TopUpKeyPool() : couldn't begin wallet transaction");
             int64 nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            printf("keypool added key %"PRI64d", size=%"PRIszu"\n", nEnd, setKeyPool.size());
+            int64 nFirst = nEnd;
+            BOOST_FOREACH(const CGeneratedKey &generated, vKeys)
+            {
+                bool fAdded;
+                if (filler.IsCrypted())
+                    fAdded = CCryptoKeyStore::AddCryptedKey(generated.pubkey, generated.vchCryptedSecret) &&
+                             walletdb.WriteCryptedKey(generated.pubkey, generated.vchCryptedSecret);
+                else
+                    fAdded = CCryptoKeyStore::AddKeyPubKey(generated.key, generated.pubkey) &&
+                             walletdb.WriteKey(generated.pubkey, generated.key.GetPrivKey());
+                if (!fAdded || !walletdb.WritePool(nEnd++, CKeyPool(generated.pubkey)))
+                {
+                    walletdb.TxnAbort();
+                    throw runtime_error("TopUpKeyPool() : writing generated key failed");
+                }
+            }
+            if (!walletdb.TxnCommit())
+                throw runtime_error("TopUpKeyPool() : committing generated keys failed");
+            for (int64 nIndex = nFirst; nIndex < nEnd; nIndex++)
+                setKeyPool.insert(nIndex);
+            nKeyPoolFillDone += vKeys.size();
+            printf("keypool added keys %"PRI64d"-%"PRI64d", size=%"PRIszu"\n", nFirst, nEnd - 1, setKeyPool.size());
         }
+    } catch (...) {
+        LOCK(cs_wallet);
+        nKeyPoolFillDone = nKeyPoolFillTarget = 0;
+        throw;
     }
-    return true;
+
+    LOCK(cs_wallet);
+    printf("TopUpKeyPool : %s, added %u of %u keys in %"PRI64d"ms\n", fComplete ? "done" : "interrupted",
+           nKeyPoolFillDone, nWanted, GetTimeMillis() - nStart);
+    nKeyPoolFillDone = nKeyPoolFillTarget = 0;
+    return fComplete;
+}
+
+bool CWallet::GetKeyPoolFillProgress(unsigned int &nDone, unsigned int &nTarget) const
+{
+    LOCK(cs_wallet);
+    nDone = nKeyPoolFillDone;
+    nTarget = nKeyPoolFillTarget;
+    return nTarget > 0;
 }
 
 void CWallet::ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
     keypool.vchPubKey = CPubKey();
+
+    if (IsHDEnabled())
     {
+        // hand out the next derived key; it counts as used from now on
         LOCK(cs_wallet);
+        CHDChain chain = GetHDChain();
+        if (!ExtendHDChain(chain.nNextIndex + GetHDLookahead()) ||
+            !GetHDPubKey(chain.nNextIndex, keypool.vchPubKey))
+            return;
+        nIndex = -2 - (int64)chain.nNextIndex;
+        chain.nNextIndex++;
+        if (!WriteHDChain(chain))
+            throw runtime_error("ReserveKeyFromKeyPool() : writing deterministic chain failed");
+        SetHDChain(chain);
+        printf("keypool reserve derived key %u\n", chain.nNextIndex - 1);
+        return;
+    }
+
+    // before taking cs_wallet, so a long fill does not hold up the wallet
+    if (!IsLocked())
+        TopUpKeyPool();
 
-        if (!IsLocked())
-            TopUpKeyPool();
+    {
+        LOCK(cs_wallet);
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -1643,6 +2535,10 @@ int64 CWallet::AddReserveKey(const CKeyPool& keypool)
 
 void CWallet::KeepKey(int64 nIndex)
 {
+    // derived keys (reserved as -2 - index) are already marked used
+    if (nIndex < -1)
+        return;
+
     // Remove from key pool
     if (fFileBacked)
     {
@@ -1654,6 +2550,21 @@ void CWallet::KeepKey(int64 nIndex)
 
 void CWallet::ReturnKey(int64 nIndex)
 {
+    if (nIndex < -1)
+    {
+        // a derived key: step back if nothing was handed out after it
+        LOCK(cs_wallet);
+        CHDChain chain = GetHDChain();
+        if (chain.nNextIndex == (unsigned int)(-2 - nIndex) + 1)
+        {
+            chain.nNextIndex--;
+            if (WriteHDChain(chain))
+                SetHDChain(chain);
+        }
+        printf("keypool return derived key %"PRI64d"\n", -2 - nIndex);
+        return;
+    }
+
     // Return to key pool
     {
         LOCK(cs_wallet);
@@ -1688,6 +2599,10 @@ bool CWallet::GetKeyFromPool(CPubKey& result, bool fAllowReuse)
 
 int64 CWallet::GetOldestKeyPoolTime()
 {
+    // derived keys are created when they are needed
+    if (IsHDEnabled())
+        return GetTime();
+
     int64 nIndex = 0;
     CKeyPool keypool;
     ReserveKeyFromKeyPool(nIndex, keypool);
@@ -1873,6 +2788,13 @@ void CWallet::GetAllReserveKeys(set<CKeyID>& setAddress)
     CWalletDB walletdb(strWalletFile);
 
     LOCK2(cs_main, cs_wallet);
+    if (IsHDEnabled())
+    {
+        CHDChain chain = GetHDChain();
+        CPubKey pubkey;
+        for (unsigned int i = chain.nNextIndex; GetHDPubKey(i, pubkey); i++)
+            setAddress.insert(pubkey.GetID());
+    }
     BOOST_FOREACH(const int64& id, setKeyPool)
     {
         CKeyPool keypool;
@@ -22,6 +22,7 @@ extern bool bSpendZeroConfChange;
 
 class CAccountingEntry;
 class CWalletTx;
+class CBloomFilter;
 class CReserveKey;
 class COutput;
 class CCoinControl;
@@ -33,6 +34,8 @@ enum WalletFeature
 
     FEATURE_WALLETCRYPT = 40000, // wallet encryption
     FEATURE_COMPRPUBKEY = 60000, // compressed public keys
+    FEATURE_HD = 80000, // hierarchical deterministic keys (BIP32)
+    FEATURE_SCRYPTKDF = 80100, // master keys derived from the passphrase with scrypt
 
     FEATURE_LATEST = 60000
 };
@@ -65,13 +68,67 @@ public:
     )
 };
 
+/** A block read ahead by a rescan, and which of its transactions may pay to the wallet */
+struct CRescanSlot
+{
+    CBlockIndex *pindex;
+    CBlock block;
+    bool fHaveBlock;             // block data could be read from disk
+    std::vector<uint256> vHash;  // transaction hashes
+    std::vector<bool> vMatch;    // an output pushes data that is in the filter
+    bool fFiltered;
+
+    void SetNull();
+};
+
+/** Reads blocks ahead of a rescan and prefilters them on worker threads.
+ *
+ * A reader thread walks the main chain from the start block, staying at most
+ * one window ahead of the consumer. Worker threads match the outputs of each
+ * block against a bloom filter of the wallet's keys and scripts. The consumer
+ * takes the blocks back in chain order. Inputs are not prefiltered: whether a
+ * transaction spends from the wallet depends on the transactions found before
+ * it, so the consumer checks them against mapWallet.
+ */
+class CRescanPipeline
+{
+private:
+    const CBloomFilter &filter;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CRescanSlot> vSlots;
+    CBlockIndex *pindexNext;  // next block for the reader
+    int nRead;                // number of blocks read,
+    int nClaimed;             // claimed by a worker,
+    int nConsumed;            // and released by the consumer
+    bool fEnd;                // the reader reached the end of the chain
+    bool fStop;
+    boost::thread_group threads;
+
+    void ThreadRead();
+    void ThreadFilter();
+
+public:
+    CRescanPipeline(const CBloomFilter &filterIn, CBlockIndex *pindexStart, unsigned int nWindow, int nWorkers);
+    // Stops the threads, also when the consumer gives up before the end of the chain
+    ~CRescanPipeline();
+
+    // Wait for the next block in chain order, or return NULL at the end of the chain
+    CRescanSlot *Next();
+    // Hand the slot returned by Next() back to the reader
+    void Release();
+};
+
+/** Whether any output of tx pushes a key, key hash or script hash in the filter */
+bool PaysToFilter(const CBloomFilter &filter, const CTransaction &tx);
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
 class CWallet : public CCryptoKeyStore
 {
 private:
-    bool SelectCoins(int64 nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, const CCoinControl *coinControl=NULL) const;
+    bool SelectCoins(int64 nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, const CCoinControl *coinControl=NULL, bool* pfUsedBnB=NULL) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -81,6 +138,63 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // progress of a running ScanForWalletTransactions (protected by cs_rescan)
+    mutable CCriticalSection cs_rescan;
+    bool fRescanning;
+    bool fAbortRescan;
+    int nRescanStartHeight;
+    int nRescanHeight;
+    int nRescanStopHeight;
+
+    // outputs of wallet transactions that are ours and not spent (protected by cs_wallet)
+    std::set<COutPoint> setWalletUnspent;
+    // bumped whenever setWalletUnspent or a transaction in it changes
+    int64 nUnspentGeneration;
+    // outputs of wallet transactions that are not ours, by the key and script
+    // ids they pay to: a key or script added later only revisits the outputs
+    // it may make ours (protected by cs_wallet)
+    std::set<std::pair<uint160, COutPoint> > setForeignOutputs;
+
+    // balance tallies over setWalletUnspent as of hashBalanceBlock, valid while
+    // neither hashBestBlock nor nUnspentGeneration moved. UpdatedBestChain and
+    // SyncWithWallets refresh them with cs_main held, so the balance getters
+    // usually need cs_wallet alone (protected by cs_wallet)
+    mutable uint256 hashBestBlock;
+    mutable uint256 hashBalanceBlock;
+    mutable int64 nBalanceGeneration;
+    mutable int64 nBalanceAvailable;
+    mutable int64 nBalanceUnconfirmed;
+    mutable int64 nBalanceImmature;
+
+    void UpdateUnspent(const uint256 &hash, const CWalletTx &wtx);
+    bool BalancesValid() const { return nBalanceGeneration == nUnspentGeneration && hashBalanceBlock == hashBestBlock; }
+    void UpdateBalances() const;  // needs cs_main and cs_wallet
+    void RefreshBalances() const;
+
+    // wallet transactions by the outpoints their inputs spend (protected by cs_wallet)
+    typedef std::multimap<COutPoint, uint256> TxSpends;
+    TxSpends mapTxSpends;
+    void AddToSpends(const uint256 &hash, const CWalletTx &wtx);
+    void RemoveFromSpends(const uint256 &hash, const CWalletTx &wtx);
+    bool IsSpentByWallet(const COutPoint &outpoint) const;
+    bool HasConfirmedConflict(const uint256 &hash, const CWalletTx &wtx) const;
+
+    // wallet transactions other than coinbases that are not in the main
+    // chain, which ReacceptWalletTransactions() offers to the memory pool
+    // again (protected by cs_wallet)
+    std::set<uint256> setUnconfirmed;
+    void UpdateUnconfirmed(const uint256 &hash, const CWalletTx &wtx);
+
+    // move the deterministic chain past derived keys that tx pays to
+    void MarkHDKeysUsed(const CTransaction &tx);
+    bool WriteHDChain(const CHDChain &chain);
+
+    // held for the duration of a TopUpKeyPool, so only one fill runs at a time
+    CCriticalSection cs_KeyPoolFill;
+    // progress of that fill (protected by cs_wallet)
+    unsigned int nKeyPoolFillDone;
+    unsigned int nKeyPoolFillTarget;
+
 public:
     mutable CCriticalSection cs_wallet;
 
@@ -102,6 +216,14 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        fRescanning = false;
+        fAbortRescan = false;
+        nRescanStartHeight = nRescanHeight = nRescanStopHeight = 0;
+        nUnspentGeneration = 0;
+        hashBestBlock = hashBalanceBlock = 0;
+        nBalanceGeneration = -1;
+        nBalanceAvailable = nBalanceUnconfirmed = nBalanceImmature = 0;
+        nKeyPoolFillDone = nKeyPoolFillTarget = 0;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -112,6 +234,14 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        fRescanning = false;
+        fAbortRescan = false;
+        nRescanStartHeight = nRescanHeight = nRescanStopHeight = 0;
+        nUnspentGeneration = 0;
+        hashBestBlock = hashBalanceBlock = 0;
+        nBalanceGeneration = -1;
+        nBalanceAvailable = nBalanceUnconfirmed = nBalanceImmature = 0;
+        nKeyPoolFillDone = nKeyPoolFillTarget = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -129,6 +259,9 @@ public:
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl=NULL) const;
     bool SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const;
+    // per confirmation tier: a changeless branch-and-bound selection if there is one, else SelectCoinsMinConf;
+    // *pfUsedBnB tells which of the two was used
+    bool SelectCoinsByTier(int64 nTargetValue, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet, bool* pfUsedBnB=NULL) const;
     bool IsLockedCoin(uint256 hash, unsigned int n) const;
     void LockCoin(COutPoint& output);
     void UnlockCoin(COutPoint& output);
@@ -140,6 +273,14 @@ public:
     CPubKey GenerateNewKey();
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    // Start a deterministic key chain from a new random seed; new keys come from it from then on
+    bool GenerateHDSeed();
+    // Start it from a given seed instead, to restore the keys of the wallet it came from.
+    // Keys the wallet already has are kept but are not derived from the seed.
+    bool SetHDSeed(const CKey &seed);
+    // Install the deterministic chain read by LoadWallet
+    bool LoadHDChain(const CHDChain &chain);
+
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
 
@@ -170,13 +311,25 @@ public:
      */
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
+    // rebuild the unspent output index and drop the cached credits of all transactions
     void MarkDirty();
+    // update the outputs paying to a key or script id that was just added, and
+    // the transactions spending them
+    void MarkDirty(const uint160 &hashID);
     bool AddToWallet(const CWalletTx& wtxIn);
     bool AddToWalletIfInvolvingMe(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate = false, bool fFindBlock = false);
     bool EraseFromWallet(uint256 hash);
     void WalletUpdateSpent(const CTransaction& prevout);
+    // bloom filter matching the keys, key hashes and script hashes of the wallet
+    CBloomFilter GetRescanFilter() const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    // progress of a running rescan; returns false if none is running
+    bool GetRescanProgress(int &nStartHeight, int &nHeight, int &nStopHeight) const;
+    // ask a running rescan to stop after the current block
+    void AbortRescan();
     void ReacceptWalletTransactions();
+    // other wallet transactions spending an input of the wallet transaction hash
+    std::set<uint256> GetConflicts(const uint256 &hash) const;
     void ResendWalletTransactions();
     int64 GetBalance() const;
     int64 GetUnconfirmedBalance() const;
@@ -191,6 +344,8 @@ public:
 
     bool NewKeyPool();
     bool TopUpKeyPool();
+    // keys added so far by a running TopUpKeyPool, and the number it is adding
+    bool GetKeyPoolFillProgress(unsigned int &nDone, unsigned int &nTarget) const;
     int64 AddReserveKey(const CKeyPool& keypool);
     void ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool);
     void KeepKey(int64 nIndex);
@@ -266,6 +421,8 @@ public:
         return nChange;
     }
     void SetBestChain(const CBlockLocator& loc);
+    // The best block moved or transactions were synced (needs cs_main)
+    void UpdatedBestChain();
 
     DBErrors LoadWallet(bool& fFirstRunRet);
 
@@ -289,6 +446,12 @@ public:
 
     int GetKeyPoolSize()
     {
+        // with a deterministic chain, the keys derived ahead of the last one handed out
+        if (IsHDEnabled())
+        {
+            unsigned int nSize = GetHDChainSize(), nNext = GetHDChain().nNextIndex;
+            return nSize > nNext ? nSize - nNext : 0;
+        }
         return setKeyPool.size();
     }
 
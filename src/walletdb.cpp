@@ -5,6 +5,7 @@
 
 #include "walletdb.h"
 #include "wallet.h"
+#include "mimblewimble_keychain.h"
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 
@@ -69,7 +70,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -86,7 +87,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw runtime_error("CWalletDB::ListAccountCreditDebit() : error scanning DB");
         }
 
@@ -105,7 +106,55 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
         entries.push_back(acentry);
     }
 
-    pcursor->close();
+    delete pcursor;
+}
+
+bool CWalletDB::WriteMWOutput(const mw::Commitment& commitment, const CMWWalletOutput& output)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(string("mwout"), commitment), output);
+}
+
+bool CWalletDB::EraseMWOutput(const mw::Commitment& commitment)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(string("mwout"), commitment));
+}
+
+void CWalletDB::ListMWOutputs(vector<CMWWalletOutput>& vOutputs)
+{
+    CDBCursor* pcursor = GetCursor();
+    if (!pcursor)
+        throw runtime_error("CWalletDB::ListMWOutputs() : cannot create DB cursor");
+    unsigned int fFlags = DB_SET_RANGE;
+    loop
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey << string("mwout");
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            delete pcursor;
+            throw runtime_error("CWalletDB::ListMWOutputs() : error scanning DB");
+        }
+
+        // Unserialize
+        string strType;
+        ssKey >> strType;
+        if (strType != "mwout")
+            break;
+        CMWWalletOutput output;
+        ssValue >> output;
+        vOutputs.push_back(output);
+    }
+
+    delete pcursor;
 }
 
 
@@ -182,6 +231,91 @@ CWalletDB::ReorderTransactions(CWallet* pwallet)
 }
 
 
+// Decode a "tx" record (after its type). Does not touch the wallet, so
+// that LoadWallet can run it on worker threads.
+static bool DecodeWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx,
+                           bool& fUpgraded, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!wtx.CheckTransaction(state) || wtx.GetHash() != hash || !state.IsValid())
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount.c_str(), hash.ToString().c_str());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString().c_str());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const uint256& hash, CWalletTx& wtx, bool fUpgraded,
+                         vector<uint256>& vWalletUpgrade, bool& fAnyUnordered)
+{
+    wtx.BindWallet(pwallet);
+    if (fUpgraded)
+        vWalletUpgrade.push_back(hash);
+    if (wtx.nOrderPos == -1)
+        fAnyUnordered = true;
+
+    pwallet->mapWallet[hash] = wtx;
+    //// debug print
+    //printf("LoadWallet  %s\n", wtx.GetHash().ToString().c_str());
+    //printf(" %12"PRI64d"  %s  %s  %s\n",
+    //    wtx.vout[0].nValue,
+    //    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetBlockTime()).c_str(),
+    //    wtx.hashBlock.ToString().c_str(),
+    //    wtx.mapValue["message"].c_str());
+}
+
+// Decode a "key" or "wkey" record and check that the private key matches
+// the public one. Like DecodeWalletTx, safe to run on any thread.
+static bool DecodeWalletKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue,
+                            CKey& key, CPubKey& vchPubKey, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    if (strType == "key")
+        ssValue >> pkey;
+    else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+    if (!key.SetPrivKey(pkey, vchPubKey.IsCompressed()))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    if (key.GetPubKey() != vchPubKey)
+    {
+        strErr = "Error reading wallet database: CPrivKey pubkey inconsistency";
+        return false;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              int& nFileVersion, vector<uint256>& vWalletUpgrade,
@@ -201,46 +335,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (wtx.CheckTransaction(state) && (wtx.GetHash() == hash) && state.IsValid())
-                wtx.BindWallet(pwallet);
-            else
+            bool fUpgraded;
+            if (!DecodeWalletTx(ssKey, ssValue, hash, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount.c_str(), hash.ToString().c_str());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString().c_str());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                fAnyUnordered = true;
-
-            pwallet->mapWallet[hash] = wtx;
-            //// debug print
-            //printf("LoadWallet  %s\n", wtx.GetHash().ToString().c_str());
-            //printf(" %12"PRI64d"  %s  %s  %s\n",
-            //    wtx.vout[0].nValue,
-            //    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetBlockTime()).c_str(),
-            //    wtx.hashBlock.ToString().c_str(),
-            //    wtx.mapValue["message"].c_str());
+            LoadWalletTx(pwallet, hash, wtx, fUpgraded, vWalletUpgrade, fAnyUnordered);
         }
         else if (strType == "acentry")
         {
@@ -261,32 +360,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "key" || strType == "wkey")
         {
-            CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
             CKey key;
-            CPrivKey pkey;
-            if (strType == "key")
-                ssValue >> pkey;
-            else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-            if (!key.SetPrivKey(pkey, vchPubKey.IsCompressed()))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
-                return false;
-            }
-            if (key.GetPubKey() != vchPubKey)
-            {
-                strErr = "Error reading wallet database: CPrivKey pubkey inconsistency";
+            CPubKey vchPubKey;
+            if (!DecodeWalletKey(strType, ssKey, ssValue, key, vchPubKey, strErr))
                 return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey))
             {
                 strErr = "Error reading wallet database: LoadKey failed";
@@ -353,6 +430,16 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nOrderPosNext;
         }
+        else if (strType == "hdchain")
+        {
+            CHDChain chain;
+            ssValue >> chain;
+            if (!pwallet->LoadHDChain(chain))
+            {
+                strErr = "Error reading wallet database: LoadHDChain failed";
+                return false;
+            }
+        }
     } catch (...)
     {
         return false;
@@ -363,9 +450,251 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
-            strType == "mkey" || strType == "ckey");
+            strType == "mkey" || strType == "ckey" || strType == "hdchain");
+}
+
+static int GetWalletLoadThreads()
+{
+    // like -par: 0 means one per core
+    int nThreads = GetArg("-walletloadthreads", 0);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+    return std::max(1, std::min(nThreads, MAX_WALLETLOAD_THREADS));
 }
 
+/** A raw wallet record, and for transactions and keys its decoded form */
+struct CWalletLoadRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    string strType;
+    bool fDecoded;
+    bool fOk;
+    string strErr;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgraded;
+    CKey key;
+    CPubKey vchPubKey;
+
+    CWalletLoadRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION),
+                          fDecoded(false), fOk(false), fUpgraded(false)
+    {
+    }
+
+    // Forget what was decoded into this slot for an earlier record
+    void ClearDecoded()
+    {
+        strType.clear();
+        fDecoded = false;
+        fOk = false;
+        strErr.clear();
+        hash = 0;
+        wtx = CWalletTx();
+        fUpgraded = false;
+        key = CKey();
+        vchPubKey = CPubKey();
+    }
+};
+
+struct CWalletLoadSlot
+{
+    std::vector<CWalletLoadRecord> vRecords;
+    unsigned int nRecords;
+    bool fDecoded;
+
+    void SetNull()
+    {
+        nRecords = 0;
+        fDecoded = false;
+    }
+};
+
+/** Reads the records of a wallet file and decodes them on worker threads.
+ *
+ * A reader thread walks the database cursor and fills batches of raw records,
+ * staying at most one window ahead of the consumer. Worker threads deserialize
+ * transactions (checking their hashes) and keys (checking the private key
+ * against the public one), which is where the time goes for large wallets.
+ * The consumer takes the batches back in file order and merges them into the
+ * wallet; all the other record types are cheap and decoded there.
+ */
+class CWalletLoadPipeline
+{
+private:
+    CWalletDB &walletdb;
+    CDBCursor *pcursor;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CWalletLoadSlot> vSlots;
+    int nRead;                // number of batches read,
+    int nClaimed;             // claimed by a worker,
+    int nConsumed;            // and released by the consumer
+    bool fEnd;                // the reader reached the end of the file
+    bool fReadError;
+    bool fStop;
+    boost::thread_group threads;
+
+public:
+    // time spent reading the file, and decoding summed over the workers
+    int64 nReadMicros;
+    int64 nDecodeMicros;
+
+private:
+    void ThreadRead()
+    {
+        RenameThread("bitcoin-walletload");
+        while (true)
+        {
+            CWalletLoadSlot *pslot;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nRead - nConsumed >= (int)vSlots.size())
+                    cond.wait(lock);
+                if (fStop)
+                    return;
+                pslot = &vSlots[nRead % vSlots.size()];
+            }
+            int64 nStart = GetTimeMicros();
+            bool fLast = false, fError = false;
+            try {
+                while (pslot->nRecords < WALLETLOAD_BATCH)
+                {
+                    CWalletLoadRecord &record = pslot->vRecords[pslot->nRecords];
+                    record.ssKey.clear();
+                    record.ssValue.clear();
+                    int ret = walletdb.ReadAtCursor(pcursor, record.ssKey, record.ssValue);
+                    if (ret == DB_NOTFOUND) {
+                        fLast = true;
+                        break;
+                    }
+                    if (ret != 0) {
+                        fError = true;
+                        break;
+                    }
+                    pslot->nRecords++;
+                }
+            } catch (std::exception &e) {
+                PrintExceptionContinue(&e, "CWalletLoadPipeline::ThreadRead()");
+                fError = true;
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nReadMicros += GetTimeMicros() - nStart;
+                if (pslot->nRecords > 0 && !fError)
+                    nRead++;
+                fReadError = fError;
+                fEnd = fLast || fError;
+            }
+            cond.notify_all();
+            if (fLast || fError)
+                return;
+        }
+    }
+
+    void ThreadDecode()
+    {
+        while (true)
+        {
+            CWalletLoadSlot *pslot;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && !fEnd && nClaimed == nRead)
+                    cond.wait(lock);
+                if (fStop || nClaimed == nRead)
+                    return;
+                pslot = &vSlots[nClaimed++ % vSlots.size()];
+            }
+            int64 nStart = GetTimeMicros();
+            for (unsigned int i = 0; i < pslot->nRecords; i++)
+            {
+                CWalletLoadRecord &record = pslot->vRecords[i];
+                record.ClearDecoded();
+                try {
+                    // the consumer decodes the other types from the untouched key
+                    CDataStream ssKey(record.ssKey.begin(), record.ssKey.end(), SER_DISK, CLIENT_VERSION);
+                    ssKey >> record.strType;
+                    if (record.strType == "tx")
+                        record.fOk = DecodeWalletTx(ssKey, record.ssValue, record.hash, record.wtx,
+                                                    record.fUpgraded, record.strErr);
+                    else if (record.strType == "key" || record.strType == "wkey")
+                        record.fOk = DecodeWalletKey(record.strType, ssKey, record.ssValue,
+                                                     record.key, record.vchPubKey, record.strErr);
+                    else
+                        continue;
+                } catch (...) {
+                    record.fOk = false;
+                }
+                record.fDecoded = true;
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nDecodeMicros += GetTimeMicros() - nStart;
+                pslot->fDecoded = true;
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CWalletLoadPipeline(CWalletDB &walletdbIn, CDBCursor *pcursorIn, unsigned int nWindow, int nWorkers) :
+        walletdb(walletdbIn), pcursor(pcursorIn), vSlots(nWindow), nRead(0), nClaimed(0), nConsumed(0),
+        fEnd(false), fReadError(false), fStop(false), nReadMicros(0), nDecodeMicros(0)
+    {
+        for (unsigned int i = 0; i < vSlots.size(); i++)
+        {
+            vSlots[i].vRecords.resize(WALLETLOAD_BATCH);
+            vSlots[i].SetNull();
+        }
+        threads.create_thread(boost::bind(&CWalletLoadPipeline::ThreadRead, this));
+        for (int i = 0; i < nWorkers; i++)
+            threads.create_thread(boost::bind(&CWalletLoadPipeline::ThreadDecode, this));
+    }
+
+    ~CWalletLoadPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+    }
+
+    // Wait for the next batch in file order, or return NULL at the end of the file
+    CWalletLoadSlot *Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true)
+        {
+            if (nConsumed < nRead) {
+                CWalletLoadSlot &slot = vSlots[nConsumed % vSlots.size()];
+                if (slot.fDecoded)
+                    return &slot;
+            } else if (fEnd)
+                return NULL;
+            cond.wait(lock);
+        }
+    }
+
+    // Hand the batch returned by Next() back to the reader
+    void Release()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vSlots[nConsumed % vSlots.size()].SetNull();
+            nConsumed++;
+        }
+        cond.notify_all();
+    }
+
+    bool ReadFailed()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fReadError;
+    }
+};
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -375,6 +704,10 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fAnyUnordered = false;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    int64 nStart = GetTimeMicros();
+    int64 nMergeMicros = 0;
+    unsigned int nRecords = 0;
+    int nThreads = GetWalletLoadThreads();
 
     try {
         LOCK(pwallet->cs_wallet);
@@ -387,49 +720,75 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             printf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
         }
 
-        loop
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            CWalletLoadPipeline pipeline(*this, pcursor, 4 * nThreads, nThreads);
+            CWalletLoadSlot *pslot;
+            while ((pslot = pipeline.Next()) != NULL)
             {
-                printf("Error reading next record from wallet database\n");
-                return DB_CORRUPT;
-            }
-
-            // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, nFileVersion,
-                              vWalletUpgrade, fIsEncrypted, fAnyUnordered, strType, strErr))
-            {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType))
-                    result = DB_CORRUPT;
-                else
+                int64 nMergeStart = GetTimeMicros();
+                for (unsigned int i = 0; i < pslot->nRecords; i++)
                 {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
+                    CWalletLoadRecord &record = pslot->vRecords[i];
+                    string strType, strErr;
+                    bool fOk;
+                    if (record.fDecoded)
+                    {
+                        strType = record.strType;
+                        strErr = record.strErr;
+                        fOk = record.fOk;
+                        if (fOk && strType == "tx")
+                            LoadWalletTx(pwallet, record.hash, record.wtx, record.fUpgraded, vWalletUpgrade, fAnyUnordered);
+                        else if (fOk && !pwallet->LoadKey(record.key, record.vchPubKey))
+                        {
+                            strErr = "Error reading wallet database: LoadKey failed";
+                            fOk = false;
+                        }
+                    }
+                    else
+                        fOk = ReadKeyValue(pwallet, record.ssKey, record.ssValue, nFileVersion,
+                                           vWalletUpgrade, fIsEncrypted, fAnyUnordered, strType, strErr);
+
+                    // Try to be tolerant of single corrupt records:
+                    if (!fOk)
+                    {
+                        // losing keys is considered a catastrophic error, anything else
+                        // we assume the user can live with:
+                        if (IsKeyType(strType))
+                            result = DB_CORRUPT;
+                        else
+                        {
+                            // Leave other errors alone, if we try to fix them we might make things worse.
+                            fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                            if (strType == "tx")
+                                // Rescan if there is a bad transaction record:
+                                SoftSetBoolArg("-rescan", true);
+                        }
+                    }
+                    if (!strErr.empty())
+                        printf("%s\n", strErr.c_str());
                 }
+                nRecords += pslot->nRecords;
+                nMergeMicros += GetTimeMicros() - nMergeStart;
+                pipeline.Release();
+            }
+            if (pipeline.ReadFailed())
+            {
+                printf("Error reading next record from wallet database\n");
+                delete pcursor;
+                return DB_CORRUPT;
             }
-            if (!strErr.empty())
-                printf("%s\n", strErr.c_str());
+            printf("LoadWallet() : %u records in %"PRI64d"ms (read %"PRI64d"ms, decode %"PRI64d"ms on %d threads, merge %"PRI64d"ms)\n",
+                   nRecords, (GetTimeMicros() - nStart) / 1000, pipeline.nReadMicros / 1000,
+                   pipeline.nDecodeMicros / 1000, nThreads, nMergeMicros / 1000);
         }
-        pcursor->close();
+        delete pcursor;
     }
     catch (boost::thread_interrupted) {
         throw;
@@ -459,7 +818,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         WriteVersion(CLIENT_VERSION);
 
     if (fAnyUnordered)
+    {
+        int64 nReorderStart = GetTimeMillis();
         result = ReorderTransactions(pwallet);
+        printf("LoadWallet() : reordered transactions in %"PRI64d"ms\n", GetTimeMillis() - nReorderStart);
+    }
 
     return result;
 }
@@ -513,11 +876,28 @@ void ThreadFlushWalletDB(const string& strFile)
                         nLastFlushed = nWalletDBUpdated;
                         int64 nStart = GetTimeMillis();
 
-                        // Flush wallet.dat so it's self contained
-                        bitdb.CloseDb(strFile);
-                        bitdb.CheckpointLSN(strFile);
-
-                        bitdb.mapFileUseCount.erase(mi++);
+                        map<string, CWalletLog*>::iterator mil = bitdb.mapLogDb.find(strFile);
+                        if (mil != bitdb.mapLogDb.end())
+                        {
+                            // A wallet log is always self contained; keep it open
+                            // (reopening replays it) and compact it while idle
+                            CWalletLog* plog = (*mil).second;
+                            plog->Sync();
+                            if (plog->NeedsCompaction())
+                            {
+                                uint64 nSizeBefore = plog->GetFileSize();
+                                if (plog->Compact())
+                                    printf("Compacted wallet.dat %"PRI64u" -> %"PRI64u" bytes\n", nSizeBefore, plog->GetFileSize());
+                            }
+                        }
+                        else
+                        {
+                            // Flush wallet.dat so it's self contained
+                            bitdb.CloseDb(strFile);
+                            bitdb.CheckpointLSN(strFile);
+
+                            bitdb.mapFileUseCount.erase(mi++);
+                        }
                         printf("Flushed wallet.dat %"PRI64d"ms\n", GetTimeMillis() - nStart);
                     }
                 }
@@ -11,6 +11,13 @@
 class CKeyPool;
 class CAccount;
 class CAccountingEntry;
+class CMWWalletOutput;
+namespace mw { class Commitment; }
+
+// records per batch handed to the wallet load workers
+static const unsigned int WALLETLOAD_BATCH = 256;
+// maximum number of wallet load worker threads (-walletloadthreads)
+static const int MAX_WALLETLOAD_THREADS = 16;
 
 /** Error statuses for the wallet database */
 enum DBErrors
@@ -26,6 +33,7 @@ enum DBErrors
 /** Access to the wallet database (wallet.dat) */
 class CWalletDB : public CDB
 {
+    friend class CWalletLoadPipeline;
 public:
     CWalletDB(std::string strFilename, const char* pszMode="r+") : CDB(strFilename.c_str(), pszMode)
     {
@@ -145,6 +153,26 @@ public:
         return Write(std::string("minversion"), nVersion);
     }
 
+    bool WriteHDChain(const CHDChain& chain)
+    {
+        nWalletDBUpdated++;
+        return Write(std::string("hdchain"), chain);
+    }
+
+    // Mimblewimble outputs of the wallet, by commitment, and the next key index
+    bool WriteMWOutput(const mw::Commitment& commitment, const CMWWalletOutput& output);
+    bool EraseMWOutput(const mw::Commitment& commitment);
+    void ListMWOutputs(std::vector<CMWWalletOutput>& vOutputs);
+    bool WriteMWKeyIndex(unsigned int nIndex)
+    {
+        nWalletDBUpdated++;
+        return Write(std::string("mwkeyindex"), nIndex);
+    }
+    bool ReadMWKeyIndex(unsigned int& nIndex)
+    {
+        return Read(std::string("mwkeyindex"), nIndex);
+    }
+
     bool ReadAccount(const std::string& strAccount, CAccount& account);
     bool WriteAccount(const std::string& strAccount, const CAccount& account);
 private:
@@ -0,0 +1,499 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletlog.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+#ifndef WIN32
+#include "sys/stat.h"
+#endif
+
+using namespace std;
+
+namespace {
+
+const char pchWalletLogMagic[8] = { 'd', 'u', 'c', 'k', 'w', 'l', 'o', 'g' };
+const unsigned int WALLETLOG_VERSION = 1;
+// magic and version
+const unsigned int WALLETLOG_HEADER_SIZE = 12;
+// payload size and CRC-32 in front of every frame
+const unsigned int WALLETLOG_FRAME_HEADER_SIZE = 8;
+// anything larger is treated as a damaged frame header
+const unsigned int WALLETLOG_MAX_FRAME = 256 * 1024 * 1024;
+
+unsigned int FrameChecksum(const char* pbegin, const char* pend)
+{
+    boost::crc_32_type crc;
+    crc.process_block(pbegin, pend);
+    return crc.checksum();
+}
+
+// approximate bytes a live record occupies in a compacted log
+uint64 RecordSize(const vector<unsigned char>& vchKey, const CSerializeData& vchValue)
+{
+    return vchKey.size() + vchValue.size() + 2 * sizeof(unsigned int);
+}
+
+bool WriteHeader(FILE* fileout)
+{
+    char header[WALLETLOG_HEADER_SIZE];
+    memcpy(header, pchWalletLogMagic, sizeof(pchWalletLogMagic));
+    memcpy(header + sizeof(pchWalletLogMagic), &WALLETLOG_VERSION, sizeof(WALLETLOG_VERSION));
+    return fwrite(header, 1, sizeof(header), fileout) == sizeof(header);
+}
+
+void RestrictPermissions(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    chmod(path.string().c_str(), S_IRUSR | S_IWUSR);
+#endif
+}
+
+} // anon namespace
+
+void CWalletLogBatch::Write(const char* pbegin, const char* pend, const char* pvbegin, const char* pvend)
+{
+    COp op;
+    op.nType = OP_WRITE;
+    op.vchKey.assign(pbegin, pend);
+    op.vchValue.assign(pvbegin, pvend);
+    vOps.push_back(op);
+}
+
+void CWalletLogBatch::Erase(const char* pbegin, const char* pend)
+{
+    COp op;
+    op.nType = OP_ERASE;
+    op.vchKey.assign(pbegin, pend);
+    vOps.push_back(op);
+}
+
+int CWalletLogBatch::Find(const vector<unsigned char>& vchKey, CSerializeData& vchValue) const
+{
+    for (vector<COp>::const_reverse_iterator it = vOps.rbegin(); it != vOps.rend(); ++it)
+    {
+        if (it->vchKey == vchKey)
+        {
+            if (it->nType == OP_WRITE)
+                vchValue = it->vchValue;
+            return it->nType;
+        }
+    }
+    return 0;
+}
+
+CWalletLog::CWalletLog()
+{
+    file = NULL;
+    nFileSize = nLiveSize = 0;
+    nWrittenSeq = nSyncedSeq = 0;
+    fSyncing = false;
+}
+
+CWalletLog::~CWalletLog()
+{
+    Close();
+}
+
+bool CWalletLog::IsLogFile(const boost::filesystem::path& pathIn)
+{
+    FILE* filein = fopen(pathIn.string().c_str(), "rb");
+    if (!filein)
+        return false;
+    char magic[sizeof(pchWalletLogMagic)];
+    bool fLog = fread(magic, 1, sizeof(magic), filein) == sizeof(magic) &&
+                memcmp(magic, pchWalletLogMagic, sizeof(magic)) == 0;
+    fclose(filein);
+    return fLog;
+}
+
+bool CWalletLog::Open(const boost::filesystem::path& pathIn, bool fCreate)
+{
+    LOCK(cs_log);
+    if (file)
+        return error("CWalletLog::Open() : %s is already open", path.string().c_str());
+    path = pathIn;
+
+    bool fExists = boost::filesystem::exists(path);
+    if (!fExists && !fCreate)
+        return error("CWalletLog::Open() : %s does not exist", path.string().c_str());
+    file = fopen(path.string().c_str(), fExists ? "rb+" : "wb+");
+    if (!file)
+        return error("CWalletLog::Open() : cannot open %s", path.string().c_str());
+
+    if (!fExists)
+    {
+        RestrictPermissions(path);
+        if (!WriteHeader(file))
+        {
+            fclose(file);
+            file = NULL;
+            return error("CWalletLog::Open() : cannot write to %s", path.string().c_str());
+        }
+        FileCommit(file);
+        nFileSize = WALLETLOG_HEADER_SIZE;
+        return true;
+    }
+
+    char header[WALLETLOG_HEADER_SIZE];
+    unsigned int nVersion = 0;
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) &&
+        memcmp(header, pchWalletLogMagic, sizeof(pchWalletLogMagic)) == 0)
+        memcpy(&nVersion, header + sizeof(pchWalletLogMagic), sizeof(nVersion));
+    if (nVersion == 0 || nVersion > WALLETLOG_VERSION || !Replay())
+    {
+        fclose(file);
+        file = NULL;
+        mapRecords.clear();
+        nLiveSize = 0;
+        return error("CWalletLog::Open() : %s is not a readable wallet log", path.string().c_str());
+    }
+    return true;
+}
+
+void CWalletLog::Close()
+{
+    boost::unique_lock<boost::mutex> lock(mutexSync);
+    while (fSyncing)
+        condSync.wait(lock);
+
+    LOCK(cs_log);
+    if (file)
+    {
+        FileCommit(file);
+        fclose(file);
+        file = NULL;
+    }
+    mapRecords.clear();
+    nFileSize = nLiveSize = 0;
+    nWrittenSeq = nSyncedSeq = 0;
+}
+
+void CWalletLog::Apply(const CWalletLogBatch& batch)
+{
+    BOOST_FOREACH(const CWalletLogBatch::COp& op, batch.vOps)
+    {
+        map<vector<unsigned char>, CSerializeData>::iterator it = mapRecords.find(op.vchKey);
+        if (it != mapRecords.end())
+        {
+            nLiveSize -= RecordSize(it->first, it->second);
+            if (op.nType == CWalletLogBatch::OP_ERASE)
+                mapRecords.erase(it);
+        }
+        if (op.nType == CWalletLogBatch::OP_WRITE)
+        {
+            mapRecords[op.vchKey] = op.vchValue;
+            nLiveSize += RecordSize(op.vchKey, op.vchValue);
+        }
+    }
+}
+
+bool CWalletLog::Replay()
+{
+    if (fseek(file, 0, SEEK_END) != 0)
+        return error("CWalletLog::Replay() : seek failed on %s", path.string().c_str());
+    uint64 nEnd = ftell(file);
+    uint64 nPos = WALLETLOG_HEADER_SIZE;
+    if (fseek(file, nPos, SEEK_SET) != 0)
+        return error("CWalletLog::Replay() : seek failed on %s", path.string().c_str());
+    unsigned int nFrames = 0;
+    while (true)
+    {
+        unsigned char header[WALLETLOG_FRAME_HEADER_SIZE];
+        size_t nRead = fread(header, 1, sizeof(header), file);
+        if (ferror(file))
+            return error("CWalletLog::Replay() : cannot read %s", path.string().c_str());
+        if (nRead == 0 && feof(file))
+            break;
+
+        unsigned int nSize = 0, nChecksum = 0;
+        CSerializeData vchFrame;
+        // where the frame claims to end
+        uint64 nFrameEnd = nPos + sizeof(header);
+        bool fDamaged = (nRead != sizeof(header));
+        if (!fDamaged)
+        {
+            memcpy(&nSize, header, sizeof(nSize));
+            memcpy(&nChecksum, header + sizeof(nSize), sizeof(nChecksum));
+            fDamaged = (nSize == 0 || nSize > WALLETLOG_MAX_FRAME);
+        }
+        if (!fDamaged)
+        {
+            nFrameEnd += nSize;
+            vchFrame.resize(nSize);
+            fDamaged = (fread(&vchFrame[0], 1, nSize, file) != nSize ||
+                        FrameChecksum(&vchFrame[0], &vchFrame[0] + nSize) != nChecksum);
+        }
+        if (fDamaged)
+        {
+            // An append that did not complete leaves a damaged frame that runs
+            // to the end of the file. Anything else is corruption of committed
+            // data: refuse to open, and leave the file alone for salvaging.
+            if (nFrameEnd < nEnd)
+                return error("CWalletLog::Replay() : damaged frame at offset %"PRI64u" of %s, with %"PRI64u" bytes after it",
+                             nPos, path.string().c_str(), nEnd - nFrameEnd);
+            // everything before it is intact
+            printf("CWalletLog : discarding damaged frame at offset %"PRI64u" of %s\n", nPos, path.string().c_str());
+            if (!TruncateFile(file, nPos))
+                return error("CWalletLog::Replay() : cannot truncate %s", path.string().c_str());
+            break;
+        }
+
+        CWalletLogBatch batch;
+        try {
+            CDataStream ss(vchFrame.begin(), vchFrame.end(), SER_DISK, CLIENT_VERSION);
+            uint64 nOps = ReadCompactSize(ss);
+            for (uint64 i = 0; i < nOps; i++)
+            {
+                CWalletLogBatch::COp op;
+                ss >> op.nType;
+                op.vchKey.resize(ReadCompactSize(ss));
+                if (!op.vchKey.empty())
+                    ss.read((char*)&op.vchKey[0], op.vchKey.size());
+                op.vchValue.resize(ReadCompactSize(ss));
+                if (!op.vchValue.empty())
+                    ss.read(&op.vchValue[0], op.vchValue.size());
+                if (op.nType != CWalletLogBatch::OP_WRITE && op.nType != CWalletLogBatch::OP_ERASE)
+                    throw runtime_error("unknown operation");
+                batch.vOps.push_back(op);
+            }
+        }
+        catch (std::exception &e) {
+            // the checksum matched, so this was written like this
+            return error("CWalletLog::Replay() : malformed frame at offset %"PRI64u" of %s: %s", nPos, path.string().c_str(), e.what());
+        }
+        Apply(batch);
+        nPos += sizeof(header) + nSize;
+        nFrames++;
+    }
+
+    if (fseek(file, nPos, SEEK_SET) != 0)
+        return error("CWalletLog::Replay() : seek failed on %s", path.string().c_str());
+    nFileSize = nPos;
+    printf("CWalletLog : replayed %u frames, %"PRIszu" records from %s\n", nFrames, mapRecords.size(), path.string().c_str());
+    return true;
+}
+
+bool CWalletLog::WriteFrame(FILE* fileout, const CWalletLogBatch& batch, uint64& nBytes)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    WriteCompactSize(ss, batch.vOps.size());
+    BOOST_FOREACH(const CWalletLogBatch::COp& op, batch.vOps)
+    {
+        ss << op.nType;
+        WriteCompactSize(ss, op.vchKey.size());
+        if (!op.vchKey.empty())
+            ss.write((const char*)&op.vchKey[0], op.vchKey.size());
+        WriteCompactSize(ss, op.vchValue.size());
+        if (!op.vchValue.empty())
+            ss.write(&op.vchValue[0], op.vchValue.size());
+    }
+
+    unsigned int nSize = ss.size();
+    unsigned int nChecksum = FrameChecksum(&ss[0], &ss[0] + nSize);
+    char header[WALLETLOG_FRAME_HEADER_SIZE];
+    memcpy(header, &nSize, sizeof(nSize));
+    memcpy(header + sizeof(nSize), &nChecksum, sizeof(nChecksum));
+    if (fwrite(header, 1, sizeof(header), fileout) != sizeof(header) ||
+        fwrite(&ss[0], 1, nSize, fileout) != nSize)
+        return false;
+    nBytes = sizeof(header) + nSize;
+    return true;
+}
+
+bool CWalletLog::Read(const vector<unsigned char>& vchKey, CSerializeData& vchValue) const
+{
+    LOCK(cs_log);
+    map<vector<unsigned char>, CSerializeData>::const_iterator it = mapRecords.find(vchKey);
+    if (it == mapRecords.end())
+        return false;
+    vchValue = it->second;
+    return true;
+}
+
+bool CWalletLog::Exists(const vector<unsigned char>& vchKey) const
+{
+    LOCK(cs_log);
+    return mapRecords.count(vchKey) > 0;
+}
+
+bool CWalletLog::Seek(const vector<unsigned char>& vchFrom, bool fInclusive, vector<unsigned char>& vchKey, CSerializeData& vchValue) const
+{
+    LOCK(cs_log);
+    map<vector<unsigned char>, CSerializeData>::const_iterator it =
+        fInclusive ? mapRecords.lower_bound(vchFrom) : mapRecords.upper_bound(vchFrom);
+    if (it == mapRecords.end())
+        return false;
+    vchKey = it->first;
+    vchValue = it->second;
+    return true;
+}
+
+bool CWalletLog::Commit(const CWalletLogBatch& batch, bool fSync)
+{
+    if (batch.IsEmpty())
+        return true;
+
+    uint64 nSeq;
+    {
+        LOCK(cs_log);
+        if (!file)
+            return error("CWalletLog::Commit() : log is closed");
+        uint64 nBytes = 0;
+        if (!WriteFrame(file, batch, nBytes) || fflush(file) != 0)
+        {
+            // cut off whatever part of the frame made it out
+            TruncateFile(file, nFileSize);
+            fseek(file, nFileSize, SEEK_SET);
+            return error("CWalletLog::Commit() : write to %s failed", path.string().c_str());
+        }
+        nFileSize += nBytes;
+        Apply(batch);
+        nSeq = ++nWrittenSeq;
+    }
+    return fSync ? SyncTo(nSeq) : true;
+}
+
+bool CWalletLog::Sync()
+{
+    uint64 nSeq;
+    {
+        LOCK(cs_log);
+        nSeq = nWrittenSeq;
+    }
+    return SyncTo(nSeq);
+}
+
+bool CWalletLog::SyncTo(uint64 nSeq)
+{
+    boost::unique_lock<boost::mutex> lock(mutexSync);
+    while (true)
+    {
+        {
+            LOCK(cs_log);
+            if (nSyncedSeq >= nSeq)
+                return true;
+        }
+        if (!fSyncing)
+            break;
+        // someone else is syncing; their fsync may cover our frame too
+        condSync.wait(lock);
+    }
+
+    // become the leader: sync everything appended so far, for all waiters
+    fSyncing = true;
+    uint64 nTarget;
+    FILE* fileSync;
+    {
+        LOCK(cs_log);
+        nTarget = nWrittenSeq;
+        fileSync = file;
+    }
+    lock.unlock();
+    if (fileSync)
+        FileCommit(fileSync);
+    lock.lock();
+
+    fSyncing = false;
+    if (fileSync)
+    {
+        LOCK(cs_log);
+        if (nTarget > nSyncedSeq)
+            nSyncedSeq = nTarget;
+    }
+    condSync.notify_all();
+    return fileSync != NULL;
+}
+
+bool CWalletLog::NeedsCompaction() const
+{
+    LOCK(cs_log);
+    return file && nFileSize > 2 * nLiveSize + WALLETLOG_COMPACT_SLACK;
+}
+
+bool CWalletLog::Compact()
+{
+    // keep fsyncs off the file while it is being replaced
+    boost::unique_lock<boost::mutex> lock(mutexSync);
+    while (fSyncing)
+        condSync.wait(lock);
+
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    int64 nStart = GetTimeMillis();
+    uint64 nOldSize = nFileSize;
+
+    boost::filesystem::path pathTmp = path.string() + ".compact";
+    FILE* fileTmp = fopen(pathTmp.string().c_str(), "wb");
+    if (!fileTmp)
+        return error("CWalletLog::Compact() : cannot create %s", pathTmp.string().c_str());
+    RestrictPermissions(pathTmp);
+
+    bool fOk = WriteHeader(fileTmp);
+    uint64 nNewSize = WALLETLOG_HEADER_SIZE;
+    CWalletLogBatch batch;
+    map<vector<unsigned char>, CSerializeData>::const_iterator it = mapRecords.begin();
+    while (fOk && it != mapRecords.end())
+    {
+        const char* pkey = it->first.empty() ? NULL : (const char*)&it->first[0];
+        const char* pvalue = it->second.empty() ? NULL : &it->second[0];
+        batch.Write(pkey, pkey + it->first.size(), pvalue, pvalue + it->second.size());
+        ++it;
+        if (batch.vOps.size() == WALLETLOG_COMPACT_FRAME || it == mapRecords.end())
+        {
+            uint64 nBytes = 0;
+            fOk = WriteFrame(fileTmp, batch, nBytes);
+            nNewSize += nBytes;
+            batch.vOps.clear();
+        }
+    }
+    if (fOk)
+    {
+        FileCommit(fileTmp);
+        fOk = (ferror(fileTmp) == 0);
+    }
+    fclose(fileTmp);
+    if (!fOk)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CWalletLog::Compact() : writing %s failed", pathTmp.string().c_str());
+    }
+
+    fclose(file);
+    file = NULL;
+    bool fRenamed = RenameOver(pathTmp, path);
+    file = fopen(path.string().c_str(), "rb+");
+    if (!file)
+        return error("CWalletLog::Compact() : cannot reopen %s", path.string().c_str());
+    fseek(file, 0, SEEK_END);
+    if (!fRenamed)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CWalletLog::Compact() : cannot replace %s", path.string().c_str());
+    }
+
+    nFileSize = nNewSize;
+    nSyncedSeq = nWrittenSeq;
+    printf("CWalletLog : compacted %s from %"PRI64u" to %"PRI64u" bytes in %"PRI64d"ms\n",
+           path.string().c_str(), nOldSize, nNewSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+uint64 CWalletLog::GetFileSize() const
+{
+    LOCK(cs_log);
+    return nFileSize;
+}
+
+unsigned int CWalletLog::GetRecordCount() const
+{
+    LOCK(cs_log);
+    return mapRecords.size();
+}
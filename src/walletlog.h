@@ -0,0 +1,114 @@
+// Copyright (c) 2014 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_WALLETLOG_H
+#define BITCOIN_WALLETLOG_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+// compaction starts once the file is this much larger than its live records
+static const uint64 WALLETLOG_COMPACT_SLACK = 1 << 20;
+// live records per frame written by Compact()
+static const unsigned int WALLETLOG_COMPACT_FRAME = 1000;
+
+/** Changes queued to be committed to a CWalletLog as one frame */
+class CWalletLogBatch
+{
+    friend class CWalletLog;
+
+public:
+    enum { OP_WRITE = 1, OP_ERASE = 2 };
+
+private:
+    struct COp
+    {
+        unsigned char nType;
+        std::vector<unsigned char> vchKey;
+        CSerializeData vchValue;
+    };
+    std::vector<COp> vOps;
+
+public:
+    void Write(const char* pbegin, const char* pend, const char* pvbegin, const char* pvend);
+    void Erase(const char* pbegin, const char* pend);
+    bool IsEmpty() const { return vOps.empty(); }
+
+    // look up the last queued change to a key: 0 if none, else OP_WRITE/OP_ERASE
+    int Find(const std::vector<unsigned char>& vchKey, CSerializeData& vchValue) const;
+};
+
+/** Append-only, log-structured storage for a wallet file.
+ *
+ * Every commit appends one frame to the file: the payload length, a CRC-32 of
+ * the payload, and the payload itself, a list of writes and erases that are
+ * applied together. The live records are kept in memory (ordered by key, as
+ * Berkeley DB orders them), so reads never touch the disk. When the log is
+ * opened the frames are replayed; a damaged frame that runs to the end of the
+ * file (an interrupted append) is cut off, while damage anywhere else makes
+ * the open fail without touching the file.
+ *
+ * Commits that ask for durability share fsyncs: a committer that finds another
+ * fsync in progress waits for it and then syncs everything appended so far on
+ * behalf of all waiters. Compact() rewrites the file from the live records
+ * once overwritten and erased records dominate it.
+ */
+class CWalletLog
+{
+private:
+    // protects mapRecords, the file position and the counters below
+    mutable CCriticalSection cs_log;
+    boost::filesystem::path path;
+    FILE* file;
+    std::map<std::vector<unsigned char>, CSerializeData> mapRecords;
+    uint64 nFileSize;
+    uint64 nLiveSize;
+    // frames appended, resp. known to be on disk
+    uint64 nWrittenSeq;
+    uint64 nSyncedSeq;
+
+    // group commit state (protected by mutexSync)
+    boost::mutex mutexSync;
+    boost::condition_variable condSync;
+    bool fSyncing;
+
+    void Apply(const CWalletLogBatch& batch);
+    bool Replay();
+    bool WriteFrame(FILE* fileout, const CWalletLogBatch& batch, uint64& nBytes);
+    // return once frame nSeq is on disk, running the fsync if nobody else is
+    bool SyncTo(uint64 nSeq);
+
+public:
+    CWalletLog();
+    ~CWalletLog();
+
+    // whether the file at pathIn is a wallet log (as opposed to Berkeley DB)
+    static bool IsLogFile(const boost::filesystem::path& pathIn);
+
+    bool Open(const boost::filesystem::path& pathIn, bool fCreate);
+    void Close();
+
+    bool Read(const std::vector<unsigned char>& vchKey, CSerializeData& vchValue) const;
+    bool Exists(const std::vector<unsigned char>& vchKey) const;
+    // the first record with key >= vchFrom (> vchFrom if !fInclusive)
+    bool Seek(const std::vector<unsigned char>& vchFrom, bool fInclusive, std::vector<unsigned char>& vchKey, CSerializeData& vchValue) const;
+
+    // append batch as one frame; with fSync, return only once it is on disk
+    bool Commit(const CWalletLogBatch& batch, bool fSync);
+    // make everything committed so far durable
+    bool Sync();
+
+    bool NeedsCompaction() const;
+    // rewrite the file with only the live records
+    bool Compact();
+
+    uint64 GetFileSize() const;
+    unsigned int GetRecordCount() const;
+};
+
+#endif // BITCOIN_WALLETLOG_H